@@ -12,6 +12,9 @@ typedef struct {
     size_t input_size;
 } thread_args;
 
+/* Readers open the file before it is deleted */
+pthread_barrier_t opened;
+
 void successful_test() {
     printf("\033[0;32m");
     printf("Successful test\n");
@@ -26,7 +29,9 @@ void* thread_read(void* arg) {
     char *input = args->input;
     assert(fd != -1);
     char output[input_size];
+    pthread_barrier_wait(&opened);
 
+    /* The file's contents are still there after it is deleted */
     for (int i = 0; i < COUNT; i++) {
         assert(tfs_read(fd, output, input_size) == input_size);
         assert(memcmp(input, output, input_size) == 0);
@@ -38,14 +43,12 @@ void* thread_read(void* arg) {
 
 void* thread_delete(void *arg) {
     thread_args *args = (thread_args *) arg;
-    int fd = tfs_open(args->path, 0);   //Get file handle
-    assert(fd != -1);
+    pthread_barrier_wait(&opened);
 
-    open_file_entry_t *file = get_open_file_entry(fd);
-    assert(file != NULL);
-
-    int inumber = file->of_inumber;
-    assert(inode_delete(inumber) != -1);
+    assert(tfs_unlink(args->path) != -1);
+    assert(tfs_lookup(args->path) == -1);
+    assert(tfs_open(args->path, 0) == -1);
+    assert(tfs_unlink(args->path) == -1);
 
     pthread_exit(NULL);
 }
@@ -58,6 +61,7 @@ int main() {
     size_t input_size = strlen(input);
 
     assert(tfs_init() != -1);
+    int free_memory = get_free_memory(tfs_default());
 
     /* Write input COUNT times into a new file */
     int fd = tfs_open(path, TFS_O_CREAT);
@@ -67,6 +71,7 @@ int main() {
     }
     assert(tfs_close(fd) != -1);
     pthread_t threads[LOOP_SIZE];
+    pthread_barrier_init(&opened, NULL, LOOP_SIZE);
 
     thread_args args;
     args.path = path;
@@ -85,6 +90,12 @@ int main() {
     for (int i = 0; i < LOOP_SIZE; i++) {
         pthread_join(threads[i], NULL);
     }
+    pthread_barrier_destroy(&opened);
+
+    /* Once the last handle is closed, the file's blocks are freed */
+    assert(tfs_open(path, 0) == -1);
+    assert(get_free_memory(tfs_default()) == free_memory);
+    assert(tfs_destroy() != -1);
 
     successful_test();
     return 0;
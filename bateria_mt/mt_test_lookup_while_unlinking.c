@@ -0,0 +1,85 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+#define COUNT 200
+#define READERS 6
+#define WRITERS 4
+
+/**
+   Opens READERS threads looking up a few files over and over, while
+   WRITERS threads keep creating and deleting other files in the same
+   directories (so their entries are removed and reused)
+ */
+
+typedef struct {
+    const char *path;
+    int inumber;
+} lookup_target;
+
+lookup_target targets[] = {{"/stable", -1}, {"/d/stable", -1}};
+
+void successful_test() {
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+}
+
+void* thread_lookup(void* arg) {
+    (void) arg;
+    for (int i = 0; i < COUNT * 10; i++) {
+        for (size_t j = 0; j < sizeof(targets) / sizeof(targets[0]); j++) {
+            assert(tfs_lookup(targets[j].path) == targets[j].inumber);
+        }
+    }
+    pthread_exit(NULL);
+}
+
+void* thread_churn(void* arg) {
+    int id = *(int *) arg;
+    char path[MAX_PATH_NAME];
+
+    for (int i = 0; i < COUNT; i++) {
+        sprintf(path, i % 2 ? "/d/churn%d" : "/churn%d", id);
+        int fd = tfs_open(path, TFS_O_CREAT);
+        assert(fd != -1);
+        assert(tfs_close(fd) != -1);
+        assert(tfs_lookup(path) != -1);
+        assert(tfs_unlink(path) != -1);
+        assert(tfs_lookup(path) == -1);
+    }
+    pthread_exit(NULL);
+}
+
+
+int main() {
+    assert(tfs_init() != -1);
+    assert(tfs_mkdir("/d") != -1);
+
+    for (size_t j = 0; j < sizeof(targets) / sizeof(targets[0]); j++) {
+        int fd = tfs_open(targets[j].path, TFS_O_CREAT);
+        assert(fd != -1);
+        assert(tfs_close(fd) != -1);
+        targets[j].inumber = tfs_lookup(targets[j].path);
+        assert(targets[j].inumber != -1);
+    }
+
+    pthread_t threads[READERS + WRITERS];
+    int ids[WRITERS];
+    for (int i = 0; i < READERS; i++) {
+        pthread_create(&threads[i], NULL, thread_lookup, NULL);
+    }
+    for (int i = 0; i < WRITERS; i++) {
+        ids[i] = i;
+        pthread_create(&threads[READERS + i], NULL, thread_churn, &ids[i]);
+    }
+
+    for (int i = 0; i < READERS + WRITERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    assert(tfs_destroy() != -1);
+    successful_test();
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS 100
+#define HANDLES 10
+#define ROUNDS 20
+#define FILES 5
+
+/**
+   Runs THREADS threads that each keep HANDLES handles open at the same
+   time, to a few shared files, and then close and reopen them over and
+   over: far more files are open at once than fit in the open file table
+   initially. Handles that were closed must stay invalid, even once their
+   entries are reused.
+ */
+
+char const *paths[FILES] = {"/f0", "/f1", "/f2", "/f3", "/f4"};
+
+void successful_test() {
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+}
+
+void *thread_open(void *arg) {
+    int id = *(int *) arg;
+    int fds[HANDLES];
+    char c;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < HANDLES; i++) {
+            fds[i] = tfs_open(paths[(id + i) % FILES], 0);
+            assert(fds[i] != -1);
+        }
+        for (int i = 0; i < HANDLES; i++) {
+            assert(tfs_read(fds[i], &c, 1) == 1);
+            assert(c == '0' + (id + i) % FILES);
+            assert(tfs_close(fds[i]) != -1);
+            /* Closed handles stay closed */
+            assert(tfs_close(fds[i]) == -1);
+            assert(tfs_read(fds[i], &c, 1) == -1);
+        }
+    }
+    pthread_exit(NULL);
+}
+
+int main() {
+    pthread_t threads[THREADS];
+    int ids[THREADS];
+
+    assert(tfs_init() != -1);
+    for (int i = 0; i < FILES; i++) {
+        char c = (char) ('0' + i);
+        int fd = tfs_open(paths[i], TFS_O_CREAT);
+        assert(fd != -1);
+        assert(tfs_write(fd, &c, 1) == 1);
+        assert(tfs_close(fd) != -1);
+    }
+
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&threads[i], NULL, thread_open, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+
+    assert(tfs_destroy() != -1);
+    successful_test();
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+#define COUNT 100
+#define READERS 6
+#define WRITERS 2
+#define SIZE (3 * BLOCK_SIZE + 100)
+
+/**
+   Opens READERS threads reading a whole file over and over, while
+   WRITERS threads keep overwriting it (one of them truncating it first)
+   with a single repeated character. Every read must see one write or
+   another in full, never a mix of two.
+ */
+
+char path[] = "/f1";
+
+void successful_test() {
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+}
+
+void* thread_read(void* arg) {
+    (void) arg;
+    char buffer[SIZE];
+
+    for (int i = 0; i < COUNT * 5; i++) {
+        int fd = tfs_open(path, 0);
+        assert(fd != -1);
+
+        ssize_t size = tfs_get_file_size(fd);
+        assert(size == 0 || size == SIZE);
+        ssize_t r = tfs_read(fd, buffer, sizeof(buffer));
+        assert(r == 0 || r == SIZE);
+        for (ssize_t j = 1; j < r; j++) {
+            assert(buffer[j] == buffer[0]);
+        }
+
+        assert(tfs_close(fd) != -1);
+    }
+    pthread_exit(NULL);
+}
+
+void* thread_write(void* arg) {
+    int id = *(int *) arg;
+    char buffer[SIZE];
+
+    for (int i = 0; i < COUNT; i++) {
+        memset(buffer, 'A' + (id * COUNT + i) % 26, sizeof(buffer));
+        int fd = tfs_open(path, id == 0 ? TFS_O_TRUNC : 0);
+        assert(fd != -1);
+        assert(tfs_write(fd, buffer, sizeof(buffer)) == SIZE);
+        assert(tfs_close(fd) != -1);
+    }
+    pthread_exit(NULL);
+}
+
+
+int main() {
+    char buffer[SIZE];
+    memset(buffer, 'A', sizeof(buffer));
+
+    assert(tfs_init() != -1);
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, buffer, sizeof(buffer)) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    pthread_t threads[READERS + WRITERS];
+    int ids[WRITERS];
+    for (int i = 0; i < READERS; i++) {
+        pthread_create(&threads[i], NULL, thread_read, NULL);
+    }
+    for (int i = 0; i < WRITERS; i++) {
+        ids[i] = i;
+        pthread_create(&threads[READERS + i], NULL, thread_write, &ids[i]);
+    }
+
+    for (int i = 0; i < READERS + WRITERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* Appending starts at the end of the last full write */
+    fd = tfs_open(path, TFS_O_APPEND);
+    assert(fd != -1);
+    assert(tfs_get_file_size(fd) == SIZE);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == 0);
+    assert(tfs_close(fd) != -1);
+
+    assert(tfs_destroy() != -1);
+    successful_test();
+    return 0;
+}
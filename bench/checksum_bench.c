@@ -0,0 +1,77 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#define FILE_SIZE (256 * BLOCK_SIZE)
+#define ROUNDS 200
+
+/**
+   This benchmark repeatedly overwrites and reads back a large file with
+   each checksum mode, and prints the throughput of every mode along with
+   its overhead relative to running without checksums
+ */
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static char input[FILE_SIZE];
+static char output[FILE_SIZE];
+
+/* Returns the write and read throughputs (in MiB/s) of a given mode */
+static void run(char const *path, checksum_mode_t mode, double *write_mbs, double *read_mbs) {
+    assert(tfs_set_checksum_mode(mode) != -1);
+
+    double start = now();
+    for (int i = 0; i < ROUNDS; i++) {
+        int fd = tfs_open(path, 0);
+        assert(fd != -1);
+        assert(tfs_write(fd, input, FILE_SIZE) == FILE_SIZE);
+        assert(tfs_close(fd) != -1);
+    }
+    double elapsed = now() - start;
+    *write_mbs = (double) FILE_SIZE * ROUNDS / (1024 * 1024) / elapsed;
+
+    start = now();
+    for (int i = 0; i < ROUNDS; i++) {
+        int fd = tfs_open(path, 0);
+        assert(fd != -1);
+        assert(tfs_read(fd, output, FILE_SIZE) == FILE_SIZE);
+        assert(tfs_close(fd) != -1);
+    }
+    elapsed = now() - start;
+    *read_mbs = (double) FILE_SIZE * ROUNDS / (1024 * 1024) / elapsed;
+
+    assert(memcmp(input, output, FILE_SIZE) == 0);
+}
+
+int main() {
+    char *path = "/f1";
+    char const *names[] = {"off", "update", "verify"};
+    checksum_mode_t modes[] = {CHECKSUM_OFF, CHECKSUM_UPDATE, CHECKSUM_VERIFY};
+    double write_mbs[3], read_mbs[3];
+
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        input[i] = (char) ('A' + i % 26);
+    }
+
+    assert(tfs_init() != -1);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, input, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(fd) != -1);
+
+    for (int i = 0; i < 3; i++) {
+        run(path, modes[i], &write_mbs[i], &read_mbs[i]);
+        printf("%-7s write %9.1f MiB/s (overhead %5.1f%%)   read %9.1f MiB/s (overhead %5.1f%%)\n",
+               names[i], write_mbs[i], (1 - write_mbs[i] / write_mbs[0]) * 100, read_mbs[i],
+               (1 - read_mbs[i] / read_mbs[0]) * 100);
+    }
+
+    assert(tfs_destroy() != -1);
+    return 0;
+}
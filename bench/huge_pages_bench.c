@@ -0,0 +1,80 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FILES 12
+#define FILE_BLOCKS 80
+#define FILE_SIZE (FILE_BLOCKS * BLOCK_SIZE)
+#define ROUNDS 20000
+
+/**
+   This benchmark fills a volume with files written a block at a time, in
+   turns, so that consecutive blocks of each file are spread over the whole
+   volume, and then reads whole files picked at random. It does so with the
+   data blocks in regular pages and then in huge pages, and prints the read
+   throughput of both.
+ */
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static char const *page_kind_names[] = {"regular", "transparent huge", "reserved huge"};
+
+static char buffer[FILE_SIZE];
+
+/* Returns the random read throughput (in MiB/s) of a new volume */
+static double run(int huge_pages) {
+    char path[MAX_PATH_NAME];
+    int fds[FILES];
+    char block[BLOCK_SIZE];
+
+    assert(tfs_set_huge_pages(huge_pages) != -1);
+    tfs_t *fs = tfs_mount();
+    assert(fs != NULL);
+    assert(tfs_set_checksum_mode_in(fs, CHECKSUM_OFF) != -1);
+
+    for (int i = 0; i < FILES; i++) {
+        sprintf(path, "/f%d", i);
+        fds[i] = tfs_open_in(fs, path, TFS_O_CREAT);
+        assert(fds[i] != -1);
+    }
+    for (int b = 0; b < FILE_BLOCKS; b++) {
+        for (int i = 0; i < FILES; i++) {
+            memset(block, 'A' + (b + i) % 26, sizeof(block));
+            assert(tfs_write_in(fs, fds[i], block, sizeof(block)) == sizeof(block));
+        }
+    }
+    for (int i = 0; i < FILES; i++) {
+        assert(tfs_close_in(fs, fds[i]) != -1);
+    }
+
+    unsigned int seed = 1;
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        int i = rand_r(&seed) % FILES;
+        sprintf(path, "/f%d", i);
+        int fd = tfs_open_in(fs, path, 0);
+        assert(fd != -1);
+        assert(tfs_read_in(fs, fd, buffer, FILE_SIZE) == FILE_SIZE);
+        assert(buffer[FILE_SIZE - 1] == 'A' + (FILE_BLOCKS - 1 + i) % 26);
+        assert(tfs_close_in(fs, fd) != -1);
+    }
+    double mbs = (double) FILE_SIZE * ROUNDS / (1024 * 1024) / (now() - start);
+
+    printf("%-17s pages: read %9.1f MiB/s\n", page_kind_names[tfs_data_pages_in(fs)], mbs);
+    assert(tfs_unmount(fs) != -1);
+    return mbs;
+}
+
+int main() {
+    double small = run(0);
+    double huge = run(1);
+    printf("huge pages speedup: %.2fx\n", huge / small);
+    return 0;
+}
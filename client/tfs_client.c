@@ -0,0 +1,339 @@
+#define _GNU_SOURCE /* memfd_create */
+#include "tfs_client.h"
+#include "fs/protocol.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Requests are numbered as they are sent; since the server answers them in
+ * order, the thread that sent request n reads the n-th response, once every
+ * earlier one has been read by its own thread.
+ *
+ * Large reads and writes go through a region shared with the server, used
+ * as a ring: each one takes the next free bytes in it, in request order,
+ * and gives them back in the same order once its response arrives.
+ */
+struct tfs_client {
+    int fd;
+    pthread_mutex_t send_mutex;
+    uint64_t next_request; /* protected by send_mutex */
+    pthread_mutex_t receive_mutex;
+    pthread_cond_t receive_turn;
+    uint64_t next_response; /* protected by receive_mutex */
+    bool broken;            /* the connection failed: every request fails */
+    char *shared;           /* NULL if the server did not attach it */
+    uint64_t shared_head;   /* next byte to take (ever), protected by send_mutex */
+    uint64_t shared_tail;   /* first byte still taken, protected by receive_mutex */
+    pthread_cond_t shared_space;
+};
+
+static int send_all(int fd, struct iovec *iov, size_t count) {
+    while (count > 0) {
+        struct msghdr message = {.msg_iov = iov, .msg_iovlen = count};
+        ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return -1;
+        }
+        /* Skip what was sent */
+        size_t left = (size_t) sent;
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    return 0;
+}
+
+static int receive_all(int fd, void *buffer, size_t len) {
+    char *next = (char *) buffer;
+    while (len > 0) {
+        ssize_t received = read(fd, next, len);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        next += received;
+        len -= (size_t) received;
+    }
+    return 0;
+}
+
+/* Creates the shared region and has the server attach it, passing the
+ * memfd along with the request; the memfd is sealed, so that neither side
+ * can shrink it under the other
+ * Returns 0 if successful, -1 otherwise */
+static int attach_shared(tfs_client_t *client) {
+    int fd = memfd_create("tfs_client", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        return -1;
+    }
+    void *shared = MAP_FAILED;
+    if (ftruncate(fd, CLIENT_SHARED_SIZE) == 0 &&
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0) {
+        shared = mmap(NULL, CLIENT_SHARED_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (shared == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    protocol_request_t request = {.op = PROTOCOL_ATTACH, .length = CLIENT_SHARED_SIZE};
+    protocol_response_t response = {.ret = -1};
+    struct iovec iov = {.iov_base = &request, .iov_len = sizeof(request)};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message = {
+        .msg_iov = &iov, .msg_iovlen = 1, .msg_control = &control, .msg_controllen = sizeof(control)};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    /* Nothing else can be in flight yet */
+    ssize_t sent = sendmsg(client->fd, &message, MSG_NOSIGNAL);
+    close(fd);
+    client->next_request = client->next_response = 1;
+    if (sent != sizeof(request) || receive_all(client->fd, &response, sizeof(response)) == -1) {
+        client->broken = true;
+    }
+    if (response.ret == -1) {
+        munmap(shared, CLIENT_SHARED_SIZE);
+        return -1;
+    }
+    client->shared = (char *) shared;
+    return 0;
+}
+
+tfs_client_t *tfs_connect(char const *socket_path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (socket_path == NULL || strlen(socket_path) >= sizeof(addr.sun_path)) {
+        return NULL;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    tfs_client_t *client = (tfs_client_t *) calloc(1, sizeof(tfs_client_t));
+    if (client == NULL) {
+        return NULL;
+    }
+    client->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (client->fd == -1) {
+        free(client);
+        return NULL;
+    }
+    if (connect(client->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(client->fd);
+        free(client);
+        return NULL;
+    }
+    pthread_mutex_init(&client->send_mutex, NULL);
+    pthread_mutex_init(&client->receive_mutex, NULL);
+    pthread_cond_init(&client->receive_turn, NULL);
+    pthread_cond_init(&client->shared_space, NULL);
+
+    /* Without a shared region, data goes through the socket */
+    attach_shared(client);
+    return client;
+}
+
+int tfs_disconnect(tfs_client_t *client) {
+    if (client == NULL) {
+        return -1;
+    }
+    int ret = close(client->fd);
+    if (client->shared != NULL) {
+        munmap(client->shared, CLIENT_SHARED_SIZE);
+    }
+    pthread_mutex_destroy(&client->send_mutex);
+    pthread_mutex_destroy(&client->receive_mutex);
+    pthread_cond_destroy(&client->receive_turn);
+    pthread_cond_destroy(&client->shared_space);
+    free(client);
+    return ret;
+}
+
+/* Takes room for a transfer in the shared region, waiting for earlier
+ * requests to give it back if need be; must be called with send_mutex held
+ * Returns the end of the room taken (what the request gives back) */
+static uint64_t take_shared(tfs_client_t *client, size_t len, uint32_t *offset) {
+    uint64_t start = client->shared_head;
+    size_t at = (size_t) (start % CLIENT_SHARED_SIZE);
+    /* Transfers never wrap around the end of the region */
+    if (at + len > CLIENT_SHARED_SIZE) {
+        start += CLIENT_SHARED_SIZE - at;
+        at = 0;
+    }
+    uint64_t end = start + len;
+
+    pthread_mutex_lock(&client->receive_mutex);
+    while (end - client->shared_tail > CLIENT_SHARED_SIZE) {
+        pthread_cond_wait(&client->shared_space, &client->receive_mutex);
+    }
+    pthread_mutex_unlock(&client->receive_mutex);
+
+    client->shared_head = end;
+    *offset = (uint32_t) at;
+    return end;
+}
+
+/* Sends a request, made of its header and up to two pieces of payload, and
+ * waits for its response; for reads, the data goes to the reply buffer.
+ * Shared reads and writes take their data through the shared region
+ * instead (for writes, the payload).
+ * Returns what the operation returned, or -1 if the connection failed */
+static int64_t call(tfs_client_t *client, protocol_op_t op, int arg, void const *payload,
+                    size_t payload_len, void const *payload2, size_t payload2_len, void *reply,
+                    size_t reply_len) {
+    bool reads = op == PROTOCOL_READ || op == PROTOCOL_READ_SHARED;
+    bool shared = op == PROTOCOL_READ_SHARED || op == PROTOCOL_WRITE_SHARED;
+    protocol_request_t request = {.op = (uint32_t) op, .arg = arg};
+    request.length = (uint32_t) (reads ? reply_len : payload_len + payload2_len);
+    struct iovec iov[3] = {
+        {.iov_base = &request, .iov_len = sizeof(request)},
+        {.iov_base = (void *) payload, .iov_len = payload_len},
+        {.iov_base = (void *) payload2, .iov_len = payload2_len},
+    };
+    uint64_t shared_end = 0;
+
+    pthread_mutex_lock(&client->send_mutex);
+    if (shared) {
+        shared_end = take_shared(client, request.length, &request.offset);
+        if (op == PROTOCOL_WRITE_SHARED) {
+            memcpy(client->shared + request.offset, payload, payload_len);
+        }
+    }
+    uint64_t ticket = client->next_request++;
+    bool sent = send_all(client->fd, iov, shared ? 1 : 3) == 0;
+    pthread_mutex_unlock(&client->send_mutex);
+
+    pthread_mutex_lock(&client->receive_mutex);
+    while (client->next_response != ticket) {
+        pthread_cond_wait(&client->receive_turn, &client->receive_mutex);
+    }
+    client->broken = client->broken || !sent;
+    bool broken = client->broken;
+    pthread_mutex_unlock(&client->receive_mutex);
+
+    /* Only this thread reads from the socket until it passes the turn on */
+    protocol_response_t response = {.ret = -1};
+    if (!broken) {
+        if (receive_all(client->fd, &response, sizeof(response)) == -1 ||
+            (reads && response.ret > (int64_t) reply_len) ||
+            (op == PROTOCOL_READ && response.ret > 0 &&
+             receive_all(client->fd, reply, (size_t) response.ret) == -1)) {
+            broken = true;
+            response.ret = -1;
+        }
+    }
+    if (op == PROTOCOL_READ_SHARED && response.ret > 0) {
+        memcpy(reply, client->shared + request.offset, (size_t) response.ret);
+    }
+
+    pthread_mutex_lock(&client->receive_mutex);
+    client->broken = client->broken || broken;
+    client->next_response++;
+    if (shared) {
+        client->shared_tail = shared_end;
+        pthread_cond_broadcast(&client->shared_space);
+    }
+    pthread_cond_broadcast(&client->receive_turn);
+    pthread_mutex_unlock(&client->receive_mutex);
+    return response.ret;
+}
+
+/* Sends a request whose payload is a path name */
+static int call_with_name(tfs_client_t *client, protocol_op_t op, int arg, char const *name) {
+    if (client == NULL || name == NULL || strlen(name) >= MAX_PATH_NAME) {
+        return -1;
+    }
+    return (int) call(client, op, arg, name, strlen(name) + 1, NULL, 0, NULL, 0);
+}
+
+int tfs_client_lookup(tfs_client_t *client, char const *name) {
+    return call_with_name(client, PROTOCOL_LOOKUP, 0, name);
+}
+
+int tfs_client_open(tfs_client_t *client, char const *name, int flags) {
+    return call_with_name(client, PROTOCOL_OPEN, flags, name);
+}
+
+int tfs_client_mkdir(tfs_client_t *client, char const *name) {
+    return call_with_name(client, PROTOCOL_MKDIR, 0, name);
+}
+
+int tfs_client_unlink(tfs_client_t *client, char const *name) {
+    return call_with_name(client, PROTOCOL_UNLINK, 0, name);
+}
+
+int tfs_client_close(tfs_client_t *client, int fhandle) {
+    if (client == NULL) {
+        return -1;
+    }
+    return (int) call(client, PROTOCOL_CLOSE, fhandle, NULL, 0, NULL, 0, NULL, 0);
+}
+
+ssize_t tfs_client_write(tfs_client_t *client, int fhandle, void const *buffer, size_t len) {
+    if (client == NULL) {
+        return -1;
+    }
+    if (len > PROTOCOL_MAX_PAYLOAD) {
+        len = PROTOCOL_MAX_PAYLOAD;
+    }
+    if (client->shared != NULL && len >= CLIENT_SHARED_MIN && len <= CLIENT_SHARED_SIZE) {
+        return (ssize_t) call(client, PROTOCOL_WRITE_SHARED, fhandle, buffer, len, NULL, 0, NULL,
+                              0);
+    }
+    return (ssize_t) call(client, PROTOCOL_WRITE, fhandle, buffer, len, NULL, 0, NULL, 0);
+}
+
+ssize_t tfs_client_read(tfs_client_t *client, int fhandle, void *buffer, size_t len) {
+    if (client == NULL) {
+        return -1;
+    }
+    if (len > PROTOCOL_MAX_PAYLOAD) {
+        len = PROTOCOL_MAX_PAYLOAD;
+    }
+    if (client->shared != NULL && len >= CLIENT_SHARED_MIN && len <= CLIENT_SHARED_SIZE) {
+        return (ssize_t) call(client, PROTOCOL_READ_SHARED, fhandle, NULL, 0, NULL, 0, buffer,
+                              len);
+    }
+    return (ssize_t) call(client, PROTOCOL_READ, fhandle, NULL, 0, NULL, 0, buffer, len);
+}
+
+ssize_t tfs_client_get_file_size(tfs_client_t *client, int fhandle) {
+    if (client == NULL) {
+        return -1;
+    }
+    return (ssize_t) call(client, PROTOCOL_SIZE, fhandle, NULL, 0, NULL, 0, NULL, 0);
+}
+
+int tfs_client_clone(tfs_client_t *client, char const *source_path, char const *dest_path) {
+    if (client == NULL || source_path == NULL || dest_path == NULL ||
+        strlen(source_path) >= MAX_PATH_NAME || strlen(dest_path) >= MAX_PATH_NAME) {
+        return -1;
+    }
+    return (int) call(client, PROTOCOL_CLONE, 0, source_path, strlen(source_path) + 1, dest_path,
+                      strlen(dest_path) + 1, NULL, 0);
+}
@@ -0,0 +1,47 @@
+#ifndef TFS_CLIENT_H
+#define TFS_CLIENT_H
+
+#include "fs/operations.h"
+#include <sys/types.h>
+
+/*
+ * Client of tfs_server: the same operations as fs/operations.h, on the
+ * server's volume, from any process. A connection may be shared by several
+ * threads, whose requests are then pipelined (each thread waits only for
+ * its own response). File handles belong to the connection that opened
+ * them, and are closed by the server when it goes away. Large reads and
+ * writes (of at least CLIENT_SHARED_MIN bytes) take their data through
+ * memory shared with the server, rather than through the socket.
+ */
+
+typedef struct tfs_client tfs_client_t;
+
+/*
+ * Connects to a server
+ * Input:
+ *  - path name of the server's socket
+ * Returns the connection if successful, NULL otherwise.
+ */
+tfs_client_t *tfs_connect(char const *socket_path);
+
+/*
+ * Closes a connection (no operation on it may be in progress)
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_disconnect(tfs_client_t *client);
+
+/*
+ * Each of these behaves as its counterpart in fs/operations.h. Reads and
+ * writes of more than PROTOCOL_MAX_PAYLOAD bytes are cut short.
+ */
+int tfs_client_lookup(tfs_client_t *client, char const *name);
+int tfs_client_open(tfs_client_t *client, char const *name, int flags);
+int tfs_client_mkdir(tfs_client_t *client, char const *name);
+int tfs_client_unlink(tfs_client_t *client, char const *name);
+int tfs_client_close(tfs_client_t *client, int fhandle);
+ssize_t tfs_client_write(tfs_client_t *client, int fhandle, void const *buffer, size_t len);
+ssize_t tfs_client_read(tfs_client_t *client, int fhandle, void *buffer, size_t len);
+ssize_t tfs_client_get_file_size(tfs_client_t *client, int fhandle);
+int tfs_client_clone(tfs_client_t *client, char const *source_path, char const *dest_path);
+
+#endif // TFS_CLIENT_H
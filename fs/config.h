@@ -7,9 +7,64 @@
 #define BLOCK_SIZE (1024)
 #define DATA_BLOCKS (1024)
 #define INODE_TABLE_SIZE (50)
-#define MAX_OPEN_FILES (20)
 #define MAX_FILE_NAME (40)
+#define MAX_PATH_NAME (256)
 
 #define DELAY (5000)
 
+/* Copies of at least this many bytes bypass the cache (non-temporal stores) */
+#define NT_COPY_THRESHOLD (64 * 1024)
+
+/* Number of blocks compressed together in compressed files */
+#define COMPRESSION_GROUP_BLOCKS (8)
+
+/* Number of entries in the block deduplication index */
+#define DEDUP_TABLE_SIZE (2 * DATA_BLOCKS)
+
+/* Default wait (in microseconds) for more journal records before a flush */
+#define JOURNAL_COMMIT_INTERVAL_US (1000)
+/* Pending journal records that start a flush without waiting any longer */
+#define JOURNAL_BATCH_MAX (256)
+
+/* Dentry cache geometry: number of buckets, and entries per bucket */
+#define DCACHE_BUCKETS (128)
+#define DCACHE_WAYS (4)
+
+/* Critical sections a thread leaves between attempts to reclaim the
+ * objects it retired (it also does so whenever it retires one) */
+#define EPOCH_COLLECT_INTERVAL (64)
+/* Volumes whose epoch records a thread keeps at hand */
+#define EPOCH_RECORD_CACHE (32)
+
+/* Maximum number of volumes a sharded file system spreads its files over */
+#define MAX_SHARDS (16)
+
+/* Default number of tfs_server workers */
+#define SERVER_WORKERS (4)
+
+/* Size of the memory region each client shares with tfs_server, and the
+ * smallest read or write that goes through it rather than the socket */
+#define CLIENT_SHARED_SIZE (1 << 20)
+#define CLIENT_SHARED_MIN (4 * 1024)
+
+/* The open file table grows by segments of entries (never moving them), up
+ * to MAX_OPEN_FILES; free entries are kept in several lists, each used by
+ * a subset of the threads */
+#define OPEN_FILE_SEGMENT_SIZE (64)
+#define MAX_OPEN_FILES (1 << 16)
+#define OPEN_FILE_FREE_LISTS (16)
+
+/* Largest number of operations of a batch (e.g. files opened by
+ * tfs_open_many in the same directory) that are carried out together */
+#define BATCH_GROUP_SIZE (64)
+
+/* Size of the huge pages a volume's data blocks are kept in, if possible */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* Size of a cache line, which i-nodes are laid out around */
+#define CACHE_LINE_SIZE (64)
+
+/* Lock-free attempts at reading an i-node before waiting for its writer */
+#define INODE_OPTIMISTIC_RETRIES (4)
+
 #endif // CONFIG_H
@@ -0,0 +1,191 @@
+#include "crc32c.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_HW
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY (0x82F63B78u)
+
+/*
+ * The hardware path runs three independent crc32 streams over adjacent
+ * chunks (the instruction has a latency of 3 cycles but a throughput of 1
+ * per cycle) and then merges them, by shifting a crc over LONG or SHORT
+ * zero bytes with the tables below
+ */
+#define CRC32C_LONG (8192)
+#define CRC32C_SHORT (256)
+
+static uint32_t crc32c_table[256];
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static bool crc32c_has_hw = false;
+
+/*
+ * Multiplies a 32x32 matrix by a vector, over GF(2)
+ */
+static uint32_t gf2_matrix_times(uint32_t const *mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, uint32_t const *mat) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+/*
+ * Builds the tables that apply len (a power of two) zero bytes to a crc
+ */
+static void crc32c_zeros(uint32_t zeros[4][256], size_t len) {
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    /* Operator for one zero bit */
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = 1u << (n - 1);
+    }
+    gf2_matrix_square(even, odd); // two zero bits
+    gf2_matrix_square(odd, even); // four zero bits
+
+    /* Keep squaring until len zero bytes are covered */
+    uint32_t *op = odd;
+    do {
+        gf2_matrix_square(even, odd);
+        op = even;
+        len >>= 1;
+        if (len == 0) {
+            break;
+        }
+        gf2_matrix_square(odd, even);
+        op = odd;
+        len >>= 1;
+    } while (len);
+
+    for (uint32_t n = 0; n < 256; n++) {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+static inline uint32_t crc32c_shift(uint32_t const zeros[4][256], uint32_t crc) {
+    return zeros[0][crc & 0xFF] ^ zeros[1][(crc >> 8) & 0xFF] ^ zeros[2][(crc >> 16) & 0xFF] ^
+           zeros[3][crc >> 24];
+}
+
+static void crc32c_setup() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[i] = crc;
+    }
+    crc32c_zeros(crc32c_long, CRC32C_LONG);
+    crc32c_zeros(crc32c_short, CRC32C_SHORT);
+
+#ifdef CRC32C_HW
+    __builtin_cpu_init();
+    crc32c_has_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+/*
+ * Portable fallback, one byte at a time
+ */
+static uint32_t crc32c_sw(uint32_t crc, unsigned char const *p, size_t len) {
+    while (len-- > 0) {
+        crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef CRC32C_HW
+static inline uint64_t load64(unsigned char const *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/*
+ * Uses the SSE4.2 crc32 instruction, on three interleaved streams. The
+ * function is compiled for SSE4.2 regardless of the global flags and is only
+ * called after checking, at run time, that the CPU supports it.
+ */
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hw(uint32_t crc, unsigned char const *p, size_t len) {
+    uint64_t crc0 = crc;
+
+    while (len >= CRC32C_LONG * 3) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        unsigned char const *end = p + CRC32C_LONG;
+        do {
+            crc0 = _mm_crc32_u64(crc0, load64(p));
+            crc1 = _mm_crc32_u64(crc1, load64(p + CRC32C_LONG));
+            crc2 = _mm_crc32_u64(crc2, load64(p + CRC32C_LONG * 2));
+            p += sizeof(uint64_t);
+        } while (p < end);
+        crc0 = crc32c_shift(crc32c_long, (uint32_t) crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_long, (uint32_t) crc0) ^ crc2;
+        p += CRC32C_LONG * 2;
+        len -= CRC32C_LONG * 3;
+    }
+
+    while (len >= CRC32C_SHORT * 3) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        unsigned char const *end = p + CRC32C_SHORT;
+        do {
+            crc0 = _mm_crc32_u64(crc0, load64(p));
+            crc1 = _mm_crc32_u64(crc1, load64(p + CRC32C_SHORT));
+            crc2 = _mm_crc32_u64(crc2, load64(p + CRC32C_SHORT * 2));
+            p += sizeof(uint64_t);
+        } while (p < end);
+        crc0 = crc32c_shift(crc32c_short, (uint32_t) crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_short, (uint32_t) crc0) ^ crc2;
+        p += CRC32C_SHORT * 2;
+        len -= CRC32C_SHORT * 3;
+    }
+
+    while (len >= sizeof(uint64_t)) {
+        crc0 = _mm_crc32_u64(crc0, load64(p));
+        p += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+
+    crc = (uint32_t) crc0;
+    while (len-- > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c(void const *data, size_t len) {
+    pthread_once(&crc32c_once, crc32c_setup);
+
+#ifdef CRC32C_HW
+    if (crc32c_has_hw) {
+        return ~crc32c_hw(~0u, data, len);
+    }
+#endif
+    return ~crc32c_sw(~0u, data, len);
+}
@@ -0,0 +1,16 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Computes the CRC32C (Castagnoli) checksum of a buffer
+ * Input:
+ *  - data: pointer to the first byte
+ *  - len: number of bytes
+ * Returns: the checksum
+ */
+uint32_t crc32c(void const *data, size_t len);
+
+#endif // CRC32C_H
@@ -0,0 +1,169 @@
+#include "dcache.h"
+#include "crc32c.h"
+#include "epoch.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Cached path name; only its inumber is ever modified in place */
+typedef struct {
+    _Atomic int inumber;
+    char path[];
+} dcache_node_t;
+
+/* Lookups read a bucket's entries without locking it: entries are
+ * published with release stores, and replaced ones are freed through
+ * epoch_retire, once no lookup can be reading them */
+typedef struct {
+    pthread_mutex_t lock; /* serializes updates */
+    _Atomic uint64_t generation;
+    unsigned int next_victim;
+    _Atomic(dcache_node_t *) entries[DCACHE_WAYS];
+} dcache_bucket_t;
+
+struct dcache {
+    epoch_domain_t *epoch; /* the volume's */
+    dcache_bucket_t buckets[DCACHE_BUCKETS];
+};
+
+static dcache_bucket_t *bucket_of(dcache_t *dcache, char const *path, size_t len) {
+    return &dcache->buckets[crc32c(path, len) % DCACHE_BUCKETS];
+}
+
+/*
+ * Stores a path's entry in its bucket (whose lock must be held), updating
+ * the path's entry or, failing that, replacing the bucket's entries in turn
+ */
+static void bucket_store(dcache_t *dcache, dcache_bucket_t *bucket, char const *path, size_t len,
+                         int inumber) {
+    for (size_t i = 0; i < DCACHE_WAYS; i++) {
+        dcache_node_t *node = atomic_load_explicit(&bucket->entries[i], memory_order_relaxed);
+        if (node != NULL && strcmp(node->path, path) == 0) {
+            atomic_store_explicit(&node->inumber, inumber, memory_order_release);
+            return;
+        }
+    }
+
+    dcache_node_t *node = (dcache_node_t *) malloc(sizeof(dcache_node_t) + len + 1);
+    if (node == NULL) {
+        return;
+    }
+    atomic_init(&node->inumber, inumber);
+    memcpy(node->path, path, len + 1);
+
+    dcache_node_t *old = atomic_exchange_explicit(&bucket->entries[bucket->next_victim], node,
+                                                  memory_order_acq_rel);
+    bucket->next_victim = (bucket->next_victim + 1) % DCACHE_WAYS;
+    if (old != NULL) {
+        epoch_retire(dcache->epoch, free, old);
+    }
+}
+
+/*
+ * Creates an empty dentry cache
+ * Input:
+ *  - epoch: the epoch domain lookups run in
+ * Returns: the cache if successful, NULL otherwise
+ */
+dcache_t *dcache_create(epoch_domain_t *epoch) {
+    dcache_t *dcache = (dcache_t *) malloc(sizeof(dcache_t));
+    if (dcache == NULL) {
+        return NULL;
+    }
+    dcache->epoch = epoch;
+
+    for (size_t i = 0; i < DCACHE_BUCKETS; i++) {
+        dcache_bucket_t *bucket = &dcache->buckets[i];
+        pthread_mutex_init(&bucket->lock, NULL);
+        atomic_init(&bucket->generation, 0);
+        bucket->next_victim = 0;
+        for (size_t j = 0; j < DCACHE_WAYS; j++) {
+            atomic_init(&bucket->entries[j], NULL);
+        }
+    }
+    return dcache;
+}
+
+/*
+ * Destroys a dentry cache (no lookup may still be reading it)
+ * Input:
+ *  - dcache: the cache
+ */
+void dcache_destroy(dcache_t *dcache) {
+    for (size_t i = 0; i < DCACHE_BUCKETS; i++) {
+        dcache_bucket_t *bucket = &dcache->buckets[i];
+        for (size_t j = 0; j < DCACHE_WAYS; j++) {
+            free(atomic_load(&bucket->entries[j]));
+        }
+        pthread_mutex_destroy(&bucket->lock);
+    }
+    free(dcache);
+}
+
+/*
+ * Looks for a path name in the dentry cache, without taking any lock
+ * Input:
+ *  - dcache: the cache
+ *  - path: path name
+ *  - inumber: where to store the path's i-node number (-1 if it is known
+ *    not to exist)
+ *  - generation: where to store the generation to pass to dcache_insert
+ *    (on a miss)
+ * Returns: true if the path is cached, false otherwise
+ */
+bool dcache_lookup(dcache_t *dcache, char const *path, int *inumber, uint64_t *generation) {
+    size_t len = strlen(path);
+    dcache_bucket_t *bucket = bucket_of(dcache, path, len);
+    bool found = false;
+
+    epoch_enter(dcache->epoch);
+    *generation = atomic_load_explicit(&bucket->generation, memory_order_acquire);
+    for (size_t i = 0; i < DCACHE_WAYS && !found; i++) {
+        dcache_node_t *node = atomic_load_explicit(&bucket->entries[i], memory_order_acquire);
+        if (node != NULL && strcmp(node->path, path) == 0) {
+            *inumber = atomic_load_explicit(&node->inumber, memory_order_acquire);
+            found = true;
+        }
+    }
+    epoch_exit(dcache->epoch);
+    return found;
+}
+
+/*
+ * Caches the result of looking up a path name in its directories, unless
+ * the path was created or removed since the lookup missed the cache
+ * Input:
+ *  - dcache: the cache
+ *  - path: path name
+ *  - inumber: its i-node number (-1 if it does not exist)
+ *  - generation: as returned by dcache_lookup
+ */
+void dcache_insert(dcache_t *dcache, char const *path, int inumber, uint64_t generation) {
+    size_t len = strlen(path);
+    dcache_bucket_t *bucket = bucket_of(dcache, path, len);
+
+    pthread_mutex_lock(&bucket->lock);
+    if (atomic_load_explicit(&bucket->generation, memory_order_relaxed) == generation) {
+        bucket_store(dcache, bucket, path, len, inumber);
+    }
+    pthread_mutex_unlock(&bucket->lock);
+}
+
+/*
+ * Records that a path name was created or removed
+ * Input:
+ *  - dcache: the cache
+ *  - path: path name
+ *  - inumber: its new i-node number (-1 if it was removed)
+ */
+void dcache_set(dcache_t *dcache, char const *path, int inumber) {
+    size_t len = strlen(path);
+    dcache_bucket_t *bucket = bucket_of(dcache, path, len);
+
+    pthread_mutex_lock(&bucket->lock);
+    atomic_fetch_add_explicit(&bucket->generation, 1, memory_order_release);
+    bucket_store(dcache, bucket, path, len, inumber);
+    pthread_mutex_unlock(&bucket->lock);
+}
@@ -0,0 +1,28 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include "config.h"
+#include "epoch.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Dentry cache: maps path names to i-node numbers, so that repeated
+ * lookups of a path do not walk its directories again. Negative entries
+ * (inumber -1) remember path names that do not exist.
+ *
+ * The cache is a set-associative hash table. Lookups take no locks;
+ * updates lock the bucket, and bump its generation number whenever one of
+ * its paths is created or removed. A lookup that misses returns the generation, and the result of
+ * the directory walk is only cached if the generation is still the same.
+ */
+
+typedef struct dcache dcache_t;
+
+dcache_t *dcache_create(epoch_domain_t *epoch);
+void dcache_destroy(dcache_t *dcache);
+bool dcache_lookup(dcache_t *dcache, char const *path, int *inumber, uint64_t *generation);
+void dcache_insert(dcache_t *dcache, char const *path, int inumber, uint64_t generation);
+void dcache_set(dcache_t *dcache, char const *path, int inumber);
+
+#endif // DCACHE_H
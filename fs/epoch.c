@@ -0,0 +1,307 @@
+#include "epoch.h"
+#include "config.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Retired object, waiting for two epochs to go by */
+typedef struct retired {
+    void (*reclaim)(void *arg);
+    void *arg;
+    uint64_t epoch;
+    struct retired *next;
+} retired_t;
+
+/* Per-thread record in a domain: the domain's epoch observed on entering a
+ * critical section (shifted left by one), with the low bit set while
+ * inside it, and the objects the thread retired. Only its thread touches
+ * the limbo list, except for epoch_synchronize, so the lock guarding it is
+ * uncontended. */
+typedef struct epoch_record {
+    _Atomic uint64_t state;
+    _Atomic uint64_t owner; /* the owning thread's id, 0 if free */
+    unsigned int nesting;   /* by its thread only */
+    unsigned int exits;     /* since the last collection (by its thread only) */
+    pthread_mutex_t limbo_lock;
+    retired_t *limbo;
+    atomic_size_t limbo_count;
+    struct epoch_record *next;
+} epoch_record_t;
+
+struct epoch_domain {
+    uint64_t id; /* never reused, unlike the domain's address */
+    _Atomic uint64_t global_epoch;
+    /* Records are only freed with the domain; those of finished threads are
+     * reused */
+    _Atomic(epoch_record_t *) records;
+    struct epoch_domain *next; /* in the list of live domains */
+};
+
+/* Live domains, for finished threads to give their records back */
+static pthread_mutex_t domains_mutex = PTHREAD_MUTEX_INITIALIZER;
+static epoch_domain_t *domains = NULL;
+static atomic_uint_least64_t next_domain_id = 1;
+
+static atomic_uint_least64_t next_thread_id = 1;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static _Thread_local uint64_t thread_id = 0;
+/* The calling thread's records in the domains it used last */
+static _Thread_local struct {
+    uint64_t domain_id;
+    epoch_record_t *record;
+} record_cache[EPOCH_RECORD_CACHE];
+
+/* Gives a finished thread's records back; they keep the objects it
+ * retired, for the next thread that takes them (or epoch_synchronize) to
+ * reclaim */
+static void release_records(void *id) {
+    pthread_mutex_lock(&domains_mutex);
+    for (epoch_domain_t *domain = domains; domain != NULL; domain = domain->next) {
+        for (epoch_record_t *record = atomic_load(&domain->records); record != NULL;
+             record = record->next) {
+            if (atomic_load(&record->owner) == (uint64_t) (uintptr_t) id) {
+                atomic_store(&record->state, 0);
+                record->nesting = 0;
+                atomic_store(&record->owner, 0);
+            }
+        }
+    }
+    pthread_mutex_unlock(&domains_mutex);
+}
+
+static void create_thread_key() { pthread_key_create(&thread_key, release_records); }
+
+/*
+ * Returns the calling thread's record in a domain, taking a free one (or a
+ * new one) the first time
+ */
+static epoch_record_t *get_record(epoch_domain_t *domain) {
+    size_t slot = domain->id % EPOCH_RECORD_CACHE;
+    if (record_cache[slot].domain_id == domain->id) {
+        return record_cache[slot].record;
+    }
+
+    if (thread_id == 0) {
+        pthread_once(&thread_key_once, create_thread_key);
+        thread_id = atomic_fetch_add(&next_thread_id, 1);
+        pthread_setspecific(thread_key, (void *) (uintptr_t) thread_id);
+    }
+
+    /* The thread's own record, if it has one already, else a free one */
+    epoch_record_t *record;
+    for (record = atomic_load(&domain->records); record != NULL; record = record->next) {
+        if (atomic_load(&record->owner) == thread_id) {
+            break;
+        }
+    }
+    for (epoch_record_t *free_record = atomic_load(&domain->records);
+         record == NULL && free_record != NULL; free_record = free_record->next) {
+        uint64_t owner = 0;
+        if (atomic_compare_exchange_strong(&free_record->owner, &owner, thread_id)) {
+            record = free_record;
+        }
+    }
+    if (record == NULL) {
+        record = (epoch_record_t *) malloc(sizeof(epoch_record_t));
+        if (record == NULL) {
+            abort();
+        }
+        atomic_init(&record->state, 0);
+        atomic_init(&record->owner, thread_id);
+        record->nesting = 0;
+        record->exits = 0;
+        pthread_mutex_init(&record->limbo_lock, NULL);
+        record->limbo = NULL;
+        atomic_init(&record->limbo_count, 0);
+        record->next = atomic_load(&domain->records);
+        while (!atomic_compare_exchange_weak(&domain->records, &record->next, record)) {
+        }
+    }
+
+    record_cache[slot].domain_id = domain->id;
+    record_cache[slot].record = record;
+    return record;
+}
+
+/*
+ * Creates an epoch domain
+ * Returns: the domain if successful, NULL otherwise
+ */
+epoch_domain_t *epoch_domain_create() {
+    epoch_domain_t *domain = (epoch_domain_t *) malloc(sizeof(epoch_domain_t));
+    if (domain == NULL) {
+        return NULL;
+    }
+    domain->id = atomic_fetch_add(&next_domain_id, 1);
+    atomic_init(&domain->global_epoch, 0);
+    atomic_init(&domain->records, NULL);
+
+    pthread_mutex_lock(&domains_mutex);
+    domain->next = domains;
+    domains = domain;
+    pthread_mutex_unlock(&domains_mutex);
+    return domain;
+}
+
+/*
+ * Destroys an epoch domain, reclaiming every object still retired in it
+ * (no thread may be using it anymore)
+ * Input:
+ *  - domain: the domain
+ */
+void epoch_domain_destroy(epoch_domain_t *domain) {
+    pthread_mutex_lock(&domains_mutex);
+    epoch_domain_t **link = &domains;
+    while (*link != domain) {
+        link = &(*link)->next;
+    }
+    *link = domain->next;
+    pthread_mutex_unlock(&domains_mutex);
+
+    epoch_record_t *record = atomic_load(&domain->records);
+    while (record != NULL) {
+        while (record->limbo != NULL) {
+            retired_t *item = record->limbo;
+            record->limbo = item->next;
+            item->reclaim(item->arg);
+            free(item);
+        }
+        epoch_record_t *next = record->next;
+        pthread_mutex_destroy(&record->limbo_lock);
+        free(record);
+        record = next;
+    }
+    free(domain);
+}
+
+/*
+ * Advances a domain's epoch, if every thread inside one of its critical
+ * sections has observed the current one
+ * Returns: the domain's epoch
+ */
+static uint64_t try_advance(epoch_domain_t *domain) {
+    uint64_t epoch = atomic_load(&domain->global_epoch);
+    for (epoch_record_t *record = atomic_load(&domain->records); record != NULL;
+         record = record->next) {
+        uint64_t state = atomic_load(&record->state);
+        if ((state & 1) && (state >> 1) != epoch) {
+            return epoch;
+        }
+    }
+    /* Fails only if another thread advanced it meanwhile */
+    atomic_compare_exchange_strong(&domain->global_epoch, &epoch, epoch + 1);
+    return atomic_load(&domain->global_epoch);
+}
+
+/*
+ * Reclaims the objects of a limbo list (whose lock must be held) that were
+ * retired two epochs before a given one
+ */
+static void reclaim_limbo(epoch_record_t *record, uint64_t epoch) {
+    retired_t **link = &record->limbo;
+    while (*link != NULL) {
+        retired_t *item = *link;
+        if (item->epoch + 2 <= epoch) {
+            *link = item->next;
+            item->reclaim(item->arg);
+            free(item);
+            atomic_fetch_sub_explicit(&record->limbo_count, 1, memory_order_relaxed);
+        } else {
+            link = &item->next;
+        }
+    }
+}
+
+/*
+ * Reclaims the objects a thread retired that no thread can be accessing
+ * anymore (the limbo lock of its record must be held)
+ */
+static void collect(epoch_domain_t *domain, epoch_record_t *record) {
+    record->exits = 0;
+    uint64_t epoch = try_advance(domain);
+    if (record->limbo != NULL && record->limbo->epoch + 2 > epoch) {
+        epoch = try_advance(domain);
+    }
+    reclaim_limbo(record, epoch);
+}
+
+/*
+ * Enters a critical section of a domain (which may be nested)
+ */
+void epoch_enter(epoch_domain_t *domain) {
+    epoch_record_t *record = get_record(domain);
+    if (record->nesting++ > 0) {
+        return;
+    }
+    atomic_store(&record->state, (atomic_load(&domain->global_epoch) << 1) | 1);
+}
+
+/*
+ * Leaves a critical section of a domain. Every EPOCH_COLLECT_INTERVAL
+ * exits, a thread that has retired objects tries to reclaim them; exits
+ * touch nothing shared with other threads otherwise.
+ */
+void epoch_exit(epoch_domain_t *domain) {
+    epoch_record_t *record = get_record(domain);
+    if (--record->nesting > 0) {
+        return;
+    }
+    atomic_store(&record->state, 0);
+    if (++record->exits < EPOCH_COLLECT_INTERVAL ||
+        atomic_load_explicit(&record->limbo_count, memory_order_relaxed) == 0) {
+        return;
+    }
+    if (pthread_mutex_trylock(&record->limbo_lock) == 0) {
+        collect(domain, record);
+        pthread_mutex_unlock(&record->limbo_lock);
+    }
+}
+
+/*
+ * Retires an object: reclaim(arg) is called once no thread can be
+ * accessing it anymore (possibly right away, by the calling thread)
+ * Input:
+ *  - domain: the domain the object can be reached in
+ *  - reclaim: function that frees the object
+ *  - arg: its argument
+ */
+void epoch_retire(epoch_domain_t *domain, void (*reclaim)(void *arg), void *arg) {
+    retired_t *item = (retired_t *) malloc(sizeof(retired_t));
+    if (item == NULL) {
+        abort();
+    }
+    item->reclaim = reclaim;
+    item->arg = arg;
+
+    epoch_record_t *record = get_record(domain);
+    pthread_mutex_lock(&record->limbo_lock);
+    item->epoch = atomic_load(&domain->global_epoch);
+    item->next = record->limbo;
+    record->limbo = item;
+    atomic_fetch_add_explicit(&record->limbo_count, 1, memory_order_relaxed);
+    collect(domain, record);
+    pthread_mutex_unlock(&record->limbo_lock);
+}
+
+/*
+ * Waits until every object retired so far in a domain, by any thread, has
+ * been reclaimed (the calling thread must not be inside one of its critical
+ * sections)
+ */
+void epoch_synchronize(epoch_domain_t *domain) {
+    uint64_t target = atomic_load(&domain->global_epoch) + 2;
+    while (try_advance(domain) < target) {
+        sched_yield();
+    }
+    for (epoch_record_t *record = atomic_load(&domain->records); record != NULL;
+         record = record->next) {
+        pthread_mutex_lock(&record->limbo_lock);
+        reclaim_limbo(record, target);
+        pthread_mutex_unlock(&record->limbo_lock);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/*
+ * Epoch-based reclamation. Threads that may reach an object through shared
+ * state (e.g. an i-node through a directory entry) do so between
+ * epoch_enter and epoch_exit. An object removed from shared state is
+ * retired, and only reclaimed once every thread that could still be
+ * accessing it has left its critical section; neither side ever waits for
+ * the other.
+ *
+ * Each volume has a domain of its own: its epoch, thread records and
+ * retired objects are apart from every other volume's, so that volumes
+ * neither wait for nor reclaim each other's objects.
+ */
+
+typedef struct epoch_domain epoch_domain_t;
+
+epoch_domain_t *epoch_domain_create();
+void epoch_domain_destroy(epoch_domain_t *domain);
+void epoch_enter(epoch_domain_t *domain);
+void epoch_exit(epoch_domain_t *domain);
+void epoch_retire(epoch_domain_t *domain, void (*reclaim)(void *arg), void *arg);
+void epoch_synchronize(epoch_domain_t *domain);
+
+#endif // EPOCH_H
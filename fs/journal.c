@@ -0,0 +1,631 @@
+#include "journal.h"
+#include "crc32c.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct journal {
+    pthread_mutex_t mutex;
+    /* Signalled when records are appended (or the journal is closing) */
+    pthread_cond_t work;
+    /* Signalled when a batch becomes durable */
+    pthread_cond_t durable;
+    pthread_t flusher;
+
+    uint64_t id;
+    bool stopping;
+    bool failed;
+    int fd;
+    unsigned int interval_us;
+
+    /* Records of committed transactions not flushed yet, in the order
+     * they committed in */
+    journal_record_t *pending;
+    size_t pending_count;
+    size_t pending_capacity;
+
+    /* Transactions open, in the order they began in */
+    struct transaction *first_open;
+    struct transaction *last_open;
+
+    _Atomic uint64_t next_lsn;
+    uint64_t durable_lsn; /* every transaction committed before it is flushed */
+    uint64_t flushed_records;
+    uint64_t flushes;
+};
+
+/* Journals are told apart by an id that is never reused, unlike their
+ * addresses */
+static _Atomic uint64_t next_journal_id = 1;
+
+/* Commit record of the last transaction committed by the calling thread,
+ * and the journal it went to */
+static _Thread_local uint64_t thread_journal = 0;
+static _Thread_local uint64_t thread_commit = 0;
+
+/* A transaction open in the calling thread: its records are kept here
+ * until it commits. Nested transactions join the innermost one, whose
+ * journal they must use; records for other journals are committed on
+ * their own. */
+typedef struct transaction {
+    uint64_t journal; /* id of the journal, 0 if none is open */
+    unsigned int depth;
+    bool failed;
+    journal_record_t *records;
+    size_t count;
+    size_t capacity;
+    uint64_t begin; /* lsn of its begin record */
+    /* In the journal's list of open transactions */
+    struct transaction *prev;
+    struct transaction *next;
+} transaction_t;
+
+/* Transactions open in the calling thread, the innermost one last (see
+ * journal_begin_apart) */
+#define JOURNAL_NESTING (2)
+static _Thread_local transaction_t transactions[JOURNAL_NESTING];
+static _Thread_local unsigned int nesting = 0;
+
+/* Frees the transaction buffers of finished threads */
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t buffer_key;
+
+static void free_buffers(void *arg) {
+    transaction_t *thread_transactions = (transaction_t *) arg;
+    for (int i = 0; i < JOURNAL_NESTING; i++) {
+        free(thread_transactions[i].records);
+    }
+}
+
+static void create_buffer_key() { pthread_key_create(&buffer_key, free_buffers); }
+
+static uint32_t record_crc(journal_record_t const *record) {
+    return crc32c(record, offsetof(journal_record_t, crc));
+}
+
+/*
+ * Fills in a record, numbering it after every record logged before
+ */
+static void record_init(journal_t *journal, journal_record_t *record, journal_record_type_t type,
+                        int inumber, int64_t arg1, int64_t arg2, char const *name) {
+    memset(record, 0, sizeof(*record));
+    record->lsn = atomic_fetch_add(&journal->next_lsn, 1);
+    record->type = (uint32_t) type;
+    record->inumber = inumber;
+    record->arg1 = arg1;
+    record->arg2 = arg2;
+    if (name != NULL) {
+        strncpy(record->name, name, MAX_FILE_NAME - 1);
+    }
+    record->crc = record_crc(record);
+}
+
+/*
+ * Adds a record to one of the calling thread's open transactions
+ */
+static void transaction_add(transaction_t *transaction, journal_record_t const *record) {
+    if (transaction->count == transaction->capacity) {
+        size_t capacity = transaction->capacity == 0 ? 64 : transaction->capacity * 2;
+        journal_record_t *records = (journal_record_t *) realloc(
+            transaction->records, sizeof(journal_record_t) * capacity);
+        if (records == NULL) {
+            transaction->failed = true;
+            return;
+        }
+        pthread_once(&buffer_key_once, create_buffer_key);
+        pthread_setspecific(buffer_key, transactions);
+        transaction->records = records;
+        transaction->capacity = capacity;
+    }
+    transaction->records[transaction->count++] = *record;
+}
+
+/*
+ * Takes a transaction off a journal's list of open transactions (with the
+ * journal's mutex held); a flush may now take what committed after it began
+ */
+static void transaction_close(journal_t *journal, transaction_t *transaction) {
+    if (transaction->prev == NULL) {
+        journal->first_open = transaction->next;
+        pthread_cond_signal(&journal->work);
+    } else {
+        transaction->prev->next = transaction->next;
+    }
+    if (transaction->next == NULL) {
+        journal->last_open = transaction->prev;
+    } else {
+        transaction->next->prev = transaction->prev;
+    }
+    transaction->prev = NULL;
+    transaction->next = NULL;
+}
+
+/*
+ * Appends the records of a transaction to a journal, for a later flush,
+ * followed by its commit record (numbered here, so that transactions are
+ * pending in the order of their commit records)
+ * Input:
+ *  - transaction: the transaction, if it was open (NULL otherwise)
+ *  - records: the transaction's records, from its begin record on
+ *  - count: number of records (none, if the transaction is dropped)
+ */
+static void journal_append(journal_t *journal, transaction_t *transaction,
+                           journal_record_t const *records, size_t count) {
+    pthread_mutex_lock(&journal->mutex);
+    if (transaction != NULL) {
+        transaction_close(journal, transaction);
+    }
+    if (journal->stopping || count == 0) {
+        pthread_mutex_unlock(&journal->mutex);
+        return;
+    }
+    count++;
+    if (journal->pending_count + count > journal->pending_capacity) {
+        size_t capacity = journal->pending_capacity == 0 ? 64 : journal->pending_capacity;
+        while (capacity < journal->pending_count + count) {
+            capacity *= 2;
+        }
+        journal_record_t *pending =
+            (journal_record_t *) realloc(journal->pending, sizeof(journal_record_t) * capacity);
+        if (pending == NULL) {
+            journal->failed = true;
+            pthread_mutex_unlock(&journal->mutex);
+            return;
+        }
+        journal->pending = pending;
+        journal->pending_capacity = capacity;
+    }
+    journal_record_t *commit = &journal->pending[journal->pending_count + count - 1];
+    memcpy(&journal->pending[journal->pending_count], records,
+           sizeof(journal_record_t) * (count - 1));
+    record_init(journal, commit, JOURNAL_TX_COMMIT, -1, 0, 0, NULL);
+    journal->pending_count += count;
+    thread_journal = journal->id;
+    thread_commit = commit->lsn;
+    pthread_cond_signal(&journal->work);
+    pthread_mutex_unlock(&journal->mutex);
+}
+
+/*
+ * Counts the pending records a flush may take (with the journal's mutex
+ * held): those of the transactions that committed before every open
+ * transaction began, as they cannot depend on updates still to be
+ * committed. Later ones wait, so that no transaction becomes durable
+ * before one whose updates it may have seen.
+ * Input:
+ *  - cut: set to the lsn the transactions taken committed before
+ * Returns: the number of records
+ */
+static size_t flushable_records(journal_t *journal, uint64_t *cut) {
+    *cut = journal->first_open != NULL && !journal->stopping
+               ? journal->first_open->begin
+               : atomic_load(&journal->next_lsn);
+    for (size_t i = journal->pending_count; i > 0; i--) {
+        journal_record_t const *record = &journal->pending[i - 1];
+        if (record->type == JOURNAL_TX_COMMIT && record->lsn < *cut) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Writes a whole buffer, retrying on partial writes
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int write_all(int fd, void const *buffer, size_t size) {
+    char const *p = buffer;
+    while (size > 0) {
+        ssize_t written = write(fd, p, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += written;
+        size -= (size_t) written;
+    }
+    return 0;
+}
+
+/*
+ * Flusher thread: repeatedly takes every pending record it may (whole
+ * transactions only, see flushable_records), and makes them durable with
+ * one write and one fdatasync. Each flush ends with a flush record: the
+ * transactions of a flush are read back all together or not at all, as
+ * the write may be cut anywhere.
+ */
+static void *journal_flush_loop(void *arg) {
+    journal_t *journal = (journal_t *) arg;
+    journal_record_t *batch = NULL;
+    size_t batch_capacity = 0;
+    uint64_t cut;
+
+    pthread_mutex_lock(&journal->mutex);
+    for (;;) {
+        while (flushable_records(journal, &cut) == 0 && !journal->stopping) {
+            pthread_cond_wait(&journal->work, &journal->mutex);
+        }
+        if (journal->pending_count == 0 && journal->stopping) {
+            break;
+        }
+
+        /* Let concurrent operations join the batch */
+        if (journal->interval_us > 0 && !journal->stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long) journal->interval_us * 1000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            while (!journal->stopping && journal->pending_count < JOURNAL_BATCH_MAX &&
+                   pthread_cond_timedwait(&journal->work, &journal->mutex, &deadline) == 0) {
+            }
+        }
+
+        /* Take the records out, so that appends go on during the flush */
+        size_t count = flushable_records(journal, &cut);
+        if (count + 1 > batch_capacity) {
+            journal_record_t *grown =
+                (journal_record_t *) realloc(batch, sizeof(journal_record_t) * (count + 1));
+            if (grown == NULL) {
+                journal->failed = true;
+                pthread_cond_broadcast(&journal->durable);
+                break;
+            }
+            batch = grown;
+            batch_capacity = count + 1;
+        }
+        memcpy(batch, journal->pending, sizeof(journal_record_t) * count);
+        memmove(journal->pending, journal->pending + count,
+                sizeof(journal_record_t) * (journal->pending_count - count));
+        journal->pending_count -= count;
+        record_init(journal, &batch[count], JOURNAL_FLUSH, -1, 0, 0, NULL);
+        pthread_mutex_unlock(&journal->mutex);
+
+        int ret = write_all(journal->fd, batch, (count + 1) * sizeof(journal_record_t));
+        if (ret == 0) {
+            ret = fdatasync(journal->fd);
+        }
+
+        pthread_mutex_lock(&journal->mutex);
+        if (ret == -1) {
+            journal->failed = true;
+        }
+        journal->durable_lsn = cut;
+        journal->flushed_records += count;
+        journal->flushes++;
+        pthread_cond_broadcast(&journal->durable);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+    free(batch);
+    return NULL;
+}
+
+/*
+ * Reads the records of the transactions committed in a journal file, up to
+ * the end of the last whole flush (stopping at the first torn or corrupted
+ * record)
+ * Input:
+ *  - file: the journal file
+ *  - count: set to the number of records
+ * Returns: the records (flush records left out), in the order they were
+ * written in (NULL if there are none, or if they could not be read)
+ */
+static journal_record_t *read_committed(FILE *file, size_t *count) {
+    journal_record_t *records = NULL;
+    size_t capacity = 0;
+    size_t read = 0;
+    *count = 0;
+
+    journal_record_t record;
+    while (fread(&record, sizeof(record), 1, file) == 1 && record.crc == record_crc(&record)) {
+        if (record.type == JOURNAL_FLUSH) {
+            *count = read;
+            continue;
+        }
+        if (read == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            journal_record_t *grown =
+                (journal_record_t *) realloc(records, sizeof(journal_record_t) * capacity);
+            if (grown == NULL) {
+                free(records);
+                *count = 0;
+                return NULL;
+            }
+            records = grown;
+        }
+        records[read++] = record;
+    }
+    return records;
+}
+
+/*
+ * Starts journaling metadata updates to a file (appending to it, with
+ * records numbered after those already in it)
+ * Input:
+ *  - path: path name of the journal file (in the host file system)
+ *  - commit_interval_us: how long (in microseconds) a flush waits for more
+ *    records before starting; 0 flushes as soon as there is a record
+ * Returns: the journal if successful, NULL otherwise
+ */
+journal_t *journal_open(char const *path, unsigned int commit_interval_us) {
+    journal_t *journal = (journal_t *) calloc(1, sizeof(journal_t));
+    if (journal == NULL) {
+        return NULL;
+    }
+
+    uint64_t last_lsn = 0;
+    FILE *existing = fopen(path, "r");
+    if (existing != NULL) {
+        size_t count;
+        journal_record_t *records = read_committed(existing, &count);
+        for (size_t i = 0; i < count; i++) {
+            last_lsn = records[i].lsn > last_lsn ? records[i].lsn : last_lsn;
+        }
+        free(records);
+        fclose(existing);
+    }
+
+    journal->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (journal->fd == -1) {
+        free(journal);
+        return NULL;
+    }
+    pthread_mutex_init(&journal->mutex, NULL);
+    pthread_cond_init(&journal->work, NULL);
+    pthread_cond_init(&journal->durable, NULL);
+    journal->id = atomic_fetch_add(&next_journal_id, 1);
+    journal->interval_us = commit_interval_us;
+    atomic_init(&journal->next_lsn, last_lsn + 1);
+
+    if (pthread_create(&journal->flusher, NULL, journal_flush_loop, journal) != 0) {
+        close(journal->fd);
+        pthread_cond_destroy(&journal->durable);
+        pthread_cond_destroy(&journal->work);
+        pthread_mutex_destroy(&journal->mutex);
+        free(journal);
+        return NULL;
+    }
+    return journal;
+}
+
+/*
+ * Flushes every pending record, stops journaling and frees the journal
+ * (no other thread may be using it anymore)
+ * Input:
+ *  - journal: the journal
+ * Returns: 0 if successful, -1 otherwise
+ */
+int journal_close(journal_t *journal) {
+    pthread_mutex_lock(&journal->mutex);
+    journal->stopping = true;
+    pthread_cond_signal(&journal->work);
+    pthread_mutex_unlock(&journal->mutex);
+
+    pthread_join(journal->flusher, NULL);
+
+    bool failed = journal->failed;
+    int ret = (close(journal->fd) == -1 || failed) ? -1 : 0;
+    free(journal->pending);
+    pthread_cond_destroy(&journal->durable);
+    pthread_cond_destroy(&journal->work);
+    pthread_mutex_destroy(&journal->mutex);
+    free(journal);
+    return ret;
+}
+
+/*
+ * Appends a record to a journal: to the calling thread's open transaction,
+ * or else as a transaction of its own. The record becomes durable with a
+ * flush after the transaction commits; see journal_sync.
+ * Input:
+ *  - journal: the journal (NULL if metadata updates are not journaled, in
+ *    which case nothing is done)
+ *  - type: kind of update
+ *  - inumber: i-node updated
+ *  - arg1, arg2: type-specific arguments
+ *  - name: entry name (JOURNAL_DIR_ADD and JOURNAL_DIR_REMOVE only, NULL
+ *    otherwise)
+ */
+void journal_log(journal_t *journal, journal_record_type_t type, int inumber, int64_t arg1,
+                 int64_t arg2, char const *name) {
+    if (journal == NULL) {
+        return;
+    }
+
+    transaction_t *transaction = nesting > 0 ? &transactions[nesting - 1] : NULL;
+    if (transaction != NULL && transaction->journal == journal->id) {
+        journal_record_t record;
+        record_init(journal, &record, type, inumber, arg1, arg2, name);
+        transaction_add(transaction, &record);
+        return;
+    }
+
+    journal_record_t records[2];
+    record_init(journal, &records[0], JOURNAL_TX_BEGIN, -1, 0, 0, NULL);
+    record_init(journal, &records[1], type, inumber, arg1, arg2, name);
+    journal_append(journal, NULL, records, 2);
+}
+
+/*
+ * Opens a transaction in one of the calling thread's slots: it is listed
+ * as open before its begin record is numbered, so that no flush takes a
+ * transaction that commits after it began until it commits too
+ */
+static void transaction_open(journal_t *journal, transaction_t *transaction) {
+    transaction->journal = journal->id;
+    transaction->depth = 1;
+    transaction->failed = false;
+    transaction->count = 0;
+
+    journal_record_t record;
+    pthread_mutex_lock(&journal->mutex);
+    record_init(journal, &record, JOURNAL_TX_BEGIN, -1, 0, 0, NULL);
+    transaction->begin = record.lsn;
+    transaction->prev = journal->last_open;
+    transaction->next = NULL;
+    if (journal->last_open == NULL) {
+        journal->first_open = transaction;
+    } else {
+        journal->last_open->next = transaction;
+    }
+    journal->last_open = transaction;
+    pthread_mutex_unlock(&journal->mutex);
+    transaction_add(transaction, &record);
+}
+
+/*
+ * Opens a transaction in the calling thread: the records it logs to the
+ * journal are appended together by the matching journal_commit. Calls may
+ * be nested; only the outermost ones count.
+ * Input:
+ *  - journal: the journal (NULL if metadata updates are not journaled, in
+ *    which case nothing is done)
+ */
+void journal_begin(journal_t *journal) {
+    if (journal == NULL) {
+        return;
+    }
+    if (nesting > 0) {
+        transactions[nesting - 1].depth++;
+        return;
+    }
+    transaction_open(journal, &transactions[nesting++]);
+}
+
+/*
+ * Opens a transaction in the calling thread apart from the one it may
+ * already have open (e.g. for updates made on behalf of other threads):
+ * its records are committed by the matching journal_commit, on their own.
+ * Transactions nested in it join it.
+ * Input:
+ *  - journal: the journal (NULL if metadata updates are not journaled, in
+ *    which case nothing is done)
+ */
+void journal_begin_apart(journal_t *journal) {
+    if (journal == NULL) {
+        return;
+    }
+    if (nesting == JOURNAL_NESTING) {
+        /* Too deep: joins the innermost one instead */
+        transactions[nesting - 1].depth++;
+        return;
+    }
+    transaction_open(journal, &transactions[nesting++]);
+}
+
+/*
+ * Commits the calling thread's innermost transaction, opened by
+ * journal_begin or journal_begin_apart, unless it is nested in another
+ * one. A transaction without records is dropped.
+ * Input:
+ *  - journal: the journal given to journal_begin
+ */
+void journal_commit(journal_t *journal) {
+    if (journal == NULL || nesting == 0) {
+        return;
+    }
+    transaction_t *transaction = &transactions[nesting - 1];
+    if (--transaction->depth > 0) {
+        return;
+    }
+
+    nesting--;
+    transaction->journal = 0;
+    if (transaction->failed) {
+        /* Records were lost: the transaction cannot be committed */
+        pthread_mutex_lock(&journal->mutex);
+        transaction_close(journal, transaction);
+        journal->failed = true;
+        pthread_mutex_unlock(&journal->mutex);
+    } else {
+        journal_append(journal, transaction, transaction->records,
+                       transaction->count > 1 ? transaction->count : 0);
+    }
+    transaction->count = 0;
+}
+
+/*
+ * Waits until the last transaction the calling thread committed to a
+ * journal is durable (and, with it, every transaction committed before
+ * it). Transactions committed to other journals since then are not waited
+ * for. Must not be called with a transaction open on the journal, which
+ * would hold back the flush.
+ * Input:
+ *  - journal: the journal (NULL if metadata updates are not journaled)
+ * Returns: 0 if successful, -1 if the journal could not be written
+ */
+int journal_sync(journal_t *journal) {
+    if (journal == NULL || thread_journal != journal->id || thread_commit == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&journal->mutex);
+    while (journal->durable_lsn <= thread_commit && !journal->failed) {
+        pthread_cond_wait(&journal->durable, &journal->mutex);
+    }
+    bool failed = journal->failed;
+    pthread_mutex_unlock(&journal->mutex);
+    thread_commit = 0;
+    return failed ? -1 : 0;
+}
+
+/*
+ * Returns how many records were flushed, and in how many flushes, since
+ * the journal was opened
+ */
+void journal_stats(journal_t *journal, uint64_t *records, uint64_t *flush_count) {
+    pthread_mutex_lock(&journal->mutex);
+    *records = journal->flushed_records;
+    *flush_count = journal->flushes;
+    pthread_mutex_unlock(&journal->mutex);
+}
+
+static int compare_lsn(void const *a, void const *b) {
+    uint64_t lsn_a = ((journal_record_t const *) a)->lsn;
+    uint64_t lsn_b = ((journal_record_t const *) b)->lsn;
+    return lsn_a < lsn_b ? -1 : lsn_a > lsn_b;
+}
+
+/*
+ * Reads back the transactions committed in a journal file, stopping at the
+ * first torn or corrupted record: the records of a transaction cut short
+ * are skipped
+ * Input:
+ *  - path: path name of the journal file
+ *  - handler: called for each record of a committed transaction (begin and
+ *    commit records included), in lsn order, so that updates are seen in
+ *    the order they were made in; a non-zero return stops reading
+ *  - arg: passed on to handler
+ * Returns: number of records read if successful, -1 otherwise
+ */
+int journal_read(char const *path, int (*handler)(journal_record_t const *record, void *arg),
+                 void *arg) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    size_t count;
+    journal_record_t *records = read_committed(file, &count);
+    fclose(file);
+
+    qsort(records, count, sizeof(journal_record_t), compare_lsn);
+    int read = 0;
+    for (size_t i = 0; i < count; i++) {
+        read++;
+        if (handler(&records[i], arg) != 0) {
+            break;
+        }
+    }
+    free(records);
+    return read;
+}
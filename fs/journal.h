@@ -0,0 +1,66 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Metadata write-ahead journal. Metadata updates append records to it;
+ * a flusher thread writes every record appended since the last flush in a
+ * single write + fdatasync (group commit), waiting up to a commit interval
+ * for more records to join the batch.
+ *
+ * The records of an operation form a transaction: between journal_begin
+ * and journal_commit, they are kept by the calling thread, and only
+ * appended (between a begin and a commit record) once it commits, so that
+ * flushes hold whole transactions. Records are numbered (lsn) in the order
+ * the updates were made in, which may differ from the order transactions
+ * commit in. A transaction may have seen the updates of any transaction
+ * that began before it committed, so it is only flushed once those have
+ * committed too, and along with them or after them; a flush is read back
+ * whole or not at all. Data blocks are not journaled.
+ */
+
+typedef enum {
+    JOURNAL_INODE_CREATE = 1, /* inumber, arg1: type */
+    JOURNAL_BLOCK_MAP,        /* inumber, arg1: slot, arg2: block */
+    JOURNAL_INDIRECTION,      /* inumber, arg1: block of indexes */
+    JOURNAL_DIR_ADD,          /* inumber: directory, arg1: entry's inumber, name */
+    JOURNAL_TRUNCATE,         /* inumber (every block is dropped) */
+    JOURNAL_DIR_REMOVE,       /* inumber: directory, arg1: entry's inumber, name */
+    JOURNAL_INODE_FREE,       /* inumber */
+    JOURNAL_SIZE,             /* inumber, arg1: size */
+    JOURNAL_COMPRESS,         /* inumber */
+    JOURNAL_GROUP,            /* inumber, arg1: group, arg2: compressed size */
+    JOURNAL_TX_BEGIN,
+    JOURNAL_TX_COMMIT,
+    JOURNAL_FLUSH, /* ends a flush (never read back) */
+} journal_record_type_t;
+
+typedef struct {
+    uint64_t lsn;
+    uint32_t type;
+    int32_t inumber;
+    int64_t arg1;
+    int64_t arg2;
+    char name[MAX_FILE_NAME];
+    uint32_t pad;
+    uint32_t crc;
+} journal_record_t;
+
+typedef struct journal journal_t;
+
+journal_t *journal_open(char const *path, unsigned int commit_interval_us);
+int journal_close(journal_t *journal);
+void journal_log(journal_t *journal, journal_record_type_t type, int inumber, int64_t arg1,
+                 int64_t arg2, char const *name);
+void journal_begin(journal_t *journal);
+void journal_begin_apart(journal_t *journal);
+void journal_commit(journal_t *journal);
+int journal_sync(journal_t *journal);
+void journal_stats(journal_t *journal, uint64_t *records, uint64_t *flushes);
+int journal_read(char const *path, int (*handler)(journal_record_t const *record, void *arg),
+                 void *arg);
+
+#endif // JOURNAL_H
@@ -0,0 +1,207 @@
+#include "lz4.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_MATCH (4)
+/* The last match must start at least 12 bytes before the end of the input */
+#define MF_LIMIT (12)
+/* The last 5 bytes are always literals */
+#define LAST_LITERALS (5)
+#define MAX_OFFSET (65535)
+
+#define HASH_LOG (12)
+#define HASH_SIZE (1 << HASH_LOG)
+
+static inline uint32_t read32(unsigned char const *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t hash32(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_LOG);
+}
+
+/*
+ * Writes the extra bytes of a length that does not fit in a token nibble
+ * Returns: pointer past the last byte written, NULL if there is no room
+ */
+static unsigned char *write_length(unsigned char *op, unsigned char const *oend, size_t length) {
+    for (; length >= 255; length -= 255) {
+        if (op >= oend) {
+            return NULL;
+        }
+        *op++ = 255;
+    }
+    if (op >= oend) {
+        return NULL;
+    }
+    *op++ = (unsigned char) length;
+    return op;
+}
+
+/*
+ * Emits one sequence: literals, followed by a match (unless match_length is
+ * 0, which ends the block)
+ * Returns: pointer past the sequence, NULL if there is no room
+ */
+static unsigned char *write_sequence(unsigned char *op, unsigned char const *oend,
+                                     unsigned char const *literals, size_t literal_length,
+                                     size_t offset, size_t match_length) {
+    if (op >= oend) {
+        return NULL;
+    }
+    unsigned char *token = op++;
+    *token = (unsigned char) ((literal_length < 15 ? literal_length : 15) << 4);
+    if (literal_length >= 15 && (op = write_length(op, oend, literal_length - 15)) == NULL) {
+        return NULL;
+    }
+    if ((size_t) (oend - op) < literal_length) {
+        return NULL;
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (match_length == 0) {
+        return op;
+    }
+
+    if (oend - op < 2) {
+        return NULL;
+    }
+    *op++ = (unsigned char) (offset & 0xFF);
+    *op++ = (unsigned char) (offset >> 8);
+
+    match_length -= MIN_MATCH;
+    *token = (unsigned char) (*token | (match_length < 15 ? match_length : 15));
+    if (match_length >= 15 && (op = write_length(op, oend, match_length - 15)) == NULL) {
+        return NULL;
+    }
+    return op;
+}
+
+ssize_t lz4_compress(void const *src, size_t src_size, void *dst, size_t dst_capacity) {
+    unsigned char const *const base = src;
+    unsigned char const *const iend = base + src_size;
+    unsigned char const *ip = base;
+    unsigned char const *anchor = base;
+    unsigned char *op = dst;
+    unsigned char const *const oend = op + dst_capacity;
+    uint32_t table[HASH_SIZE];
+
+    memset(table, 0, sizeof(table));
+
+    if (src_size > MF_LIMIT) {
+        unsigned char const *const mflimit = iend - MF_LIMIT;
+        unsigned char const *const matchlimit = iend - LAST_LITERALS;
+
+        ip++;
+        while (ip < mflimit) {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hash32(sequence);
+            unsigned char const *ref = base + table[h];
+            table[h] = (uint32_t) (ip - base);
+
+            if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            /* Extend the match backwards, then forwards */
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            size_t match_length = MIN_MATCH;
+            while (ip + match_length < matchlimit && ip[match_length] == ref[match_length]) {
+                match_length++;
+            }
+
+            op = write_sequence(op, oend, anchor, (size_t) (ip - anchor), (size_t) (ip - ref),
+                                match_length);
+            if (op == NULL) {
+                return -1;
+            }
+            ip += match_length;
+            anchor = ip;
+        }
+    }
+
+    /* Last literals */
+    op = write_sequence(op, oend, anchor, (size_t) (iend - anchor), 0, 0);
+    if (op == NULL) {
+        return -1;
+    }
+    return (ssize_t) (op - (unsigned char *) dst);
+}
+
+/*
+ * Reads the extra bytes of a length that does not fit in a token nibble
+ * Returns: 0 if successful, -1 if the input ends prematurely
+ */
+static int read_length(unsigned char const **ip, unsigned char const *iend, size_t *length) {
+    unsigned char byte;
+    do {
+        if (*ip >= iend) {
+            return -1;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+ssize_t lz4_decompress(void const *src, size_t src_size, void *dst, size_t dst_capacity) {
+    unsigned char const *ip = src;
+    unsigned char const *const iend = ip + src_size;
+    unsigned char *const base = dst;
+    unsigned char *op = base;
+    unsigned char const *const oend = base + dst_capacity;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && read_length(&ip, iend, &literal_length) == -1) {
+            return -1;
+        }
+        if ((size_t) (iend - ip) < literal_length || (size_t) (oend - op) < literal_length) {
+            return -1;
+        }
+        memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        if (ip == iend) {
+            /* The last sequence has no match */
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = (size_t) ip[0] | ((size_t) ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t) (op - base)) {
+            return -1;
+        }
+
+        size_t match_length = token & 15;
+        if (match_length == 15 && read_length(&ip, iend, &match_length) == -1) {
+            return -1;
+        }
+        match_length += MIN_MATCH;
+        if ((size_t) (oend - op) < match_length) {
+            return -1;
+        }
+
+        /* The match may overlap the bytes being produced */
+        unsigned char const *match = op - offset;
+        for (size_t i = 0; i < match_length; i++) {
+            op[i] = match[i];
+        }
+        op += match_length;
+    }
+    return (ssize_t) (op - base);
+}
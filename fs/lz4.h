@@ -0,0 +1,33 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Worst case size of the compressed form of size bytes */
+#define LZ4_BOUND(size) ((size) + (size) / 255 + 16)
+
+/*
+ * Compresses a buffer (LZ4 block format)
+ * Input:
+ *  - src: input buffer
+ *  - src_size: number of bytes to compress
+ *  - dst: output buffer
+ *  - dst_capacity: size of the output buffer
+ * Returns: compressed size if successful, -1 if it does not fit in dst
+ */
+ssize_t lz4_compress(void const *src, size_t src_size, void *dst, size_t dst_capacity);
+
+/*
+ * Decompresses a buffer produced by lz4_compress
+ * Input:
+ *  - src: compressed buffer
+ *  - src_size: size of the compressed buffer
+ *  - dst: output buffer
+ *  - dst_capacity: size of the output buffer
+ * Returns: decompressed size if successful, -1 if the input is malformed or
+ * does not fit in dst
+ */
+ssize_t lz4_decompress(void const *src, size_t src_size, void *dst, size_t dst_capacity);
+
+#endif // LZ4_H
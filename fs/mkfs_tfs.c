@@ -0,0 +1,147 @@
+#include "operations.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Creates a volume image offline, for tfs_load (or tfs-inspect) to open
+ * later: the volume has the geometry this file system was built with, and
+ * holds a copy of a directory tree of the external file system, streamed
+ * into it one file at a time.
+ *
+ * Usage: mkfs.tfs [-c] [-d] <image> [directory]
+ *  -c: store every file compressed
+ *  -d: share identical blocks between files
+ */
+
+#define COPY_CHUNK (64 * 1024)
+
+static char const *program;
+static char chunk[COPY_CHUNK];
+
+/* Copies a regular file of the external file system into the volume
+ * Returns 0 if successful, -1 otherwise */
+static int copy_file(tfs_t *fs, char const *source, char const *dest) {
+    FILE *in = fopen(source, "r");
+    if (in == NULL) {
+        perror(source);
+        return -1;
+    }
+    int fd = tfs_open_in(fs, dest, TFS_O_CREAT);
+    if (fd == -1) {
+        fprintf(stderr, "%s: %s: cannot create file\n", program, dest);
+        fclose(in);
+        return -1;
+    }
+
+    int ret = 0;
+    size_t length;
+    while ((length = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        if (tfs_write_in(fs, fd, chunk, length) != (ssize_t) length) {
+            fprintf(stderr, "%s: %s: volume full, or file too large\n", program, dest);
+            ret = -1;
+            break;
+        }
+    }
+    if (ferror(in)) {
+        perror(source);
+        ret = -1;
+    }
+    fclose(in);
+    tfs_close_in(fs, fd);
+    return ret;
+}
+
+/* Copies the contents of a directory of the external file system into a
+ * directory of the volume (dest is "" for the root)
+ * Returns 0 if successful, -1 otherwise */
+static int copy_tree(tfs_t *fs, char const *source, char const *dest) {
+    DIR *dir = opendir(source);
+    if (dir == NULL) {
+        perror(source);
+        return -1;
+    }
+
+    int ret = 0;
+    struct dirent *entry;
+    while (ret == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char source_path[4096];
+        char dest_path[MAX_PATH_NAME];
+        snprintf(source_path, sizeof(source_path), "%s/%s", source, entry->d_name);
+        if (strlen(entry->d_name) >= MAX_FILE_NAME ||
+            (size_t) snprintf(dest_path, sizeof(dest_path), "%s/%s", dest, entry->d_name) >=
+                sizeof(dest_path)) {
+            fprintf(stderr, "%s: %s: name too long\n", program, source_path);
+            ret = -1;
+            break;
+        }
+
+        struct stat st;
+        if (lstat(source_path, &st) == -1) {
+            perror(source_path);
+            ret = -1;
+        } else if (S_ISDIR(st.st_mode)) {
+            if (tfs_mkdir_in(fs, dest_path) == -1) {
+                fprintf(stderr, "%s: %s: cannot create directory\n", program, dest_path);
+                ret = -1;
+            } else {
+                ret = copy_tree(fs, source_path, dest_path);
+            }
+        } else if (S_ISREG(st.st_mode)) {
+            ret = copy_file(fs, source_path, dest_path);
+        } else {
+            fprintf(stderr, "%s: %s: skipped (not a regular file or directory)\n", program,
+                    source_path);
+        }
+    }
+    closedir(dir);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    int compress = 0;
+    int dedup = 0;
+    int option;
+    program = argv[0];
+    while ((option = getopt(argc, argv, "cd")) != -1) {
+        switch (option) {
+        case 'c':
+            compress = 1;
+            break;
+        case 'd':
+            dedup = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c] [-d] <image> [directory]\n", program);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 && optind != argc - 2) {
+        fprintf(stderr, "usage: %s [-c] [-d] <image> [directory]\n", program);
+        return EXIT_FAILURE;
+    }
+    char const *image = argv[optind];
+
+    tfs_t *fs = tfs_mount();
+    if (fs == NULL) {
+        fprintf(stderr, "%s: failed to create the volume\n", program);
+        return EXIT_FAILURE;
+    }
+    tfs_set_compression_in(fs, compress);
+    tfs_set_dedup_in(fs, dedup);
+
+    int ret = optind == argc - 2 ? copy_tree(fs, argv[optind + 1], "") : 0;
+    if (ret == 0 && tfs_save_in(fs, image) == -1) {
+        perror(image);
+        ret = -1;
+    }
+    tfs_unmount(fs);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,219 +1,1290 @@
-#include "operations.h"
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-
-int tfs_init() {
-    state_init();
-
-    /* create root inode */
-    int root = inode_create(T_DIRECTORY);
-    if (root != ROOT_DIR_INUM) {
-        return -1;
-    }
-
-    return 0;
-}
-
-int tfs_destroy() {
-    state_destroy();
-    return 0;
-}
-
-static bool valid_pathname(char const *name) {
-    return name != NULL && strlen(name) > 1 && name[0] == '/';
-}
-
-
-int tfs_lookup(char const *name) {
-    if (!valid_pathname(name)) {
-        return -1;
-    }
-
-    // skip the initial '/' character
-    name++;
-
-    return find_in_dir(ROOT_DIR_INUM, name);
-}
-
-int tfs_open(char const *name, int flags) {
-    int inum;
-    size_t offset;
-
-    /* Checks if the path name is valid */
-    if (!valid_pathname(name)) {
-        return -1;
-    }
-
-    inum = tfs_lookup(name);
-    if (inum >= 0) {
-        /* The file already exists */
-        inode_t *inode = inode_get(inum);
-        if (inode == NULL) {
-            return -1;
-        }
-
-        /* Trucate (if requested) */
-        if (flags & TFS_O_TRUNC) {
-            pthread_rwlock_wrlock(&inode->i_lock);
-            if (inode->i_size > 0) {
-                if (inode->indirection_block != -1) {
-                    /* Has indirect data blocks */
-                    if (inode_free_indirect_blocks(inode) == -1) {
-                        pthread_rwlock_unlock(&inode->i_lock);
-                        return 1;
-                    }
-                }
-                if (inode_free_direct_blocks(inode) == -1) {
-                    pthread_rwlock_unlock(&inode->i_lock);
-                    return -1;
-                }
-            }
-            inode->i_data_block = (int *) realloc(inode->i_data_block, sizeof(int));
-            if (inode->i_data_block == NULL) {
-                pthread_rwlock_unlock(&inode->i_lock);
-                return -1;
-            }
-            if (inode_alloc_first_block(inum) == -1) {
-                pthread_rwlock_unlock(&inode->i_lock);
-                return -1;
-            }
-            pthread_rwlock_unlock(&inode->i_lock);
-        }
-        /* Determine initial offset */
-        if (flags & TFS_O_APPEND) {
-            pthread_rwlock_rdlock(&inode->i_lock);
-            offset = inode->i_size;
-            pthread_rwlock_unlock(&inode->i_lock);
-        } else {
-            offset = 0;
-        }
-    } 
-    else if (flags & TFS_O_CREAT) {
-        /* The file doesn't exist; the flags specify that it should be created*/
-        /* Create inode */
-        inum = inode_create(T_FILE);
-        if (inum == -1) {
-            return -1;
-        }
-        /* Add entry in the root directory */
-        if (add_dir_entry(ROOT_DIR_INUM, inum, name + 1) == -1) {
-            inode_delete(inum);
-            return -1;
-        }
-        offset = 0;
-    } 
-    else {
-        return -1;
-    }
-    /* Finally, add entry to the open file table and
-     * return the corresponding handle */
-    return add_to_open_file_table(inum, offset);
-
-    /* Note: for simplification, if file was created with TFS_O_CREAT and there
-     * is an error adding an entry to the open file table, the file is not
-     * opened but it remains created */
-}
-
-
-int tfs_close(int fhandle) { return remove_from_open_file_table(fhandle); }
-
-ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
-
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    ssize_t bytes_written = 0;
-    if (file == NULL) {
-        return -1;
-    }
-
-    /* From the open file table entry, we get the inode */
-    inode_t *inode = inode_get(file->of_inumber);
-    if (inode == NULL) {
-        return -1;
-    }
-
-    /* Write the information on the open file's corresponding inode */
-    bytes_written = inode_write(file, inode, buffer, to_write);
-    if (bytes_written == -1) {
-        return -1;
-    }
-    return bytes_written;
-}
-
-ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
-
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    ssize_t bytes_read;
-    if (file == NULL) {
-        return -1;
-    }
-
-    /* From the open file table entry, we get the inode */
-    inode_t *inode = inode_get(file->of_inumber);
-    if (inode == NULL) {
-        return -1;
-    } 
-
-
-    bytes_read = inode_read(file, inode, buffer, len);
-    if (bytes_read == -1) {
-        return -1;
-    }
-    return bytes_read;
-}
-
-int tfs_copy_to_external_fs(char const *source_path, char const *dest_path) {
-    int fhandleSource;
-
-    //Passing 0 as a flag to tfs_open, opens the file with the offset at 0
-    if ((fhandleSource = tfs_open(source_path, 0)) == -1) {
-        //Source file doesn't exist
-        return -1;
-    }
-
-    open_file_entry_t *file = get_open_file_entry(fhandleSource);
-    if (file == NULL) {
-        return -1;
-    }
-
-    /* From the open file table entry, we get the inode */
-    inode_t *inode = inode_get(file->of_inumber);
-    if (inode == NULL) {
-        return -1;
-    }
-
-    void *buffer = malloc(inode->i_size);
-    if (buffer == NULL) { //Out of memory
-        return -1;
-    }
-    memset(buffer, 0, inode->i_size);
-
-    FILE *destFile = fopen(dest_path, "w");
-    if (destFile == NULL) {
-        return -1;
-    }
-
-    ssize_t readBytes = tfs_read(fhandleSource, buffer, inode->i_size);
-    if (readBytes == -1) {  //Read from file in TFS
-        return -1;
-    }
-
-    size_t writeBytes = fwrite(buffer, 1, (size_t) readBytes, destFile);
-    if (writeBytes != readBytes) {
-        return -1;
-    }
-    
-    int close = fclose(destFile);
-    if (close == EOF) {
-        return -1;
-    }
-    
-    if ((fhandleSource = tfs_close(fhandleSource)) == -1) {
-            return -1;
-    }
-    free(buffer);
-
-    return 0;
-}
+#include "operations.h"
+#include "dcache.h"
+#include "epoch.h"
+#include "journal.h"
+#include "trace.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Volumes the functions that take none operate on (created by tfs_init or
+ * tfs_init_sharded): each path name belongs to one of them, chosen by its
+ * first component */
+static tfs_t *shards[MAX_SHARDS];
+static unsigned int shard_count = 0;
+
+/* Whether volumes mounted from now on keep their data in huge pages */
+static atomic_bool use_huge_pages = true;
+
+/* Creates a volume without any i-node, not even the root directory's
+ * Returns the volume if successful, NULL otherwise */
+static tfs_t *volume_create() {
+    /* Mapped rather than allocated: page aligned (so aligned like the
+     * i-nodes in it), and zero-filled without touching any page */
+    page_kind_t pages;
+    tfs_t *fs = (tfs_t *) pages_alloc(sizeof(tfs_t), false, &pages);
+    if (fs == NULL) {
+        return NULL;
+    }
+
+    if (state_init(fs, atomic_load(&use_huge_pages)) == -1 ||
+        (fs->dcache = dcache_create(fs->epoch)) == NULL) {
+        tfs_unmount(fs);
+        return NULL;
+    }
+    return fs;
+}
+
+tfs_t *tfs_mount() {
+    tfs_t *fs = volume_create();
+    if (fs == NULL) {
+        return NULL;
+    }
+
+    /* create root inode */
+    if (inode_create(fs, T_DIRECTORY) != ROOT_DIR_INUM) {
+        tfs_unmount(fs);
+        return NULL;
+    }
+    return fs;
+}
+
+tfs_t *tfs_load(char const *path) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        return NULL;
+    }
+
+    tfs_t *fs = volume_create();
+    if (fs != NULL && state_load(fs, in) == -1) {
+        tfs_unmount(fs);
+        fs = NULL;
+    }
+    fclose(in);
+    return fs;
+}
+
+/* Volume a journal is replayed onto, and whether a record did not fit */
+typedef struct {
+    tfs_t *fs;
+    bool failed;
+} replay_t;
+
+static int replay_record(journal_record_t const *record, void *arg) {
+    replay_t *replay = (replay_t *) arg;
+    replay->failed = state_replay(replay->fs, record) == -1;
+    return replay->failed;
+}
+
+tfs_t *tfs_recover(char const *image_path, char const *journal_path) {
+    replay_t replay = {.fs = tfs_load(image_path), .failed = false};
+    if (replay.fs != NULL &&
+        (journal_read(journal_path, replay_record, &replay) == -1 || replay.failed)) {
+        tfs_unmount(replay.fs);
+        replay.fs = NULL;
+    }
+    return replay.fs;
+}
+
+int tfs_save_in(tfs_t *fs, char const *path) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        return -1;
+    }
+    int ret = state_save(fs, out);
+    if (fclose(out) == EOF) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int tfs_stats_in(tfs_t *fs, volume_stats_t *stats) {
+    state_stats(fs, stats);
+    return 0;
+}
+
+int tfs_unmount(tfs_t *fs) {
+    if (fs == NULL) {
+        return -1;
+    }
+
+    if (fs->journal != NULL) {
+        journal_close(fs->journal);
+        fs->journal = NULL;
+    }
+    if (fs->dcache != NULL) {
+        dcache_destroy(fs->dcache);
+    }
+    state_destroy(fs);
+    pages_free(fs, sizeof(tfs_t));
+    return 0;
+}
+
+int tfs_init() { return tfs_init_sharded(1); }
+
+int tfs_init_sharded(unsigned int count) {
+    if (count == 0 || count > MAX_SHARDS || shard_count != 0) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        shards[i] = tfs_mount();
+        if (shards[i] == NULL) {
+            while (i-- > 0) {
+                tfs_unmount(shards[i]);
+            }
+            return -1;
+        }
+    }
+    shard_count = count;
+    return 0;
+}
+
+int tfs_destroy() {
+    int ret = shard_count == 0 ? -1 : 0;
+    for (unsigned int i = 0; i < shard_count; i++) {
+        if (tfs_unmount(shards[i]) == -1) {
+            ret = -1;
+        }
+        shards[i] = NULL;
+    }
+    shard_count = 0;
+    trace_close();
+    return ret;
+}
+
+tfs_t *tfs_default() { return shards[0]; }
+
+/* Path names are absolute, with non-empty components separated by a
+ * single '/' */
+static bool valid_pathname(char const *name) {
+    if (name == NULL || name[0] != '/' || strlen(name) < 2 || strlen(name) >= MAX_PATH_NAME) {
+        return false;
+    }
+
+    size_t component = 0;
+    for (char const *c = name + 1;; c++) {
+        if (*c != '/' && *c != '\0') {
+            component++;
+            continue;
+        }
+        if (component == 0 || component >= MAX_FILE_NAME) {
+            return false;
+        }
+        if (*c == '\0') {
+            return true;
+        }
+        component = 0;
+    }
+}
+
+/* Splits a (valid) path name into its parent's path name ("" for the root
+ * directory) and its last component, which is returned */
+static char const *split_pathname(char const *name, char *parent) {
+    char const *last = strrchr(name, '/');
+    size_t parent_len = (size_t) (last - name);
+    memcpy(parent, name, parent_len);
+    parent[parent_len] = '\0';
+    return last + 1;
+}
+
+/* Resolves a (valid) path name, or "" for the root directory: first in the
+ * dentry cache, then through its parent in the parent's directory */
+static int resolve_pathname(tfs_t *fs, char const *name) {
+    int inumber;
+    uint64_t generation;
+
+    if (name[0] == '\0') {
+        return ROOT_DIR_INUM;
+    }
+    if (dcache_lookup(fs->dcache, name, &inumber, &generation)) {
+        return inumber;
+    }
+
+    char parent_name[MAX_PATH_NAME];
+    char const *sub_name = split_pathname(name, parent_name);
+    int parent = resolve_pathname(fs, parent_name);
+    inumber = parent == -1 ? -1 : find_in_dir(fs, parent, sub_name);
+
+    dcache_insert(fs->dcache, name, inumber, generation);
+    return inumber;
+}
+
+/* Adds a new i-node to its parent directory, under a (valid) path name;
+ * must run outside epoch critical sections
+ * Returns 0 if successful, -1 otherwise */
+static int link_new_inode(tfs_t *fs, char const *name, int inumber) {
+    char parent_name[MAX_PATH_NAME];
+    char const *sub_name = split_pathname(name, parent_name);
+
+    int parent = resolve_pathname(fs, parent_name);
+    if (parent == -1 || add_dir_entry(fs, parent, inumber, sub_name) == -1) {
+        return -1;
+    }
+    dcache_set(fs->dcache, name, inumber);
+    return 0;
+}
+
+
+int tfs_lookup_in(tfs_t *fs, char const *name) {
+    if (!valid_pathname(name)) {
+        return -1;
+    }
+
+    return resolve_pathname(fs, name);
+}
+
+int tfs_mkdir_in(tfs_t *fs, char const *name) {
+    if (!valid_pathname(name) || resolve_pathname(fs, name) != -1) {
+        return -1;
+    }
+
+    journal_begin(fs->journal);
+    int inum = inode_create(fs, T_DIRECTORY);
+    if (inum != -1 && link_new_inode(fs, name, inum) == -1) {
+        inode_delete(fs, inum);
+        inum = -1;
+    }
+    journal_commit(fs->journal);
+    return inum == -1 ? -1 : journal_sync(fs->journal);
+}
+
+/* Opens an existing file; must run in an epoch critical section, so that
+ * its i-node is not reclaimed before the open file entry takes a reference
+ * to it */
+static int open_existing(tfs_t *fs, int inum, int flags) {
+    size_t offset;
+
+    inode_t *inode = inode_get(fs, inum);
+    if (inode == NULL || inode->i_node_type != T_FILE) {
+        return -1;
+    }
+
+    /* Trucate (if requested) */
+    if (flags & TFS_O_TRUNC) {
+        inode_write_lock(inode);
+        if (inode_truncate(fs, inum) == -1) {
+            inode_write_unlock(inode);
+            return -1;
+        }
+        inode_write_unlock(inode);
+    }
+    /* Determine initial offset */
+    if (flags & TFS_O_APPEND) {
+        offset = inode_get_size(inode);
+    } else {
+        offset = 0;
+    }
+
+    return add_to_open_file_table(fs, inum, offset);
+}
+
+/* Creates a file, in no directory yet, and opens it. The open file entry
+ * references the new i-node before it is added to its directory, so that
+ * it cannot be unlinked and reclaimed meanwhile.
+ * Returns the file handle if successful, -1 otherwise */
+static int create_unlinked(tfs_t *fs, int flags, int *inum) {
+    /* Create inode */
+    *inum = inode_create(fs, T_FILE);
+    if (*inum == -1) {
+        return -1;
+    }
+    /* Compress it, if requested for this file or for the whole volume */
+    if (((flags & TFS_O_COMPRESS) || state_compression_enabled(fs)) &&
+        inode_set_compressed(fs, *inum) == -1) {
+        inode_delete(fs, *inum);
+        return -1;
+    }
+
+    int fhandle = add_to_open_file_table(fs, *inum, 0);
+    if (fhandle == -1) {
+        inode_delete(fs, *inum);
+        return -1;
+    }
+    return fhandle;
+}
+
+/* Gives up on a file created by create_unlinked that could not be added to
+ * its directory, and opens the file of that name instead, if any
+ * Returns the file handle if successful, -1 otherwise */
+static int open_after_failed_link(tfs_t *fs, char const *name, int flags, int fhandle,
+                                  int inum) {
+    remove_from_open_file_table(fs, fhandle);
+    inode_delete(fs, inum);
+
+    /* Another thread may have created the file meanwhile; look in the
+     * directory itself, as it may not have updated the dentry cache yet */
+    char parent_name[MAX_PATH_NAME];
+    char const *sub_name = split_pathname(name, parent_name);
+    epoch_enter(fs->epoch);
+    int parent = resolve_pathname(fs, parent_name);
+    int existing = parent == -1 ? -1 : find_in_dir(fs, parent, sub_name);
+    fhandle = existing == -1 ? -1 : open_existing(fs, existing, flags);
+    epoch_exit(fs->epoch);
+    return fhandle;
+}
+
+/* Creates and opens a file */
+static int open_new(tfs_t *fs, char const *name, int flags) {
+    int inum;
+    int fhandle = create_unlinked(fs, flags, &inum);
+    if (fhandle == -1) {
+        return -1;
+    }
+    /* Add entry in the parent directory */
+    if (link_new_inode(fs, name, inum) == -1) {
+        fhandle = open_after_failed_link(fs, name, flags, fhandle, inum);
+    }
+    return fhandle;
+}
+
+int tfs_open_in(tfs_t *fs, char const *name, int flags) {
+    /* Checks if the path name is valid */
+    if (!valid_pathname(name)) {
+        return -1;
+    }
+
+    journal_begin(fs->journal);
+    epoch_enter(fs->epoch);
+    int inum = resolve_pathname(fs, name);
+    int fhandle = inum >= 0 ? open_existing(fs, inum, flags) : -1;
+    epoch_exit(fs->epoch);
+
+    if (inum == -1 && (flags & TFS_O_CREAT)) {
+        /* The file doesn't exist; the flags specify that it should be created*/
+        fhandle = open_new(fs, name, flags);
+    }
+    journal_commit(fs->journal);
+
+    /* Wait for the metadata updates to be durable */
+    if (fhandle != -1 && journal_sync(fs->journal) == -1) {
+        remove_from_open_file_table(fs, fhandle);
+        return -1;
+    }
+    return fhandle;
+}
+
+/* Marks the files of tfs_open_many_in that are still to be created */
+#define OPEN_MANY_CREATE (-2)
+
+/* Creates and opens files of a same directory, adding them all to it at
+ * once; the file handle of names[indices[k]] goes to fhandles[indices[k]] */
+static void open_new_in_dir(tfs_t *fs, char const *parent_name, char const *const *names,
+                            size_t const *indices, size_t count, int flags, int *fhandles) {
+    char unused[MAX_PATH_NAME];
+    int inums[BATCH_GROUP_SIZE];
+    char const *sub_names[BATCH_GROUP_SIZE];
+    int linked[BATCH_GROUP_SIZE];
+    size_t created[BATCH_GROUP_SIZE];
+    size_t n = 0;
+
+    for (size_t k = 0; k < count; k++) {
+        size_t i = indices[k];
+        fhandles[i] = create_unlinked(fs, flags, &inums[n]);
+        if (fhandles[i] != -1) {
+            sub_names[n] = split_pathname(names[i], unused);
+            created[n++] = i;
+        }
+    }
+
+    int parent = resolve_pathname(fs, parent_name);
+    add_dir_entries(fs, parent, inums, sub_names, linked, n);
+    for (size_t k = 0; k < n; k++) {
+        size_t i = created[k];
+        if (linked[k] == 0) {
+            dcache_set(fs->dcache, names[i], inums[k]);
+        } else {
+            fhandles[i] = open_after_failed_link(fs, names[i], flags, fhandles[i], inums[k]);
+        }
+    }
+}
+
+int tfs_open_many_in(tfs_t *fs, char const *const *names, int flags, int *fhandles,
+                     size_t count) {
+    /* One transaction for them all; existing files first, all in one epoch
+     * critical section */
+    journal_begin(fs->journal);
+    epoch_enter(fs->epoch);
+    for (size_t i = 0; i < count; i++) {
+        int inum = valid_pathname(names[i]) ? resolve_pathname(fs, names[i]) : -1;
+        if (inum >= 0) {
+            fhandles[i] = open_existing(fs, inum, flags);
+        } else {
+            fhandles[i] = valid_pathname(names[i]) && (flags & TFS_O_CREAT) ? OPEN_MANY_CREATE : -1;
+        }
+    }
+    epoch_exit(fs->epoch);
+
+    /* Then new files, grouped by directory */
+    for (size_t i = 0; i < count; i++) {
+        if (fhandles[i] != OPEN_MANY_CREATE) {
+            continue;
+        }
+        char parent_name[MAX_PATH_NAME];
+        char other_parent[MAX_PATH_NAME];
+        size_t group[BATCH_GROUP_SIZE];
+        size_t n = 0;
+        split_pathname(names[i], parent_name);
+        for (size_t j = i; j < count && n < BATCH_GROUP_SIZE; j++) {
+            if (fhandles[j] != OPEN_MANY_CREATE) {
+                continue;
+            }
+            split_pathname(names[j], other_parent);
+            if (strcmp(other_parent, parent_name) == 0) {
+                fhandles[j] = -1;
+                group[n++] = j;
+            }
+        }
+        open_new_in_dir(fs, parent_name, names, group, n, flags, fhandles);
+    }
+    journal_commit(fs->journal);
+
+    /* Wait for the metadata updates to be durable, once for all */
+    bool durable = journal_sync(fs->journal) != -1;
+    int opened = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (fhandles[i] != -1 && !durable) {
+            remove_from_open_file_table(fs, fhandles[i]);
+            fhandles[i] = -1;
+        }
+        if (fhandles[i] != -1) {
+            opened++;
+        }
+    }
+    return opened;
+}
+
+int tfs_close_many_in(tfs_t *fs, int const *fhandles, int *results, size_t count) {
+    return remove_many_from_open_file_table(fs, fhandles, results, count) == count ? 0 : -1;
+}
+
+/* Runs the operations of a batch, on a given volume or (if NULL) through
+ * the functions that take none; consecutive opens (with the same flags)
+ * and closes are carried out together
+ * Returns 0 if every operation succeeded, -1 otherwise */
+static int batch_run(tfs_t *fs, tfs_batch_op_t *ops, size_t count) {
+    int ret = 0;
+    for (size_t i = 0; i < count;) {
+        tfs_batch_op_t *op = &ops[i];
+        size_t run = 1;
+        if (op->op == TFS_BATCH_OPEN || op->op == TFS_BATCH_CLOSE) {
+            while (i + run < count && run < BATCH_GROUP_SIZE && ops[i + run].op == op->op &&
+                   (op->op == TFS_BATCH_CLOSE || ops[i + run].flags == op->flags)) {
+                run++;
+            }
+        }
+
+        char const *names[BATCH_GROUP_SIZE];
+        int handles[BATCH_GROUP_SIZE];
+        switch (op->op) {
+        case TFS_BATCH_LOOKUP:
+            op->ret = fs == NULL ? tfs_lookup(op->name) : tfs_lookup_in(fs, op->name);
+            break;
+        case TFS_BATCH_MKDIR:
+            op->ret = fs == NULL ? tfs_mkdir(op->name) : tfs_mkdir_in(fs, op->name);
+            break;
+        case TFS_BATCH_UNLINK:
+            op->ret = fs == NULL ? tfs_unlink(op->name) : tfs_unlink_in(fs, op->name);
+            break;
+        case TFS_BATCH_OPEN:
+            for (size_t k = 0; k < run; k++) {
+                names[k] = ops[i + k].name;
+            }
+            if (fs == NULL) {
+                tfs_open_many(names, op->flags, handles, run);
+            } else {
+                tfs_open_many_in(fs, names, op->flags, handles, run);
+            }
+            for (size_t k = 0; k < run; k++) {
+                ops[i + k].ret = handles[k];
+            }
+            break;
+        case TFS_BATCH_CLOSE:
+            for (size_t k = 0; k < run; k++) {
+                handles[k] = ops[i + k].fhandle;
+            }
+            if (fs == NULL) {
+                tfs_close_many(handles, handles, run);
+            } else {
+                tfs_close_many_in(fs, handles, handles, run);
+            }
+            for (size_t k = 0; k < run; k++) {
+                ops[i + k].ret = handles[k];
+            }
+            break;
+        default:
+            op->ret = -1;
+            break;
+        }
+
+        for (size_t k = 0; k < run; k++) {
+            if (ops[i + k].ret == -1) {
+                ret = -1;
+            }
+        }
+        i += run;
+    }
+    return ret;
+}
+
+int tfs_batch_in(tfs_t *fs, tfs_batch_op_t *ops, size_t count) {
+    return batch_run(fs, ops, count);
+}
+
+int tfs_unlink_in(tfs_t *fs, char const *name) {
+    if (!valid_pathname(name)) {
+        return -1;
+    }
+
+    journal_begin(fs->journal);
+    epoch_enter(fs->epoch);
+    char parent_name[MAX_PATH_NAME];
+    split_pathname(name, parent_name);
+    int parent = resolve_pathname(fs, parent_name);
+    int inum = parent == -1 ? -1 : resolve_pathname(fs, name);
+    inode_t *inode = inode_get(fs, inum);
+
+    /* Only the thread that removes the entry goes on to unlink the i-node */
+    if (inode == NULL || inode->i_node_type != T_FILE || clear_dir_entry(fs, parent, inum) == -1) {
+        epoch_exit(fs->epoch);
+        journal_commit(fs->journal);
+        return -1;
+    }
+    dcache_set(fs->dcache, name, -1);
+    inode_unlink(fs, inum);
+    epoch_exit(fs->epoch);
+    journal_commit(fs->journal);
+
+    return journal_sync(fs->journal);
+}
+
+int tfs_close_in(tfs_t *fs, int fhandle) { return remove_from_open_file_table(fs, fhandle); }
+
+/* Writes to an open file, storing the offset the write starts at in
+ * offset, if not NULL
+ * Returns: number of bytes written if successful, -1 otherwise */
+static ssize_t file_write(tfs_t *fs, int fhandle, void const *buffer, size_t to_write,
+                          size_t *offset) {
+
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    ssize_t bytes_written = 0;
+    if (file == NULL) {
+        return -1;
+    }
+
+    /* The open file table entry already holds the inode */
+    inode_t *inode = file->of_inode;
+
+    /* Write the information on the open file's corresponding inode */
+    journal_begin(fs->journal);
+    bytes_written = inode_write(fs, file, inode, buffer, to_write, offset);
+    journal_commit(fs->journal);
+    if (bytes_written == -1 || journal_sync(fs->journal) == -1) {
+        return -1;
+    }
+    return bytes_written;
+}
+
+/* Reads from an open file, storing the offset the read starts at in offset,
+ * if not NULL
+ * Returns: number of bytes read if successful, -1 otherwise */
+static ssize_t file_read(tfs_t *fs, int fhandle, void *buffer, size_t len, size_t *offset) {
+
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    ssize_t bytes_read;
+    if (file == NULL) {
+        return -1;
+    }
+
+    /* The open file table entry already holds the inode */
+    inode_t *inode = file->of_inode;
+
+    bytes_read = inode_read(fs, file, inode, buffer, len, offset);
+    if (bytes_read == -1) {
+        return -1;
+    }
+    return bytes_read;
+}
+
+ssize_t tfs_write_in(tfs_t *fs, int fhandle, void const *buffer, size_t to_write) {
+    return file_write(fs, fhandle, buffer, to_write, NULL);
+}
+
+ssize_t tfs_read_in(tfs_t *fs, int fhandle, void *buffer, size_t len) {
+    return file_read(fs, fhandle, buffer, len, NULL);
+}
+
+int tfs_copy_to_external_fs_in(tfs_t *fs, char const *source_path, char const *dest_path) {
+    int fhandleSource;
+
+    //Passing 0 as a flag to tfs_open, opens the file with the offset at 0
+    if ((fhandleSource = tfs_open_in(fs, source_path, 0)) == -1) {
+        //Source file doesn't exist
+        return -1;
+    }
+
+    open_file_entry_t *file = get_open_file_entry(fs, fhandleSource);
+    if (file == NULL) {
+        return -1;
+    }
+
+    /* The open file table entry already holds the inode */
+    inode_t *inode = file->of_inode;
+
+    size_t size = inode_get_size(inode);
+    void *buffer = malloc(size);
+    if (buffer == NULL) { //Out of memory
+        return -1;
+    }
+    memset(buffer, 0, size);
+
+    FILE *destFile = fopen(dest_path, "w");
+    if (destFile == NULL) {
+        return -1;
+    }
+
+    ssize_t readBytes = tfs_read_in(fs, fhandleSource, buffer, size);
+    if (readBytes == -1) {  //Read from file in TFS
+        return -1;
+    }
+
+    size_t writeBytes = fwrite(buffer, 1, (size_t) readBytes, destFile);
+    if (writeBytes != readBytes) {
+        return -1;
+    }
+    
+    int close = fclose(destFile);
+    if (close == EOF) {
+        return -1;
+    }
+    
+    if ((fhandleSource = tfs_close_in(fs, fhandleSource)) == -1) {
+            return -1;
+    }
+    free(buffer);
+
+    return 0;
+}
+
+ssize_t tfs_get_file_size_in(tfs_t *fs, int fhandle) {
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+
+    return (ssize_t) inode_get_size(file->of_inode);
+}
+
+int tfs_set_checksum_mode_in(tfs_t *fs, checksum_mode_t mode) {
+    switch (mode) {
+    case CHECKSUM_OFF:
+    case CHECKSUM_UPDATE:
+    case CHECKSUM_VERIFY:
+        state_set_checksum_mode(fs, mode);
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+int tfs_set_compression_in(tfs_t *fs, int enabled) {
+    state_set_compression(fs, enabled != 0);
+    return 0;
+}
+
+int tfs_set_dedup_in(tfs_t *fs, int enabled) {
+    state_set_dedup(fs, enabled != 0);
+    return 0;
+}
+
+page_kind_t tfs_data_pages_in(tfs_t *fs) { return fs->fs_data_pages; }
+
+/* Clones a file into a new i-node; must run in an epoch critical section,
+ * so that the source i-node is not reclaimed while it is being cloned
+ * Returns 0 if successful, -1 otherwise */
+static int clone_in_epoch(tfs_t *fs, char const *source_path, char const *dest_path, int dest) {
+    int source = tfs_lookup_in(fs, source_path);
+    if (source == -1 || tfs_lookup_in(fs, dest_path) != -1) {
+        /* The source must exist and the destination must not */
+        return -1;
+    }
+    return inode_clone(fs, source, dest);
+}
+
+int tfs_clone_in(tfs_t *fs, char const *source_path, char const *dest_path) {
+    if (!valid_pathname(source_path) || !valid_pathname(dest_path)) {
+        return -1;
+    }
+
+    journal_begin(fs->journal);
+    int dest = inode_create(fs, T_FILE);
+    int ret = dest == -1 ? -1 : 0;
+    if (ret == 0) {
+        epoch_enter(fs->epoch);
+        ret = clone_in_epoch(fs, source_path, dest_path, dest);
+        epoch_exit(fs->epoch);
+    }
+    if (dest != -1 && (ret == -1 || link_new_inode(fs, dest_path, dest) == -1)) {
+        inode_delete(fs, dest);
+        ret = -1;
+    }
+    journal_commit(fs->journal);
+    return ret == -1 ? -1 : journal_sync(fs->journal);
+}
+
+snapshot_t *tfs_snapshot_in(tfs_t *fs) { return snapshot_create(fs); }
+
+dir_listing_t *tfs_opendir_in(tfs_t *fs, char const *name) {
+    if (name != NULL && strcmp(name, "/") == 0) {
+        return dir_list(fs, ROOT_DIR_INUM);
+    }
+    if (!valid_pathname(name)) {
+        return NULL;
+    }
+
+    int inum = resolve_pathname(fs, name);
+    return inum == -1 ? NULL : dir_list(fs, inum);
+}
+
+int tfs_journal_open_in(tfs_t *fs, char const *path, unsigned int commit_interval_us) {
+    if (path == NULL || fs->journal != NULL) {
+        return -1;
+    }
+    fs->journal = journal_open(path, commit_interval_us);
+    return fs->journal == NULL ? -1 : 0;
+}
+
+int tfs_journal_close_in(tfs_t *fs) {
+    journal_t *journal = fs->journal;
+    if (journal == NULL) {
+        return -1;
+    }
+    fs->journal = NULL;
+    return journal_close(journal);
+}
+
+/* Picks the shard of a path name, by hashing its first component (FNV-1a),
+ * so that a directory and everything under it share a shard
+ * Returns the shard's volume, or NULL before tfs_init */
+static tfs_t *shard_of_name(char const *name, unsigned int *shard) {
+    uint32_t hash = 2166136261u;
+
+    if (shard_count == 0) {
+        return NULL;
+    }
+    if (name != NULL && name[0] == '/') {
+        for (char const *c = name + 1; *c != '/' && *c != '\0'; c++) {
+            hash = (hash ^ (uint8_t) *c) * 16777619u;
+        }
+    }
+    *shard = hash % shard_count;
+    return shards[*shard];
+}
+
+/* A handle (or i-node number) of a shard, as seen by callers: multiplied
+ * by the number of shards, plus the shard itself */
+static int shard_to_global(unsigned int shard, int local) {
+    return local < 0 ? -1 : local * (int) shard_count + (int) shard;
+}
+
+/* Inverse of shard_to_global
+ * Returns the shard's volume, or NULL if the handle is invalid */
+static tfs_t *shard_of_handle(int global, int *local) {
+    if (global < 0 || shard_count == 0) {
+        return NULL;
+    }
+    *local = global / (int) shard_count;
+    return shards[(unsigned int) global % shard_count];
+}
+
+/* Copies a file between shards (clones across shards cannot share blocks)
+ * Returns 0 if successful, -1 otherwise */
+static int copy_across_shards(tfs_t *source_fs, char const *source_path, tfs_t *dest_fs,
+                              char const *dest_path) {
+    char buffer[BLOCK_SIZE];
+    ssize_t bytes_read;
+
+    if (tfs_lookup_in(dest_fs, dest_path) != -1) {
+        return -1;
+    }
+    int source = tfs_open_in(source_fs, source_path, 0);
+    if (source == -1) {
+        return -1;
+    }
+    int dest = tfs_open_in(dest_fs, dest_path, TFS_O_CREAT);
+    if (dest == -1) {
+        tfs_close_in(source_fs, source);
+        return -1;
+    }
+
+    int ret = 0;
+    while ((bytes_read = tfs_read_in(source_fs, source, buffer, sizeof(buffer))) > 0) {
+        if (tfs_write_in(dest_fs, dest, buffer, (size_t) bytes_read) != bytes_read) {
+            ret = -1;
+            break;
+        }
+    }
+    if (bytes_read == -1) {
+        ret = -1;
+    }
+    tfs_close_in(dest_fs, dest);
+    tfs_close_in(source_fs, source);
+    return ret;
+}
+
+int tfs_lookup(char const *name) {
+    trace_call_t call = {.op = TRACE_LOOKUP, .name = name};
+    trace_begin(&call);
+    unsigned int shard;
+    tfs_t *fs = shard_of_name(name, &shard);
+    int ret = fs == NULL ? -1 : shard_to_global(shard, tfs_lookup_in(fs, name));
+    trace_end(&call, ret);
+    return ret;
+}
+
+int tfs_open(char const *name, int flags) {
+    trace_call_t call = {.op = TRACE_OPEN, .name = name, .arg = flags};
+    trace_begin(&call);
+    unsigned int shard;
+    tfs_t *fs = shard_of_name(name, &shard);
+    int ret = fs == NULL ? -1 : shard_to_global(shard, tfs_open_in(fs, name, flags));
+    trace_end(&call, ret);
+    return ret;
+}
+
+int tfs_mkdir(char const *name) {
+    trace_call_t call = {.op = TRACE_MKDIR, .name = name};
+    trace_begin(&call);
+    unsigned int shard;
+    tfs_t *fs = shard_of_name(name, &shard);
+    int ret = fs == NULL ? -1 : tfs_mkdir_in(fs, name);
+    trace_end(&call, ret);
+    return ret;
+}
+
+int tfs_unlink(char const *name) {
+    trace_call_t call = {.op = TRACE_UNLINK, .name = name};
+    trace_begin(&call);
+    unsigned int shard;
+    tfs_t *fs = shard_of_name(name, &shard);
+    int ret = fs == NULL ? -1 : tfs_unlink_in(fs, name);
+    trace_end(&call, ret);
+    return ret;
+}
+
+int tfs_close(int fhandle) {
+    trace_call_t call = {.op = TRACE_CLOSE, .handle = fhandle};
+    trace_begin(&call);
+    int local;
+    tfs_t *fs = shard_of_handle(fhandle, &local);
+    int ret = fs == NULL ? -1 : tfs_close_in(fs, local);
+    trace_end(&call, ret);
+    return ret;
+}
+
+/* tfs_open_many for at most BATCH_GROUP_SIZE files: each shard opens its
+ * own at once; every file is traced as if opened alone */
+static int open_many_in_shards(char const *const *names, int flags, int *fhandles,
+                               size_t count) {
+    trace_call_t calls[BATCH_GROUP_SIZE];
+    unsigned int shard_of[BATCH_GROUP_SIZE];
+    for (size_t i = 0; i < count; i++) {
+        calls[i] = (trace_call_t){.op = TRACE_OPEN, .name = names[i], .arg = flags};
+        trace_begin(&calls[i]);
+        shard_of[i] = 0;
+        shard_of_name(names[i], &shard_of[i]);
+        fhandles[i] = -1;
+    }
+
+    int opened = 0;
+    for (unsigned int shard = 0; shard < shard_count; shard++) {
+        char const *shard_names[BATCH_GROUP_SIZE];
+        int local[BATCH_GROUP_SIZE];
+        size_t where[BATCH_GROUP_SIZE];
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (shard_of[i] == shard) {
+                shard_names[n] = names[i];
+                where[n++] = i;
+            }
+        }
+        if (n > 0) {
+            opened += tfs_open_many_in(shards[shard], shard_names, flags, local, n);
+        }
+        for (size_t k = 0; k < n; k++) {
+            fhandles[where[k]] = shard_to_global(shard, local[k]);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        trace_end(&calls[i], fhandles[i]);
+    }
+    return opened;
+}
+
+int tfs_open_many(char const *const *names, int flags, int *fhandles, size_t count) {
+    int opened = 0;
+    for (size_t start = 0; start < count; start += BATCH_GROUP_SIZE) {
+        size_t n = count - start < BATCH_GROUP_SIZE ? count - start : BATCH_GROUP_SIZE;
+        opened += open_many_in_shards(names + start, flags, fhandles + start, n);
+    }
+    return opened;
+}
+
+/* tfs_close_many for at most BATCH_GROUP_SIZE files, a shard at a time */
+static int close_many_in_shards(int const *fhandles, int *results, size_t count) {
+    trace_call_t calls[BATCH_GROUP_SIZE];
+    int local[BATCH_GROUP_SIZE];
+    tfs_t *fs_of[BATCH_GROUP_SIZE];
+    for (size_t i = 0; i < count; i++) {
+        calls[i] = (trace_call_t){.op = TRACE_CLOSE, .handle = fhandles[i]};
+        trace_begin(&calls[i]);
+        fs_of[i] = shard_of_handle(fhandles[i], &local[i]);
+        results[i] = -1;
+    }
+
+    for (unsigned int shard = 0; shard < shard_count; shard++) {
+        int shard_handles[BATCH_GROUP_SIZE];
+        int shard_results[BATCH_GROUP_SIZE];
+        size_t where[BATCH_GROUP_SIZE];
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (fs_of[i] != NULL && fs_of[i] == shards[shard]) {
+                shard_handles[n] = local[i];
+                where[n++] = i;
+            }
+        }
+        if (n > 0) {
+            tfs_close_many_in(shards[shard], shard_handles, shard_results, n);
+        }
+        for (size_t k = 0; k < n; k++) {
+            results[where[k]] = shard_results[k];
+        }
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < count; i++) {
+        trace_end(&calls[i], results[i]);
+        if (results[i] == -1) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+int tfs_close_many(int const *fhandles, int *results, size_t count) {
+    int ret = 0;
+    for (size_t start = 0; start < count; start += BATCH_GROUP_SIZE) {
+        int group_results[BATCH_GROUP_SIZE];
+        size_t n = count - start < BATCH_GROUP_SIZE ? count - start : BATCH_GROUP_SIZE;
+        if (close_many_in_shards(fhandles + start, group_results, n) == -1) {
+            ret = -1;
+        }
+        if (results != NULL) {
+            memcpy(results + start, group_results, n * sizeof(int));
+        }
+    }
+    return ret;
+}
+
+int tfs_batch(tfs_batch_op_t *ops, size_t count) { return batch_run(NULL, ops, count); }
+
+ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
+    trace_call_t call = {.op = TRACE_WRITE, .handle = fhandle, .size = to_write};
+    int local;
+    tfs_t *fs = shard_of_handle(fhandle, &local);
+    size_t *offset = trace_begin(&call) ? &call.offset : NULL;
+    ssize_t ret = fs == NULL ? -1 : file_write(fs, local, buffer, to_write, offset);
+    trace_end(&call, ret);
+    return ret;
+}
+
+ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
+    trace_call_t call = {.op = TRACE_READ, .handle = fhandle, .size = len};
+    int local;
+    tfs_t *fs = shard_of_handle(fhandle, &local);
+    size_t *offset = trace_begin(&call) ? &call.offset : NULL;
+    ssize_t ret = fs == NULL ? -1 : file_read(fs, local, buffer, len, offset);
+    trace_end(&call, ret);
+    return ret;
+}
+
+int tfs_copy_to_external_fs(char const *source_path, char const *dest_path) {
+    trace_call_t call = {.op = TRACE_COPY_TO_EXTERNAL, .name = source_path, .name2 = dest_path};
+    trace_begin(&call);
+    unsigned int shard;
+    tfs_t *fs = shard_of_name(source_path, &shard);
+    int ret = fs == NULL ? -1 : tfs_copy_to_external_fs_in(fs, source_path, dest_path);
+    trace_end(&call, ret);
+    return ret;
+}
+
+ssize_t tfs_get_file_size(int fhandle) {
+    trace_call_t call = {.op = TRACE_GET_FILE_SIZE, .handle = fhandle};
+    trace_begin(&call);
+    int local;
+    tfs_t *fs = shard_of_handle(fhandle, &local);
+    ssize_t ret = fs == NULL ? -1 : tfs_get_file_size_in(fs, local);
+    trace_end(&call, ret);
+    return ret;
+}
+
+int tfs_set_checksum_mode(checksum_mode_t mode) {
+    trace_call_t call = {.op = TRACE_SET_CHECKSUM_MODE, .arg = (int) mode};
+    trace_begin(&call);
+    int ret = shard_count == 0 ? -1 : 0;
+    for (unsigned int i = 0; i < shard_count; i++) {
+        if (tfs_set_checksum_mode_in(shards[i], mode) == -1) {
+            ret = -1;
+        }
+    }
+    trace_end(&call, ret);
+    return ret;
+}
+
+int tfs_set_compression(int enabled) {
+    trace_call_t call = {.op = TRACE_SET_COMPRESSION, .arg = enabled};
+    trace_begin(&call);
+    int ret = shard_count == 0 ? -1 : 0;
+    for (unsigned int i = 0; i < shard_count; i++) {
+        if (tfs_set_compression_in(shards[i], enabled) == -1) {
+            ret = -1;
+        }
+    }
+    trace_end(&call, ret);
+    return ret;
+}
+
+int tfs_set_dedup(int enabled) {
+    trace_call_t call = {.op = TRACE_SET_DEDUP, .arg = enabled};
+    trace_begin(&call);
+    int ret = shard_count == 0 ? -1 : 0;
+    for (unsigned int i = 0; i < shard_count; i++) {
+        if (tfs_set_dedup_in(shards[i], enabled) == -1) {
+            ret = -1;
+        }
+    }
+    trace_end(&call, ret);
+    return ret;
+}
+
+int tfs_set_huge_pages(int enabled) {
+    trace_call_t call = {.op = TRACE_SET_HUGE_PAGES, .arg = enabled};
+    trace_begin(&call);
+    atomic_store(&use_huge_pages, enabled != 0);
+    trace_end(&call, 0);
+    return 0;
+}
+
+static int clone_in_shards(char const *source_path, char const *dest_path) {
+    unsigned int source_shard, dest_shard;
+    tfs_t *source_fs = shard_of_name(source_path, &source_shard);
+    tfs_t *dest_fs = shard_of_name(dest_path, &dest_shard);
+    if (source_fs == NULL || !valid_pathname(source_path) || !valid_pathname(dest_path)) {
+        return -1;
+    }
+
+    if (source_fs == dest_fs) {
+        return tfs_clone_in(source_fs, source_path, dest_path);
+    }
+    return copy_across_shards(source_fs, source_path, dest_fs, dest_path);
+}
+
+int tfs_clone(char const *source_path, char const *dest_path) {
+    trace_call_t call = {.op = TRACE_CLONE, .name = source_path, .name2 = dest_path};
+    trace_begin(&call);
+    int ret = clone_in_shards(source_path, dest_path);
+    trace_end(&call, ret);
+    return ret;
+}
+
+/* Releases a chain of snapshots
+ * Returns: 0 if successful, -1 otherwise */
+static int release_snapshots(snapshot_t *snapshot) {
+    if (snapshot == NULL) {
+        return -1;
+    }
+    while (snapshot != NULL) {
+        snapshot_t *next = snapshot->next;
+        snapshot_destroy(snapshot);
+        snapshot = next;
+    }
+    return 0;
+}
+
+/* Takes one snapshot per shard, chained in shard order
+ * Returns: the first one if successful, NULL otherwise */
+static snapshot_t *snapshot_shards() {
+    snapshot_t *first = NULL;
+    for (unsigned int i = shard_count; i-- > 0;) {
+        snapshot_t *snapshot = tfs_snapshot_in(shards[i]);
+        if (snapshot == NULL) {
+            release_snapshots(first);
+            return NULL;
+        }
+        snapshot->next = first;
+        first = snapshot;
+    }
+    return first;
+}
+
+snapshot_t *tfs_snapshot() {
+    trace_call_t call = {.op = TRACE_SNAPSHOT};
+    trace_begin(&call);
+    snapshot_t *snapshot = snapshot_shards();
+    trace_end(&call, trace_object(snapshot));
+    return snapshot;
+}
+
+/* Reads from a file as it was in a snapshot (see tfs_snapshot_read) */
+static ssize_t read_snapshot(snapshot_t *snapshot, char const *name, size_t offset,
+                             void *buffer, size_t len) {
+    unsigned int shard = 0;
+    if (snapshot == NULL || !valid_pathname(name)) {
+        return -1;
+    }
+
+    /* Snapshots taken by tfs_snapshot_in are not chained */
+    if (snapshot->next != NULL && shard_of_name(name, &shard) != NULL) {
+        for (; shard > 0 && snapshot->next != NULL; shard--) {
+            snapshot = snapshot->next;
+        }
+    }
+    return snapshot_read(snapshot, name + 1, offset, buffer, len);
+}
+
+ssize_t tfs_snapshot_read(snapshot_t *snapshot, char const *name, size_t offset, void *buffer,
+                          size_t len) {
+    trace_call_t call = {.op = TRACE_SNAPSHOT_READ,
+                         .name = name,
+                         .object = snapshot,
+                         .size = len,
+                         .offset = offset};
+    trace_begin(&call);
+    ssize_t ret = read_snapshot(snapshot, name, offset, buffer, len);
+    trace_end(&call, ret);
+    return ret;
+}
+
+int tfs_snapshot_release(snapshot_t *snapshot) {
+    trace_call_t call = {.op = TRACE_SNAPSHOT_RELEASE, .object = snapshot};
+    trace_begin(&call);
+    int ret = release_snapshots(snapshot);
+    trace_end(&call, ret);
+    return ret;
+}
+
+/* Lists a directory of a shard, with i-node numbers as callers see them
+ * Returns the listing if successful, NULL otherwise */
+static dir_listing_t *opendir_in_shard(unsigned int shard, char const *name) {
+    dir_listing_t *listing = tfs_opendir_in(shards[shard], name);
+    for (size_t i = 0; listing != NULL && i < listing->count; i++) {
+        listing->entries[i].inumber = shard_to_global(shard, listing->entries[i].inumber);
+    }
+    return listing;
+}
+
+/* Frees a chain of listings
+ * Returns: 0 if successful, -1 otherwise */
+static int free_listings(dir_listing_t *listing) {
+    if (listing == NULL) {
+        return -1;
+    }
+    while (listing != NULL) {
+        dir_listing_t *next = listing->next;
+        free(listing);
+        listing = next;
+    }
+    return 0;
+}
+
+/* Lists a directory, in every shard if it is the root directory
+ * Returns the listing if successful, NULL otherwise */
+static dir_listing_t *opendir_in_shards(char const *name) {
+    unsigned int shard;
+    if (name == NULL || strcmp(name, "/") != 0) {
+        return shard_of_name(name, &shard) == NULL ? NULL : opendir_in_shard(shard, name);
+    }
+
+    /* The root directory: one listing per shard, chained in shard order */
+    dir_listing_t *first = NULL;
+    for (unsigned int i = shard_count; i-- > 0;) {
+        dir_listing_t *listing = opendir_in_shard(i, name);
+        if (listing == NULL) {
+            free_listings(first);
+            return NULL;
+        }
+        listing->next = first;
+        first = listing;
+    }
+    return first;
+}
+
+dir_listing_t *tfs_opendir(char const *name) {
+    trace_call_t call = {.op = TRACE_OPENDIR, .name = name};
+    trace_begin(&call);
+    dir_listing_t *listing = opendir_in_shards(name);
+    trace_end(&call, trace_object(listing));
+    return listing;
+}
+
+ssize_t tfs_readdir_plus(dir_listing_t *listing, dir_listing_entry_t *entries, size_t len) {
+    trace_call_t call = {.op = TRACE_READDIR_PLUS, .object = listing, .size = len};
+    trace_begin(&call);
+    ssize_t copied = listing == NULL ? -1 : 0;
+    for (; listing != NULL && (size_t) copied < len; listing = listing->next) {
+        while (listing->position < listing->count && (size_t) copied < len) {
+            entries[copied++] = listing->entries[listing->position++];
+        }
+    }
+    trace_end(&call, copied);
+    return copied;
+}
+
+int tfs_closedir(dir_listing_t *listing) {
+    trace_call_t call = {.op = TRACE_CLOSEDIR, .object = listing};
+    trace_begin(&call);
+    int ret = free_listings(listing);
+    trace_end(&call, ret);
+    return ret;
+}
+
+int tfs_journal_open(char const *path, unsigned int commit_interval_us) {
+    char shard_path[MAX_PATH_NAME];
+
+    if (path == NULL || shard_count == 0) {
+        return -1;
+    }
+    /* Each shard journals to its own file: the path name, followed by the
+     * shard's number if there is more than one */
+    for (unsigned int i = 0; i < shard_count; i++) {
+        int len = shard_count == 1 ? snprintf(shard_path, sizeof(shard_path), "%s", path)
+                                   : snprintf(shard_path, sizeof(shard_path), "%s.%u", path, i);
+        if (len < 0 || (size_t) len >= sizeof(shard_path) ||
+            tfs_journal_open_in(shards[i], shard_path, commit_interval_us) == -1) {
+            while (i-- > 0) {
+                tfs_journal_close_in(shards[i]);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int tfs_journal_close() {
+    int ret = shard_count == 0 ? -1 : 0;
+    for (unsigned int i = 0; i < shard_count; i++) {
+        if (tfs_journal_close_in(shards[i]) == -1) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+int tfs_trace_open(char const *path) {
+    return path == NULL || shard_count == 0 ? -1 : trace_open(path, shard_count);
+}
+
+int tfs_trace_close() { return trace_close(); }
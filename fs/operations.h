@@ -9,20 +9,116 @@ enum {
     TFS_O_CREAT = 0b001,
     TFS_O_TRUNC = 0b010,
     TFS_O_APPEND = 0b100,
+    TFS_O_COMPRESS = 0b1000,
 };
 
+typedef enum {
+    TFS_BATCH_LOOKUP,
+    TFS_BATCH_OPEN,
+    TFS_BATCH_CLOSE,
+    TFS_BATCH_MKDIR,
+    TFS_BATCH_UNLINK,
+} tfs_batch_kind_t;
+
+/* An operation of a batch (see tfs_batch) */
+typedef struct {
+    tfs_batch_kind_t op;
+    char const *name; /* lookup, open, mkdir, unlink */
+    int flags;        /* open */
+    int fhandle;      /* close */
+    int ret;          /* set by tfs_batch: what the call alone would return */
+} tfs_batch_op_t;
+
 /*
- * Initializes tecnicofs
+ * Initializes tecnicofs: creates the default volume, which the functions
+ * below operate on (see tfs_mount for other volumes)
  * Returns 0 if successful, -1 otherwise.
  */
 int tfs_init();
 
 /*
- * Destroy tecnicofs
+ * Initializes tecnicofs in sharded mode: instead of a single default
+ * volume, the functions below spread path names over several volumes
+ * (shards), each with its own i-node table, block allocator and root
+ * directory, by hashing their first component. Files in different shards
+ * are created and allocated without contending on any lock, and each shard
+ * adds to the capacity of the file system.
+ * Input:
+ *  - number of shards (between 1 and MAX_SHARDS; tfs_init uses 1)
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_init_sharded(unsigned int count);
+
+/*
+ * Destroy tecnicofs (the default volume, or every shard)
  * Returns 0 if successful, -1 otherwise.
  */
 int tfs_destroy();
 
+/*
+ * Creates a new, empty volume, with nothing in common with any other: a
+ * process can host several of them. Each function below has a variant
+ * ending in _in that operates on a given volume instead of the default one,
+ * taking it as its first argument.
+ * Returns the volume if successful, NULL otherwise.
+ */
+tfs_t *tfs_mount();
+
+/*
+ * Destroys a volume created by tfs_mount (no operation on it may be in
+ * progress)
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_unmount(tfs_t *fs);
+
+/*
+ * Mounts a volume from an image written by tfs_save_in (e.g. by mkfs.tfs),
+ * which must have the geometry (BLOCK_SIZE, DATA_BLOCKS, INODE_TABLE_SIZE)
+ * this file system was built with
+ * Input:
+ *  - path name of the image, in the external file system
+ * Returns the volume if successful, NULL otherwise.
+ */
+tfs_t *tfs_load(char const *path);
+
+/*
+ * Mounts a volume from an image, like tfs_load, and brings it up to date
+ * with the journal started (by tfs_journal_open_in) after the image was
+ * saved: the operations whose records were all made durable are applied,
+ * in the order they were made in; one cut short by a crash is not. File
+ * contents are not journaled: blocks written since the image was saved
+ * read as zeros.
+ * Input:
+ *  - path name of the image, in the external file system
+ *  - path name of the journal file, in the external file system
+ * Returns the volume if successful, NULL otherwise.
+ */
+tfs_t *tfs_recover(char const *image_path, char const *journal_path);
+
+/*
+ * Writes a volume to an image, for tfs_load to mount again later (no
+ * operation on it may be in progress, and no file open)
+ * Input:
+ *  - path name of the image, in the external file system
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_save_in(tfs_t *fs, char const *path);
+
+/*
+ * Gathers allocation and fragmentation statistics about a volume (no
+ * operation on it may be in progress)
+ * Input:
+ *  - statistics to fill in
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_stats_in(tfs_t *fs, volume_stats_t *stats);
+
+/*
+ * Returns the default volume, which is the first shard in sharded mode
+ * (NULL before tfs_init)
+ */
+tfs_t *tfs_default();
+
 /*
  * Waits until no file is open and then destroy tecnicofs 
  * Returns 0 if successful, -1 otherwise.
@@ -31,10 +127,9 @@ int tfs_destroy_after_all_closed();
 
 
 /*
- * Looks for a file
- * Note: as a simplification, only a plain directory space (root directory only)
- * is supported Input:
- *  - name: absolute path name
+ * Looks for a file or directory
+ * Input:
+ *  - name: absolute path name (e.g. "/dir/file")
  * Returns the inumber of the file, -1 if unsuccessful
  */
 int tfs_lookup(char const *name);
@@ -47,9 +142,25 @@ int tfs_lookup(char const *name);
  *    - append mode (TFS_O_APPEND)
  *    - truncate file contents (TFS_O_TRUNC)
  *    - create file if it does not exist (TFS_O_CREAT)
+ *    - store the file compressed, if it is created (TFS_O_COMPRESS)
  */
 int tfs_open(char const *name, int flags);
 
+/* Creates a directory
+ * Input:
+ *  - path name of the new directory (its parent must exist)
+ *  Returns 0 if successful, -1 otherwise
+ */
+int tfs_mkdir(char const *name);
+
+/* Removes a file's name. Handles already open on it keep working; its
+ * contents are freed once the last of them is closed.
+ * Input:
+ *  - path name of the file
+ *  Returns 0 if successful, -1 otherwise
+ */
+int tfs_unlink(char const *name);
+
 /* Closes a file
  * Input:
  * 	- file handle (obtained from a previous call to tfs_open)
@@ -57,6 +168,37 @@ int tfs_open(char const *name, int flags);
  */
 int tfs_close(int fhandle);
 
+/* Opens several files, with the same flags, paying for locks, epoch
+ * sections and journal flushes once for them all (or once per directory,
+ * for files it creates) rather than once per file
+ * Input:
+ *  - path names of the files
+ *  - flags (as in tfs_open)
+ *  - handles: set to each file's handle, or to -1 if it was not opened
+ *  - number of files
+ *  Returns the number of files opened
+ */
+int tfs_open_many(char const *const *names, int flags, int *fhandles, size_t count);
+
+/* Closes several files at once
+ * Input:
+ *  - file handles (obtained from previous calls to tfs_open)
+ *  - results: set to 0 for each file closed, -1 for the others (unless NULL)
+ *  - number of files
+ *  Returns 0 if every file was closed, -1 otherwise
+ */
+int tfs_close_many(int const *fhandles, int *results, size_t count);
+
+/* Carries out a sequence of operations, in order; consecutive opens (with
+ * the same flags) and closes are done together, as in tfs_open_many and
+ * tfs_close_many
+ * Input:
+ *  - operations, whose results are set to what each call alone would return
+ *  - number of operations
+ *  Returns 0 if every operation succeeded, -1 otherwise
+ */
+int tfs_batch(tfs_batch_op_t *ops, size_t count);
+
 /* Writes to an open file, starting at the current offset
  * Input:
  * 	- file handle (obtained from a previous call to tfs_open)
@@ -96,4 +238,168 @@ int tfs_copy_to_external_fs(char const *source_path, char const *dest_path);
 */
 ssize_t tfs_get_file_size(int fhandle);
 
+/* Selects how data block checksums (CRC32C) are maintained
+ * Input:
+ *  - mode: CHECKSUM_OFF, CHECKSUM_UPDATE (the default) or CHECKSUM_VERIFY,
+ *    in which case reads of corrupted blocks fail
+ *  Returns 0 if successful, -1 otherwise
+ */
+int tfs_set_checksum_mode(checksum_mode_t mode);
+
+/* Selects whether every file created from now on is stored compressed
+ * (as if opened with TFS_O_COMPRESS)
+ * Input:
+ *  - enabled: non-zero to compress new files, 0 otherwise
+ *  Returns 0 if successful, -1 otherwise
+ */
+int tfs_set_compression(int enabled);
+
+/* Selects whether identical data blocks are shared between (uncompressed)
+ * files; shared blocks are copied again when one of the files modifies them
+ * Input:
+ *  - enabled: non-zero to deduplicate blocks on write, 0 otherwise
+ *  Returns 0 if successful, -1 otherwise
+ */
+int tfs_set_dedup(int enabled);
+
+/* Selects whether volumes mounted from now on (by tfs_mount, tfs_init or
+ * tfs_init_sharded) keep their data blocks in huge pages, which spares
+ * accesses spread over a large volume most TLB misses. Reserved huge pages
+ * are used if the system has any, else transparent ones; without either,
+ * regular pages are used all the same.
+ * Input:
+ *  - enabled: non-zero to use huge pages (the default), 0 otherwise
+ *  Returns 0 if successful, -1 otherwise
+ */
+int tfs_set_huge_pages(int enabled);
+
+/* Returns the kind of pages a volume's data blocks ended up in */
+page_kind_t tfs_data_pages_in(tfs_t *fs);
+
+/* Creates a file that shares the contents of an existing one, without
+ * copying any data: the blocks are copied only when either file modifies
+ * them (copy-on-write). In sharded mode, files in different shards cannot
+ * share blocks, so the contents are copied instead.
+ * Input:
+ *  - path name of the existing file
+ *  - path name of the new file (which must not exist)
+ *  Returns 0 if successful, -1 otherwise
+ */
+int tfs_clone(char const *source_path, char const *dest_path);
+
+/* Takes a consistent snapshot of every file, in every directory; writers
+ * may carry on while the snapshot is read. In sharded mode, each shard is
+ * captured at a consistent point of its own.
+ *  Returns the snapshot if successful, NULL otherwise
+ */
+snapshot_t *tfs_snapshot();
+
+/* Reads from a file as it was when a snapshot was taken
+ * Input:
+ *  - snapshot (obtained from a previous call to tfs_snapshot)
+ *  - path name of the file
+ *  - offset to start reading at
+ *  - destination buffer
+ *  - length of the buffer
+ *  Returns the number of bytes read, or -1 in case of error
+ */
+ssize_t tfs_snapshot_read(snapshot_t *snapshot, char const *name, size_t offset, void *buffer,
+                          size_t len);
+
+/* Releases a snapshot
+ * Input:
+ *  - snapshot (obtained from a previous call to tfs_snapshot)
+ *  Returns 0 if successful, -1 otherwise
+ */
+int tfs_snapshot_release(snapshot_t *snapshot);
+
+/* Opens a directory for listing: its entries are captured at once, with
+ * the type and size of each, so that a scan needs no lookup, open or close
+ * per file. In sharded mode, the root directory lists every shard's.
+ * Input:
+ *  - path name of the directory ("/" for the root)
+ *  Returns the listing if successful, NULL otherwise
+ */
+dir_listing_t *tfs_opendir(char const *name);
+
+/* Reads the next entries of a directory listing (which must not be read
+ * from several threads at the same time)
+ * Input:
+ *  - listing (obtained from a previous call to tfs_opendir)
+ *  - destination buffer, for up to len entries (name, i-node number as
+ *    returned by tfs_lookup, type and size)
+ *  - length of the buffer
+ *  Returns the number of entries read (0 once all were read), or -1 in
+ *  case of error
+ */
+ssize_t tfs_readdir_plus(dir_listing_t *listing, dir_listing_entry_t *entries, size_t len);
+
+/* Releases a directory listing
+ * Input:
+ *  - listing (obtained from a previous call to tfs_opendir)
+ *  Returns 0 if successful, -1 otherwise
+ */
+int tfs_closedir(dir_listing_t *listing);
+
+/* Starts journaling metadata updates (new files, directory entries, block
+ * allocations, sizes and truncations) to a file; each operation's updates
+ * form a transaction, flushed as a whole, and operations that update
+ * metadata only return once it is durable (see tfs_recover). Concurrent operations share
+ * flushes (group commit). In sharded mode, each shard has its own journal,
+ * named after the given path and the shard's number (e.g. "tfs.journal.2").
+ * Input:
+ *  - path name of the journal file, in the external file system
+ *  - commit interval: how long (in microseconds) a flush waits for other
+ *    operations to join it; longer intervals trade latency for fewer flushes
+ *  Returns 0 if successful, -1 otherwise
+ */
+int tfs_journal_open(char const *path, unsigned int commit_interval_us);
+
+/* Flushes any pending records and stops journaling (also done by
+ * tfs_destroy). Neither this nor tfs_journal_open may run concurrently with
+ * other operations.
+ *  Returns 0 if successful, -1 otherwise
+ */
+int tfs_journal_close();
+
+/* Starts recording every call to the functions above that take no volume
+ * (file handles, sizes, offsets, path names, results, timings and calling
+ * threads) to a compact binary trace, which tfs-replay can issue again
+ * against a new file system. Calls cost next to nothing while no trace is
+ * open.
+ * Input:
+ *  - path name of the trace, in the external file system
+ *  Returns 0 if successful, -1 otherwise (e.g. if a trace is already open)
+ */
+int tfs_trace_open(char const *path);
+
+/* Stops tracing (also done by tfs_destroy). Neither this nor
+ * tfs_trace_open may run concurrently with other operations.
+ *  Returns 0 if successful, -1 otherwise
+ */
+int tfs_trace_close();
+
+/* Variants of the functions above that operate on a given volume */
+int tfs_lookup_in(tfs_t *fs, char const *name);
+int tfs_open_in(tfs_t *fs, char const *name, int flags);
+int tfs_mkdir_in(tfs_t *fs, char const *name);
+int tfs_unlink_in(tfs_t *fs, char const *name);
+int tfs_close_in(tfs_t *fs, int fhandle);
+int tfs_open_many_in(tfs_t *fs, char const *const *names, int flags, int *fhandles,
+                     size_t count);
+int tfs_close_many_in(tfs_t *fs, int const *fhandles, int *results, size_t count);
+int tfs_batch_in(tfs_t *fs, tfs_batch_op_t *ops, size_t count);
+ssize_t tfs_write_in(tfs_t *fs, int fhandle, void const *buffer, size_t len);
+ssize_t tfs_read_in(tfs_t *fs, int fhandle, void *buffer, size_t len);
+int tfs_copy_to_external_fs_in(tfs_t *fs, char const *source_path, char const *dest_path);
+ssize_t tfs_get_file_size_in(tfs_t *fs, int fhandle);
+int tfs_set_checksum_mode_in(tfs_t *fs, checksum_mode_t mode);
+int tfs_set_compression_in(tfs_t *fs, int enabled);
+int tfs_set_dedup_in(tfs_t *fs, int enabled);
+int tfs_clone_in(tfs_t *fs, char const *source_path, char const *dest_path);
+snapshot_t *tfs_snapshot_in(tfs_t *fs);
+dir_listing_t *tfs_opendir_in(tfs_t *fs, char const *name);
+int tfs_journal_open_in(tfs_t *fs, char const *path, unsigned int commit_interval_us);
+int tfs_journal_close_in(tfs_t *fs);
+
 #endif // OPERATIONS_H
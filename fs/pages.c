@@ -0,0 +1,66 @@
+#define _GNU_SOURCE
+#include "pages.h"
+#include "config.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+/* Regions span whole huge pages, whichever kind they end up with */
+static size_t round_to_huge_pages(size_t size) {
+    return (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+}
+
+/*
+ * Maps a zero-filled region of memory
+ * Input:
+ *  - size: in bytes
+ *  - huge: whether to back it with huge pages if possible: reserved ones,
+ *    else transparent ones, else (e.g. if neither is available) regular
+ *    pages; if not, it is kept on regular pages even where the kernel would
+ *    use transparent huge pages on its own
+ *  - kind: set to the kind of pages the region ended up with
+ * Returns: the region if successful, NULL otherwise
+ */
+void *pages_alloc(size_t size, bool huge, page_kind_t *kind) {
+    size = round_to_huge_pages(size);
+    if (!huge) {
+        void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            return NULL;
+        }
+        madvise(region, size, MADV_NOHUGEPAGE);
+        *kind = PAGES_SMALL;
+        return region;
+    }
+
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (region != MAP_FAILED) {
+        *kind = PAGES_HUGETLB;
+        return region;
+    }
+
+    /* Over-map, so that the region can start on a huge page boundary, and
+     * give back what is left on either side */
+    char *mapped = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return NULL;
+    }
+    size_t head = (HUGE_PAGE_SIZE - (uintptr_t) mapped % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+    if (head > 0) {
+        munmap(mapped, head);
+    }
+    munmap(mapped + head + size, HUGE_PAGE_SIZE - head);
+    region = mapped + head;
+
+    *kind = madvise(region, size, MADV_HUGEPAGE) == 0 ? PAGES_TRANSPARENT_HUGE : PAGES_SMALL;
+    return region;
+}
+
+/*
+ * Unmaps a region mapped by pages_alloc
+ * Input:
+ *  - region, and the size it was allocated with
+ */
+void pages_free(void *region, size_t size) { munmap(region, round_to_huge_pages(size)); }
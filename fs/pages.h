@@ -0,0 +1,23 @@
+#ifndef PAGES_H
+#define PAGES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Memory for large, randomly accessed regions (a volume's data blocks):
+ * backed by huge pages when possible, so that accesses spread over the
+ * region do not miss the TLB on every other page
+ */
+
+typedef enum {
+    PAGES_SMALL,            /* regular pages */
+    PAGES_TRANSPARENT_HUGE, /* regular pages the kernel is asked to back
+                               with huge ones (MADV_HUGEPAGE) */
+    PAGES_HUGETLB,          /* reserved huge pages (MAP_HUGETLB) */
+} page_kind_t;
+
+void *pages_alloc(size_t size, bool huge, page_kind_t *kind);
+void pages_free(void *region, size_t size);
+
+#endif // PAGES_H
@@ -0,0 +1,52 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+/*
+ * Messages exchanged between tfs_server and its clients, over a Unix
+ * domain stream socket. A request is a header followed by its payload (a
+ * path name, two path names, or the data to write), and is answered by a
+ * response header followed, for reads, by the data read. A client may send
+ * several requests before reading any response (pipelining): responses
+ * come back in the same order.
+ *
+ * Large reads and writes may instead go through a region of memory shared
+ * by the client and the server (attached once per connection, by passing a
+ * sealed memfd along with a PROTOCOL_ATTACH request): the request only
+ * says where in the region the data is, and the server copies it straight
+ * between the region and the file system.
+ */
+
+typedef enum {
+    PROTOCOL_LOOKUP = 1, /* payload: path name */
+    PROTOCOL_OPEN,       /* arg: flags, payload: path name */
+    PROTOCOL_MKDIR,      /* payload: path name */
+    PROTOCOL_UNLINK,     /* payload: path name */
+    PROTOCOL_CLOSE,      /* arg: file handle */
+    PROTOCOL_WRITE,      /* arg: file handle, payload: data */
+    PROTOCOL_READ,       /* arg: file handle, length: bytes to read */
+    PROTOCOL_SIZE,       /* arg: file handle */
+    PROTOCOL_CLONE,      /* payload: source and destination path names */
+    PROTOCOL_ATTACH,     /* length: size of the shared region (its fd comes along) */
+    PROTOCOL_WRITE_SHARED, /* arg: file handle, length: bytes, offset: data in the region */
+    PROTOCOL_READ_SHARED,  /* arg: file handle, length: bytes, offset: room in the region */
+} protocol_op_t;
+
+/* Path names in payloads are null-terminated */
+typedef struct {
+    uint32_t op;
+    int32_t arg;
+    uint32_t length; /* bytes of payload, or bytes to read */
+    uint32_t offset; /* in the shared region */
+} protocol_request_t;
+
+/* ret is what the operation returned; for reads, that many bytes follow */
+typedef struct {
+    int64_t ret;
+} protocol_response_t;
+
+/* Largest payload (and read) in a single request */
+#define PROTOCOL_MAX_PAYLOAD (1 << 20)
+
+#endif // PROTOCOL_H
@@ -1,922 +1,3028 @@
-#include "state.h"
-
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-
-
-/* Persistent FS state  (in reality, it should be maintained in secondary
- * memory; for simplicity, this project maintains it in primary memory) */
-
-/* I-node table */
-pthread_rwlock_t inode_table_mutex = PTHREAD_RWLOCK_INITIALIZER;
-static inode_t inode_table[INODE_TABLE_SIZE];
-pthread_rwlock_t freeinode_ts_mutex = PTHREAD_RWLOCK_INITIALIZER;
-static char freeinode_ts[INODE_TABLE_SIZE];
-
-/* Data blocks */
-pthread_rwlock_t fs_data_mutex = PTHREAD_RWLOCK_INITIALIZER;
-static char fs_data[BLOCK_SIZE * DATA_BLOCKS];
-pthread_rwlock_t free_blocks_mutex = PTHREAD_RWLOCK_INITIALIZER;
-static char free_blocks[DATA_BLOCKS];
-
-/* Volatile FS state */
-static open_file_entry_t open_file_table[MAX_OPEN_FILES];
-pthread_rwlock_t free_open_file_entries_mutex = PTHREAD_RWLOCK_INITIALIZER;
-static char free_open_file_entries[MAX_OPEN_FILES];
-
-static inline bool valid_inumber(int inumber) {
-    return inumber >= 0 && inumber < INODE_TABLE_SIZE;
-}
-
-static inline bool valid_block_number(int block_number) {
-    return block_number >= 0 && block_number < DATA_BLOCKS;
-}
-
-static inline bool valid_file_handle(int file_handle) {
-    return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
-}
-
-/**
- * We need to defeat the optimizer for the insert_delay() function.
- * Under optimization, the empty loop would be completely optimized away.
- * This function tells the compiler that the assembly code being run (which is
- * none) might potentially change *all memory in the process*.
- *
- * This prevents the optimizer from optimizing this code away, because it does
- * not know what it does and it may have side effects.
- *
- * Reference with more information: https://youtu.be/nXaxk27zwlk?t=2775
- *
- * Exercise: try removing this function and look at the assembly generated to
- * compare.
- */
-static void touch_all_memory() { __asm volatile("" : : : "memory"); }
-
-/*
- * Auxiliary function to insert a delay.
- * Used in accesses to persistent FS state as a way of emulating access
- * latencies as if such data structures were really stored in secondary memory.
- */
-static void insert_delay() {
-    for (int i = 0; i < DELAY; i++) {
-        touch_all_memory();
-    }
-}
-
-/*
- * Initializes FS state
- */
-void state_init() {
-    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        freeinode_ts[i] = FREE;
-    }
-
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        free_blocks[i] = FREE;
-    }
-
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        free_open_file_entries[i] = FREE;
-    }
-}
-
-void state_destroy() {
-    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        if (freeinode_ts[i] == TAKEN) {
-            inode_delete(i);
-        }
-    }
-
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries[i] == TAKEN) {
-            open_file_entry_t *file = get_open_file_entry(i);
-            pthread_rwlock_destroy(&file->of_lock);
-            remove_from_open_file_table(i);
-        }
-    }
-
-    pthread_rwlock_destroy(&inode_table_mutex);
-    pthread_rwlock_destroy(&freeinode_ts_mutex);
-    pthread_rwlock_destroy(&fs_data_mutex);
-    pthread_rwlock_destroy(&free_blocks_mutex);
-    pthread_rwlock_destroy(&free_open_file_entries_mutex);
-}
-
-/*
- * Checks how much free memory (in bytes) there is left on TFS
- * Returns:
- *  number of bytes
- */
-int get_free_memory() {
-    int size = 0;
-
-    pthread_rwlock_rdlock(&free_blocks_mutex);
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        if (free_blocks[i] == FREE) {
-            size = size + BLOCK_SIZE;
-        }
-    }
-    pthread_rwlock_unlock(&free_blocks_mutex);
-    return size;
-}
-
-/*
- * Allocs an inode's first direct data block
- * Input:
- *  - inumber
- * Returns:
- *  0 if successful, -1 if an error occured
- */
-int inode_alloc_first_block(int inumber) {
-    if (!valid_inumber(inumber)) {
-        return -1;
-    }
-
-    int b = data_block_alloc();
-    if (b == -1) {
-        pthread_rwlock_wrlock(&freeinode_ts_mutex);
-        freeinode_ts[inumber] = FREE;
-        pthread_rwlock_unlock(&freeinode_ts_mutex);
-        return -1;
-    }
-
-    inode_table[inumber].i_data_block[0] = b;
-    return 0;
-}
-
-/*
- * Creates a new i-node in the i-node table.
- * Input:
- *  - n_type: the type of the node (file or directory)
- * Returns:
- *  new i-node's number if successfully created, -1 otherwise
- */
-int inode_create(inode_type n_type) {
-
-
-    for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if ((inumber * (int) sizeof(allocation_state_t)) == 0) {
-            insert_delay(); // simulate storage access delay (to freeinode_ts)
-        }
-
-        pthread_rwlock_wrlock(&freeinode_ts_mutex);
-
-        /* Finds first free entry in i-node table */
-        if (freeinode_ts[inumber] == FREE) {
-            /* Found a free entry, so takes it for the new i-node*/
-            freeinode_ts[inumber] = TAKEN;
-            pthread_rwlock_unlock(&freeinode_ts_mutex);
-            insert_delay(); // simulate storage access delay (to i-node)
-            inode_table[inumber].i_node_type = n_type;
-
-            //Allocate memory for first data block
-            inode_table[inumber].i_data_block = (int *) malloc(sizeof(int) * 1);
-            if (inode_table[inumber].i_data_block == NULL) { //Out of memory
-
-                return -1;
-            }
-            inode_table[inumber].number_of_blocks = 1;
-            inode_table[inumber].number_indirect_blocks = 0;
-            inode_table[inumber].indirection_block = -1;
-            pthread_rwlock_init(&inode_table[inumber].i_lock, NULL);
-
-            if (n_type == T_DIRECTORY) {
-                //Allocate memory for first data block
-                int b = data_block_alloc();
-                if (b == -1) {
-                    pthread_rwlock_wrlock(&freeinode_ts_mutex);
-                    freeinode_ts[inumber] = FREE;
-                    pthread_rwlock_unlock(&freeinode_ts_mutex);
-                    return -1;
-                }
-
-                inode_table[inumber].i_size = BLOCK_SIZE;
-                inode_table[inumber].i_data_block[0] = b;
-
-                dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
-                if (dir_entry == NULL) {
-                    pthread_rwlock_wrlock(&freeinode_ts_mutex);
-                    freeinode_ts[inumber] = FREE;
-                    pthread_rwlock_unlock(&freeinode_ts_mutex);
-                    return -1;
-                }
-
-                for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-                    dir_entry[i].d_inumber = -1;
-                }
-
-            }
-            else {
-                /* In case of a new file, simply sets its size to 0 */
-                inode_table[inumber].i_size = 0;
-                if (inode_alloc_first_block(inumber) == -1) {
-                    return -1;
-                }
-            }
-            return inumber;
-        }
-    }
-    return -1;
-}
-
-/*
- * Frees an inode's direct data blocks
- * Input:
- *  - inode: pointer to an inode_t struct
- * Returns:
- *  1 if successful, -1 otherwise
- */
-int inode_free_direct_blocks(inode_t *inode) {
-    for (size_t i = 0; i < inode->number_of_blocks; i++) {
-
-
-        if (data_block_free(inode->i_data_block[i]) == -1) {
-            pthread_rwlock_unlock(&inode->i_lock);
-            return -1;
-        }
-    }
-
-    inode->i_size = 0;
-    inode->number_of_blocks = 0;
-
-    return 1;
-}
-
-/*
- * Frees an inode's indirect data blocks
- * Input:
- *  - inode: pointer to an inode_t struct
- * Returns:
- *  1 if successful, -1 otherwise
- */
-int inode_free_indirect_blocks(inode_t *inode) {
-    int *block_of_indexes = data_block_get(inode->indirection_block);
-    if (block_of_indexes == NULL) {
-        return -1;
-    }
-
-    size_t end = BLOCK_SIZE / sizeof(int);
-    size_t i = 1;
-    while (i < end && block_of_indexes[i] != -1) {
-        if (data_block_free(block_of_indexes[i]) == -1) {
-            return -1;
-        }
-        i++;
-    }
-    if (data_block_free(inode->indirection_block) == -1) {
-        return -1;
-    }
-
-    inode->number_indirect_blocks = 0;
-    inode->i_size = DIRECT_BLOCKS_COUNT * BLOCK_SIZE;
-    inode->indirection_block = -1;
-
-    return 1;
-}
-
-/*
- * Deletes the i-node.
- * Input:
- *  - inumber: i-node's number
- * Returns: 0 if successful, -1 if failed
- */
-int inode_delete(int inumber) {
-    // simulate storage access delay (to i-node and freeinode_ts)
-    insert_delay();
-    insert_delay();
-    inode_t *inode;
-
-    if (!valid_inumber(inumber) || freeinode_ts[inumber] == FREE) {
-        return -1;
-    }
-
-    freeinode_ts[inumber] = FREE;
-
-    if ((inode = inode_get(inumber)) == NULL) {
-        return -1;
-    }
-
-    pthread_rwlock_wrlock(&inode->i_lock);
-
-    if (inode_table[inumber].i_size > 0) {
-        if (inode_free_direct_blocks(inode) == -1) {
-            return -1;
-        }
-        if (data_block_free(inode->i_data_block[0]) == -1) {
-            return -1;
-        }
-        free(inode_table[inumber].i_data_block);
-
-        if (inode_table[inumber].indirection_block != -1) {
-            //If the inode has any associated indirect blocks
-            if (inode_free_indirect_blocks(inode) == -1) {
-                return -1;
-            }
-        }
-    }
-    pthread_rwlock_destroy(&inode->i_lock);
-    pthread_rwlock_destroy(&inode_table[inumber].i_lock);
-    return 0;
-}
-
-/*
- * Returns a pointer to an existing i-node.
- * Input:
- *  - inumber: identifier of the i-node
- * Returns: pointer if successful, NULL if failed
- */
-inode_t *inode_get(int inumber) {
-    if (!valid_inumber(inumber)) {
-        return NULL;
-    }
-
-    insert_delay(); // simulate storage access delay to i-node
-    inode_t *inode = &inode_table[inumber];
-    return inode;
-}
-
-/*
- * Checks if a certain inode is free
- * Input:
- *  - inumber: identifier of the i-node
- * Returns: 1 if free, 0 if taken and -1 if it is an invalid inumber
- */
-int inode_is_free(int inumber) {
-
-    if (!valid_inumber(inumber)) {
-        return -1;
-    }
-    pthread_rwlock_rdlock(&freeinode_ts_mutex);
-    if (freeinode_ts[inumber] == TAKEN) {
-        pthread_rwlock_unlock(&freeinode_ts_mutex);
-        return 0;
-    }
-    pthread_rwlock_unlock(&freeinode_ts_mutex);
-    return 1;
-}
-
-
-/*
- * Inicializes direct data blocks, within a given range, for an inode
- * Input:
- *  - inode: pointer to an inode
- *  - start: number of first data block
- *  - end: number of last data block to be inicialized
- * Returns: 0 if successful, -1 if an error occured
- */
-int inode_inicialize_direct_blocks(inode_t *inode, size_t start, size_t end) {
-
-    if (end < start || start > DIRECT_BLOCKS_COUNT) {
-        //Incorrect bounds
-        return -1;
-    }
-
-    for (size_t i = start; i < end; i++) {
-        inode->i_data_block[i] = data_block_alloc();
-        if (inode->i_data_block[i] == -1) {
-            return -1;
-        }
-    }
-    return 0;
-}
-
-/*
- * Writes a data block's index on an inode's indirection block
- * Input:
- *  - inode: pointer to an inode_t struct
- *  - block: block index
- * Returns:
- *  0 if successful, -1 otherwise
- */
-int write_index_to_block(inode_t *inode, int block) {
-    if (inode->number_indirect_blocks == 0) {
-        return -1;
-    }
-
-    int *block_of_indexes = data_block_get(inode->indirection_block);
-    if (block_of_indexes == NULL) {
-        return -1;
-    }
-
-    size_t position = inode->number_indirect_blocks - 1;
-    pthread_rwlock_wrlock(&fs_data_mutex);
-    block_of_indexes[position] = block;
-    pthread_rwlock_unlock(&fs_data_mutex);
-
-    return 0;
-}
-
-/*
- * Inicializes indirect data blocks, within a given range, for an inode
- * Input:
- *  - inode: pointer to an inode
- *  - start: number of first data block
- *  - end: number of last data block to be inicialized
- * Returns: 0 if successful, -1 if an error occured
- */
-int inode_inicialize_indirect_blocks(inode_t *inode, size_t start, size_t end) {
-    unsigned int limit = BLOCK_SIZE / sizeof(int) + 1;
-    int *block_of_indexes;
-
-    if (inode->indirection_block == -1) {
-        return -1;
-    }
-
-    block_of_indexes = data_block_get(inode->indirection_block);
-    if (block_of_indexes == NULL) {
-        return -1;
-    }
-
-    if (end < start || start > limit) {
-        //Incorrect bounds
-        return -1;
-    }
-
-    for (size_t i = start; i < limit; i++) {
-        if (i < end) {
-            int block = data_block_alloc();
-            inode->number_indirect_blocks += 1;
-            //Write index on indirection block
-            write_index_to_block(inode, block);
-        }
-        else {
-            pthread_rwlock_wrlock(&fs_data_mutex);
-            block_of_indexes[i] = -1;
-            pthread_rwlock_unlock(&fs_data_mutex);
-        }
-    }
-    return 0;
-}
-
-/*
- * Associates the required amount of data blocks to an inode, in order to
- * store a given amount of information on the inode
- * Input:
- *  - inumber
- *  - sizeToBeAdded: memory in bytes required
- *  - offset: offset of the open file
- * Returns: 0 if successful, -1 if an error occured
- */
-int inode_add_blocks(int inumber, size_t sizeToBeAdded, size_t offset) {
-    int memory;
-    size_t number_blocks;
-    inode_t *inode;
-    if (inode_is_free(inumber)) {
-        return -1;
-    }
-    if ((inode = inode_get(inumber)) == NULL) {
-        return -1;
-    }
-
-    if ((offset + sizeToBeAdded) <= ((inode->number_of_blocks + inode->number_indirect_blocks) * BLOCK_SIZE)) {
-        //If there is no need for additional blocks
-        return 0;
-    }
-
-    memory = get_free_memory();
-    if (memory < sizeToBeAdded) { //Not enough data blocks
-        return -1;
-    }
-
-
-    number_blocks = sizeToBeAdded / (unsigned int) BLOCK_SIZE; //Number of blocks to be added
-    if ((offset + sizeToBeAdded) >= ((inode->number_of_blocks + inode->number_indirect_blocks) * BLOCK_SIZE)) {
-        number_blocks++;
-    }
-
-    //Associate direct data blocks first
-    if (inode->number_of_blocks < DIRECT_BLOCKS_COUNT) {
-        size_t to_add = DIRECT_BLOCKS_COUNT - (unsigned int) inode->number_of_blocks;
-
-        if (to_add > number_blocks) { //Still doesn't need 10 direct blocks
-            to_add = number_blocks;
-        }
-        inode->i_data_block = (int *) realloc(inode->i_data_block, sizeof(int) * (unsigned int) (inode->number_of_blocks + to_add));
-        if (inode->i_data_block == NULL) {
-            return -1;
-        }
-
-        inode_inicialize_direct_blocks(inode, inode->number_of_blocks, inode->number_of_blocks + to_add);
-        inode->number_of_blocks += to_add;
-
-        number_blocks -= to_add;
-    }
-    if (number_blocks > 0 && inode->indirection_block == -1) {
-        inode->indirection_block = data_block_alloc();
-        if (inode->indirection_block == -1) {
-            return -1;
-        }
-        inode_inicialize_indirect_blocks(inode, inode->number_indirect_blocks, inode->number_indirect_blocks + number_blocks);
-
-    }
-    return 0;
-}
-
-/*
- * Checks if it is an invalid block associated with an inode
- * Input:
- *  - inode
- *  - block_number
- * Returns: 0 if it is a valid block, otherwise returns a non-zero integer
- */
-int inode_invalid_indirect_block(inode_t *inode, size_t block_number) {
-    int *block_of_indexes = data_block_get(inode->indirection_block);
-
-
-    return (block_of_indexes == NULL || (block_number >= (BLOCK_SIZE / sizeof(int))) ||
-        block_of_indexes[block_number] == -1);
-}
-
-
-/*
- * Writes from a buffer to an inode's data blocks
- * Input:
- *  - file: pointer to an open file entry
- *  - inode: pointer to an inode_t struct
- *  - buffer: input buffer
- *  - to_write: number of bytes to write
- * Returns:
- *  number of bytes written if successful, -1 otherwise
- */
-ssize_t inode_write(open_file_entry_t *file, inode_t *inode, void const*buffer, size_t to_write) {
-    size_t bytes_written = 0;
-    void *block = NULL;
-
-    pthread_rwlock_wrlock(&inode->i_lock);
-    pthread_rwlock_wrlock(&file->of_lock);
-    if (file->of_offset > inode->i_size) { //If the file was truncated
-        file->of_offset = inode->i_size;
-    }
-    if ((file->of_offset + to_write) > ((DIRECT_BLOCKS_COUNT + (BLOCK_SIZE / sizeof(int))) * BLOCK_SIZE)) {
-        //If trying to write more than the inode can store
-        to_write = ((DIRECT_BLOCKS_COUNT + (BLOCK_SIZE / sizeof(int))) * BLOCK_SIZE) - file->of_offset;
-    }
-
-    if (file->of_offset > inode->i_size) { //If the file was truncated
-        file->of_offset = inode->i_size;
-    }
-
-    size_t block_to_write = file->of_offset / BLOCK_SIZE;
-    if (block_to_write >= DIRECT_BLOCKS_COUNT) {
-        block_to_write++; //Skip block of indexes
-    }
-    if (to_write > inode->i_size ) { //Need to increase inode size
-        inode_add_blocks(file->of_inumber, to_write, file->of_offset);
-    }
-    else if ((file->of_offset + to_write) >= ((inode->number_of_blocks + inode->number_indirect_blocks) * BLOCK_SIZE)) {
-
-        size_t memory_needed = to_write;
-        if (to_write < BLOCK_SIZE) {
-            memory_needed = BLOCK_SIZE;
-        }
-        inode_add_blocks(file->of_inumber, memory_needed, file->of_offset);
-    }
-
-    while (to_write > 0) {
-        if (block_to_write == DIRECT_BLOCKS_COUNT) {
-            block_to_write++; //Skip block of indexes
-        }
-        if (block_to_write < DIRECT_BLOCKS_COUNT) { //Start writing on direct data blocks
-            block = data_block_get(inode->i_data_block[block_to_write]);
-        }
-        else {  //Start writing on indirect data blocks
-            int *block_of_indexes = data_block_get(inode->indirection_block);
-            if (inode_invalid_indirect_block(inode, block_to_write - DIRECT_BLOCKS_COUNT)) {
-                int new_block = data_block_alloc();
-                if (new_block == -1) {
-                    pthread_rwlock_unlock(&inode->i_lock);
-                    pthread_rwlock_unlock(&file->of_lock);
-                    return -1;
-                }
-                inode->number_indirect_blocks++;
-                pthread_rwlock_wrlock(&fs_data_mutex);
-                block_of_indexes[inode->number_indirect_blocks] = new_block;
-                pthread_rwlock_unlock(&fs_data_mutex);
-                if (write_index_to_block(inode, new_block) == -1) {
-                    pthread_rwlock_unlock(&inode->i_lock);
-                    pthread_rwlock_unlock(&file->of_lock);
-                    return -1;
-                }
-
-                if (inode_invalid_indirect_block(inode, block_to_write - DIRECT_BLOCKS_COUNT)) {
-                    pthread_rwlock_unlock(&inode->i_lock);
-                    pthread_rwlock_unlock(&file->of_lock);
-                    return -1;
-                }
-            }
-            block = data_block_get(block_of_indexes[block_to_write - DIRECT_BLOCKS_COUNT]);
-        }
-
-        if (block == NULL) {
-            pthread_rwlock_unlock(&file->of_lock);
-            pthread_rwlock_unlock(&inode->i_lock);
-            return -1;
-        }
-
-        size_t size;
-        size_t room_in_block = (block_to_write + 1) * BLOCK_SIZE - file->of_offset;
-        if (to_write > room_in_block) {
-            size = room_in_block;
-        }
-        else {
-            size = to_write;
-        }
-
-        /* Perform the actual write */
-        pthread_rwlock_wrlock(&fs_data_mutex);
-        memcpy(block + (file->of_offset % BLOCK_SIZE), buffer, size);
-        pthread_rwlock_unlock(&fs_data_mutex);
-
-        /* Advance buffer pointer and update loop variables */
-        buffer += size; //Disregard already written part of buffer
-        to_write = to_write - size;
-        bytes_written += size;
-
-        /* The offset associated with the file handle is
-        * incremented accordingly */
-        file->of_offset += size;
-        if (file->of_offset % BLOCK_SIZE == 0) {
-            block_to_write += 1;
-        }
-        if (file->of_offset > inode->i_size) {
-            inode->i_size = file->of_offset;
-        }
-    }
-    pthread_rwlock_unlock(&file->of_lock);
-    pthread_rwlock_unlock(&inode->i_lock);
-    return (ssize_t) bytes_written;
-}
-
-/*
- * Reads to a buffer from an inode's data blocks
- * Input:
- *  - file: pointer to an open file entry
- *  - inode: pointer to an inode_t struct
- *  - buffer: output buffer
- *  - to_write: number of bytes to read
- * Returns:
- *  number of bytes read if successful, -1 otherwise
- */
-ssize_t inode_read(open_file_entry_t *file, inode_t *inode, void *buffer, size_t len) {
-    size_t bytes_read = 0;
-    void *block;
-
-    pthread_rwlock_rdlock(&inode->i_lock);
-    pthread_rwlock_rdlock(&file->of_lock);
-
-    if (file->of_offset > inode->i_size) {
-        file->of_offset = inode->i_size;
-    }
-    /* Determine how many bytes to read */
-    size_t to_read = inode->i_size - file->of_offset;
-    if (to_read > len) {
-        to_read = len;
-    }
-
-    bytes_read = 0;
-    while (to_read > 0 && (file->of_offset < inode->i_size)) {
-        size_t block_to_read = file->of_offset / BLOCK_SIZE;
-        if (block_to_read >= DIRECT_BLOCKS_COUNT) {
-            block_to_read++;
-        }
-        if (block_to_read < DIRECT_BLOCKS_COUNT) {
-            block = data_block_get(inode->i_data_block[block_to_read]);
-        }
-        else {
-            if (inode->indirection_block == -1 || inode_invalid_indirect_block(inode, block_to_read - DIRECT_BLOCKS_COUNT)) {
-                pthread_rwlock_unlock(&inode->i_lock);
-                pthread_rwlock_unlock(&file->of_lock);
-                return -1;
-            }
-            int *block_of_indexes = data_block_get(inode->indirection_block);
-            block = data_block_get(block_of_indexes[block_to_read - DIRECT_BLOCKS_COUNT]);
-        }
-
-        if (block == NULL) {
-            pthread_rwlock_unlock(&inode->i_lock);
-            pthread_rwlock_unlock(&file->of_lock);
-            return -1;
-        }
-
-        size_t size;
-        size_t room_in_block = (block_to_read + 1) * BLOCK_SIZE - file->of_offset;
-        if (to_read > room_in_block) {
-            size = room_in_block;
-        }
-        else {
-            size = to_read;
-        }
-        /* Perform the actual read */
-        pthread_rwlock_rdlock(&fs_data_mutex);
-        memcpy(buffer, block + (file->of_offset % BLOCK_SIZE), size);
-        pthread_rwlock_unlock(&fs_data_mutex);
-
-        /* Advance buffer pointer and update loop variables*/
-        bytes_read += size;
-        to_read -= size;
-        buffer += size;
-
-        /* The offset associated with the file handle is
-        * incremented accordingly */
-        file->of_offset += size;
-    }
-    pthread_rwlock_unlock(&file->of_lock);
-    pthread_rwlock_unlock(&inode->i_lock);
-    return (ssize_t) bytes_read;
-}
-
-/*
- * Adds an entry to the i-node directory data.
- * Input:
- *  - inumber: identifier of the i-node
- *  - sub_inumber: identifier of the sub i-node entry
- *  - sub_name: name of the sub i-node entry
- * Returns: SUCCESS or FAIL
- */
-
-int add_dir_entry(int inumber, int sub_inumber, char const *sub_name) {
-    if (!valid_inumber(inumber) || !valid_inumber(sub_inumber)) {
-        return -1;
-    }
-
-    insert_delay(); // simulate storage access delay to i-node with inumber
-    pthread_rwlock_wrlock(&inode_table_mutex);
-
-    if (inode_table[inumber].i_node_type != T_DIRECTORY) {
-        pthread_rwlock_unlock(&inode_table_mutex);
-        return -1;
-    }
-
-    if (strlen(sub_name) == 0) {
-        pthread_rwlock_unlock(&inode_table_mutex);
-        return -1;
-    }
-
-    /* Locates the block containing the directory's entries */
-    dir_entry_t *dir_entry =
-        (dir_entry_t *)data_block_get(inode_table[inumber].i_data_block[0]);
-    if (dir_entry == NULL) {
-        pthread_rwlock_unlock(&inode_table_mutex);
-        return -1;
-    }
-    /* Finds and fills the first empty entry */
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (dir_entry[i].d_inumber == -1) {
-            dir_entry[i].d_inumber = sub_inumber;
-            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
-            dir_entry[i].d_name[MAX_FILE_NAME - 1] = 0;
-            pthread_rwlock_unlock(&inode_table_mutex);
-            return 0;
-        }
-    }
-
-    pthread_rwlock_unlock(&inode_table_mutex);
-    return -1;
-}
-
-/* Looks for a given name inside a directory
- * Input:
- * 	- parent directory's i-node number
- * 	- name to search
- * 	Returns i-number linked to the target name, -1 if not found
- */
-int find_in_dir(int inumber, char const *sub_name) {
-    insert_delay(); // simulate storage access delay to i-node with inumber
-    if (!valid_inumber(inumber) ||
-        inode_table[inumber].i_node_type != T_DIRECTORY) {
-        return -1;
-    }
-
-    /* Locates the block containing the directory's entries */
-
-    pthread_rwlock_rdlock(&inode_table_mutex);
-    dir_entry_t *dir_entry =
-        (dir_entry_t *)data_block_get(inode_table[inumber].i_data_block[0]);
-    if (dir_entry == NULL) {
-        pthread_rwlock_unlock(&inode_table_mutex);
-        return -1;
-    }
-
-    /* Iterates over the directory entries looking for one that has the target
-     * name */
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++)
-        if ((dir_entry[i].d_inumber != -1) &&
-            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
-            pthread_rwlock_unlock(&inode_table_mutex);
-            return dir_entry[i].d_inumber;
-        }
-
-    pthread_rwlock_unlock(&inode_table_mutex);
-    return -1;
-}
-
-/*
- * Allocated a new data block
- * Returns: block index if successful, -1 otherwise
- */
-
-int data_block_alloc() {
-    pthread_rwlock_wrlock(&free_blocks_mutex);
-    for (int i = 0; i < DATA_BLOCKS; i++) {
-        if (i * (int) sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
-        }
-
-        if (free_blocks[i] == FREE) {
-            free_blocks[i] = TAKEN;
-            pthread_rwlock_unlock(&free_blocks_mutex);
-            return i;
-        }
-    }
-    pthread_rwlock_unlock(&free_blocks_mutex);
-    return -1;
-}
-
-/* Frees a data block
- * Input
- * 	- the block index
- * Returns: 0 if success, -1 otherwise
- */
-int data_block_free(int block_number) {
-    if (!valid_block_number(block_number)) {
-        return -1;
-    }
-
-    insert_delay(); // simulate storage access delay to free_blocks
-    pthread_rwlock_wrlock(&free_blocks_mutex);
-    free_blocks[block_number] = FREE;
-    pthread_rwlock_unlock(&free_blocks_mutex);
-    return 0;
-}
-
-/* Returns a pointer to the contents of a given block
- * Input:
- * 	- Block's index
- * Returns: pointer to the first byte of the block, NULL otherwise
- */
-void *data_block_get(int block_number) {
-    if (!valid_block_number(block_number)) {
-        return NULL;
-    }
-
-    insert_delay(); // simulate storage access delay to block
-    pthread_rwlock_rdlock(&fs_data_mutex);
-    void* ret = &fs_data[block_number * BLOCK_SIZE];
-    pthread_rwlock_unlock(&fs_data_mutex);
-    return ret;
-}
-
-/* Add new entry to the open file table
- * Inputs:
- * 	- I-node number of the file to open
- * 	- Initial offset
- * Returns: file handle if successful, -1 otherwise
- */
-int add_to_open_file_table(int inumber, size_t offset) {
-    pthread_rwlock_wrlock(&free_open_file_entries_mutex);
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries[i] == FREE) {
-            free_open_file_entries[i] = TAKEN;
-            open_file_table[i].of_inumber = inumber;
-            open_file_table[i].of_offset = offset;
-            pthread_rwlock_init(&open_file_table[i].of_lock, NULL);
-            pthread_rwlock_unlock(&free_open_file_entries_mutex);
-            return i;
-        }
-    }
-    pthread_rwlock_unlock(&free_open_file_entries_mutex);
-    return -1;
-}
-
-/* Frees an entry from the open file table
- * Inputs:
- * 	- file handle to free/close
- * Returns 0 is success, -1 otherwise
- */
-int remove_from_open_file_table(int fhandle) {
-    pthread_rwlock_wrlock(&free_open_file_entries_mutex);
-    if (!valid_file_handle(fhandle) ||
-        free_open_file_entries[fhandle] != TAKEN) {
-        pthread_rwlock_unlock(&free_open_file_entries_mutex);
-        return -1;
-    }
-    free_open_file_entries[fhandle] = FREE;
-    pthread_rwlock_unlock(&free_open_file_entries_mutex);
-    return 0;
-}
-
-/* Returns pointer to a given entry in the open file table
- * Inputs:
- * 	 - file handle
- * Returns: pointer to the entry if sucessful, NULL otherwise
- */
-open_file_entry_t *get_open_file_entry(int fhandle) {
-    if (!valid_file_handle(fhandle)) {
-        return NULL;
-    }
-    open_file_entry_t *entry = &open_file_table[fhandle];
-    return entry;
-}
+#include "state.h"
+#include "crc32c.h"
+#include "epoch.h"
+#include "journal.h"
+#include "lz4.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+static inline bool valid_inumber(int inumber) {
+    return inumber >= 0 && inumber < INODE_TABLE_SIZE;
+}
+
+static inline bool valid_block_number(int block_number) {
+    return block_number >= 0 && block_number < DATA_BLOCKS;
+}
+
+static inline int block_index(tfs_t *fs, void const *block) {
+    return (int) (((char const *) block - fs->fs_data) / BLOCK_SIZE);
+}
+
+/* File handles: the index of their entry in the open file table, plus
+ * (above HANDLE_INDEX_BITS) the entry's generation when it was taken, so
+ * that a handle used after being closed is told apart from later uses of
+ * its entry. Handles stay below 2^27, leaving room for the shard number. */
+#define HANDLE_INDEX_BITS (16)
+#define HANDLE_GENERATION_MASK ((1u << 11) - 1)
+_Static_assert(MAX_OPEN_FILES <= (1 << HANDLE_INDEX_BITS), "handles must fit every index");
+
+/* Free list each thread takes its entries from and returns them to */
+static atomic_uint next_free_list = 0;
+static _Thread_local unsigned int thread_free_list = OPEN_FILE_FREE_LISTS;
+
+/**
+ * We need to defeat the optimizer for the insert_delay() function.
+ * Under optimization, the empty loop would be completely optimized away.
+ * This function tells the compiler that the assembly code being run (which is
+ * none) might potentially change *all memory in the process*.
+ *
+ * This prevents the optimizer from optimizing this code away, because it does
+ * not know what it does and it may have side effects.
+ *
+ * Reference with more information: https://youtu.be/nXaxk27zwlk?t=2775
+ *
+ * Exercise: try removing this function and look at the assembly generated to
+ * compare.
+ */
+static void touch_all_memory() { __asm volatile("" : : : "memory"); }
+
+/*
+ * Auxiliary function to insert a delay.
+ * Used in accesses to persistent FS state as a way of emulating access
+ * latencies as if such data structures were really stored in secondary memory.
+ */
+static void insert_delay() {
+    for (int i = 0; i < DELAY; i++) {
+        touch_all_memory();
+    }
+}
+
+/*
+ * Initializes FS state
+ * Input:
+ *  - fs: the volume, zero-filled; zero is the initial state of every table
+ *    (free i-nodes and blocks, an empty deduplication index), so none is
+ *    walked here, and pages no allocation has reached are never touched
+ *  - huge_pages: whether to keep its data blocks in huge pages if possible
+ * Returns: 0 if successful, -1 otherwise (state_destroy must still be
+ * called)
+ */
+int state_init(tfs_t *fs, bool huge_pages) {
+    fs->epoch = epoch_domain_create();
+    pthread_rwlock_init(&fs->inode_table_mutex, NULL);
+    pthread_rwlock_init(&fs->freeinode_ts_mutex, NULL);
+    pthread_rwlock_init(&fs->fs_data_mutex, NULL);
+    pthread_rwlock_init(&fs->free_blocks_mutex, NULL);
+    pthread_mutex_init(&fs->dedup_mutex, NULL);
+    fs->checksum_mode = CHECKSUM_UPDATE;
+
+    pthread_mutex_init(&fs->open_file_grow_mutex, NULL);
+    for (size_t i = 0; i < OPEN_FILE_FREE_LISTS; i++) {
+        pthread_mutex_init(&fs->open_file_free_lists[i].lock, NULL);
+        fs->open_file_free_lists[i].head = -1;
+    }
+
+    fs->fs_data = pages_alloc(BLOCK_SIZE * DATA_BLOCKS, huge_pages, &fs->fs_data_pages);
+    return fs->epoch == NULL || fs->fs_data == NULL ? -1 : 0;
+}
+
+void state_destroy(tfs_t *fs) {
+    for (size_t segment = 0; segment < fs->open_file_segment_count; segment++) {
+        open_file_entry_t *entries = atomic_load(&fs->open_file_segments[segment]);
+        for (size_t i = 0; i < OPEN_FILE_SEGMENT_SIZE; i++) {
+            if (atomic_load(&entries[i].of_state) % OPEN_FILE_GENERATION == OPEN_FILE_TAKEN) {
+                inode_close_ref(fs, open_file_inumber(fs, &entries[i]));
+            }
+            pthread_mutex_destroy(&entries[i].of_lock);
+        }
+        free(entries);
+    }
+    /* Unlinked i-nodes whose last handle was just closed (and everything
+     * else still retired) */
+    if (fs->epoch != NULL) {
+        epoch_domain_destroy(fs->epoch);
+        fs->epoch = NULL;
+    }
+
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        if (fs->freeinode_ts[i] == TAKEN) {
+            inode_delete(fs, i);
+        }
+    }
+
+    pthread_rwlock_destroy(&fs->inode_table_mutex);
+    pthread_rwlock_destroy(&fs->freeinode_ts_mutex);
+    pthread_rwlock_destroy(&fs->fs_data_mutex);
+    pthread_rwlock_destroy(&fs->free_blocks_mutex);
+    pthread_mutex_destroy(&fs->dedup_mutex);
+    pthread_mutex_destroy(&fs->open_file_grow_mutex);
+    for (size_t i = 0; i < OPEN_FILE_FREE_LISTS; i++) {
+        pthread_mutex_destroy(&fs->open_file_free_lists[i].lock);
+    }
+    if (fs->fs_data != NULL) {
+        pages_free(fs->fs_data, BLOCK_SIZE * DATA_BLOCKS);
+    }
+}
+
+/*
+ * Selects how data block checksums are maintained. Should be called while
+ * no I/O is in progress; when turning checksums on, the checksums of every
+ * block in use are recomputed.
+ * Input:
+ *  - mode: CHECKSUM_OFF, CHECKSUM_UPDATE or CHECKSUM_VERIFY
+ */
+void state_set_checksum_mode(tfs_t *fs, checksum_mode_t mode) {
+    pthread_rwlock_wrlock(&fs->fs_data_mutex);
+    if (fs->checksum_mode == CHECKSUM_OFF && mode != CHECKSUM_OFF) {
+        pthread_rwlock_rdlock(&fs->free_blocks_mutex);
+        for (size_t i = 0; i < DATA_BLOCKS; i++) {
+            if (fs->free_blocks[i] == TAKEN) {
+                fs->block_checksums[i] = crc32c(&fs->fs_data[i * BLOCK_SIZE], BLOCK_SIZE);
+            }
+        }
+        pthread_rwlock_unlock(&fs->free_blocks_mutex);
+    }
+    fs->checksum_mode = mode;
+    pthread_rwlock_unlock(&fs->fs_data_mutex);
+}
+
+/*
+ * Selects whether files created from now on are compressed
+ * Input:
+ *  - enabled: true to compress every new file
+ */
+void state_set_compression(tfs_t *fs, bool enabled) {
+    fs->compress_new_files = enabled;
+}
+
+/*
+ * Selects whether the blocks of (uncompressed) files are deduplicated: once a
+ * write completes, each block it touched is shared with an existing block of
+ * identical contents, if there is one
+ * Input:
+ *  - enabled: true to deduplicate blocks on write
+ */
+void state_set_dedup(tfs_t *fs, bool enabled) {
+    pthread_mutex_lock(&fs->dedup_mutex);
+    fs->dedup_enabled = enabled;
+    if (enabled) {
+        fs->blocks_shared = true;
+    }
+    pthread_mutex_unlock(&fs->dedup_mutex);
+}
+
+/*
+ * Checks whether files created from now on are compressed
+ * Returns: true if new files are compressed
+ */
+bool state_compression_enabled(tfs_t *fs) {
+    return fs->compress_new_files;
+}
+
+/*
+ * Checks how much free memory (in bytes) there is left on TFS
+ * Returns:
+ *  number of bytes
+ */
+int get_free_memory(tfs_t *fs) {
+    int size = 0;
+
+    pthread_rwlock_rdlock(&fs->free_blocks_mutex);
+    for (size_t i = 0; i < DATA_BLOCKS; i++) {
+        if (fs->free_blocks[i] == FREE) {
+            size = size + BLOCK_SIZE;
+        }
+    }
+    pthread_rwlock_unlock(&fs->free_blocks_mutex);
+    return size;
+}
+
+/*
+ * Allocs an inode's first direct data block
+ * Input:
+ *  - inumber
+ * Returns:
+ *  0 if successful, -1 if an error occured
+ */
+int inode_alloc_first_block(tfs_t *fs, int inumber) {
+    if (!valid_inumber(inumber)) {
+        return -1;
+    }
+
+    int b = data_block_alloc(fs);
+    if (b == -1) {
+        return -1;
+    }
+
+    fs->inode_table[inumber].i_data_block[0] = b;
+    fs->inode_table[inumber].number_of_blocks = 1;
+    return 0;
+}
+
+/*
+ * Takes the first free entry of the i-node table for a new i-node
+ * Input:
+ *  - n_type: the type of the node (file or directory)
+ * Returns:
+ *  new i-node's number if successfully created, -1 otherwise
+ */
+static int inode_alloc(tfs_t *fs, inode_type n_type) {
+    for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
+        if ((inumber * (int) sizeof(allocation_state_t)) == 0) {
+            insert_delay(); // simulate storage access delay (to freeinode_ts)
+        }
+
+        pthread_rwlock_wrlock(&fs->freeinode_ts_mutex);
+
+        /* Finds first free entry in i-node table */
+        if (fs->freeinode_ts[inumber] == FREE) {
+            /* Found a free entry, so takes it for the new i-node*/
+            fs->freeinode_ts[inumber] = TAKEN;
+            pthread_rwlock_unlock(&fs->freeinode_ts_mutex);
+            insert_delay(); // simulate storage access delay (to i-node)
+            fs->inode_table[inumber].i_node_type = n_type;
+            fs->inode_table[inumber].number_of_blocks = 1;
+            fs->inode_table[inumber].number_indirect_blocks = 0;
+            fs->inode_table[inumber].indirection_block = -1;
+            fs->inode_table[inumber].i_compressed = false;
+            fs->inode_table[inumber].i_group_bytes = NULL;
+            fs->inode_table[inumber].i_groups = 0;
+            atomic_store(&fs->inode_table[inumber].i_refs, 0);
+            pthread_rwlock_init(&fs->inode_table[inumber].i_lock, NULL);
+
+            if (n_type == T_DIRECTORY) {
+                //Allocate memory for first data block
+                int b = data_block_alloc(fs);
+                if (b == -1) {
+                    pthread_rwlock_wrlock(&fs->freeinode_ts_mutex);
+                    fs->freeinode_ts[inumber] = FREE;
+                    pthread_rwlock_unlock(&fs->freeinode_ts_mutex);
+                    return -1;
+                }
+
+                fs->inode_table[inumber].i_size = BLOCK_SIZE;
+                fs->inode_table[inumber].i_data_block[0] = b;
+
+                dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(fs, b);
+                if (dir_entry == NULL) {
+                    pthread_rwlock_wrlock(&fs->freeinode_ts_mutex);
+                    fs->freeinode_ts[inumber] = FREE;
+                    pthread_rwlock_unlock(&fs->freeinode_ts_mutex);
+                    return -1;
+                }
+
+                for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+                    dir_entry[i].d_inumber = -1;
+                }
+
+            }
+            else {
+                /* In case of a new file, simply sets its size to 0 */
+                fs->inode_table[inumber].i_size = 0;
+                if (inode_alloc_first_block(fs, inumber) == -1) {
+                    pthread_rwlock_wrlock(&fs->freeinode_ts_mutex);
+                    fs->freeinode_ts[inumber] = FREE;
+                    pthread_rwlock_unlock(&fs->freeinode_ts_mutex);
+                    return -1;
+                }
+            }
+            journal_log(fs->journal, JOURNAL_INODE_CREATE, inumber, n_type, 0, NULL);
+            journal_log(fs->journal, JOURNAL_BLOCK_MAP, inumber, 0,
+                        fs->inode_table[inumber].i_data_block[0], NULL);
+            return inumber;
+        }
+        pthread_rwlock_unlock(&fs->freeinode_ts_mutex);
+    }
+    return -1;
+}
+
+/*
+ * Creates a new i-node in the i-node table (outside epoch critical
+ * sections, as it may wait for unlinked i-nodes to be reclaimed).
+ * Input:
+ *  - n_type: the type of the node (file or directory)
+ * Returns:
+ *  new i-node's number if successfully created, -1 otherwise
+ */
+int inode_create(tfs_t *fs, inode_type n_type) {
+    int inumber;
+    /* Unlinked i-nodes waiting to be reclaimed may free the entries (and
+     * data blocks) needed */
+    while ((inumber = inode_alloc(fs, n_type)) == -1 && atomic_load(&fs->retired_inodes) > 0) {
+        epoch_synchronize(fs->epoch);
+    }
+    return inumber;
+}
+
+/*
+ * Frees an inode's direct data blocks
+ * Input:
+ *  - inode: pointer to an inode_t struct
+ * Returns:
+ *  1 if successful, -1 otherwise
+ */
+int inode_free_direct_blocks(tfs_t *fs, inode_t *inode) {
+    for (size_t i = 0; i < inode->number_of_blocks; i++) {
+        if (inode->i_data_block[i] == -1) {
+            //Slot of a compressed group that needs fewer blocks
+            continue;
+        }
+
+        if (data_block_free(fs, inode->i_data_block[i]) == -1) {
+            return -1;
+        }
+    }
+
+    inode->i_size = 0;
+    inode->number_of_blocks = 0;
+
+    return 1;
+}
+
+/*
+ * Frees an inode's indirect data blocks
+ * Input:
+ *  - inode: pointer to an inode_t struct
+ * Returns:
+ *  1 if successful, -1 otherwise
+ */
+int inode_free_indirect_blocks(tfs_t *fs, inode_t *inode) {
+    int *block_of_indexes = data_block_get(fs, inode->indirection_block);
+    if (block_of_indexes == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < inode->number_indirect_blocks; i++) {
+        if (block_of_indexes[i] != -1 && data_block_free(fs, block_of_indexes[i]) == -1) {
+            return -1;
+        }
+    }
+    if (data_block_free(fs, inode->indirection_block) == -1) {
+        return -1;
+    }
+
+    inode->number_indirect_blocks = 0;
+    inode->i_size = DIRECT_BLOCKS_COUNT * BLOCK_SIZE;
+    inode->indirection_block = -1;
+
+    return 1;
+}
+
+/*
+ * Deletes the i-node.
+ * Input:
+ *  - inumber: i-node's number
+ * Returns: 0 if successful, -1 if failed
+ */
+int inode_delete(tfs_t *fs, int inumber) {
+    // simulate storage access delay (to i-node and freeinode_ts)
+    insert_delay();
+    insert_delay();
+    inode_t *inode;
+
+    if (!valid_inumber(inumber) || fs->freeinode_ts[inumber] == FREE) {
+        return -1;
+    }
+
+    if ((inode = inode_get(fs, inumber)) == NULL) {
+        return -1;
+    }
+
+    inode_write_lock(inode);
+
+    if (inode->indirection_block != -1) {
+        //If the inode has any associated indirect blocks
+        if (inode_free_indirect_blocks(fs, inode) == -1) {
+            inode_write_unlock(inode);
+            return -1;
+        }
+    }
+    if (inode_free_direct_blocks(fs, inode) == -1) {
+        inode_write_unlock(inode);
+        return -1;
+    }
+    free(inode->i_group_bytes);
+    inode->i_group_bytes = NULL;
+    inode->i_groups = 0;
+
+    inode_write_unlock(inode);
+
+    /* Only now may the i-node be taken again (journaled first, so that the
+     * record comes before that of its next creation) */
+    journal_log(fs->journal, JOURNAL_INODE_FREE, inumber, 0, 0, NULL);
+    pthread_rwlock_wrlock(&fs->freeinode_ts_mutex);
+    fs->freeinode_ts[inumber] = FREE;
+    pthread_rwlock_unlock(&fs->freeinode_ts_mutex);
+    return 0;
+}
+
+/* Unlinked i-node waiting for a grace period */
+typedef struct {
+    tfs_t *fs;
+    int inumber;
+} retired_inode_t;
+
+static void inode_reclaim(void *arg) {
+    retired_inode_t *retired = (retired_inode_t *) arg;
+    /* Whichever thread reclaims it, not as part of what that thread does */
+    journal_begin_apart(retired->fs->journal);
+    inode_delete(retired->fs, retired->inumber);
+    journal_commit(retired->fs->journal);
+    atomic_fetch_sub(&retired->fs->retired_inodes, 1);
+    free(retired);
+}
+
+static void inode_retire(tfs_t *fs, int inumber) {
+    retired_inode_t *retired = (retired_inode_t *) malloc(sizeof(retired_inode_t));
+    if (retired == NULL) {
+        abort();
+    }
+    retired->fs = fs;
+    retired->inumber = inumber;
+    atomic_fetch_add(&fs->retired_inodes, 1);
+    epoch_retire(fs->epoch, inode_reclaim, retired);
+}
+
+/*
+ * Takes a reference to an i-node for an open file entry
+ * Input:
+ *  - inumber: i-node's number (which must not be reclaimed meanwhile, i.e.
+ *    the caller is in an epoch critical section or holds a reference)
+ * Returns: 0 if successful, -1 if the i-node has been unlinked
+ */
+int inode_open_ref(tfs_t *fs, int inumber) {
+    inode_t *inode = inode_get(fs, inumber);
+    if (inode == NULL) {
+        return -1;
+    }
+
+    unsigned int refs = atomic_load(&inode->i_refs);
+    do {
+        if (refs & INODE_UNLINKED) {
+            return -1;
+        }
+    } while (!atomic_compare_exchange_weak(&inode->i_refs, &refs, refs + 1));
+    return 0;
+}
+
+/*
+ * Drops a reference taken by inode_open_ref; the last one of an unlinked
+ * i-node retires it
+ * Input:
+ *  - inumber: i-node's number
+ */
+void inode_close_ref(tfs_t *fs, int inumber) {
+    inode_t *inode = inode_get(fs, inumber);
+    if (inode == NULL) {
+        return;
+    }
+
+    if (atomic_fetch_sub(&inode->i_refs, 1) == (INODE_UNLINKED | 1)) {
+        inode_retire(fs, inumber);
+    }
+}
+
+/*
+ * Marks an i-node whose directory entry was removed as unlinked: it is
+ * retired right away if no open file entry references it, or else when
+ * the last one is closed. Either way, its blocks are only freed once no
+ * thread can still be accessing it.
+ * Input:
+ *  - inumber: i-node's number
+ */
+void inode_unlink(tfs_t *fs, int inumber) {
+    inode_t *inode = inode_get(fs, inumber);
+    if (inode == NULL) {
+        return;
+    }
+
+    if (atomic_fetch_or(&inode->i_refs, INODE_UNLINKED) == 0) {
+        inode_retire(fs, inumber);
+    }
+}
+
+/*
+ * Truncates a file to size 0, keeping a single (empty) data block
+ * Input:
+ *  - inumber: i-node's number (locked with inode_write_lock)
+ * Returns: 0 if successful, -1 if failed (the file is then left empty,
+ * without any block: dropping shared blocks may free none)
+ */
+int inode_truncate(tfs_t *fs, int inumber) {
+    inode_t *inode = inode_get(fs, inumber);
+    if (inode == NULL) {
+        return -1;
+    }
+
+    if (inode->indirection_block != -1) {
+        /* Has indirect data blocks */
+        if (inode_free_indirect_blocks(fs, inode) == -1) {
+            return -1;
+        }
+    }
+    if (inode_free_direct_blocks(fs, inode) == -1) {
+        return -1;
+    }
+
+    free(inode->i_group_bytes);
+    inode->i_group_bytes = NULL;
+    inode->i_groups = 0;
+
+    journal_log(fs->journal, JOURNAL_TRUNCATE, inumber, 0, 0, NULL);
+    if (inode_alloc_first_block(fs, inumber) == -1) {
+        return -1;
+    }
+    journal_log(fs->journal, JOURNAL_BLOCK_MAP, inumber, 0, inode->i_data_block[0], NULL);
+    return 0;
+}
+
+/*
+ * Marks an empty file as compressed: its contents are then stored in
+ * groups of COMPRESSION_GROUP_BLOCKS blocks, each compressed on its own
+ * Input:
+ *  - inumber: i-node's number
+ * Returns: 0 if successful, -1 if failed
+ */
+int inode_set_compressed(tfs_t *fs, int inumber) {
+    inode_t *inode = inode_get(fs, inumber);
+    if (inode == NULL || inode->i_node_type != T_FILE) {
+        return -1;
+    }
+
+    inode_write_lock(inode);
+    if (inode->i_size != 0) {
+        inode_write_unlock(inode);
+        return -1;
+    }
+    inode->i_compressed = true;
+    journal_log(fs->journal, JOURNAL_COMPRESS, inumber, 0, 0, NULL);
+    inode_write_unlock(inode);
+    return 0;
+}
+
+/*
+ * Returns a pointer to an existing i-node.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: pointer if successful, NULL if failed
+ */
+inode_t *inode_get(tfs_t *fs, int inumber) {
+    if (!valid_inumber(inumber)) {
+        return NULL;
+    }
+
+    insert_delay(); // simulate storage access delay to i-node
+    inode_t *inode = &fs->inode_table[inumber];
+    return inode;
+}
+
+/*
+ * Locks an i-node for writing, telling optimistic readers that it is
+ * about to change
+ * Input:
+ *  - inode: pointer to an inode_t struct
+ */
+void inode_write_lock(inode_t *inode) {
+    pthread_rwlock_wrlock(&inode->i_lock);
+    atomic_fetch_add_explicit(&inode->i_seq, 1, memory_order_relaxed);
+    /* The odd sequence number is visible before any of the changes */
+    atomic_thread_fence(memory_order_release);
+}
+
+/*
+ * Unlocks an i-node locked with inode_write_lock
+ * Input:
+ *  - inode: pointer to an inode_t struct
+ */
+void inode_write_unlock(inode_t *inode) {
+    atomic_fetch_add_explicit(&inode->i_seq, 1, memory_order_release);
+    pthread_rwlock_unlock(&inode->i_lock);
+}
+
+/*
+ * Starts an optimistic (lock-free) read of an i-node
+ * Input:
+ *  - inode: pointer to an inode_t struct
+ *  - seq: where to store the sequence number to validate the read against
+ * Returns: true if no writer is changing the i-node, false otherwise
+ */
+static bool inode_read_begin(inode_t *inode, unsigned int *seq) {
+    *seq = atomic_load_explicit(&inode->i_seq, memory_order_acquire);
+    return (*seq & 1) == 0;
+}
+
+/*
+ * Returns: true if no writer changed the i-node since inode_read_begin
+ * returned seq, so what was read meanwhile is consistent
+ */
+static bool inode_read_validate(inode_t *inode, unsigned int seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&inode->i_seq, memory_order_relaxed) == seq;
+}
+
+/*
+ * Returns the size of an open i-node, without locking it unless a writer
+ * keeps racing with the read
+ * Input:
+ *  - inode: pointer to an inode_t struct
+ */
+size_t inode_get_size(inode_t *inode) {
+    for (int attempt = 0; attempt < INODE_OPTIMISTIC_RETRIES; attempt++) {
+        unsigned int seq;
+        if (inode_read_begin(inode, &seq)) {
+            size_t size = inode->i_size;
+            if (inode_read_validate(inode, seq)) {
+                return size;
+            }
+        }
+    }
+
+    pthread_rwlock_rdlock(&inode->i_lock);
+    size_t size = inode->i_size;
+    pthread_rwlock_unlock(&inode->i_lock);
+    return size;
+}
+
+/*
+ * Checks if a certain inode is free
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: 1 if free, 0 if taken and -1 if it is an invalid inumber
+ */
+int inode_is_free(tfs_t *fs, int inumber) {
+
+    if (!valid_inumber(inumber)) {
+        return -1;
+    }
+    pthread_rwlock_rdlock(&fs->freeinode_ts_mutex);
+    if (fs->freeinode_ts[inumber] == TAKEN) {
+        pthread_rwlock_unlock(&fs->freeinode_ts_mutex);
+        return 0;
+    }
+    pthread_rwlock_unlock(&fs->freeinode_ts_mutex);
+    return 1;
+}
+
+
+/*
+ * Inicializes direct data blocks, within a given range, for an inode
+ * Input:
+ *  - inode: pointer to an inode
+ *  - start: number of first data block
+ *  - end: number of last data block to be inicialized
+ * Returns: 0 if successful, -1 if an error occured
+ */
+int inode_inicialize_direct_blocks(tfs_t *fs, inode_t *inode, size_t start, size_t end) {
+
+    if (end < start || start > DIRECT_BLOCKS_COUNT) {
+        //Incorrect bounds
+        return -1;
+    }
+
+    for (size_t i = start; i < end; i++) {
+        inode->i_data_block[i] = data_block_alloc(fs);
+        if (inode->i_data_block[i] == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Writes a data block's index on an inode's indirection block
+ * Input:
+ *  - inode: pointer to an inode_t struct
+ *  - block: block index
+ * Returns:
+ *  0 if successful, -1 otherwise
+ */
+int write_index_to_block(tfs_t *fs, inode_t *inode, int block) {
+    if (inode->number_indirect_blocks == 0) {
+        return -1;
+    }
+
+    int *block_of_indexes = data_block_get(fs, inode->indirection_block);
+    if (block_of_indexes == NULL) {
+        return -1;
+    }
+
+    size_t position = inode->number_indirect_blocks - 1;
+    pthread_rwlock_wrlock(&fs->fs_data_mutex);
+    block_of_indexes[position] = block;
+    pthread_rwlock_unlock(&fs->fs_data_mutex);
+
+    return 0;
+}
+
+/*
+ * Inicializes indirect data blocks, within a given range, for an inode
+ * Input:
+ *  - inode: pointer to an inode
+ *  - start: position of the first index (in the block of indexes)
+ *  - end: position after the last index to be inicialized
+ * Returns: 0 if successful, -1 if an error occured
+ */
+int inode_inicialize_indirect_blocks(tfs_t *fs, inode_t *inode, size_t start, size_t end) {
+    if (inode->indirection_block == -1) {
+        return -1;
+    }
+
+    if (end < start || end > INDIRECT_BLOCKS_COUNT) {
+        //Incorrect bounds
+        return -1;
+    }
+
+    for (size_t i = start; i < end; i++) {
+        int block = data_block_alloc(fs);
+        if (block == -1) {
+            return -1;
+        }
+        inode->number_indirect_blocks += 1;
+        //Write index on indirection block
+        if (write_index_to_block(fs, inode, block) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the number of the data block in a given slot of an inode's block
+ * list (-1 if the slot holds no block)
+ */
+static int inode_slot_get(tfs_t *fs, inode_t *inode, size_t slot) {
+    if (slot < DIRECT_BLOCKS_COUNT) {
+        return inode->i_data_block[slot];
+    }
+
+    pthread_rwlock_rdlock(&fs->fs_data_mutex);
+    int const *block_of_indexes = (int const *) &fs->fs_data[inode->indirection_block * BLOCK_SIZE];
+    int block = block_of_indexes[slot - DIRECT_BLOCKS_COUNT];
+    pthread_rwlock_unlock(&fs->fs_data_mutex);
+    return block;
+}
+
+/*
+ * Stores the number of a data block (or -1) in a slot of an inode's block list
+ */
+static void inode_slot_set(tfs_t *fs, inode_t *inode, size_t slot, int block) {
+    journal_log(fs->journal, JOURNAL_BLOCK_MAP, (int) (inode - fs->inode_table), (int64_t) slot, block,
+                NULL);
+    if (slot < DIRECT_BLOCKS_COUNT) {
+        inode->i_data_block[slot] = block;
+        return;
+    }
+
+    pthread_rwlock_wrlock(&fs->fs_data_mutex);
+    int *block_of_indexes = (int *) &fs->fs_data[inode->indirection_block * BLOCK_SIZE];
+    block_of_indexes[slot - DIRECT_BLOCKS_COUNT] = block;
+    pthread_rwlock_unlock(&fs->fs_data_mutex);
+}
+
+/*
+ * Journals the blocks held by a range of slots of an inode's block list
+ */
+static void journal_block_range(tfs_t *fs, inode_t *inode, size_t start, size_t end) {
+    if (fs->journal == NULL) {
+        return;
+    }
+    for (size_t slot = start; slot < end; slot++) {
+        journal_log(fs->journal, JOURNAL_BLOCK_MAP, (int) (inode - fs->inode_table), (int64_t) slot,
+                    inode_slot_get(fs, inode, slot), NULL);
+    }
+}
+
+/*
+ * Allocates an inode's block of indexes (if it has none yet), with every
+ * index unused
+ * Input:
+ *  - inode: pointer to an inode_t struct
+ * Returns: 0 if successful, -1 if an error occured
+ */
+static int inode_alloc_indirection_block(tfs_t *fs, inode_t *inode) {
+    if (inode->indirection_block != -1) {
+        return 0;
+    }
+
+    int block = data_block_alloc(fs);
+    if (block == -1) {
+        return -1;
+    }
+    int *block_of_indexes = data_block_get(fs, block);
+    if (block_of_indexes == NULL) {
+        return -1;
+    }
+    pthread_rwlock_wrlock(&fs->fs_data_mutex);
+    for (size_t i = 0; i < INDIRECT_BLOCKS_COUNT; i++) {
+        block_of_indexes[i] = -1;
+    }
+    pthread_rwlock_unlock(&fs->fs_data_mutex);
+    inode->indirection_block = block;
+    journal_log(fs->journal, JOURNAL_INDIRECTION, (int) (inode - fs->inode_table), block, 0, NULL);
+    return 0;
+}
+
+/*
+ * Associates the required amount of data blocks to an inode, in order to
+ * store a given amount of information on the inode
+ * Input:
+ *  - inode: an i-node held open by the caller
+ *  - sizeToBeAdded: memory in bytes required
+ *  - offset: offset of the open file
+ * Returns: 0 if successful, -1 if an error occured
+ */
+int inode_add_blocks(tfs_t *fs, inode_t *inode, size_t sizeToBeAdded, size_t offset) {
+    size_t required_blocks;
+    size_t current_blocks;
+
+    required_blocks = (offset + sizeToBeAdded + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    current_blocks = inode->number_of_blocks + inode->number_indirect_blocks;
+    if (required_blocks <= current_blocks) {
+        //If there is no need for additional blocks
+        return 0;
+    }
+    if (required_blocks > MAX_FILE_BLOCKS) {
+        return -1;
+    }
+
+    size_t to_alloc = required_blocks - current_blocks;
+    if (required_blocks > DIRECT_BLOCKS_COUNT && inode->indirection_block == -1) {
+        to_alloc++; //The block of indexes itself
+    }
+    if ((size_t) get_free_memory(fs) < to_alloc * BLOCK_SIZE) { //Not enough data blocks
+        return -1;
+    }
+
+    //Associate direct data blocks first
+    if (inode->number_of_blocks < DIRECT_BLOCKS_COUNT) {
+        size_t direct_end = required_blocks;
+        if (direct_end > DIRECT_BLOCKS_COUNT) {
+            direct_end = DIRECT_BLOCKS_COUNT;
+        }
+        if (inode_inicialize_direct_blocks(fs, inode, inode->number_of_blocks, direct_end) == -1) {
+            return -1;
+        }
+        inode->number_of_blocks = direct_end;
+    }
+
+    if (required_blocks > DIRECT_BLOCKS_COUNT) {
+        if (inode_alloc_indirection_block(fs, inode) == -1 ||
+            inode_inicialize_indirect_blocks(fs, inode, inode->number_indirect_blocks,
+                                             required_blocks - DIRECT_BLOCKS_COUNT) == -1) {
+            return -1;
+        }
+    }
+
+    journal_block_range(fs, inode, current_blocks, required_blocks);
+    return 0;
+}
+
+/*
+ * Checks if it is an invalid block associated with an inode
+ * Input:
+ *  - inode
+ *  - block_number
+ * Returns: 0 if it is a valid block, otherwise returns a non-zero integer
+ */
+int inode_invalid_indirect_block(tfs_t *fs, inode_t *inode, size_t block_number) {
+    int *block_of_indexes = data_block_get(fs, inode->indirection_block);
+
+
+    return (block_of_indexes == NULL || (block_number >= (BLOCK_SIZE / sizeof(int))) ||
+        block_of_indexes[block_number] == -1);
+}
+
+
+/*
+ * Copies a run of bytes between a caller's buffer and fs_data.
+ * Runs of at least NT_COPY_THRESHOLD bytes are copied with non-temporal
+ * stores (when the target supports them), so that bulk transfers do not
+ * evict the rest of the working set from the cache.
+ */
+static void data_copy(void *dest, void const *src, size_t size) {
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__)
+#if defined(__AVX512F__)
+#define NT_VECTOR_SIZE 64
+#elif defined(__AVX2__)
+#define NT_VECTOR_SIZE 32
+#else
+#define NT_VECTOR_SIZE 16
+#endif
+    if (size >= NT_COPY_THRESHOLD) {
+        char *d = dest;
+        char const *s = src;
+
+        /* Streaming stores need an aligned destination */
+        size_t head = (NT_VECTOR_SIZE - ((uintptr_t) d % NT_VECTOR_SIZE)) % NT_VECTOR_SIZE;
+        memcpy(d, s, head);
+        d += head;
+        s += head;
+        size -= head;
+
+        for (; size >= NT_VECTOR_SIZE; size -= NT_VECTOR_SIZE) {
+#if defined(__AVX512F__)
+            _mm512_stream_si512((void *) d, _mm512_loadu_si512((void const *) s));
+#elif defined(__AVX2__)
+            _mm256_stream_si256((__m256i *) (void *) d, _mm256_loadu_si256((__m256i const *) (void const *) s));
+#else
+            _mm_stream_si128((__m128i *) (void *) d, _mm_loadu_si128((__m128i const *) (void const *) s));
+#endif
+            d += NT_VECTOR_SIZE;
+            s += NT_VECTOR_SIZE;
+        }
+        _mm_sfence();
+        memcpy(d, s, size);
+        return;
+    }
+#undef NT_VECTOR_SIZE
+#endif
+    memcpy(dest, src, size);
+}
+
+/*
+ * Recomputes the checksums of a run of mapped blocks after [block_offset,
+ * block_offset + size) of the run was copied from source (fs_data_mutex must
+ * be held for writing). Fully overwritten blocks are checksummed from the
+ * source, which is still in cache, unlike fs_data after a streaming copy.
+ */
+static void update_checksums(tfs_t *fs, void *const *blocks, size_t run, size_t block_offset,
+                             char const *source, size_t size) {
+    for (size_t i = 0; i < run; i++) {
+        size_t start = i * BLOCK_SIZE;
+        if (start >= block_offset && start + BLOCK_SIZE <= block_offset + size) {
+            fs->block_checksums[block_index(fs, blocks[i])] = crc32c(source + start - block_offset, BLOCK_SIZE);
+        } else {
+            fs->block_checksums[block_index(fs, blocks[i])] = crc32c(blocks[i], BLOCK_SIZE);
+        }
+    }
+}
+
+/*
+ * Checks a run of mapped blocks against their stored checksums (the
+ * blocks' i-node must not be written meanwhile, see inode_read_range)
+ * Returns: 0 if every block is intact, -1 otherwise
+ */
+static int verify_checksums(tfs_t *fs, void *const *blocks, size_t run) {
+    for (size_t i = 0; i < run; i++) {
+        if (fs->block_checksums[block_index(fs, blocks[i])] != crc32c(blocks[i], BLOCK_SIZE)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Counts how many mapped blocks, starting at blocks[first], are physically
+ * contiguous in fs_data (and can therefore be copied in one go)
+ */
+static size_t contiguous_blocks(void *const *blocks, size_t first, size_t count) {
+    size_t run = 1;
+    while (first + run < count &&
+           (char *) blocks[first + run] == (char *) blocks[first + run - 1] + BLOCK_SIZE) {
+        run++;
+    }
+    return run;
+}
+
+/*
+ * Reads a block number that a writer may be changing at the same time,
+ * exactly once, so that the value checked is the value used
+ */
+static inline int block_number_load(int const *field) { return *(int const volatile *) field; }
+
+/*
+ * Resolves, in a single pass, the data blocks that hold a byte range of an
+ * inode, so that the copy loops can run over plain pointers. Block numbers
+ * are read once and checked before use, so that this is safe even without
+ * i_lock (see inode_read_optimistic): no lock is taken, as the block list
+ * only changes with i_lock held for writing.
+ * Input:
+ *  - inode: pointer to an inode_t struct (its i_lock should be held)
+ *  - offset: first byte of the range
+ *  - len: length of the range (in bytes)
+ *  - blocks: output array, with room for at least MAX_FILE_BLOCKS pointers
+ * Returns:
+ *  number of blocks mapped if successful, -1 otherwise
+ */
+ssize_t inode_map_blocks(tfs_t *fs, inode_t *inode, size_t offset, size_t len, void **blocks) {
+    if (len == 0) {
+        return 0;
+    }
+
+    size_t first = offset / BLOCK_SIZE;
+    size_t last = (offset + len - 1) / BLOCK_SIZE;
+    if (last >= MAX_FILE_BLOCKS ||
+        last >= inode->number_of_blocks + inode->number_indirect_blocks) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to the i-node's block list
+    size_t count = 0;
+    size_t b = first;
+    for (; b <= last && b < DIRECT_BLOCKS_COUNT; b++) {
+        int block = block_number_load(&inode->i_data_block[b]);
+        if (!valid_block_number(block)) {
+            return -1;
+        }
+        blocks[count++] = &fs->fs_data[block * BLOCK_SIZE];
+    }
+
+    if (b <= last) {
+        int indirection_block = block_number_load(&inode->indirection_block);
+        if (!valid_block_number(indirection_block)) {
+            return -1;
+        }
+        insert_delay(); // simulate storage access delay to the block of indexes
+        int const *block_of_indexes = (int const *) &fs->fs_data[indirection_block * BLOCK_SIZE];
+        for (; b <= last; b++) {
+            int block = block_number_load(&block_of_indexes[b - DIRECT_BLOCKS_COUNT]);
+            if (!valid_block_number(block)) {
+                return -1;
+            }
+            blocks[count++] = &fs->fs_data[block * BLOCK_SIZE];
+        }
+    }
+    return (ssize_t) count;
+}
+
+/*
+ * Takes an additional reference to a data block
+ */
+static void data_block_ref(tfs_t *fs, int block_number) {
+    pthread_rwlock_wrlock(&fs->free_blocks_mutex);
+    fs->block_refcount[block_number]++;
+    pthread_rwlock_unlock(&fs->free_blocks_mutex);
+}
+
+/*
+ * Checks whether a data block is referenced by more than one block list
+ */
+static bool data_block_is_shared(tfs_t *fs, int block_number) {
+    pthread_rwlock_rdlock(&fs->free_blocks_mutex);
+    bool shared = fs->block_refcount[block_number] > 1;
+    pthread_rwlock_unlock(&fs->free_blocks_mutex);
+    return shared;
+}
+
+/*
+ * Grows a compressed file's block list up to a number of slots and its
+ * group table up to the matching number of groups. New slots hold no block.
+ * Input:
+ *  - inode: pointer to an inode_t struct
+ *  - groups: number of groups the file must be able to hold
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int inode_reserve_groups(tfs_t *fs, inode_t *inode, size_t groups) {
+    size_t slots = groups * COMPRESSION_GROUP_BLOCKS;
+    if (slots > MAX_FILE_BLOCKS) {
+        return -1;
+    }
+
+    if (groups > inode->i_groups) {
+        size_t *group_bytes = (size_t *) realloc(inode->i_group_bytes, sizeof(size_t) * groups);
+        if (group_bytes == NULL) {
+            return -1;
+        }
+        for (size_t g = inode->i_groups; g < groups; g++) {
+            group_bytes[g] = 0;
+        }
+        inode->i_group_bytes = group_bytes;
+        inode->i_groups = groups;
+    }
+
+    if (inode->number_of_blocks < DIRECT_BLOCKS_COUNT && slots > inode->number_of_blocks) {
+        size_t direct_end = slots < DIRECT_BLOCKS_COUNT ? slots : DIRECT_BLOCKS_COUNT;
+        for (size_t i = inode->number_of_blocks; i < direct_end; i++) {
+            inode->i_data_block[i] = -1;
+        }
+        inode->number_of_blocks = direct_end;
+    }
+
+    if (slots > DIRECT_BLOCKS_COUNT) {
+        if (inode_alloc_indirection_block(fs, inode) == -1) {
+            return -1;
+        }
+        if (slots - DIRECT_BLOCKS_COUNT > inode->number_indirect_blocks) {
+            inode->number_indirect_blocks = slots - DIRECT_BLOCKS_COUNT;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns how many bytes of a compressed file's group lie within the file
+ */
+static size_t group_plain_size(inode_t const *inode, size_t group) {
+    size_t start = group * COMPRESSION_GROUP_SIZE;
+    if (inode->i_size <= start) {
+        return 0;
+    }
+    size_t size = inode->i_size - start;
+    return size < COMPRESSION_GROUP_SIZE ? size : COMPRESSION_GROUP_SIZE;
+}
+
+/*
+ * Loads the uncompressed contents of a group of a compressed file. Only the
+ * copy of the stored bytes is done while holding fs_data_mutex; the
+ * decompression runs after releasing it.
+ * Input:
+ *  - inode: pointer to an inode_t struct (its i_lock must be held)
+ *  - group: index of the group
+ *  - plain: output buffer, with room for COMPRESSION_GROUP_SIZE bytes
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int inode_load_group(tfs_t *fs, inode_t *inode, size_t group, char *plain) {
+    char packed[LZ4_BOUND(COMPRESSION_GROUP_SIZE)];
+    void *blocks[COMPRESSION_GROUP_BLOCKS];
+
+    size_t plain_size = group_plain_size(inode, group);
+    if (plain_size == 0) {
+        return 0;
+    }
+
+    /* A group is either compressed or, if it did not shrink, stored as is */
+    size_t stored = inode->i_group_bytes[group];
+    size_t data_size = stored != 0 ? stored : plain_size;
+    char *data = stored != 0 ? packed : plain;
+    size_t count = (data_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    insert_delay(); // simulate storage access delay to the i-node's block list
+    for (size_t i = 0; i < count; i++) {
+        int block = inode_slot_get(fs, inode, group * COMPRESSION_GROUP_BLOCKS + i);
+        if (!valid_block_number(block)) {
+            return -1;
+        }
+        blocks[i] = &fs->fs_data[block * BLOCK_SIZE];
+    }
+
+    pthread_rwlock_rdlock(&fs->fs_data_mutex);
+    if (fs->checksum_mode == CHECKSUM_VERIFY && verify_checksums(fs, blocks, count) == -1) {
+        pthread_rwlock_unlock(&fs->fs_data_mutex);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t size = data_size - i * BLOCK_SIZE;
+        memcpy(data + i * BLOCK_SIZE, blocks[i], size < BLOCK_SIZE ? size : BLOCK_SIZE);
+    }
+    pthread_rwlock_unlock(&fs->fs_data_mutex);
+
+    if (stored != 0 && lz4_decompress(packed, stored, plain, COMPRESSION_GROUP_SIZE) < (ssize_t) plain_size) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Stores the uncompressed contents of a group of a compressed file,
+ * compressing them first (without holding fs_data_mutex) and resizing the
+ * group to the blocks the result needs
+ * Input:
+ *  - inode: pointer to an inode_t struct (its i_lock must be held for writing)
+ *  - group: index of the group
+ *  - plain: the group's contents
+ *  - plain_size: number of bytes in plain
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int inode_store_group(tfs_t *fs, inode_t *inode, size_t group, char const *plain, size_t plain_size) {
+    char packed[LZ4_BOUND(COMPRESSION_GROUP_SIZE)];
+    void *blocks[COMPRESSION_GROUP_BLOCKS];
+
+    ssize_t compressed = lz4_compress(plain, plain_size, packed, sizeof(packed));
+    size_t plain_blocks = (plain_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t stored = 0;
+    char const *data = plain;
+    size_t data_size = plain_size;
+    if (compressed != -1 && ((size_t) compressed + BLOCK_SIZE - 1) / BLOCK_SIZE < plain_blocks) {
+        /* Only keep the compressed form if it saves blocks */
+        stored = (size_t) compressed;
+        data = packed;
+        data_size = stored;
+    }
+    size_t count = (data_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    insert_delay(); // simulate storage access delay to the i-node's block list
+    for (size_t i = 0; i < COMPRESSION_GROUP_BLOCKS; i++) {
+        size_t slot = group * COMPRESSION_GROUP_BLOCKS + i;
+        int block = inode_slot_get(fs, inode, slot);
+        if (i < count && block != -1 && data_block_is_shared(fs, block)) {
+            /* The group is rewritten as a whole: copy-on-write needs no copy */
+            data_block_free(fs, block);
+            block = -1;
+        }
+        if (i < count && block == -1) {
+            if ((block = data_block_alloc(fs)) == -1) {
+                return -1;
+            }
+            inode_slot_set(fs, inode, slot, block);
+        } else if (i >= count && block != -1) {
+            data_block_free(fs, block);
+            inode_slot_set(fs, inode, slot, -1);
+        }
+        if (i < count) {
+            blocks[i] = &fs->fs_data[block * BLOCK_SIZE];
+        }
+    }
+
+    pthread_rwlock_wrlock(&fs->fs_data_mutex);
+    for (size_t i = 0; i < count; i++) {
+        size_t size = data_size - i * BLOCK_SIZE;
+        memcpy(blocks[i], data + i * BLOCK_SIZE, size < BLOCK_SIZE ? size : BLOCK_SIZE);
+    }
+    if (fs->checksum_mode != CHECKSUM_OFF) {
+        update_checksums(fs, blocks, count, 0, data, data_size);
+    }
+    pthread_rwlock_unlock(&fs->fs_data_mutex);
+
+    inode->i_group_bytes[group] = stored;
+    journal_log(fs->journal, JOURNAL_GROUP, (int) (inode - fs->inode_table), (int64_t) group,
+                (int64_t) stored, NULL);
+    return 0;
+}
+
+/*
+ * Writes to a compressed file, one group at a time: each group touched by
+ * the write is loaded (unless it is fully overwritten), modified and stored
+ * again
+ * Input:
+ *  - inode: pointer to an inode_t struct (its i_lock must be held for writing)
+ *  - offset: where to start writing
+ *  - buffer: input buffer
+ *  - to_write: number of bytes to write
+ * Returns: number of bytes written if successful, -1 otherwise
+ */
+static ssize_t inode_write_compressed(tfs_t *fs, inode_t *inode, size_t offset, char const *buffer,
+                                      size_t to_write) {
+    char plain[COMPRESSION_GROUP_SIZE];
+
+    if (offset + to_write > COMPRESSED_MAX_FILE_SIZE) {
+        to_write = COMPRESSED_MAX_FILE_SIZE - offset;
+    }
+    if (to_write == 0) {
+        return 0;
+    }
+
+    size_t end = offset + to_write;
+    if (inode_reserve_groups(fs, inode, (end + COMPRESSION_GROUP_SIZE - 1) / COMPRESSION_GROUP_SIZE) == -1) {
+        return -1;
+    }
+
+    for (size_t group = offset / COMPRESSION_GROUP_SIZE; group * COMPRESSION_GROUP_SIZE < end; group++) {
+        size_t group_start = group * COMPRESSION_GROUP_SIZE;
+        size_t write_start = (offset > group_start ? offset : group_start) - group_start;
+        size_t write_end = (end < group_start + COMPRESSION_GROUP_SIZE ? end : group_start + COMPRESSION_GROUP_SIZE) - group_start;
+        size_t old_size = group_plain_size(inode, group);
+
+        if ((write_start > 0 || write_end < old_size) && inode_load_group(fs, inode, group, plain) == -1) {
+            return -1;
+        }
+        memcpy(plain + write_start, buffer + (group_start + write_start - offset), write_end - write_start);
+
+        size_t new_size = write_end > old_size ? write_end : old_size;
+        if (inode_store_group(fs, inode, group, plain, new_size) == -1) {
+            return -1;
+        }
+        if (group_start + new_size > inode->i_size) {
+            inode->i_size = group_start + new_size;
+            journal_log(fs->journal, JOURNAL_SIZE, (int) (inode - fs->inode_table),
+                        (int64_t) inode->i_size, 0, NULL);
+        }
+    }
+    return (ssize_t) to_write;
+}
+
+/*
+ * Reads from a compressed file, decompressing each group it touches
+ * Input:
+ *  - inode: pointer to an inode_t struct (its i_lock must be held)
+ *  - offset: where to start reading
+ *  - buffer: output buffer
+ *  - to_read: number of bytes to read (within the file's size)
+ * Returns: number of bytes read if successful, -1 otherwise
+ */
+static ssize_t inode_read_compressed(tfs_t *fs, inode_t *inode, size_t offset, char *buffer, size_t to_read) {
+    char plain[COMPRESSION_GROUP_SIZE];
+    size_t end = offset + to_read;
+
+    for (size_t group = offset / COMPRESSION_GROUP_SIZE; group * COMPRESSION_GROUP_SIZE < end; group++) {
+        size_t group_start = group * COMPRESSION_GROUP_SIZE;
+        size_t read_start = (offset > group_start ? offset : group_start) - group_start;
+        size_t read_end = (end < group_start + COMPRESSION_GROUP_SIZE ? end : group_start + COMPRESSION_GROUP_SIZE) - group_start;
+
+        if (inode_load_group(fs, inode, group, plain) == -1) {
+            return -1;
+        }
+        memcpy(buffer + (group_start + read_start - offset), plain + read_start, read_end - read_start);
+    }
+    return (ssize_t) to_read;
+}
+
+/*
+ * Takes an additional reference to a block in the deduplication index
+ * (dedup_mutex must be held)
+ * Returns: 0 if successful, -1 if the block stopped being indexed
+ */
+static int data_block_share(tfs_t *fs, int block_number) {
+    pthread_rwlock_wrlock(&fs->free_blocks_mutex);
+    if (fs->free_blocks[block_number] != TAKEN || !fs->block_indexed[block_number]) {
+        pthread_rwlock_unlock(&fs->free_blocks_mutex);
+        return -1;
+    }
+    fs->block_refcount[block_number]++;
+    pthread_rwlock_unlock(&fs->free_blocks_mutex);
+    return 0;
+}
+
+/*
+ * Makes the mapped blocks of a range safe to modify in place: blocks in the
+ * deduplication index are taken out of it, and blocks still referenced
+ * elsewhere are replaced by private copies (copy-on-write)
+ * Input:
+ *  - inode: pointer to an inode_t struct (its i_lock must be held for writing)
+ *  - first: slot of the first mapped block
+ *  - blocks: the mapped blocks (updated with the private copies)
+ *  - count: number of mapped blocks
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int inode_unshare_blocks(tfs_t *fs, inode_t *inode, size_t first, void **blocks, size_t count) {
+    if (!fs->blocks_shared) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&fs->dedup_mutex);
+    for (size_t i = 0; i < count; i++) {
+        int block = block_index(fs, blocks[i]);
+
+        pthread_rwlock_wrlock(&fs->free_blocks_mutex);
+        fs->block_indexed[block] = 0;
+        unsigned int references = fs->block_refcount[block];
+        pthread_rwlock_unlock(&fs->free_blocks_mutex);
+        if (references <= 1) {
+            continue;
+        }
+
+        int copy = data_block_alloc(fs);
+        if (copy == -1) {
+            pthread_mutex_unlock(&fs->dedup_mutex);
+            return -1;
+        }
+        pthread_rwlock_wrlock(&fs->fs_data_mutex);
+        memcpy(&fs->fs_data[copy * BLOCK_SIZE], blocks[i], BLOCK_SIZE);
+        fs->block_checksums[copy] = fs->block_checksums[block];
+        pthread_rwlock_unlock(&fs->fs_data_mutex);
+
+        inode_slot_set(fs, inode, first + i, copy);
+        data_block_free(fs, block);
+        blocks[i] = &fs->fs_data[copy * BLOCK_SIZE];
+    }
+    pthread_mutex_unlock(&fs->dedup_mutex);
+    return 0;
+}
+
+/*
+ * Deduplicates the mapped blocks of a range that was just written: each one
+ * is replaced by an indexed block with identical contents, if there is one,
+ * or added to the index otherwise
+ * Input:
+ *  - inode: pointer to an inode_t struct (its i_lock must be held for writing)
+ *  - first: slot of the first mapped block
+ *  - blocks: the mapped blocks
+ *  - count: number of mapped blocks
+ */
+static void inode_dedup_blocks(tfs_t *fs, inode_t *inode, size_t first, void *const *blocks, size_t count) {
+    pthread_mutex_lock(&fs->dedup_mutex);
+    for (size_t i = 0; i < count; i++) {
+        int block = block_index(fs, blocks[i]);
+
+        pthread_rwlock_rdlock(&fs->fs_data_mutex);
+        uint32_t hash = fs->checksum_mode != CHECKSUM_OFF ? fs->block_checksums[block]
+                                                       : crc32c(blocks[i], BLOCK_SIZE);
+        int candidate = fs->dedup_table[hash % DEDUP_TABLE_SIZE] - 1;
+        bool identical = candidate != -1 && candidate != block && fs->block_indexed[candidate] &&
+                         fs->block_hash[candidate] == hash &&
+                         memcmp(&fs->fs_data[candidate * BLOCK_SIZE], blocks[i], BLOCK_SIZE) == 0;
+        pthread_rwlock_unlock(&fs->fs_data_mutex);
+
+        if (identical && data_block_share(fs, candidate) == 0) {
+            inode_slot_set(fs, inode, first + i, candidate);
+            data_block_free(fs, block);
+            continue;
+        }
+
+        if (fs->block_indexed[block]) {
+            continue;
+        }
+        pthread_rwlock_wrlock(&fs->free_blocks_mutex);
+        fs->block_hash[block] = hash;
+        fs->block_indexed[block] = 1;
+        pthread_rwlock_unlock(&fs->free_blocks_mutex);
+        fs->dedup_table[hash % DEDUP_TABLE_SIZE] = block + 1;
+    }
+    pthread_mutex_unlock(&fs->dedup_mutex);
+}
+
+/*
+ * Writes from a buffer to an inode's data blocks
+ * Input:
+ *  - file: pointer to an open file entry
+ *  - inode: pointer to an inode_t struct
+ *  - buffer: input buffer
+ *  - to_write: number of bytes to write
+ *  - offset: if not NULL, where to store the offset the write starts at
+ * Returns:
+ *  number of bytes written if successful, -1 otherwise
+ */
+ssize_t inode_write(tfs_t *fs, open_file_entry_t *file, inode_t *inode, void const *buffer, size_t to_write,
+                    size_t *offset) {
+    void *blocks[MAX_FILE_BLOCKS];
+    char const *source = buffer;
+
+    inode_write_lock(inode);
+    pthread_mutex_lock(&file->of_lock);
+    if (file->of_offset > inode->i_size) { //If the file was truncated
+        file->of_offset = inode->i_size;
+    }
+    if (offset != NULL) {
+        *offset = file->of_offset;
+    }
+    if (inode->i_compressed) {
+        ssize_t written = inode_write_compressed(fs, inode, file->of_offset, source, to_write);
+        if (written > 0) {
+            file->of_offset += (size_t) written;
+        }
+        pthread_mutex_unlock(&file->of_lock);
+        inode_write_unlock(inode);
+        return written;
+    }
+    if ((file->of_offset + to_write) > MAX_FILE_BLOCKS * BLOCK_SIZE) {
+        //If trying to write more than the inode can store
+        to_write = MAX_FILE_BLOCKS * BLOCK_SIZE - file->of_offset;
+    }
+
+    /* Make sure every block of the range exists, then resolve them all */
+    ssize_t count;
+    size_t first_block = file->of_offset / BLOCK_SIZE;
+    if (inode_add_blocks(fs, inode, to_write, file->of_offset) == -1 ||
+        (count = inode_map_blocks(fs, inode, file->of_offset, to_write, blocks)) == -1 ||
+        inode_unshare_blocks(fs, inode, first_block, blocks, (size_t) count) == -1) {
+        pthread_mutex_unlock(&file->of_lock);
+        inode_write_unlock(inode);
+        return -1;
+    }
+
+    size_t bytes_written = 0;
+    for (size_t i = 0; bytes_written < to_write;) {
+        size_t run = contiguous_blocks(blocks, i, (size_t) count);
+        size_t block_offset = file->of_offset % BLOCK_SIZE;
+        size_t size = run * BLOCK_SIZE - block_offset;
+        if (size > to_write - bytes_written) {
+            size = to_write - bytes_written;
+        }
+
+        /* Perform the actual write, one contiguous run at a time */
+        pthread_rwlock_wrlock(&fs->fs_data_mutex);
+        data_copy((char *) blocks[i] + block_offset, source + bytes_written, size);
+        if (fs->checksum_mode != CHECKSUM_OFF) {
+            update_checksums(fs, blocks + i, run, block_offset, source + bytes_written, size);
+        }
+        pthread_rwlock_unlock(&fs->fs_data_mutex);
+        i += run;
+
+        /* The offset associated with the file handle is
+         * incremented accordingly */
+        bytes_written += size;
+        file->of_offset += size;
+    }
+    if (file->of_offset > inode->i_size) {
+        inode->i_size = file->of_offset;
+        journal_log(fs->journal, JOURNAL_SIZE, (int) (inode - fs->inode_table),
+                    (int64_t) inode->i_size, 0, NULL);
+    }
+    if (fs->dedup_enabled) {
+        inode_dedup_blocks(fs, inode, first_block, blocks, (size_t) count);
+    }
+    pthread_mutex_unlock(&file->of_lock);
+    inode_write_unlock(inode);
+    return (ssize_t) bytes_written;
+}
+
+/*
+ * Makes an i-node reference the same contents as another one, sharing its
+ * data blocks (copy-on-write) instead of copying them. Only the block list
+ * is duplicated, including the block of indexes.
+ * Input:
+ *  - dst: i-node that receives the copy (holding no blocks)
+ *  - src: i-node being copied (its i_lock must be held)
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int inode_share_blocks(tfs_t *fs, inode_t *dst, inode_t const *src) {
+    size_t *group_bytes = NULL;
+    if (src->i_groups > 0) {
+        group_bytes = (size_t *) malloc(sizeof(size_t) * src->i_groups);
+        if (group_bytes == NULL) {
+            return -1;
+        }
+        memcpy(group_bytes, src->i_group_bytes, sizeof(size_t) * src->i_groups);
+    }
+
+    int indirection_block = -1;
+    if (src->indirection_block != -1) {
+        indirection_block = data_block_alloc(fs);
+        if (indirection_block == -1) {
+            free(group_bytes);
+            return -1;
+        }
+        pthread_rwlock_wrlock(&fs->fs_data_mutex);
+        memcpy(&fs->fs_data[indirection_block * BLOCK_SIZE], &fs->fs_data[src->indirection_block * BLOCK_SIZE],
+               BLOCK_SIZE);
+        pthread_rwlock_unlock(&fs->fs_data_mutex);
+    }
+
+    pthread_mutex_lock(&fs->dedup_mutex);
+    fs->blocks_shared = true;
+    pthread_mutex_unlock(&fs->dedup_mutex);
+
+    for (size_t i = 0; i < src->number_of_blocks; i++) {
+        if (src->i_data_block[i] != -1) {
+            data_block_ref(fs, src->i_data_block[i]);
+        }
+    }
+    if (indirection_block != -1) {
+        int const *block_of_indexes = (int const *) &fs->fs_data[indirection_block * BLOCK_SIZE];
+        for (size_t i = 0; i < src->number_indirect_blocks; i++) {
+            if (block_of_indexes[i] != -1) {
+                data_block_ref(fs, block_of_indexes[i]);
+            }
+        }
+    }
+
+    dst->i_node_type = src->i_node_type;
+    dst->i_size = src->i_size;
+    memcpy(dst->i_data_block, src->i_data_block, sizeof(int) * src->number_of_blocks);
+    dst->number_of_blocks = src->number_of_blocks;
+    dst->indirection_block = indirection_block;
+    dst->number_indirect_blocks = src->number_indirect_blocks;
+    dst->i_compressed = src->i_compressed;
+    dst->i_group_bytes = group_bytes;
+    dst->i_groups = src->i_groups;
+    return 0;
+}
+
+/*
+ * Makes a new, empty file share the contents of an existing one
+ * (copy-on-write)
+ * Input:
+ *  - src_inumber: i-node's number of the file being cloned
+ *  - dst_inumber: i-node's number of the new file
+ * Returns: 0 if successful, -1 otherwise
+ */
+int inode_clone(tfs_t *fs, int src_inumber, int dst_inumber) {
+    inode_t *src = inode_get(fs, src_inumber);
+    inode_t *dst = inode_get(fs, dst_inumber);
+    if (src == NULL || dst == NULL || src == dst || src->i_node_type != T_FILE) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&src->i_lock);
+    inode_write_lock(dst);
+
+    /* Drop the blocks the new file was created with */
+    if ((dst->indirection_block != -1 && inode_free_indirect_blocks(fs, dst) == -1) ||
+        inode_free_direct_blocks(fs, dst) == -1) {
+        inode_write_unlock(dst);
+        pthread_rwlock_unlock(&src->i_lock);
+        return -1;
+    }
+    size_t *old_group_bytes = dst->i_group_bytes;
+
+    int ret = inode_share_blocks(fs, dst, src);
+    if (ret == 0) {
+        free(old_group_bytes);
+
+        journal_log(fs->journal, JOURNAL_TRUNCATE, dst_inumber, 0, 0, NULL);
+        if (dst->indirection_block != -1) {
+            journal_log(fs->journal, JOURNAL_INDIRECTION, dst_inumber, dst->indirection_block, 0,
+                        NULL);
+        }
+        journal_block_range(fs, dst, 0, dst->number_of_blocks + dst->number_indirect_blocks);
+        journal_log(fs->journal, JOURNAL_SIZE, dst_inumber, (int64_t) dst->i_size, 0, NULL);
+        if (dst->i_compressed) {
+            journal_log(fs->journal, JOURNAL_COMPRESS, dst_inumber, 0, 0, NULL);
+        }
+        for (size_t g = 0; g < dst->i_groups; g++) {
+            journal_log(fs->journal, JOURNAL_GROUP, dst_inumber, (int64_t) g,
+                        (int64_t) dst->i_group_bytes[g], NULL);
+        }
+    }
+
+    inode_write_unlock(dst);
+    pthread_rwlock_unlock(&src->i_lock);
+    return ret;
+}
+
+/*
+ * Copies a range of an inode's contents to a buffer. Uncompressed contents
+ * are copied without any lock: the blocks of an i-node, and their
+ * checksums, only change with its i_lock held for writing (blocks shared
+ * with other files are copied before being written), so holding i_lock
+ * for reading, or validating i_seq afterwards, is enough.
+ * Input:
+ *  - inode: pointer to an inode_t struct (its i_lock should be held, see
+ *    inode_read_optimistic otherwise)
+ *  - offset: where to start reading
+ *  - buffer: output buffer
+ *  - to_read: number of bytes to read (within the file's size)
+ * Returns:
+ *  number of bytes read if successful, -1 otherwise
+ */
+static ssize_t inode_read_range(tfs_t *fs, inode_t *inode, size_t offset, char *buffer, size_t to_read) {
+    void *blocks[MAX_FILE_BLOCKS];
+
+    if (inode->i_compressed) {
+        return inode_read_compressed(fs, inode, offset, buffer, to_read);
+    }
+
+    ssize_t count = inode_map_blocks(fs, inode, offset, to_read, blocks);
+    if (count == -1) {
+        return -1;
+    }
+
+    size_t bytes_read = 0;
+    for (size_t i = 0; bytes_read < to_read;) {
+        size_t run = contiguous_blocks(blocks, i, (size_t) count);
+        size_t block_offset = (offset + bytes_read) % BLOCK_SIZE;
+        size_t size = run * BLOCK_SIZE - block_offset;
+        if (size > to_read - bytes_read) {
+            size = to_read - bytes_read;
+        }
+
+        /* Perform the actual read, one contiguous run at a time */
+        if (fs->checksum_mode == CHECKSUM_VERIFY && verify_checksums(fs, blocks + i, run) == -1) {
+            /* The stored data is corrupted */
+            return -1;
+        }
+        data_copy(buffer + bytes_read, (char const *) blocks[i] + block_offset, size);
+        i += run;
+        bytes_read += size;
+    }
+    return (ssize_t) bytes_read;
+}
+
+/*
+ * Reads to a buffer from an uncompressed inode's data blocks without
+ * locking it: the copy is kept only if no writer raced with it
+ * Input:
+ *  - file: pointer to an open file entry (its of_lock must be held)
+ *  - inode: pointer to an inode_t struct
+ *  - buffer: output buffer
+ *  - len: number of bytes to read
+ *  - bytes_read: where to store the number of bytes read (-1 on failure)
+ *  - start: if not NULL, where to store the offset the read starts at
+ * Returns: true if the read is consistent, false if it must be redone
+ */
+static bool inode_read_optimistic(tfs_t *fs, open_file_entry_t *file, inode_t *inode, void *buffer,
+                                  size_t len, ssize_t *bytes_read, size_t *start) {
+    unsigned int seq;
+    if (!inode_read_begin(inode, &seq)) {
+        return false;
+    }
+
+    /* At worst, the block list is read while being changed: the blocks
+     * mapped are still within fs_data, and the i-node stays allocated while
+     * the file is open */
+    size_t size = inode->i_size;
+    size_t offset = file->of_offset < size ? file->of_offset : size;
+    size_t to_read = size - offset;
+    if (to_read > len) {
+        to_read = len;
+    }
+    ssize_t count = inode_read_range(fs, inode, offset, buffer, to_read);
+
+    if (!inode_read_validate(inode, seq)) {
+        return false;
+    }
+    if (start != NULL) {
+        *start = offset;
+    }
+    if (count > 0) {
+        offset += (size_t) count;
+    }
+    file->of_offset = offset;
+    *bytes_read = count;
+    return true;
+}
+
+/*
+ * Reads to a buffer from an inode's data blocks
+ * Input:
+ *  - file: pointer to an open file entry
+ *  - inode: pointer to an inode_t struct
+ *  - buffer: output buffer
+ *  - len: number of bytes to read
+ *  - offset: if not NULL, where to store the offset the read starts at
+ * Returns:
+ *  number of bytes read if successful, -1 otherwise
+ */
+ssize_t inode_read(tfs_t *fs, open_file_entry_t *file, inode_t *inode, void *buffer, size_t len,
+                   size_t *offset) {
+    /* Writers reallocate the group table of compressed files, so only plain
+     * files are read optimistically */
+    if (!inode->i_compressed) {
+        ssize_t bytes_read;
+        pthread_mutex_lock(&file->of_lock);
+        for (int attempt = 0; attempt < INODE_OPTIMISTIC_RETRIES; attempt++) {
+            if (inode_read_optimistic(fs, file, inode, buffer, len, &bytes_read, offset)) {
+                pthread_mutex_unlock(&file->of_lock);
+                return bytes_read;
+            }
+        }
+        pthread_mutex_unlock(&file->of_lock);
+    }
+
+    /* Writers kept racing with the read: wait for them instead */
+    pthread_rwlock_rdlock(&inode->i_lock);
+    pthread_mutex_lock(&file->of_lock);
+
+    if (file->of_offset > inode->i_size) {
+        file->of_offset = inode->i_size;
+    }
+    if (offset != NULL) {
+        *offset = file->of_offset;
+    }
+    /* Determine how many bytes to read */
+    size_t to_read = inode->i_size - file->of_offset;
+    if (to_read > len) {
+        to_read = len;
+    }
+
+    ssize_t bytes_read = inode_read_range(fs, inode, file->of_offset, buffer, to_read);
+    if (bytes_read > 0) {
+        /* The offset associated with the file handle is
+         * incremented accordingly */
+        file->of_offset += (size_t) bytes_read;
+    }
+    pthread_mutex_unlock(&file->of_lock);
+    pthread_rwlock_unlock(&inode->i_lock);
+    return bytes_read;
+}
+
+/*
+ * Returns: true if a directory entry is in use by a regular file
+ */
+static bool dir_entry_is_file(tfs_t *fs, dir_entry_t const *entry) {
+    return entry->d_inumber >= 0 && fs->inode_table[entry->d_inumber].i_node_type == T_FILE;
+}
+
+/*
+ * Gathers the files in a directory and, recursively, in its subdirectories
+ * (inode_table_mutex must be held), naming each by its path name without
+ * the leading '/'
+ * Input:
+ *  - inumber: identifier of the directory's i-node
+ *  - prefix: path name of the directory, in the same form ("" for the root)
+ *  - snapshot: where the files' names go
+ *  - inumbers: where their i-node numbers go (INODE_TABLE_SIZE of them)
+ */
+static void snapshot_gather(tfs_t *fs, int inumber, char const *prefix, snapshot_t *snapshot,
+                            int *inumbers) {
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, fs->inode_table[inumber].i_data_block[0]);
+    if (dir_entry == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        int sub_inumber = dir_entry[i].d_inumber;
+        if (sub_inumber < 0 || snapshot->count == INODE_TABLE_SIZE) {
+            continue;
+        }
+        char path[MAX_PATH_NAME];
+        snprintf(path, sizeof(path), "%s%s", prefix, dir_entry[i].d_name);
+        if (fs->inode_table[sub_inumber].i_node_type == T_DIRECTORY) {
+            strncat(path, "/", sizeof(path) - strlen(path) - 1);
+            snapshot_gather(fs, sub_inumber, path, snapshot, inumbers);
+        } else {
+            memcpy(snapshot->entries[snapshot->count].name, path, MAX_PATH_NAME);
+            inumbers[snapshot->count++] = sub_inumber;
+        }
+    }
+}
+
+/*
+ * Takes a snapshot of every file in the volume, in every directory. Files
+ * are frozen together, so the snapshot is a consistent view of the volume;
+ * afterwards writers carry on, copying the blocks they share with the
+ * snapshot.
+ * Returns: the snapshot if successful, NULL otherwise
+ */
+snapshot_t *snapshot_create(tfs_t *fs) {
+    snapshot_t *snapshot = (snapshot_t *) aligned_alloc(_Alignof(snapshot_t), sizeof(snapshot_t));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    snapshot->fs = fs;
+    snapshot->next = NULL;
+    snapshot->count = 0;
+
+    insert_delay(); // simulate storage access delay to the root i-node
+    pthread_rwlock_wrlock(&fs->inode_table_mutex);
+    int inumbers[INODE_TABLE_SIZE];
+    snapshot_gather(fs, ROOT_DIR_INUM, "", snapshot, inumbers);
+    size_t files = snapshot->count;
+
+    /* Freeze every file before copying any of them */
+    for (size_t i = 0; i < files; i++) {
+        pthread_rwlock_rdlock(&fs->inode_table[inumbers[i]].i_lock);
+    }
+
+    bool failed = false;
+    snapshot->count = 0;
+    for (size_t i = 0; i < files && !failed; i++) {
+        snapshot_entry_t *entry = &snapshot->entries[snapshot->count];
+        if (inode_share_blocks(fs, &entry->inode, &fs->inode_table[inumbers[i]]) == -1) {
+            failed = true;
+        } else {
+            snapshot->count++;
+        }
+    }
+
+    for (size_t i = 0; i < files; i++) {
+        pthread_rwlock_unlock(&fs->inode_table[inumbers[i]].i_lock);
+    }
+    pthread_rwlock_unlock(&fs->inode_table_mutex);
+
+    if (failed) {
+        snapshot_destroy(snapshot);
+        return NULL;
+    }
+    return snapshot;
+}
+
+/*
+ * Reads from a file, as it was when a snapshot was taken
+ * Input:
+ *  - snapshot: the snapshot
+ *  - sub_name: path name of the file, without the leading '/' (e.g.
+ *    "dir/file")
+ *  - offset: where to start reading
+ *  - buffer: output buffer
+ *  - len: number of bytes to read
+ * Returns: number of bytes read if successful, -1 otherwise
+ */
+ssize_t snapshot_read(snapshot_t *snapshot, char const *sub_name, size_t offset, void *buffer,
+                      size_t len) {
+    tfs_t *fs = snapshot->fs;
+    for (size_t i = 0; i < snapshot->count; i++) {
+        inode_t *inode = &snapshot->entries[i].inode;
+        if (strncmp(snapshot->entries[i].name, sub_name, MAX_PATH_NAME) != 0) {
+            continue;
+        }
+
+        if (offset >= inode->i_size) {
+            return 0;
+        }
+        size_t to_read = inode->i_size - offset;
+        if (to_read > len) {
+            to_read = len;
+        }
+        return inode_read_range(fs, inode, offset, buffer, to_read);
+    }
+    return -1;
+}
+
+/*
+ * Releases a snapshot, dropping its references to data blocks
+ * Input:
+ *  - snapshot: the snapshot
+ */
+void snapshot_destroy(snapshot_t *snapshot) {
+    tfs_t *fs = snapshot->fs;
+    for (size_t i = 0; i < snapshot->count; i++) {
+        inode_t *inode = &snapshot->entries[i].inode;
+        if (inode->indirection_block != -1) {
+            inode_free_indirect_blocks(fs, inode);
+        }
+        inode_free_direct_blocks(fs, inode);
+        free(inode->i_group_bytes);
+    }
+    free(snapshot);
+}
+
+/* Fills the first empty entry of a directory, unless the name is taken
+ * (inode_table_mutex must be held for writing; it is released and taken
+ * again while waiting for removed entries to become free)
+ * Returns 0 if successful, -1 otherwise */
+static int dir_entry_fill(tfs_t *fs, int inumber, dir_entry_t *dir_entry, int sub_inumber,
+                          char const *sub_name) {
+    if (!valid_inumber(sub_inumber) || strlen(sub_name) == 0) {
+        return -1;
+    }
+
+    /* Fails if the name is taken; otherwise, fills the first empty entry */
+    dir_entry_t *empty = NULL;
+    for (;;) {
+        bool retired = false;
+        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+            if (dir_entry[i].d_inumber == -1) {
+                if (empty == NULL) {
+                    empty = &dir_entry[i];
+                }
+            } else if (dir_entry[i].d_inumber == DIR_ENTRY_RETIRED) {
+                retired = true;
+            } else if (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0) {
+                return -1;
+            }
+        }
+        if (empty != NULL || !retired) {
+            break;
+        }
+        /* Every free entry was removed recently: wait until no lookup can
+         * still be reading them */
+        pthread_rwlock_unlock(&fs->inode_table_mutex);
+        epoch_synchronize(fs->epoch);
+        pthread_rwlock_wrlock(&fs->inode_table_mutex);
+    }
+    if (empty == NULL) {
+        return -1;
+    }
+
+    /* Publishes the entry once its name is in place */
+    strncpy(empty->d_name, sub_name, MAX_FILE_NAME - 1);
+    empty->d_name[MAX_FILE_NAME - 1] = 0;
+    atomic_store_explicit(&empty->d_inumber, sub_inumber, memory_order_release);
+    journal_log(fs->journal, JOURNAL_DIR_ADD, inumber, sub_inumber, 0, empty->d_name);
+    return 0;
+}
+
+/*
+ * Adds an entry to the i-node directory data (outside epoch critical
+ * sections, as it may wait for removed entries to be reclaimed).
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - sub_inumber: identifier of the sub i-node entry
+ *  - sub_name: name of the sub i-node entry
+ * Returns: SUCCESS or FAIL
+ */
+int add_dir_entry(tfs_t *fs, int inumber, int sub_inumber, char const *sub_name) {
+    int result;
+    add_dir_entries(fs, inumber, &sub_inumber, &sub_name, &result, 1);
+    return result;
+}
+
+/* Adds several entries to a directory, accessing it and taking its lock
+ * once for all of them (outside epoch critical sections, like
+ * add_dir_entry)
+ * Input:
+ *  - inumber: identifier of the directory's i-node
+ *  - sub_inumbers, sub_names: the entries
+ *  - results: set to 0 for each entry added, -1 for the others (e.g. if
+ *    the name is taken, or the directory is full)
+ *  - count: number of entries
+ * Returns: the number of entries added
+ */
+size_t add_dir_entries(tfs_t *fs, int inumber, int const *sub_inumbers,
+                       char const *const *sub_names, int *results, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        results[i] = -1;
+    }
+    if (!valid_inumber(inumber)) {
+        return 0;
+    }
+
+    insert_delay(); // simulate storage access delay to i-node with inumber
+    pthread_rwlock_wrlock(&fs->inode_table_mutex);
+
+    if (fs->inode_table[inumber].i_node_type != T_DIRECTORY) {
+        pthread_rwlock_unlock(&fs->inode_table_mutex);
+        return 0;
+    }
+
+    /* Locates the block containing the directory's entries */
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, fs->inode_table[inumber].i_data_block[0]);
+    if (dir_entry == NULL) {
+        pthread_rwlock_unlock(&fs->inode_table_mutex);
+        return 0;
+    }
+
+    size_t added = 0;
+    for (size_t i = 0; i < count; i++) {
+        results[i] = dir_entry_fill(fs, inumber, dir_entry, sub_inumbers[i], sub_names[i]);
+        if (results[i] == 0) {
+            added++;
+        }
+    }
+    pthread_rwlock_unlock(&fs->inode_table_mutex);
+    return added;
+}
+
+/* Looks for a given name inside a directory
+ * Input:
+ * 	- parent directory's i-node number
+ * 	- name to search
+ * 	Returns i-number linked to the target name, -1 if not found
+ */
+int find_in_dir(tfs_t *fs, int inumber, char const *sub_name) {
+    insert_delay(); // simulate storage access delay to i-node with inumber
+    if (!valid_inumber(inumber) ||
+        fs->inode_table[inumber].i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    /* Locates the block containing the directory's entries */
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, fs->inode_table[inumber].i_data_block[0]);
+    if (dir_entry == NULL) {
+        return -1;
+    }
+
+    /* Iterates over the directory entries looking for one that has the target
+     * name. No lock is taken: entries are published with release stores, and
+     * a removed entry is not reused while a lookup might be reading it. */
+    int sub_inumber = -1;
+    epoch_enter(fs->epoch);
+    for (size_t i = 0; i < MAX_DIR_ENTRIES && sub_inumber == -1; i++) {
+        int entry_inumber = atomic_load_explicit(&dir_entry[i].d_inumber, memory_order_acquire);
+        if (entry_inumber >= 0 &&
+            strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0) {
+            sub_inumber = entry_inumber;
+        }
+    }
+    epoch_exit(fs->epoch);
+    return sub_inumber;
+}
+
+/*
+ * Lists a directory: the name, i-node number, type and size of each entry,
+ * read with the directory and every file in it frozen, so that the listing
+ * is consistent (a single pass, however many entries there are)
+ * Input:
+ *  - inumber: identifier of the directory's i-node
+ * Returns: the listing if successful, NULL otherwise
+ */
+dir_listing_t *dir_list(tfs_t *fs, int inumber) {
+    if (!valid_inumber(inumber)) {
+        return NULL;
+    }
+    dir_listing_t *listing = (dir_listing_t *) malloc(sizeof(dir_listing_t));
+    if (listing == NULL) {
+        return NULL;
+    }
+    listing->next = NULL;
+    listing->count = 0;
+    listing->position = 0;
+
+    insert_delay(); // simulate storage access delay to i-node with inumber
+    pthread_rwlock_rdlock(&fs->inode_table_mutex);
+    dir_entry_t *dir_entry = NULL;
+    if (fs->inode_table[inumber].i_node_type == T_DIRECTORY) {
+        dir_entry = (dir_entry_t *)data_block_get(fs, fs->inode_table[inumber].i_data_block[0]);
+    }
+    if (dir_entry == NULL) {
+        pthread_rwlock_unlock(&fs->inode_table_mutex);
+        free(listing);
+        return NULL;
+    }
+
+    /* Entries only change with inode_table_mutex held for writing; freezing
+     * every file too keeps their sizes consistent with each other */
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (dir_entry_is_file(fs, &dir_entry[i])) {
+            pthread_rwlock_rdlock(&fs->inode_table[dir_entry[i].d_inumber].i_lock);
+        }
+    }
+
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        int sub_inumber = dir_entry[i].d_inumber;
+        if (sub_inumber < 0) {
+            continue;
+        }
+        dir_listing_entry_t *entry = &listing->entries[listing->count++];
+        memcpy(entry->name, dir_entry[i].d_name, MAX_FILE_NAME);
+        entry->inumber = sub_inumber;
+        entry->type = fs->inode_table[sub_inumber].i_node_type;
+        entry->size = fs->inode_table[sub_inumber].i_size;
+    }
+
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (dir_entry_is_file(fs, &dir_entry[i])) {
+            pthread_rwlock_unlock(&fs->inode_table[dir_entry[i].d_inumber].i_lock);
+        }
+    }
+    pthread_rwlock_unlock(&fs->inode_table_mutex);
+    return listing;
+}
+
+/*
+ * Makes a removed directory entry available again
+ */
+static void dir_entry_reclaim(void *entry) {
+    atomic_store(&((dir_entry_t *) entry)->d_inumber, -1);
+}
+
+/*
+ * Removes an entry from the i-node directory data.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - sub_inumber: identifier of the sub i-node entry
+ * Returns: SUCCESS or FAIL
+ */
+int clear_dir_entry(tfs_t *fs, int inumber, int sub_inumber) {
+    if (!valid_inumber(inumber) || !valid_inumber(sub_inumber)) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to i-node with inumber
+    pthread_rwlock_wrlock(&fs->inode_table_mutex);
+
+    if (fs->inode_table[inumber].i_node_type != T_DIRECTORY) {
+        pthread_rwlock_unlock(&fs->inode_table_mutex);
+        return -1;
+    }
+
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, fs->inode_table[inumber].i_data_block[0]);
+    if (dir_entry == NULL) {
+        pthread_rwlock_unlock(&fs->inode_table_mutex);
+        return -1;
+    }
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (dir_entry[i].d_inumber == sub_inumber) {
+            atomic_store_explicit(&dir_entry[i].d_inumber, DIR_ENTRY_RETIRED,
+                                  memory_order_release);
+            journal_log(fs->journal, JOURNAL_DIR_REMOVE, inumber, sub_inumber, 0,
+                        dir_entry[i].d_name);
+            pthread_rwlock_unlock(&fs->inode_table_mutex);
+            epoch_retire(fs->epoch, dir_entry_reclaim, &dir_entry[i]);
+            return 0;
+        }
+    }
+
+    pthread_rwlock_unlock(&fs->inode_table_mutex);
+    return -1;
+}
+
+/*
+ * Allocated a new data block
+ * Returns: block index if successful, -1 otherwise
+ */
+
+int data_block_alloc(tfs_t *fs) {
+    pthread_rwlock_wrlock(&fs->free_blocks_mutex);
+    for (int i = 0; i < DATA_BLOCKS; i++) {
+        if (i * (int) sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
+            insert_delay(); // simulate storage access delay to free_blocks
+        }
+
+        if (fs->free_blocks[i] == FREE) {
+            fs->free_blocks[i] = TAKEN;
+            fs->block_refcount[i] = 1;
+            fs->block_indexed[i] = 0;
+            pthread_rwlock_unlock(&fs->free_blocks_mutex);
+            return i;
+        }
+    }
+    pthread_rwlock_unlock(&fs->free_blocks_mutex);
+    return -1;
+}
+
+/* Drops a reference to a data block, freeing it once no block list
+ * references it anymore
+ * Input
+ * 	- the block index
+ * Returns: 0 if success, -1 otherwise
+ */
+int data_block_free(tfs_t *fs, int block_number) {
+    if (!valid_block_number(block_number)) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to free_blocks
+    pthread_rwlock_wrlock(&fs->free_blocks_mutex);
+    if (fs->free_blocks[block_number] == TAKEN && --fs->block_refcount[block_number] == 0) {
+        fs->free_blocks[block_number] = FREE;
+        fs->block_indexed[block_number] = 0;
+    }
+    pthread_rwlock_unlock(&fs->free_blocks_mutex);
+    return 0;
+}
+
+/* Returns a pointer to the contents of a given block
+ * Input:
+ * 	- Block's index
+ * Returns: pointer to the first byte of the block, NULL otherwise
+ */
+void *data_block_get(tfs_t *fs, int block_number) {
+    if (!valid_block_number(block_number)) {
+        return NULL;
+    }
+
+    insert_delay(); // simulate storage access delay to block
+    return &fs->fs_data[block_number * BLOCK_SIZE];
+}
+
+/* Returns the free list of the calling thread */
+static open_file_free_list_t *thread_free_list_of(tfs_t *fs) {
+    if (thread_free_list == OPEN_FILE_FREE_LISTS) {
+        thread_free_list = atomic_fetch_add(&next_free_list, 1) % OPEN_FILE_FREE_LISTS;
+    }
+    return &fs->open_file_free_lists[thread_free_list];
+}
+
+/* Returns the segment of the open file table holding a given index, NULL
+ * if the table has not grown that far */
+static open_file_entry_t *open_file_segment_of(tfs_t *fs, int index) {
+    return atomic_load_explicit(&fs->open_file_segments[index / OPEN_FILE_SEGMENT_SIZE],
+                                memory_order_acquire);
+}
+
+/* Returns the entry at a given index of the open file table, which must
+ * exist (be in a free list, or belong to a handle) */
+static open_file_entry_t *open_file_entry_at(tfs_t *fs, int index) {
+    return &open_file_segment_of(fs, index)[index % OPEN_FILE_SEGMENT_SIZE];
+}
+
+/* Takes an entry from a free list
+ * Returns: its index, -1 if the list is empty */
+static int free_list_pop(tfs_t *fs, open_file_free_list_t *list) {
+    pthread_mutex_lock(&list->lock);
+    int index = list->head;
+    if (index != -1) {
+        list->head = open_file_entry_at(fs, index)->of_next_free;
+    }
+    pthread_mutex_unlock(&list->lock);
+    return index;
+}
+
+static void free_list_push(tfs_t *fs, open_file_free_list_t *list, int index) {
+    pthread_mutex_lock(&list->lock);
+    open_file_entry_at(fs, index)->of_next_free = list->head;
+    list->head = index;
+    pthread_mutex_unlock(&list->lock);
+}
+
+/* Adds a segment to the open file table: its first entry is returned, and
+ * the others go to the given free list
+ * Returns: the index of the entry, -1 if the table is full */
+static int open_file_table_grow(tfs_t *fs, open_file_free_list_t *list) {
+    pthread_mutex_lock(&fs->open_file_grow_mutex);
+    size_t segment = fs->open_file_segment_count;
+    open_file_entry_t *entries = NULL;
+    if (segment < MAX_OPEN_FILES / OPEN_FILE_SEGMENT_SIZE) {
+        entries = (open_file_entry_t *) aligned_alloc(
+            _Alignof(open_file_entry_t), OPEN_FILE_SEGMENT_SIZE * sizeof(open_file_entry_t));
+    }
+    if (entries == NULL) {
+        pthread_mutex_unlock(&fs->open_file_grow_mutex);
+        return -1;
+    }
+
+    int first = (int) (segment * OPEN_FILE_SEGMENT_SIZE);
+    for (int i = 0; i < OPEN_FILE_SEGMENT_SIZE; i++) {
+        atomic_init(&entries[i].of_state, OPEN_FILE_FREE);
+        pthread_mutex_init(&entries[i].of_lock, NULL);
+        entries[i].of_next_free = first + i + 1;
+    }
+    atomic_store_explicit(&fs->open_file_segments[segment], entries, memory_order_release);
+    fs->open_file_segment_count++;
+    pthread_mutex_unlock(&fs->open_file_grow_mutex);
+
+    pthread_mutex_lock(&list->lock);
+    entries[OPEN_FILE_SEGMENT_SIZE - 1].of_next_free = list->head;
+    list->head = first + 1;
+    pthread_mutex_unlock(&list->lock);
+    return first;
+}
+
+/* Returns the entry of a file handle, and its state, NULL if the handle is
+ * not open (or was closed, even if its entry was taken again since) */
+static open_file_entry_t *open_file_entry_of(tfs_t *fs, int fhandle, unsigned int *state) {
+    if (fhandle < 0) {
+        return NULL;
+    }
+    unsigned int generation = (unsigned int) fhandle >> HANDLE_INDEX_BITS;
+    int index = fhandle & ((1 << HANDLE_INDEX_BITS) - 1);
+    if (open_file_segment_of(fs, index) == NULL) {
+        return NULL;
+    }
+    open_file_entry_t *file = open_file_entry_at(fs, index);
+
+    *state = atomic_load_explicit(&file->of_state, memory_order_acquire);
+    if (*state % OPEN_FILE_GENERATION != OPEN_FILE_TAKEN ||
+        ((*state / OPEN_FILE_GENERATION) & HANDLE_GENERATION_MASK) != generation) {
+        return NULL;
+    }
+    return file;
+}
+
+/* Add new entry to the open file table: from the calling thread's free
+ * list, else from any other, else from a new segment
+ * Inputs:
+ * 	- I-node number of the file to open
+ * 	- Initial offset
+ * Returns: file handle if successful, -1 otherwise
+ */
+int add_to_open_file_table(tfs_t *fs, int inumber, size_t offset) {
+    if (inode_open_ref(fs, inumber) == -1) {
+        return -1;
+    }
+
+    open_file_free_list_t *list = thread_free_list_of(fs);
+    int index = free_list_pop(fs, list);
+    for (unsigned int i = 1; index == -1 && i < OPEN_FILE_FREE_LISTS; i++) {
+        index = free_list_pop(fs, &fs->open_file_free_lists[(thread_free_list + i) %
+                                                             OPEN_FILE_FREE_LISTS]);
+    }
+    if (index == -1 && (index = open_file_table_grow(fs, list)) == -1) {
+        inode_close_ref(fs, inumber);
+        return -1;
+    }
+
+    /* Nobody else can reach a free entry that is in no free list */
+    open_file_entry_t *file = open_file_entry_at(fs, index);
+    file->of_inode = &fs->inode_table[inumber];
+    file->of_offset = offset;
+    unsigned int generation = atomic_load_explicit(&file->of_state, memory_order_relaxed) /
+                              OPEN_FILE_GENERATION;
+    atomic_store_explicit(&file->of_state, generation * OPEN_FILE_GENERATION + OPEN_FILE_TAKEN,
+                          memory_order_release);
+    return (int) ((generation & HANDLE_GENERATION_MASK) << HANDLE_INDEX_BITS) | index;
+}
+
+/* Frees the entry of a file handle, and drops its reference to its i-node;
+ * the entry is left for the caller to put in a free list
+ * Returns: the entry's index, -1 if the handle is not open */
+static int open_file_entry_release(tfs_t *fs, int fhandle) {
+    unsigned int state;
+    open_file_entry_t *file = open_file_entry_of(fs, fhandle, &state);
+    if (file == NULL) {
+        return -1;
+    }
+
+    /* Only one close of the handle frees the entry, moving it on to its
+     * next generation */
+    unsigned int freed = (state / OPEN_FILE_GENERATION + 1) * OPEN_FILE_GENERATION;
+    if (!atomic_compare_exchange_strong(&file->of_state, &state, freed)) {
+        return -1;
+    }
+    inode_close_ref(fs, open_file_inumber(fs, file));
+    return fhandle & ((1 << HANDLE_INDEX_BITS) - 1);
+}
+
+/* Frees an entry from the open file table
+ * Inputs:
+ * 	- file handle to free/close
+ * Returns 0 is success, -1 otherwise
+ */
+int remove_from_open_file_table(tfs_t *fs, int fhandle) {
+    int index = open_file_entry_release(fs, fhandle);
+    if (index == -1) {
+        return -1;
+    }
+    free_list_push(fs, thread_free_list_of(fs), index);
+    return 0;
+}
+
+/* Frees several entries from the open file table, returning them all to
+ * the calling thread's free list at once
+ * Inputs:
+ * 	- file handles to free/close
+ * 	- results: set to 0 for each handle closed, -1 for the others (unless
+ * 	  NULL)
+ * 	- number of handles
+ * Returns: the number of handles closed
+ */
+size_t remove_many_from_open_file_table(tfs_t *fs, int const *fhandles, int *results,
+                                        size_t count) {
+    int head = -1;
+    int tail = -1;
+    size_t closed = 0;
+    for (size_t i = 0; i < count; i++) {
+        int index = open_file_entry_release(fs, fhandles[i]);
+        if (results != NULL) {
+            results[i] = index == -1 ? -1 : 0;
+        }
+        if (index == -1) {
+            continue;
+        }
+        /* Nobody else can reach a free entry that is in no free list */
+        open_file_entry_at(fs, index)->of_next_free = head;
+        head = index;
+        if (tail == -1) {
+            tail = index;
+        }
+        closed++;
+    }
+
+    if (head != -1) {
+        open_file_free_list_t *list = thread_free_list_of(fs);
+        pthread_mutex_lock(&list->lock);
+        open_file_entry_at(fs, tail)->of_next_free = list->head;
+        list->head = head;
+        pthread_mutex_unlock(&list->lock);
+    }
+    return closed;
+}
+
+/* Returns pointer to a given entry in the open file table
+ * Inputs:
+ * 	 - file handle
+ * Returns: pointer to the entry if sucessful, NULL otherwise
+ */
+open_file_entry_t *get_open_file_entry(tfs_t *fs, int fhandle) {
+    unsigned int state;
+    return open_file_entry_of(fs, fhandle, &state);
+}
+
+/* Returns the i-node number of the file an open file entry refers to
+ * Inputs:
+ * 	 - an entry in use
+ * Returns: the i-node number
+ */
+int open_file_inumber(tfs_t *fs, open_file_entry_t const *file) {
+    return (int) (file->of_inode - fs->inode_table);
+}
+
+/*
+ * Volume images: a header, the block tables, every data block and then the
+ * i-nodes in use, each followed by the compressed size of its groups (the
+ * deduplication index is not kept: loaded blocks are just not shared with
+ * new ones)
+ */
+#define IMAGE_MAGIC "TFSIMG1"
+
+typedef struct {
+    char magic[8];
+    uint32_t block_size;
+    uint32_t data_blocks;
+    uint32_t inode_table_size;
+    uint32_t inodes; /* number of i-nodes at the end of the image */
+} image_header_t;
+
+typedef struct {
+    int32_t inumber;
+    uint32_t type;
+    int32_t indirection_block;
+    uint32_t compressed;
+    uint64_t size;
+    uint64_t number_of_blocks;
+    uint64_t number_indirect_blocks;
+    uint64_t groups;
+    int32_t data_block[DIRECT_BLOCKS_COUNT];
+} image_inode_t;
+
+/*
+ * Writes a volume to an image
+ * Input:
+ *  - out: the image file, written from its current position
+ * Returns: 0 if successful, -1 otherwise
+ * (no operation on the volume may be in progress, and no file open)
+ */
+int state_save(tfs_t *fs, FILE *out) {
+    /* Unlinked i-nodes go first, so that every i-node saved is reachable */
+    epoch_synchronize(fs->epoch);
+
+    image_header_t header = {.magic = IMAGE_MAGIC,
+                             .block_size = BLOCK_SIZE,
+                             .data_blocks = DATA_BLOCKS,
+                             .inode_table_size = INODE_TABLE_SIZE};
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        if (fs->freeinode_ts[i] == TAKEN) {
+            header.inodes++;
+        }
+    }
+    if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+        fwrite(fs->free_blocks, sizeof(fs->free_blocks), 1, out) != 1 ||
+        fwrite(fs->block_refcount, sizeof(fs->block_refcount), 1, out) != 1 ||
+        fwrite(fs->block_checksums, sizeof(fs->block_checksums), 1, out) != 1 ||
+        fwrite(fs->fs_data, BLOCK_SIZE, DATA_BLOCKS, out) != DATA_BLOCKS) {
+        return -1;
+    }
+
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        if (fs->freeinode_ts[i] != TAKEN) {
+            continue;
+        }
+        inode_t *inode = &fs->inode_table[i];
+        image_inode_t record = {.inumber = i,
+                                .type = inode->i_node_type,
+                                .indirection_block = inode->indirection_block,
+                                .compressed = inode->i_compressed,
+                                .size = inode->i_size,
+                                .number_of_blocks = inode->number_of_blocks,
+                                .number_indirect_blocks = inode->number_indirect_blocks,
+                                .groups = inode->i_groups};
+        memcpy(record.data_block, inode->i_data_block, sizeof(record.data_block));
+        if (fwrite(&record, sizeof(record), 1, out) != 1) {
+            return -1;
+        }
+        for (size_t g = 0; g < inode->i_groups; g++) {
+            uint64_t bytes = inode->i_group_bytes[g];
+            if (fwrite(&bytes, sizeof(bytes), 1, out) != 1) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Checks the fields of an i-node record of an image on their own
+ */
+static bool valid_image_inode(tfs_t *fs, image_inode_t const *record) {
+    if (!valid_inumber(record->inumber) || fs->freeinode_ts[record->inumber] != FREE ||
+        (record->type != T_FILE && record->type != T_DIRECTORY) ||
+        record->number_of_blocks > DIRECT_BLOCKS_COUNT ||
+        record->number_indirect_blocks > INDIRECT_BLOCKS_COUNT ||
+        record->groups * COMPRESSION_GROUP_BLOCKS > MAX_FILE_BLOCKS ||
+        (record->indirection_block != -1 && !valid_block_number(record->indirection_block)) ||
+        (record->number_indirect_blocks > 0 &&
+         (record->indirection_block == -1 || record->number_of_blocks != DIRECT_BLOCKS_COUNT))) {
+        return false;
+    }
+    for (size_t b = 0; b < DIRECT_BLOCKS_COUNT; b++) {
+        if (record->data_block[b] != -1 && !valid_block_number(record->data_block[b])) {
+            return false;
+        }
+    }
+
+    uint64_t slots = record->number_of_blocks + record->number_indirect_blocks;
+    if (record->type == T_DIRECTORY) {
+        /* A directory is a single block of entries */
+        return record->compressed == 0 && record->size == BLOCK_SIZE &&
+               record->number_of_blocks == 1 && record->number_indirect_blocks == 0 &&
+               record->indirection_block == -1 && record->data_block[0] != -1;
+    }
+    if (record->compressed != 0) {
+        return record->groups * COMPRESSION_GROUP_BLOCKS <= slots &&
+               record->size <= record->groups * COMPRESSION_GROUP_SIZE;
+    }
+    return record->size <= slots * BLOCK_SIZE;
+}
+
+/*
+ * Checks the blocks an i-node record of an image maps (loaded already) and
+ * counts the references to them
+ * Input:
+ *  - record: an i-node record accepted by valid_image_inode
+ *  - references: number of references to each data block, updated
+ * Returns: true if every mapped block is in use, false otherwise
+ */
+static bool count_image_blocks(tfs_t *fs, image_inode_t const *record, unsigned int *references) {
+    /* Only compressed groups that need fewer blocks leave slots empty */
+    int const *block_of_indexes = NULL;
+    if (record->indirection_block != -1) {
+        if (fs->free_blocks[record->indirection_block] != TAKEN) {
+            return false;
+        }
+        references[record->indirection_block]++;
+        block_of_indexes = (int const *) &fs->fs_data[record->indirection_block * BLOCK_SIZE];
+    }
+
+    uint64_t slots = record->number_of_blocks + record->number_indirect_blocks;
+    for (uint64_t slot = 0; slot < slots; slot++) {
+        int block = slot < DIRECT_BLOCKS_COUNT
+                        ? record->data_block[slot]
+                        : block_of_indexes[slot - DIRECT_BLOCKS_COUNT];
+        if (block == -1 && record->compressed != 0) {
+            continue;
+        }
+        if (!valid_block_number(block) || fs->free_blocks[block] != TAKEN) {
+            return false;
+        }
+        references[block]++;
+    }
+    return true;
+}
+
+/*
+ * Checks the block tables of an image against the references the i-nodes
+ * loaded from it make, and the entries of its directories against those
+ * i-nodes
+ * Returns: true if they agree, false otherwise
+ */
+static bool valid_image_tables(tfs_t *fs, unsigned int const *references) {
+    for (int b = 0; b < DATA_BLOCKS; b++) {
+        if ((fs->free_blocks[b] != FREE && fs->free_blocks[b] != TAKEN) ||
+            (fs->free_blocks[b] == FREE) != (fs->block_refcount[b] == 0) ||
+            fs->block_refcount[b] < references[b]) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        if (fs->freeinode_ts[i] != TAKEN || fs->inode_table[i].i_node_type != T_DIRECTORY) {
+            continue;
+        }
+        dir_entry_t *dir_entry =
+            (dir_entry_t *) &fs->fs_data[fs->inode_table[i].i_data_block[0] * BLOCK_SIZE];
+        for (size_t e = 0; e < MAX_DIR_ENTRIES; e++) {
+            int sub_inumber = atomic_load(&dir_entry[e].d_inumber);
+            if (sub_inumber == DIR_ENTRY_RETIRED) {
+                /* No lookup can be reading its name in a new volume */
+                atomic_store(&dir_entry[e].d_inumber, -1);
+            } else if (sub_inumber != -1 &&
+                       (!valid_inumber(sub_inumber) || fs->freeinode_ts[sub_inumber] != TAKEN ||
+                        memchr(dir_entry[e].d_name, '\0', MAX_FILE_NAME) == NULL)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Reads the i-nodes of an image, once its blocks are loaded
+ * Input:
+ *  - inodes: number of i-nodes in the image
+ *  - references: number of references to each data block, updated
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int load_image_inodes(tfs_t *fs, FILE *in, uint32_t inodes, unsigned int *references) {
+    for (uint32_t i = 0; i < inodes; i++) {
+        image_inode_t record;
+        if (fread(&record, sizeof(record), 1, in) != 1 || !valid_image_inode(fs, &record) ||
+            !count_image_blocks(fs, &record, references)) {
+            return -1;
+        }
+
+        size_t *group_bytes = NULL;
+        if (record.groups > 0) {
+            group_bytes = (size_t *) malloc(sizeof(size_t) * record.groups);
+            if (group_bytes == NULL) {
+                return -1;
+            }
+            for (size_t g = 0; g < record.groups; g++) {
+                /* A group is only kept compressed if it shrank */
+                uint64_t bytes;
+                if (fread(&bytes, sizeof(bytes), 1, in) != 1 || bytes >= COMPRESSION_GROUP_SIZE) {
+                    free(group_bytes);
+                    return -1;
+                }
+                group_bytes[g] = (size_t) bytes;
+            }
+        }
+
+        inode_t *inode = &fs->inode_table[record.inumber];
+        inode->i_node_type = (inode_type) record.type;
+        inode->indirection_block = record.indirection_block;
+        inode->i_compressed = record.compressed != 0;
+        inode->i_size = (size_t) record.size;
+        memcpy(inode->i_data_block, record.data_block, sizeof(inode->i_data_block));
+        inode->number_of_blocks = (size_t) record.number_of_blocks;
+        inode->number_indirect_blocks = (size_t) record.number_indirect_blocks;
+        inode->i_group_bytes = group_bytes;
+        inode->i_groups = (size_t) record.groups;
+        atomic_store(&inode->i_refs, 0);
+        pthread_rwlock_init(&inode->i_lock, NULL);
+        fs->freeinode_ts[record.inumber] = TAKEN;
+    }
+    return 0;
+}
+
+/*
+ * Reads a volume from an image written by state_save, checking that every
+ * block and i-node in it is consistent with the others
+ * Input:
+ *  - fs: a volume, just initialized (without even a root directory)
+ *  - in: the image file, read from its current position
+ * Returns: 0 if successful, -1 otherwise (the volume must then be
+ * destroyed)
+ */
+int state_load(tfs_t *fs, FILE *in) {
+    image_header_t header;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.block_size != BLOCK_SIZE || header.data_blocks != DATA_BLOCKS ||
+        header.inode_table_size != INODE_TABLE_SIZE || header.inodes > INODE_TABLE_SIZE) {
+        return -1;
+    }
+
+    /* The blocks come first, so that the block lists of the i-nodes can be
+     * checked as they are read */
+    if (fread(fs->free_blocks, sizeof(fs->free_blocks), 1, in) != 1 ||
+        fread(fs->block_refcount, sizeof(fs->block_refcount), 1, in) != 1 ||
+        fread(fs->block_checksums, sizeof(fs->block_checksums), 1, in) != 1 ||
+        fread(fs->fs_data, BLOCK_SIZE, DATA_BLOCKS, in) != DATA_BLOCKS) {
+        return -1;
+    }
+
+    unsigned int *references = (unsigned int *) calloc(DATA_BLOCKS, sizeof(unsigned int));
+    if (references == NULL) {
+        return -1;
+    }
+    int result = load_image_inodes(fs, in, header.inodes, references) == 0 &&
+                         valid_image_tables(fs, references) &&
+                         fs->freeinode_ts[ROOT_DIR_INUM] == TAKEN &&
+                         fs->inode_table[ROOT_DIR_INUM].i_node_type == T_DIRECTORY
+                     ? 0
+                     : -1;
+    free(references);
+    return result;
+}
+
+/*
+ * Takes a reference to a data block while replaying a journal. A block
+ * that was free is zero-filled: its contents are not journaled.
+ */
+static void replay_block_ref(tfs_t *fs, int block) {
+    if (fs->free_blocks[block] == TAKEN) {
+        fs->block_refcount[block]++;
+        return;
+    }
+    fs->free_blocks[block] = TAKEN;
+    fs->block_refcount[block] = 1;
+    memset(&fs->fs_data[block * BLOCK_SIZE], 0, BLOCK_SIZE);
+    fs->block_checksums[block] = crc32c(&fs->fs_data[block * BLOCK_SIZE], BLOCK_SIZE);
+}
+
+/*
+ * Drops a reference to a data block while replaying a journal
+ */
+static void replay_block_unref(tfs_t *fs, int block) {
+    if (block != -1 && fs->free_blocks[block] == TAKEN && --fs->block_refcount[block] == 0) {
+        fs->free_blocks[block] = FREE;
+    }
+}
+
+/*
+ * Drops every block of an i-node while replaying a journal, leaving it
+ * empty
+ */
+static void replay_release_blocks(tfs_t *fs, inode_t *inode) {
+    for (size_t i = 0; i < inode->number_of_blocks; i++) {
+        replay_block_unref(fs, inode->i_data_block[i]);
+    }
+    if (inode->indirection_block != -1) {
+        int const *block_of_indexes =
+            (int const *) &fs->fs_data[inode->indirection_block * BLOCK_SIZE];
+        for (size_t i = 0; i < inode->number_indirect_blocks; i++) {
+            replay_block_unref(fs, block_of_indexes[i]);
+        }
+        replay_block_unref(fs, inode->indirection_block);
+    }
+    free(inode->i_group_bytes);
+    inode->i_group_bytes = NULL;
+    inode->i_groups = 0;
+    inode->i_size = 0;
+    inode->number_of_blocks = 0;
+    inode->number_indirect_blocks = 0;
+    inode->indirection_block = -1;
+}
+
+/*
+ * Makes room for a slot in an i-node's block list while replaying a
+ * journal; new slots hold no block
+ * Returns: 0 if successful, -1 if the slot needs a block of indexes the
+ * i-node does not have
+ */
+static int replay_extend_slots(tfs_t *fs, inode_t *inode, size_t slots) {
+    while (inode->number_of_blocks < DIRECT_BLOCKS_COUNT && inode->number_of_blocks < slots) {
+        inode->i_data_block[inode->number_of_blocks++] = -1;
+    }
+    if (slots <= DIRECT_BLOCKS_COUNT) {
+        return 0;
+    }
+    if (inode->indirection_block == -1) {
+        return -1;
+    }
+    int *block_of_indexes = (int *) &fs->fs_data[inode->indirection_block * BLOCK_SIZE];
+    while (DIRECT_BLOCKS_COUNT + inode->number_indirect_blocks < slots) {
+        block_of_indexes[inode->number_indirect_blocks++] = -1;
+    }
+    return 0;
+}
+
+/*
+ * Replays a block map record: the block the slot held loses a reference,
+ * the new one gains one
+ */
+static int replay_block_map(tfs_t *fs, inode_t *inode, int64_t slot, int64_t block) {
+    if (slot < 0 || slot >= (int64_t) MAX_FILE_BLOCKS ||
+        (block != -1 && !valid_block_number((int) block)) ||
+        replay_extend_slots(fs, inode, (size_t) slot + 1) == -1) {
+        return -1;
+    }
+
+    int *entry = slot < DIRECT_BLOCKS_COUNT
+                     ? &inode->i_data_block[slot]
+                     : (int *) &fs->fs_data[inode->indirection_block * BLOCK_SIZE] +
+                           (slot - DIRECT_BLOCKS_COUNT);
+    int old = *entry;
+    if (block != -1) {
+        replay_block_ref(fs, (int) block);
+    }
+    replay_block_unref(fs, old);
+    *entry = (int) block;
+
+    if (inode->i_node_type == T_DIRECTORY && block != -1) {
+        /* A directory's block is only mapped when it is created */
+        dir_entry_t *dir_entry = (dir_entry_t *) &fs->fs_data[block * BLOCK_SIZE];
+        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+            atomic_store(&dir_entry[i].d_inumber, -1);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Replays the update of a directory's entries
+ */
+static int replay_dir_entry(tfs_t *fs, inode_t *dir, journal_record_t const *record) {
+    if (dir->i_node_type != T_DIRECTORY || dir->number_of_blocks == 0 ||
+        dir->i_data_block[0] == -1 || !valid_inumber((int) record->arg1) ||
+        memchr(record->name, '\0', MAX_FILE_NAME) == NULL) {
+        return -1;
+    }
+
+    dir_entry_t *dir_entry = (dir_entry_t *) &fs->fs_data[dir->i_data_block[0] * BLOCK_SIZE];
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        int sub_inumber = atomic_load(&dir_entry[i].d_inumber);
+        if (record->type == JOURNAL_DIR_ADD && (sub_inumber == -1 || sub_inumber == DIR_ENTRY_RETIRED)) {
+            strcpy(dir_entry[i].d_name, record->name);
+            atomic_store(&dir_entry[i].d_inumber, (int) record->arg1);
+            return 0;
+        }
+        if (record->type == JOURNAL_DIR_REMOVE && sub_inumber == record->arg1 &&
+            strncmp(dir_entry[i].d_name, record->name, MAX_FILE_NAME) == 0) {
+            atomic_store(&dir_entry[i].d_inumber, -1);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Applies a record of a committed transaction of the volume's journal (see
+ * journal_read) to a volume loaded from an image saved before the journal
+ * was started. Data blocks are not journaled: blocks taken since the image
+ * was saved read as zeros.
+ * Input:
+ *  - record: the record
+ * Returns: 0 if successful, -1 if the record does not fit the volume
+ * (no operation on the volume may be in progress)
+ */
+int state_replay(tfs_t *fs, journal_record_t const *record) {
+    if (record->type == JOURNAL_TX_BEGIN || record->type == JOURNAL_TX_COMMIT) {
+        return 0;
+    }
+    if (!valid_inumber(record->inumber)) {
+        return -1;
+    }
+    inode_t *inode = &fs->inode_table[record->inumber];
+
+    if (record->type == JOURNAL_INODE_CREATE) {
+        if (record->arg1 != T_FILE && record->arg1 != T_DIRECTORY) {
+            return -1;
+        }
+        if (fs->freeinode_ts[record->inumber] == TAKEN) {
+            replay_release_blocks(fs, inode);
+        } else {
+            inode->indirection_block = -1;
+            inode->number_of_blocks = 0;
+            inode->number_indirect_blocks = 0;
+            inode->i_group_bytes = NULL;
+            inode->i_groups = 0;
+            pthread_rwlock_init(&inode->i_lock, NULL);
+        }
+        inode->i_node_type = (inode_type) record->arg1;
+        inode->i_size = inode->i_node_type == T_DIRECTORY ? BLOCK_SIZE : 0;
+        inode->i_compressed = false;
+        atomic_store(&inode->i_refs, 0);
+        fs->freeinode_ts[record->inumber] = TAKEN;
+        return 0;
+    }
+    if (fs->freeinode_ts[record->inumber] != TAKEN) {
+        return -1;
+    }
+
+    switch (record->type) {
+    case JOURNAL_BLOCK_MAP:
+        return replay_block_map(fs, inode, record->arg1, record->arg2);
+    case JOURNAL_INDIRECTION:
+        if (!valid_block_number((int) record->arg1) || inode->indirection_block != -1) {
+            return -1;
+        }
+        replay_block_ref(fs, (int) record->arg1);
+        inode->indirection_block = (int) record->arg1;
+        for (size_t i = 0; i < INDIRECT_BLOCKS_COUNT; i++) {
+            ((int *) &fs->fs_data[record->arg1 * BLOCK_SIZE])[i] = -1;
+        }
+        return 0;
+    case JOURNAL_DIR_ADD:
+    case JOURNAL_DIR_REMOVE:
+        return replay_dir_entry(fs, inode, record);
+    case JOURNAL_TRUNCATE:
+        replay_release_blocks(fs, inode);
+        return 0;
+    case JOURNAL_INODE_FREE:
+        replay_release_blocks(fs, inode);
+        fs->freeinode_ts[record->inumber] = FREE;
+        return 0;
+    case JOURNAL_SIZE:
+        if (record->arg1 < 0 || record->arg1 > (int64_t) (MAX_FILE_BLOCKS * BLOCK_SIZE)) {
+            return -1;
+        }
+        inode->i_size = (size_t) record->arg1;
+        return 0;
+    case JOURNAL_COMPRESS:
+        inode->i_compressed = true;
+        return 0;
+    case JOURNAL_GROUP: {
+        size_t group = (size_t) record->arg1;
+        if (record->arg1 < 0 || (group + 1) * COMPRESSION_GROUP_BLOCKS > MAX_FILE_BLOCKS ||
+            record->arg2 < 0 || record->arg2 >= (int64_t) COMPRESSION_GROUP_SIZE ||
+            replay_extend_slots(fs, inode, (group + 1) * COMPRESSION_GROUP_BLOCKS) == -1) {
+            return -1;
+        }
+        if (group >= inode->i_groups) {
+            size_t *group_bytes = (size_t *) realloc(inode->i_group_bytes, sizeof(size_t) * (group + 1));
+            if (group_bytes == NULL) {
+                return -1;
+            }
+            for (size_t g = inode->i_groups; g <= group; g++) {
+                group_bytes[g] = 0;
+            }
+            inode->i_group_bytes = group_bytes;
+            inode->i_groups = group + 1;
+        }
+        inode->i_group_bytes[group] = (size_t) record->arg2;
+        return 0;
+    }
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Gathers allocation and fragmentation statistics about a volume
+ * Input:
+ *  - stats: filled in
+ * (no operation on the volume may be in progress)
+ */
+void state_stats(tfs_t *fs, volume_stats_t *stats) {
+    /* Unlinked i-nodes are not counted once reclaimed */
+    epoch_synchronize(fs->epoch);
+    memset(stats, 0, sizeof(*stats));
+
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        if (fs->freeinode_ts[i] != TAKEN) {
+            continue;
+        }
+        inode_t *inode = &fs->inode_table[i];
+        stats->inodes++;
+        if (inode->i_node_type == T_DIRECTORY) {
+            stats->directories++;
+            continue;
+        }
+        stats->files++;
+        stats->bytes_stored += inode->i_size;
+
+        /* An extent is a run of consecutive blocks in the file's block list
+         * that are also consecutive on the volume */
+        size_t extents = 0;
+        int previous = -1;
+        for (size_t slot = 0; slot < inode->number_of_blocks + inode->number_indirect_blocks;
+             slot++) {
+            int block = inode_slot_get(fs, inode, slot);
+            if (block != -1 && (previous == -1 || block != previous + 1)) {
+                extents++;
+            }
+            previous = block;
+        }
+        stats->extents += extents;
+        if (extents > 1) {
+            stats->fragmented_files++;
+        }
+    }
+
+    size_t free_run = 0;
+    for (size_t b = 0; b < DATA_BLOCKS; b++) {
+        if (fs->free_blocks[b] == TAKEN) {
+            stats->blocks_used++;
+            if (fs->block_refcount[b] > 1) {
+                stats->blocks_shared++;
+            }
+            free_run = 0;
+            continue;
+        }
+        stats->blocks_free++;
+        if (free_run++ == 0) {
+            stats->free_extents++;
+        }
+        if (free_run > stats->largest_free_extent) {
+            stats->largest_free_extent = free_run;
+        }
+    }
+}
@@ -1,82 +1,290 @@
-#ifndef STATE_H
-#define STATE_H
-
-#include "config.h"
-#include <pthread.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <sys/types.h>
-
-#define DIRECT_BLOCKS_COUNT 10
-
-/*
- * Directory entry
- */
-typedef struct {
-    char d_name[MAX_FILE_NAME];
-    int d_inumber;
-} dir_entry_t;
-
-typedef enum { T_FILE, T_DIRECTORY } inode_type;
-
-/*
- * I-node
- */
-typedef struct {
-    inode_type i_node_type;
-    size_t i_size;
-    int *i_data_block;
-    size_t number_of_blocks;
-    int indirection_block;
-    size_t number_indirect_blocks;
-    pthread_rwlock_t i_lock;
-    /* in a real FS, more fields would exist here */
-} inode_t;
-
-typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
-
-/*
- * Open file entry (in open file table)
- */
-typedef struct {
-    int of_inumber;
-    size_t of_offset;
-    pthread_rwlock_t of_lock;
-} open_file_entry_t;
-
-
-#define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
-
-void state_init();
-void state_destroy();
-
-int get_free_memory();
-
-int inode_alloc_first_block(int inumber);
-int inode_create(inode_type n_type);
-int inode_free_direct_blocks(inode_t *inode);
-int inode_free_indirect_blocks(inode_t *inode);
-int inode_delete(int inumber);
-inode_t *inode_get(int inumber);
-int inode_is_free(int inumber);
-int inode_inicialize_direct_blocks(inode_t *inode, size_t start, size_t end);
-int write_index_to_block(inode_t *inode, int block);
-int inode_inicialize_indirect_blocks(inode_t *inode, size_t start, size_t end);
-size_t inode_compute_required_blocks(size_t size_to_be_added, size_t offset, inode_t *inode);
-int inode_add_blocks(int inumber, size_t sizeToBeAdded, size_t offset);
-int inode_invalid_indirect_block(inode_t *inode, size_t block_number);
-ssize_t inode_write(open_file_entry_t *file, inode_t *inode, void const *buffer, size_t to_write);
-ssize_t inode_read(open_file_entry_t *file, inode_t *inode, void *buffer, size_t to_read);
-
-int clear_dir_entry(int inumber, int sub_inumber);
-int add_dir_entry(int inumber, int sub_inumber, char const *sub_name);
-int find_in_dir(int inumber, char const *sub_name);
-
-int data_block_alloc();
-int data_block_free(int block_number);
-void *data_block_get(int block_number);
-
-int add_to_open_file_table(int inumber, size_t offset);
-int remove_from_open_file_table(int fhandle);
-open_file_entry_t *get_open_file_entry(int fhandle);
+#ifndef STATE_H
+#define STATE_H
+
+#include "config.h"
+#include "dcache.h"
+#include "journal.h"
+#include "pages.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#define DIRECT_BLOCKS_COUNT 10
+#define INDIRECT_BLOCKS_COUNT (BLOCK_SIZE / sizeof(int))
+#define MAX_FILE_BLOCKS (DIRECT_BLOCKS_COUNT + INDIRECT_BLOCKS_COUNT)
+
+/* Compressed files are stored in groups of blocks, compressed on their own */
+#define COMPRESSION_GROUP_SIZE (COMPRESSION_GROUP_BLOCKS * BLOCK_SIZE)
+#define COMPRESSED_MAX_FILE_SIZE \
+    ((MAX_FILE_BLOCKS / COMPRESSION_GROUP_BLOCKS) * COMPRESSION_GROUP_SIZE)
+
+/*
+ * Directory entry
+ */
+typedef struct {
+    char d_name[MAX_FILE_NAME];
+    _Atomic int d_inumber;
+} dir_entry_t;
+
+/* d_inumber of a removed entry, until no lookup can still be reading its
+ * name (unused entries hold -1) */
+#define DIR_ENTRY_RETIRED (-2)
+
+typedef enum { T_FILE, T_DIRECTORY } inode_type;
+
+/*
+ * I-node, laid out in whole cache lines: the first one holds everything a
+ * read looks at, the second what only writers and opens change, and the
+ * last one the lock, so that neither it nor the reference count written by
+ * every open and close slows down readers of this or a neighbouring i-node
+ */
+typedef struct {
+    /* odd while a writer (holding i_lock for writing) changes the i-node or
+     * its contents; readers copy without i_lock and retry if it moved */
+    _Alignas(CACHE_LINE_SIZE) atomic_uint i_seq;
+    inode_type i_node_type;
+    int indirection_block;
+    bool i_compressed;
+    size_t i_size;
+    int i_data_block[DIRECT_BLOCKS_COUNT];
+
+    _Alignas(CACHE_LINE_SIZE) size_t number_of_blocks;
+    size_t number_indirect_blocks;
+    size_t *i_group_bytes; /* compressed size of each group, 0 if stored as is */
+    size_t i_groups;
+    /* number of open file entries referencing it, plus INODE_UNLINKED once
+     * its last directory entry is removed */
+    atomic_uint i_refs;
+    /* in a real FS, more fields would exist here */
+
+    _Alignas(CACHE_LINE_SIZE) pthread_rwlock_t i_lock;
+} inode_t;
+
+_Static_assert(offsetof(inode_t, i_data_block) + sizeof(int) * DIRECT_BLOCKS_COUNT <=
+                   CACHE_LINE_SIZE,
+               "the fields reads use must fit in the first cache line of an i-node");
+
+#define INODE_UNLINKED (1u << 31)
+
+typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t; /* FREE must be 0 */
+
+/*
+ * How data block checksums are maintained: not at all, updated on every
+ * write, or updated on every write and verified on every read
+ */
+typedef enum { CHECKSUM_OFF, CHECKSUM_UPDATE, CHECKSUM_VERIFY } checksum_mode_t;
+
+/*
+ * Allocation and fragmentation statistics of a volume
+ */
+typedef struct {
+    size_t inodes;      /* in use, of INODE_TABLE_SIZE */
+    size_t files;
+    size_t directories;
+    size_t bytes_stored; /* sum of the files' sizes */
+    size_t blocks_used;  /* of DATA_BLOCKS */
+    size_t blocks_shared; /* used by more than one file */
+    size_t blocks_free;
+    /* runs of a file's blocks that are consecutive on the volume: a file
+     * without fragmentation is a single extent */
+    size_t extents;
+    size_t fragmented_files; /* files in more than one extent */
+    size_t free_extents;     /* runs of free blocks */
+    size_t largest_free_extent;
+} volume_stats_t;
+
+/*
+ * Open file entry (in open file table), alone in its cache line, so that
+ * threads using different handles never touch the same line
+ */
+typedef struct {
+    /* an open_file_state_t, plus the entry's generation (bumped whenever it
+     * is freed) times OPEN_FILE_GENERATION */
+    _Alignas(CACHE_LINE_SIZE) atomic_uint of_state;
+    int of_next_free; /* next entry in its free list, -1 if none */
+    /* the file's i-node, resolved once at open time; the entry's reference
+     * keeps it from being reclaimed while the handle is valid */
+    inode_t *of_inode;
+    size_t of_offset;
+    pthread_mutex_t of_lock;
+} open_file_entry_t;
+
+typedef enum { OPEN_FILE_FREE = 0, OPEN_FILE_TAKEN } open_file_state_t;
+#define OPEN_FILE_GENERATION (4u)
+
+/* A list of free open file entries */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t lock;
+    int head; /* -1 if empty */
+} open_file_free_list_t;
+
+_Static_assert(sizeof(open_file_entry_t) == CACHE_LINE_SIZE,
+               "an open file entry must fill exactly one cache line");
+
+
+#define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
+
+/*
+ * Snapshot of every file of a volume: a private copy of each file's
+ * i-node, referencing the same data blocks (copy-on-write)
+ */
+typedef struct {
+    char name[MAX_PATH_NAME]; /* path name, without the leading '/' */
+    inode_t inode;
+} snapshot_entry_t;
+
+typedef struct tfs tfs_t;
+
+typedef struct snapshot {
+    tfs_t *fs;
+    struct snapshot *next; /* snapshot of the next shard (see tfs_snapshot) */
+    size_t count;
+    snapshot_entry_t entries[INODE_TABLE_SIZE];
+} snapshot_t;
+
+/*
+ * Listing of a directory: its entries and their attributes, as they were
+ * when it was taken (see dir_list)
+ */
+typedef struct {
+    char name[MAX_FILE_NAME];
+    int inumber;
+    inode_type type;
+    size_t size;
+} dir_listing_entry_t;
+
+typedef struct dir_listing {
+    struct dir_listing *next; /* listing of the next shard (see tfs_opendir) */
+    size_t count;
+    size_t position; /* next entry to return */
+    dir_listing_entry_t entries[MAX_DIR_ENTRIES];
+} dir_listing_t;
+
+/*
+ * A TecnicoFS volume: every piece of state of one file system, so that a
+ * process can host several independent ones
+ */
+struct tfs {
+    /* Persistent FS state  (in reality, it should be maintained in secondary
+     * memory; for simplicity, this project maintains it in primary memory) */
+
+    /* I-node table */
+    pthread_rwlock_t inode_table_mutex;
+    inode_t inode_table[INODE_TABLE_SIZE];
+    pthread_rwlock_t freeinode_ts_mutex;
+    char freeinode_ts[INODE_TABLE_SIZE];
+    /* Unlinked i-nodes waiting to be reclaimed */
+    atomic_int retired_inodes;
+
+    /* Data blocks */
+    pthread_rwlock_t fs_data_mutex;
+    char *fs_data; /* BLOCK_SIZE * DATA_BLOCKS bytes, huge pages if possible */
+    page_kind_t fs_data_pages;
+    pthread_rwlock_t free_blocks_mutex;
+    char free_blocks[DATA_BLOCKS];
+    /* Number of block list slots referencing each block (protected by
+     * free_blocks_mutex); a block is only freed when it drops to 0 */
+    unsigned int block_refcount[DATA_BLOCKS];
+
+    /* Deduplication index: blocks whose contents may be shared, found by
+     * the CRC32C of their contents. An indexed block is never modified in
+     * place; its owner takes it out of the index first (under dedup_mutex). */
+    pthread_mutex_t dedup_mutex;
+    bool dedup_enabled;
+    bool blocks_shared;
+    int dedup_table[DEDUP_TABLE_SIZE]; /* block number + 1, 0 if empty */
+    uint32_t block_hash[DATA_BLOCKS];
+    char block_indexed[DATA_BLOCKS];
+
+    /* Per-block CRC32C checksums (written with fs_data_mutex held; read as
+     * in inode_read_range) */
+    uint32_t block_checksums[DATA_BLOCKS];
+    checksum_mode_t checksum_mode;
+
+    /* Whether new files are compressed regardless of their open flags */
+    bool compress_new_files;
+
+    /* Metadata journal (NULL unless one is open) */
+    journal_t *journal;
+
+    /* Volatile FS state */
+    /* Open file table: segments of OPEN_FILE_SEGMENT_SIZE entries, added
+     * (under open_file_grow_mutex) as more files are open at once */
+    open_file_entry_t *_Atomic open_file_segments[MAX_OPEN_FILES / OPEN_FILE_SEGMENT_SIZE];
+    pthread_mutex_t open_file_grow_mutex;
+    size_t open_file_segment_count; /* protected by open_file_grow_mutex */
+    open_file_free_list_t open_file_free_lists[OPEN_FILE_FREE_LISTS];
+    dcache_t *dcache;
+    /* Reclamation of what lock-free lookups may still be reading */
+    epoch_domain_t *epoch;
+};
+
+int state_init(tfs_t *fs, bool huge_pages);
+void state_destroy(tfs_t *fs);
+void state_set_checksum_mode(tfs_t *fs, checksum_mode_t mode);
+void state_set_compression(tfs_t *fs, bool enabled);
+void state_set_dedup(tfs_t *fs, bool enabled);
+bool state_compression_enabled(tfs_t *fs);
+
+int get_free_memory(tfs_t *fs);
+
+int inode_alloc_first_block(tfs_t *fs, int inumber);
+int inode_create(tfs_t *fs, inode_type n_type);
+int inode_free_direct_blocks(tfs_t *fs, inode_t *inode);
+int inode_free_indirect_blocks(tfs_t *fs, inode_t *inode);
+int inode_delete(tfs_t *fs, int inumber);
+int inode_open_ref(tfs_t *fs, int inumber);
+void inode_close_ref(tfs_t *fs, int inumber);
+void inode_unlink(tfs_t *fs, int inumber);
+int inode_truncate(tfs_t *fs, int inumber);
+int inode_set_compressed(tfs_t *fs, int inumber);
+int inode_clone(tfs_t *fs, int src_inumber, int dst_inumber);
+inode_t *inode_get(tfs_t *fs, int inumber);
+void inode_write_lock(inode_t *inode);
+void inode_write_unlock(inode_t *inode);
+size_t inode_get_size(inode_t *inode);
+int inode_is_free(tfs_t *fs, int inumber);
+int inode_inicialize_direct_blocks(tfs_t *fs, inode_t *inode, size_t start, size_t end);
+int write_index_to_block(tfs_t *fs, inode_t *inode, int block);
+int inode_inicialize_indirect_blocks(tfs_t *fs, inode_t *inode, size_t start, size_t end);
+size_t inode_compute_required_blocks(size_t size_to_be_added, size_t offset, inode_t *inode);
+int inode_add_blocks(tfs_t *fs, inode_t *inode, size_t sizeToBeAdded, size_t offset);
+int inode_invalid_indirect_block(tfs_t *fs, inode_t *inode, size_t block_number);
+ssize_t inode_map_blocks(tfs_t *fs, inode_t *inode, size_t offset, size_t len, void **blocks);
+ssize_t inode_write(tfs_t *fs, open_file_entry_t *file, inode_t *inode, void const *buffer,
+                    size_t to_write, size_t *offset);
+ssize_t inode_read(tfs_t *fs, open_file_entry_t *file, inode_t *inode, void *buffer,
+                   size_t to_read, size_t *offset);
+
+int state_save(tfs_t *fs, FILE *out);
+int state_load(tfs_t *fs, FILE *in);
+int state_replay(tfs_t *fs, journal_record_t const *record);
+void state_stats(tfs_t *fs, volume_stats_t *stats);
+
+snapshot_t *snapshot_create(tfs_t *fs);
+ssize_t snapshot_read(snapshot_t *snapshot, char const *sub_name, size_t offset, void *buffer,
+                      size_t len);
+void snapshot_destroy(snapshot_t *snapshot);
+
+int clear_dir_entry(tfs_t *fs, int inumber, int sub_inumber);
+int add_dir_entry(tfs_t *fs, int inumber, int sub_inumber, char const *sub_name);
+size_t add_dir_entries(tfs_t *fs, int inumber, int const *sub_inumbers,
+                       char const *const *sub_names, int *results, size_t count);
+int find_in_dir(tfs_t *fs, int inumber, char const *sub_name);
+dir_listing_t *dir_list(tfs_t *fs, int inumber);
+
+int data_block_alloc(tfs_t *fs);
+int data_block_free(tfs_t *fs, int block_number);
+void *data_block_get(tfs_t *fs, int block_number);
+
+int add_to_open_file_table(tfs_t *fs, int inumber, size_t offset);
+int remove_from_open_file_table(tfs_t *fs, int fhandle);
+size_t remove_many_from_open_file_table(tfs_t *fs, int const *fhandles, int *results,
+                                        size_t count);
+open_file_entry_t *get_open_file_entry(tfs_t *fs, int fhandle);
+int open_file_inumber(tfs_t *fs, open_file_entry_t const *file);
 #endif // STATE_H
\ No newline at end of file
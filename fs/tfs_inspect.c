@@ -0,0 +1,47 @@
+#include "operations.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Prints the allocation and fragmentation statistics of a volume image
+ * (written by mkfs.tfs or tfs_save_in).
+ *
+ * Usage: tfs-inspect <image>
+ */
+
+static double percent(size_t part, size_t whole) {
+    return whole == 0 ? 0 : 100.0 * (double) part / (double) whole;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <image>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    tfs_t *fs = tfs_load(argv[1]);
+    if (fs == NULL) {
+        fprintf(stderr, "%s: %s: cannot be read, or is not an image of this geometry\n",
+                argv[0], argv[1]);
+        return EXIT_FAILURE;
+    }
+    volume_stats_t stats;
+    tfs_stats_in(fs, &stats);
+
+    printf("geometry:      %d blocks of %d bytes, %d i-nodes\n", DATA_BLOCKS, BLOCK_SIZE,
+           INODE_TABLE_SIZE);
+    printf("i-nodes:       %zu used (%.1f%%): %zu files, %zu directories\n", stats.inodes,
+           percent(stats.inodes, INODE_TABLE_SIZE), stats.files, stats.directories);
+    printf("blocks:        %zu used (%.1f%%), %zu shared, %zu free\n", stats.blocks_used,
+           percent(stats.blocks_used, DATA_BLOCKS), stats.blocks_shared, stats.blocks_free);
+    printf("file data:     %zu bytes\n", stats.bytes_stored);
+    printf("fragmentation: %zu extents in %zu files (%.2f per file), %zu fragmented (%.1f%%)\n",
+           stats.extents, stats.files,
+           stats.files == 0 ? 0 : (double) stats.extents / (double) stats.files,
+           stats.fragmented_files, percent(stats.fragmented_files, stats.files));
+    printf("free space:    %zu extents, the largest of %zu blocks\n", stats.free_extents,
+           stats.largest_free_extent);
+
+    tfs_unmount(fs);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,439 @@
+#include "operations.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Issues the calls of a trace (see tfs_trace_open) again, against a new
+ * file system with as many shards as the traced one. Each traced thread's
+ * calls are issued by a thread of their own, and every call is issued in
+ * the order the traced calls were made; calls that use a handle, a
+ * snapshot or a listing wait for the call it came from. Written data is a fixed pattern, and files copied
+ * to the external file system are copied to /dev/null.
+ *
+ * Prints the count and latency of each kind of call, traced and replayed,
+ * and fails if any call returned differently than when it was traced.
+ *
+ * Usage: tfs-replay [-r] [-s shards] <trace>
+ *  -r: issue each call at the time it was made (by default, as soon as the
+ *      previous one was issued)
+ *  -s: number of shards of the new file system
+ */
+
+typedef struct {
+    trace_record_t record;
+    char *names;
+    char const *name2;
+    size_t producer; /* call whose handle or object it uses, SIZE_MAX if none */
+    size_t worker;
+    int64_t ret;
+    uint64_t duration_ns;
+    bool done;
+} call_t;
+
+typedef struct {
+    pthread_t tid;
+    size_t *calls;
+    size_t count;
+    char *buffer;
+} worker_t;
+
+static char const *op_names[TRACE_OPS] = {
+    "?",         "lookup", "open",  "mkdir",        "unlink",       "close",       "write",
+    "read",      "size",   "clone", "copy_to_ext",  "set_checksum", "set_compress", "set_dedup",
+    "set_huge",  "snapshot", "snap_read", "snap_release", "opendir",  "readdir",     "closedir"};
+
+static call_t *calls;
+static size_t call_count;
+static char *pattern;
+static size_t max_size;
+static bool real_time;
+static uint64_t origin_ns;
+
+/* The next call to issue; calls are marked done under the same mutex */
+static pthread_mutex_t turn_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t turn_cond = PTHREAD_COND_INITIALIZER;
+static size_t next_call = 0;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static int compare_seq(void const *a, void const *b) {
+    uint64_t x = ((call_t const *) a)->record.seq;
+    uint64_t y = ((call_t const *) b)->record.seq;
+    return x < y ? -1 : x > y;
+}
+
+/* Reads a whole trace, sorted in the order the calls were made
+ * Returns: 0 if successful, -1 otherwise */
+static int read_trace(char const *path, trace_header_t *header) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        return -1;
+    }
+    if (fread(header, sizeof(*header), 1, in) != 1 ||
+        memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0) {
+        fclose(in);
+        return -1;
+    }
+
+    size_t capacity = 0;
+    trace_record_t record;
+    while (fread(&record, sizeof(record), 1, in) == 1) {
+        if (call_count == capacity) {
+            capacity = capacity == 0 ? 1024 : capacity * 2;
+            call_t *grown = (call_t *) realloc(calls, capacity * sizeof(call_t));
+            if (grown == NULL) {
+                fclose(in);
+                return -1;
+            }
+            calls = grown;
+        }
+        call_t *call = &calls[call_count++];
+        memset(call, 0, sizeof(*call));
+        call->record = record;
+        call->names = (char *) malloc((size_t) record.names_len + 2);
+        if (call->names == NULL ||
+            fread(call->names, 1, record.names_len, in) != record.names_len ||
+            record.op == 0 || record.op >= TRACE_OPS) {
+            fclose(in);
+            return -1;
+        }
+        /* Both names are always terminated, even if missing */
+        call->names[record.names_len] = '\0';
+        call->names[record.names_len + 1] = '\0';
+        call->name2 = call->names + strlen(call->names) + 1;
+        size_t size = (size_t) record.size;
+        if (record.op == TRACE_READDIR_PLUS) {
+            size *= sizeof(dir_listing_entry_t);
+        } else if (record.op != TRACE_WRITE && record.op != TRACE_READ &&
+                   record.op != TRACE_SNAPSHOT_READ) {
+            size = 0;
+        }
+        if (size > max_size) {
+            max_size = size;
+        }
+    }
+    fclose(in);
+    qsort(calls, call_count, sizeof(call_t), compare_seq);
+    return 0;
+}
+
+/* Whether a call returns a handle or an object that later calls use */
+static bool produces(uint16_t op) {
+    return op == TRACE_OPEN || op == TRACE_SNAPSHOT || op == TRACE_OPENDIR;
+}
+
+/* The handle or object a call uses, -1 if none */
+static int64_t used_key(trace_record_t const *record) {
+    uint16_t op = record->op;
+    if (op == TRACE_CLOSE || op == TRACE_WRITE || op == TRACE_READ || op == TRACE_GET_FILE_SIZE) {
+        return record->handle;
+    }
+    if (op == TRACE_SNAPSHOT_READ || op == TRACE_SNAPSHOT_RELEASE || op == TRACE_READDIR_PLUS ||
+        op == TRACE_CLOSEDIR) {
+        return record->object;
+    }
+    return -1;
+}
+
+/* Finds, for every call that uses a handle (or a snapshot or a listing),
+ * the last call made before it that returned it */
+static int link_handles() {
+    size_t capacity = 16;
+    while (capacity < 2 * call_count) {
+        capacity *= 2;
+    }
+    size_t *opens = (size_t *) malloc(capacity * sizeof(size_t));
+    if (opens == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        opens[i] = SIZE_MAX;
+    }
+
+    for (size_t i = 0; i < call_count; i++) {
+        trace_record_t const *record = &calls[i].record;
+        bool uses = !produces(record->op);
+        int64_t key = uses ? used_key(record) : record->ret;
+        calls[i].producer = SIZE_MAX;
+        if (key < 0) {
+            continue;
+        }
+
+        size_t slot = (size_t) ((uint64_t) key * 2654435761u % capacity);
+        while (opens[slot] != SIZE_MAX && calls[opens[slot]].record.ret != key) {
+            slot = (slot + 1) % capacity;
+        }
+        if (uses) {
+            calls[i].producer = opens[slot];
+        } else {
+            opens[slot] = i;
+        }
+    }
+    free(opens);
+    return 0;
+}
+
+static int64_t issue(worker_t *worker, call_t *call, int64_t produced) {
+    trace_record_t const *record = &call->record;
+    int handle = (int) produced;
+    void *object = produced == -1 ? NULL : (void *) (intptr_t) produced;
+    switch ((trace_op_t) record->op) {
+    case TRACE_LOOKUP:
+        return tfs_lookup(call->names);
+    case TRACE_OPEN:
+        return tfs_open(call->names, record->arg);
+    case TRACE_MKDIR:
+        return tfs_mkdir(call->names);
+    case TRACE_UNLINK:
+        return tfs_unlink(call->names);
+    case TRACE_CLOSE:
+        return tfs_close(handle);
+    case TRACE_WRITE:
+        return tfs_write(handle, pattern, (size_t) record->size);
+    case TRACE_READ:
+        return tfs_read(handle, worker->buffer, (size_t) record->size);
+    case TRACE_GET_FILE_SIZE:
+        return tfs_get_file_size(handle);
+    case TRACE_CLONE:
+        return tfs_clone(call->names, call->name2);
+    case TRACE_COPY_TO_EXTERNAL:
+        return tfs_copy_to_external_fs(call->names, "/dev/null");
+    case TRACE_SET_CHECKSUM_MODE:
+        return tfs_set_checksum_mode((checksum_mode_t) record->arg);
+    case TRACE_SET_COMPRESSION:
+        return tfs_set_compression(record->arg);
+    case TRACE_SET_DEDUP:
+        return tfs_set_dedup(record->arg);
+    case TRACE_SET_HUGE_PAGES:
+        return tfs_set_huge_pages(record->arg);
+    case TRACE_SNAPSHOT:
+        return trace_object(tfs_snapshot());
+    case TRACE_SNAPSHOT_READ:
+        return tfs_snapshot_read((snapshot_t *) object, call->names, (size_t) record->offset,
+                                 worker->buffer, (size_t) record->size);
+    case TRACE_SNAPSHOT_RELEASE:
+        return tfs_snapshot_release((snapshot_t *) object);
+    case TRACE_OPENDIR:
+        return trace_object(tfs_opendir(call->names));
+    case TRACE_READDIR_PLUS:
+        return tfs_readdir_plus((dir_listing_t *) object, (dir_listing_entry_t *) worker->buffer,
+                                (size_t) record->size);
+    case TRACE_CLOSEDIR:
+        return tfs_closedir((dir_listing_t *) object);
+    default:
+        return -1;
+    }
+}
+
+static void *replay_thread(void *arg) {
+    worker_t *worker = (worker_t *) arg;
+
+    for (size_t i = 0; i < worker->count; i++) {
+        size_t index = worker->calls[i];
+        call_t *call = &calls[index];
+
+        pthread_mutex_lock(&turn_mutex);
+        while (next_call != index) {
+            pthread_cond_wait(&turn_cond, &turn_mutex);
+        }
+        int64_t produced = -1;
+        if (call->producer != SIZE_MAX) {
+            while (!calls[call->producer].done) {
+                pthread_cond_wait(&turn_cond, &turn_mutex);
+            }
+            produced = calls[call->producer].ret;
+        }
+        pthread_mutex_unlock(&turn_mutex);
+
+        if (real_time) {
+            uint64_t elapsed = now_ns() - origin_ns;
+            if (elapsed < call->record.start_ns) {
+                uint64_t wait = call->record.start_ns - elapsed;
+                struct timespec delay = {.tv_sec = (time_t) (wait / 1000000000u),
+                                         .tv_nsec = (long) (wait % 1000000000u)};
+                nanosleep(&delay, NULL);
+            }
+        }
+
+        /* The next call may be issued as soon as this one is */
+        pthread_mutex_lock(&turn_mutex);
+        next_call++;
+        pthread_cond_broadcast(&turn_cond);
+        pthread_mutex_unlock(&turn_mutex);
+
+        uint64_t start = now_ns();
+        int64_t ret = issue(worker, call, produced);
+        uint64_t duration = now_ns() - start;
+
+        pthread_mutex_lock(&turn_mutex);
+        call->ret = ret;
+        call->duration_ns = duration;
+        call->done = true;
+        pthread_cond_broadcast(&turn_cond);
+        pthread_mutex_unlock(&turn_mutex);
+    }
+    return NULL;
+}
+
+/* Whether a call returned what it did when traced (only whether opens,
+ * lookups, snapshots and listings succeeded, as their handles, i-node
+ * numbers and addresses may differ) */
+static bool same_result(call_t const *call) {
+    if (produces(call->record.op) || call->record.op == TRACE_LOOKUP) {
+        return (call->ret == -1) == (call->record.ret == -1);
+    }
+    return call->ret == call->record.ret;
+}
+
+static void print_report(double elapsed) {
+    size_t count[TRACE_OPS] = {0};
+    uint64_t traced_total[TRACE_OPS] = {0}, traced_max[TRACE_OPS] = {0};
+    uint64_t replayed_total[TRACE_OPS] = {0}, replayed_max[TRACE_OPS] = {0};
+    size_t mismatches = 0;
+
+    for (size_t i = 0; i < call_count; i++) {
+        call_t const *call = &calls[i];
+        uint16_t op = call->record.op;
+        count[op]++;
+        traced_total[op] += call->record.duration_ns;
+        replayed_total[op] += call->duration_ns;
+        if (call->record.duration_ns > traced_max[op]) {
+            traced_max[op] = call->record.duration_ns;
+        }
+        if (call->duration_ns > replayed_max[op]) {
+            replayed_max[op] = call->duration_ns;
+        }
+        if (!same_result(call)) {
+            mismatches++;
+        }
+    }
+
+    printf("%-13s %9s %14s %14s %14s %14s\n", "call", "count", "traced mean", "traced max",
+           "replayed mean", "replayed max");
+    for (int op = 1; op < TRACE_OPS; op++) {
+        if (count[op] == 0) {
+            continue;
+        }
+        printf("%-13s %9zu %11.1f us %11.1f us %11.1f us %11.1f us\n", op_names[op], count[op],
+               (double) traced_total[op] / (double) count[op] / 1e3,
+               (double) traced_max[op] / 1e3,
+               (double) replayed_total[op] / (double) count[op] / 1e3,
+               (double) replayed_max[op] / 1e3);
+    }
+    printf("%zu calls replayed in %.3f s, %zu with a different result\n", call_count, elapsed,
+           mismatches);
+}
+
+int main(int argc, char **argv) {
+    long shards = 0;
+    int option;
+    while ((option = getopt(argc, argv, "rs:")) != -1) {
+        switch (option) {
+        case 'r':
+            real_time = true;
+            break;
+        case 's':
+            shards = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r] [-s shards] <trace>\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-r] [-s shards] <trace>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    trace_header_t header;
+    if (read_trace(argv[optind], &header) == -1 || link_handles() == -1) {
+        fprintf(stderr, "%s: %s: cannot be read, or is not a trace\n", argv[0], argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if (shards == 0) {
+        shards = header.shards;
+    }
+    if (shards < 1 || shards > MAX_SHARDS || tfs_init_sharded((unsigned int) shards) == -1) {
+        fprintf(stderr, "%s: failed to initialize the file system\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* One worker per traced thread */
+    worker_t *workers = (worker_t *) calloc(call_count + 1, sizeof(worker_t));
+    uint32_t *threads = (uint32_t *) calloc(call_count + 1, sizeof(uint32_t));
+    size_t *indices = (size_t *) malloc((call_count + 1) * sizeof(size_t));
+    pattern = (char *) malloc(max_size + 1);
+    if (workers == NULL || threads == NULL || indices == NULL || pattern == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < max_size; i++) {
+        pattern[i] = (char) ('a' + i % 26);
+    }
+    size_t worker_count = 0;
+    for (size_t i = 0; i < call_count; i++) {
+        size_t w = 0;
+        while (w < worker_count && threads[w] != calls[i].record.thread) {
+            w++;
+        }
+        if (w == worker_count) {
+            threads[worker_count++] = calls[i].record.thread;
+        }
+        calls[i].worker = w;
+        workers[w].count++;
+    }
+    size_t next = 0;
+    for (size_t w = 0; w < worker_count; w++) {
+        workers[w].calls = indices + next;
+        next += workers[w].count;
+        workers[w].count = 0;
+        workers[w].buffer = (char *) malloc(max_size + 1);
+        if (workers[w].buffer == NULL) {
+            fprintf(stderr, "%s: out of memory\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (size_t i = 0; i < call_count; i++) {
+        worker_t *worker = &workers[calls[i].worker];
+        worker->calls[worker->count++] = i;
+    }
+
+    origin_ns = now_ns();
+    for (size_t w = 0; w < worker_count; w++) {
+        if (pthread_create(&workers[w].tid, NULL, replay_thread, &workers[w]) != 0) {
+            fprintf(stderr, "%s: failed to start a thread\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (size_t w = 0; w < worker_count; w++) {
+        pthread_join(workers[w].tid, NULL);
+    }
+    double elapsed = (double) (now_ns() - origin_ns) / 1e9;
+
+    print_report(elapsed);
+    bool same = true;
+    for (size_t i = 0; i < call_count; i++) {
+        same = same && same_result(&calls[i]);
+        free(calls[i].names);
+    }
+    for (size_t w = 0; w < worker_count; w++) {
+        free(workers[w].buffer);
+    }
+    free(calls);
+    free(workers);
+    free(threads);
+    free(indices);
+    free(pattern);
+    tfs_destroy();
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
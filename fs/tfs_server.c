@@ -0,0 +1,544 @@
+#define _GNU_SOURCE /* memfd seals */
+#include "operations.h"
+#include "protocol.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Serves the file system over a Unix domain socket, to any number of client
+ * processes (see client/tfs_client.h).
+ *
+ * A fixed pool of workers waits on a single epoll instance, where every
+ * connection is registered in one-shot mode: a connection is served by one
+ * worker at a time, which reads everything the client has sent, runs every
+ * complete request in it (clients pipeline requests), answers them all in a
+ * single write and then re-arms the connection. Connections never block: if
+ * the client does not take every answer, the rest is kept and the connection
+ * is re-armed for writing instead, and nothing more is read from it until
+ * it is all sent. Large reads and writes
+ * copy data directly between the file system and a region of memory the
+ * client shares with the server.
+ *
+ * Usage: tfs_server <socket path> [workers] [shards]
+ */
+
+typedef struct connection {
+    int fd;
+    char *in; /* bytes received and not yet processed */
+    size_t in_len;
+    size_t in_cap;
+    char *out; /* responses not yet sent */
+    size_t out_len;
+    size_t out_cap;
+    size_t out_sent; /* bytes of out the client already took */
+    int *handles; /* files this client has open */
+    size_t handle_count;
+    size_t handle_cap;
+    int received_fd; /* passed by the client, for PROTOCOL_ATTACH */
+    char *shared;    /* region shared with the client */
+    size_t shared_size;
+    struct connection *next;
+} connection_t;
+
+static int listen_fd;
+static int epoll_fd;
+/* Written to (once) to stop every worker */
+static int stop_pipe[2];
+
+/* Every open connection, so that they can be closed on exit */
+static pthread_mutex_t connections_mutex = PTHREAD_MUTEX_INITIALIZER;
+static connection_t *connections = NULL;
+
+/* Grows a buffer to hold at least the given number of bytes
+ * Returns 0 if successful, -1 otherwise */
+static int reserve(char **buffer, size_t *capacity, size_t size) {
+    if (size <= *capacity) {
+        return 0;
+    }
+    size_t new_capacity = *capacity == 0 ? 4096 : *capacity;
+    while (new_capacity < size) {
+        new_capacity *= 2;
+    }
+    char *new_buffer = (char *) realloc(*buffer, new_capacity);
+    if (new_buffer == NULL) {
+        return -1;
+    }
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return 0;
+}
+
+/* Sends as much of a connection's pending responses as the socket takes
+ * Returns 0 if successful (even if some are left), -1 otherwise */
+static int send_responses(connection_t *conn) {
+    while (conn->out_sent < conn->out_len) {
+        ssize_t written =
+            write(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1 && errno == EAGAIN) {
+            return 0;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        conn->out_sent += (size_t) written;
+    }
+    conn->out_len = 0;
+    conn->out_sent = 0;
+    return 0;
+}
+
+static bool owns_handle(connection_t *conn, int fhandle) {
+    for (size_t i = 0; i < conn->handle_count; i++) {
+        if (conn->handles[i] == fhandle) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int add_handle(connection_t *conn, int fhandle) {
+    if (conn->handle_count == conn->handle_cap) {
+        size_t capacity = conn->handle_cap == 0 ? 8 : 2 * conn->handle_cap;
+        int *handles = (int *) realloc(conn->handles, capacity * sizeof(int));
+        if (handles == NULL) {
+            return -1;
+        }
+        conn->handles = handles;
+        conn->handle_cap = capacity;
+    }
+    conn->handles[conn->handle_count++] = fhandle;
+    return 0;
+}
+
+static void remove_handle(connection_t *conn, int fhandle) {
+    for (size_t i = 0; i < conn->handle_count; i++) {
+        if (conn->handles[i] == fhandle) {
+            conn->handles[i] = conn->handles[--conn->handle_count];
+            return;
+        }
+    }
+}
+
+/* Checks that a payload holds the given number of null-terminated strings,
+ * and nothing else */
+static bool valid_names(char const *payload, size_t len, int count) {
+    if (len == 0 || payload[len - 1] != '\0') {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (payload[i] == '\0') {
+            count--;
+        }
+    }
+    return count == 0;
+}
+
+/* Maps the region a client shares, from the memfd it passed; the memfd
+ * must be sealed against shrinking, so that the client cannot make the
+ * server fault on it
+ * Returns 0 if successful, -1 otherwise */
+static int attach_shared(connection_t *conn, size_t size) {
+    struct stat st;
+    int fd = conn->received_fd;
+    conn->received_fd = -1;
+
+    int seals = fd == -1 ? -1 : fcntl(fd, F_GET_SEALS);
+    if (seals == -1 || !(seals & F_SEAL_SHRINK) || conn->shared != NULL || size == 0 ||
+        fstat(fd, &st) == -1 || (size_t) st.st_size < size) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    void *shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED) {
+        return -1;
+    }
+    conn->shared = (char *) shared;
+    conn->shared_size = size;
+    return 0;
+}
+
+static bool valid_shared(connection_t *conn, protocol_request_t const *request) {
+    return conn->shared != NULL && request->offset <= conn->shared_size &&
+           request->length <= conn->shared_size - request->offset;
+}
+
+/* Bytes of payload that follow a request's header */
+static size_t payload_length(protocol_request_t const *request) {
+    switch ((protocol_op_t) request->op) {
+    case PROTOCOL_LOOKUP:
+    case PROTOCOL_OPEN:
+    case PROTOCOL_MKDIR:
+    case PROTOCOL_UNLINK:
+    case PROTOCOL_WRITE:
+    case PROTOCOL_CLONE:
+        return request->length;
+    case PROTOCOL_CLOSE:
+    case PROTOCOL_READ:
+    case PROTOCOL_SIZE:
+    case PROTOCOL_ATTACH:
+    case PROTOCOL_WRITE_SHARED:
+    case PROTOCOL_READ_SHARED:
+    default:
+        return 0;
+    }
+}
+
+/* Runs one request, appending its response to the connection's output
+ * Returns 0 if successful, -1 if the connection must be closed */
+static int handle_request(connection_t *conn, protocol_request_t const *request,
+                          char const *payload) {
+    protocol_response_t response = {.ret = -1};
+    size_t response_at = conn->out_len;
+    size_t data_len = request->op == PROTOCOL_READ ? request->length : 0;
+    if (reserve(&conn->out, &conn->out_cap, response_at + sizeof(response) + data_len) == -1) {
+        return -1;
+    }
+    char *data = conn->out + response_at + sizeof(response);
+    int fhandle = request->arg;
+
+    switch ((protocol_op_t) request->op) {
+    case PROTOCOL_LOOKUP:
+        if (valid_names(payload, request->length, 1)) {
+            response.ret = tfs_lookup(payload);
+        }
+        break;
+    case PROTOCOL_OPEN:
+        if (valid_names(payload, request->length, 1)) {
+            response.ret = tfs_open(payload, request->arg);
+        }
+        if (response.ret != -1 && add_handle(conn, (int) response.ret) == -1) {
+            tfs_close((int) response.ret);
+            response.ret = -1;
+        }
+        break;
+    case PROTOCOL_MKDIR:
+        if (valid_names(payload, request->length, 1)) {
+            response.ret = tfs_mkdir(payload);
+        }
+        break;
+    case PROTOCOL_UNLINK:
+        if (valid_names(payload, request->length, 1)) {
+            response.ret = tfs_unlink(payload);
+        }
+        break;
+    case PROTOCOL_CLOSE:
+        /* Clients may only use the files they opened themselves */
+        if (owns_handle(conn, fhandle)) {
+            remove_handle(conn, fhandle);
+            response.ret = tfs_close(fhandle);
+        }
+        break;
+    case PROTOCOL_WRITE:
+        if (owns_handle(conn, fhandle)) {
+            response.ret = tfs_write(fhandle, payload, request->length);
+        }
+        break;
+    case PROTOCOL_READ:
+        if (owns_handle(conn, fhandle)) {
+            response.ret = tfs_read(fhandle, data, data_len);
+        }
+        break;
+    case PROTOCOL_SIZE:
+        if (owns_handle(conn, fhandle)) {
+            response.ret = tfs_get_file_size(fhandle);
+        }
+        break;
+    case PROTOCOL_CLONE:
+        if (valid_names(payload, request->length, 2)) {
+            response.ret = tfs_clone(payload, payload + strlen(payload) + 1);
+        }
+        break;
+    case PROTOCOL_ATTACH:
+        response.ret = attach_shared(conn, request->length);
+        break;
+    case PROTOCOL_WRITE_SHARED:
+        if (owns_handle(conn, fhandle) && valid_shared(conn, request)) {
+            response.ret = tfs_write(fhandle, conn->shared + request->offset, request->length);
+        }
+        break;
+    case PROTOCOL_READ_SHARED:
+        if (owns_handle(conn, fhandle) && valid_shared(conn, request)) {
+            response.ret = tfs_read(fhandle, conn->shared + request->offset, request->length);
+        }
+        break;
+    default:
+        break;
+    }
+
+    memcpy(conn->out + response_at, &response, sizeof(response));
+    conn->out_len = response_at + sizeof(response);
+    if (request->op == PROTOCOL_READ && response.ret > 0) {
+        conn->out_len += (size_t) response.ret;
+    }
+    return 0;
+}
+
+/* Sends what is left of earlier responses, and then reads what the client
+ * sent and answers every complete request in it
+ * Returns 0 if successful, -1 if the connection must be closed */
+static int serve(connection_t *conn) {
+    if (send_responses(conn) == -1) {
+        return -1;
+    }
+    if (conn->out_len > 0) {
+        /* The client is not reading: wait until it takes the rest */
+        return 0;
+    }
+    if (reserve(&conn->in, &conn->in_cap, conn->in_len + 4096) == -1) {
+        return -1;
+    }
+    struct iovec iov = {.iov_base = conn->in + conn->in_len, .iov_len = conn->in_cap - conn->in_len};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message = {
+        .msg_iov = &iov, .msg_iovlen = 1, .msg_control = &control, .msg_controllen = sizeof(control)};
+
+    ssize_t received = recvmsg(conn->fd, &message, 0);
+    if (received == -1 && (errno == EINTR || errno == EAGAIN)) {
+        return 0;
+    }
+    if (received <= 0) {
+        return -1;
+    }
+    conn->in_len += (size_t) received;
+
+    /* A memfd to attach (only the first one passed counts) */
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+        if (conn->received_fd == -1) {
+            conn->received_fd = fd;
+        } else {
+            close(fd);
+        }
+    }
+
+    size_t consumed = 0;
+    protocol_request_t request;
+    while (conn->in_len - consumed >= sizeof(request)) {
+        memcpy(&request, conn->in + consumed, sizeof(request));
+        size_t payload_len = payload_length(&request);
+        if (payload_len > PROTOCOL_MAX_PAYLOAD ||
+            (request.op == PROTOCOL_READ && request.length > PROTOCOL_MAX_PAYLOAD)) {
+            return -1;
+        }
+        if (conn->in_len - consumed < sizeof(request) + payload_len) {
+            /* Wait for the rest of the request */
+            if (reserve(&conn->in, &conn->in_cap, consumed + sizeof(request) + payload_len) ==
+                -1) {
+                return -1;
+            }
+            break;
+        }
+        if (handle_request(conn, &request, conn->in + consumed + sizeof(request)) == -1) {
+            return -1;
+        }
+        consumed += sizeof(request) + payload_len;
+    }
+    memmove(conn->in, conn->in + consumed, conn->in_len - consumed);
+    conn->in_len -= consumed;
+
+    /* Every response to this batch, in one go */
+    return send_responses(conn);
+}
+
+static void close_connection(connection_t *conn) {
+    pthread_mutex_lock(&connections_mutex);
+    for (connection_t **c = &connections; *c != NULL; c = &(*c)->next) {
+        if (*c == conn) {
+            *c = conn->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&connections_mutex);
+
+    /* Files left open by the client are closed for it */
+    for (size_t i = 0; i < conn->handle_count; i++) {
+        tfs_close(conn->handles[i]);
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    if (conn->received_fd != -1) {
+        close(conn->received_fd);
+    }
+    if (conn->shared != NULL) {
+        munmap(conn->shared, conn->shared_size);
+    }
+    free(conn->in);
+    free(conn->out);
+    free(conn->handles);
+    free(conn);
+}
+
+/* Accepts every pending connection */
+static void accept_connections() {
+    int fd;
+    while ((fd = accept(listen_fd, NULL, NULL)) != -1) {
+        connection_t *conn = (connection_t *) calloc(1, sizeof(connection_t));
+        if (conn == NULL || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->received_fd = -1;
+
+        pthread_mutex_lock(&connections_mutex);
+        conn->next = connections;
+        connections = conn;
+        pthread_mutex_unlock(&connections_mutex);
+
+        struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = conn};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            close_connection(conn);
+        }
+    }
+}
+
+static void *worker(void *arg) {
+    (void) arg;
+    struct epoll_event event;
+
+    for (;;) {
+        if (epoll_wait(epoll_fd, &event, 1, -1) != 1) {
+            continue;
+        }
+        if (event.data.ptr == stop_pipe) {
+            return NULL;
+        }
+        if (event.data.ptr == NULL) {
+            accept_connections();
+            event.events = EPOLLIN | EPOLLONESHOT;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listen_fd, &event);
+            continue;
+        }
+
+        connection_t *conn = (connection_t *) event.data.ptr;
+        if ((event.events & (EPOLLERR | EPOLLHUP)) && !(event.events & EPOLLIN)) {
+            close_connection(conn);
+        } else if (serve(conn) == -1) {
+            close_connection(conn);
+        } else {
+            /* Responses left unsent are flushed once the client reads */
+            event.events = (conn->out_len > 0 ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+        }
+    }
+}
+
+/* Creates the listening socket, bound to a path name
+ * Returns 0 if successful, -1 otherwise */
+static int listen_on(char const *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd == -1) {
+        return -1;
+    }
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, SOMAXCONN) == -1 ||
+        fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK) == -1) {
+        close(listen_fd);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "usage: %s <socket path> [workers] [shards]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    long workers = argc > 2 ? strtol(argv[2], NULL, 10) : SERVER_WORKERS;
+    long shards = argc > 3 ? strtol(argv[3], NULL, 10) : 1;
+    if (workers < 1 || workers > 1024 || shards < 1 || shards > MAX_SHARDS) {
+        fprintf(stderr, "%s: invalid number of workers or shards\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Only the main thread handles the signals that stop the server */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (tfs_init_sharded((unsigned int) shards) == -1) {
+        fprintf(stderr, "%s: failed to initialize the file system\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (listen_on(argv[1]) == -1) {
+        perror(argv[1]);
+        tfs_destroy();
+        return EXIT_FAILURE;
+    }
+
+    struct epoll_event listen_event = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = NULL};
+    struct epoll_event stop_event = {.events = EPOLLIN, .data.ptr = stop_pipe};
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd == -1 || pipe(stop_pipe) == -1 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) == -1 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_pipe[0], &stop_event) == -1) {
+        perror("epoll");
+        return EXIT_FAILURE;
+    }
+
+    pthread_t *tid = (pthread_t *) malloc((size_t) workers * sizeof(pthread_t));
+    if (tid == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (long i = 0; i < workers; i++) {
+        if (pthread_create(&tid[i], NULL, worker, NULL) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    int signal_number;
+    sigwait(&signals, &signal_number);
+
+    /* The stop pipe stays readable, waking every worker */
+    if (write(stop_pipe[1], "", 1) != 1) {
+        return EXIT_FAILURE;
+    }
+    for (long i = 0; i < workers; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    free(tid);
+    while (connections != NULL) {
+        close_connection(connections);
+    }
+
+    close(listen_fd);
+    unlink(argv[1]);
+    close(epoll_fd);
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    return tfs_destroy() == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
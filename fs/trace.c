@@ -0,0 +1,135 @@
+#include "trace.h"
+#include "config.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static FILE *trace_file = NULL;
+static atomic_bool tracing = false;
+static uint64_t origin_ns;
+static atomic_uint_least64_t next_seq = 0;
+static atomic_uint next_thread = 1;
+static _Thread_local uint32_t thread_number = 0; /* 0 until its first traced call */
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/*
+ * Starts tracing calls (neither this nor trace_close may run concurrently
+ * with traced calls)
+ * Input:
+ *  - path name of the trace, in the external file system
+ *  - number of shards of the file system
+ * Returns: 0 if successful, -1 otherwise (e.g. if a trace is already open)
+ */
+int trace_open(char const *path, unsigned int shards) {
+    if (trace_file != NULL) {
+        return -1;
+    }
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    trace_header_t header = {.magic = TRACE_MAGIC, .shards = shards};
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        return -1;
+    }
+
+    trace_file = file;
+    origin_ns = now_ns();
+    atomic_store(&next_seq, 0);
+    atomic_store(&tracing, true);
+    return 0;
+}
+
+/*
+ * Stops tracing calls, writing out any record still buffered
+ * Returns: 0 if successful, -1 otherwise
+ */
+int trace_close() {
+    if (trace_file == NULL) {
+        return -1;
+    }
+    atomic_store(&tracing, false);
+    int ret = fclose(trace_file) == EOF ? -1 : 0;
+    trace_file = NULL;
+    return ret;
+}
+
+/*
+ * Notes that a call is being made
+ * Input:
+ *  - call: its op and arguments
+ * Returns: whether the call is traced, i.e. whether a trace is open
+ */
+bool trace_begin(trace_call_t *call) {
+    call->traced = atomic_load_explicit(&tracing, memory_order_relaxed);
+    if (call->traced) {
+        call->seq = atomic_fetch_add(&next_seq, 1);
+        call->start_ns = now_ns() - origin_ns;
+    }
+    return call->traced;
+}
+
+/*
+ * Identifies a snapshot or a listing in a trace: calls that return one
+ * record it as their result, and calls that use it as their object
+ * Input:
+ *  - object: the snapshot or listing (NULL if none)
+ * Returns: its address, -1 if NULL
+ */
+int64_t trace_object(void const *object) {
+    return object == NULL ? -1 : (int64_t) (intptr_t) object;
+}
+
+static size_t copy_name(char *dest, char const *name) {
+    if (name == NULL) {
+        return 0;
+    }
+    size_t len = strnlen(name, MAX_PATH_NAME - 1);
+    memcpy(dest, name, len);
+    dest[len] = '\0';
+    return len + 1;
+}
+
+/*
+ * Records a call that returned (if trace_begin found it traced)
+ * Input:
+ *  - call: as passed to trace_begin
+ *  - ret: what it returned
+ */
+void trace_end(trace_call_t *call, int64_t ret) {
+    if (!call->traced) {
+        return;
+    }
+    if (thread_number == 0) {
+        thread_number = atomic_fetch_add(&next_thread, 1);
+    }
+
+    /* One fwrite per call, so that records of concurrent calls never
+     * interleave */
+    char buffer[sizeof(trace_record_t) + 2 * MAX_PATH_NAME];
+    size_t names_len = copy_name(buffer + sizeof(trace_record_t), call->name);
+    names_len += copy_name(buffer + sizeof(trace_record_t) + names_len, call->name2);
+    trace_record_t record = {.seq = call->seq,
+                             .start_ns = call->start_ns,
+                             .duration_ns = now_ns() - origin_ns - call->start_ns,
+                             .size = call->size,
+                             .offset = call->offset,
+                             .ret = ret,
+                             .object = trace_object(call->object),
+                             .handle = call->handle,
+                             .arg = call->arg,
+                             .thread = thread_number,
+                             .op = (uint16_t) call->op,
+                             .names_len = (uint16_t) names_len};
+    memcpy(buffer, &record, sizeof(record));
+    fwrite(buffer, sizeof(record) + names_len, 1, trace_file);
+}
@@ -0,0 +1,89 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Call tracing: while a trace is open, every call to the functions that
+ * operate on the default volume (or shards) is recorded to a binary log,
+ * which tfs-replay can issue again. A trace is a trace_header_t followed by
+ * one trace_record_t per call, in the order the calls returned, each
+ * followed by the call's path names. Calls that set the file system up or
+ * tear it down (tfs_init, tfs_destroy, tfs_journal_open, ...) are not
+ * traced, and tfs_open_many, tfs_close_many and tfs_batch are traced as
+ * the calls they stand for, one per file or operation.
+ */
+
+typedef enum {
+    TRACE_LOOKUP = 1,
+    TRACE_OPEN,             /* arg: flags */
+    TRACE_MKDIR,
+    TRACE_UNLINK,
+    TRACE_CLOSE,            /* handle */
+    TRACE_WRITE,            /* handle, size, offset */
+    TRACE_READ,             /* handle, size, offset */
+    TRACE_GET_FILE_SIZE,    /* handle */
+    TRACE_CLONE,            /* two path names */
+    TRACE_COPY_TO_EXTERNAL, /* two path names (the second one external) */
+    TRACE_SET_CHECKSUM_MODE, /* arg: mode */
+    TRACE_SET_COMPRESSION,  /* arg: enabled */
+    TRACE_SET_DEDUP,        /* arg: enabled */
+    TRACE_SET_HUGE_PAGES,   /* arg: enabled */
+    TRACE_SNAPSHOT,         /* ret: the snapshot, as an object */
+    TRACE_SNAPSHOT_READ,    /* object, size, offset */
+    TRACE_SNAPSHOT_RELEASE, /* object */
+    TRACE_OPENDIR,          /* ret: the listing, as an object */
+    TRACE_READDIR_PLUS,     /* object, size: entries asked for */
+    TRACE_CLOSEDIR,         /* object */
+} trace_op_t;
+
+#define TRACE_OPS (TRACE_CLOSEDIR + 1)
+#define TRACE_MAGIC "TFSTRC2"
+
+typedef struct {
+    char magic[8];
+    uint32_t shards; /* number of shards of the traced file system */
+    uint32_t pad;
+} trace_header_t;
+
+typedef struct {
+    uint64_t seq;         /* order in which the calls were made */
+    uint64_t start_ns;    /* since the trace was opened */
+    uint64_t duration_ns;
+    uint64_t size;
+    uint64_t offset; /* of the open file, as the call was made */
+    int64_t ret;
+    int64_t object; /* snapshot or listing the call uses (see trace_object) */
+    int32_t handle;
+    int32_t arg;
+    uint32_t thread; /* numbered from 1, in order of their first call */
+    uint16_t op;
+    uint16_t names_len; /* bytes of path names that follow, each ending in '\0' */
+} trace_record_t;
+
+/* A call being traced; the caller sets the op and those of its arguments
+ * the op uses */
+typedef struct {
+    trace_op_t op;
+    char const *name;
+    char const *name2;
+    int handle;
+    void const *object;
+    int arg;
+    size_t size;
+    size_t offset;
+
+    bool traced;
+    uint64_t seq;
+    uint64_t start_ns;
+} trace_call_t;
+
+int trace_open(char const *path, unsigned int shards);
+int trace_close();
+bool trace_begin(trace_call_t *call);
+void trace_end(trace_call_t *call, int64_t ret);
+int64_t trace_object(void const *object);
+
+#endif // TRACE_H
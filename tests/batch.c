@@ -0,0 +1,125 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILES (16)
+
+/**
+   This test opens and closes files in batches: new files spread over two
+   directories, files that already exist, and names that cannot be opened,
+   all in one call. Then it runs a mixed sequence of operations through
+   tfs_batch, and opens and closes files spread over several shards.
+ */
+
+static char names[FILES + 4][MAX_PATH_NAME];
+static char const *paths[FILES + 4];
+
+static void check_file(char const *path, char const *contents) {
+    char buffer[64];
+    int fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == strlen(contents));
+    assert(memcmp(buffer, contents, strlen(contents)) == 0);
+    assert(tfs_close(fd) != -1);
+}
+
+/* Opens FILES files at once (half in /d, half in /e), writes their names to
+ * them and closes them at once */
+static void create_files() {
+    int fds[FILES];
+    int results[FILES];
+
+    for (int i = 0; i < FILES; i++) {
+        sprintf(names[i], "/%c/f%d", i % 2 == 0 ? 'd' : 'e', i);
+        paths[i] = names[i];
+    }
+    assert(tfs_open_many(paths, TFS_O_CREAT, fds, FILES) == FILES);
+    for (int i = 0; i < FILES; i++) {
+        assert(tfs_write(fds[i], paths[i], strlen(paths[i])) == strlen(paths[i]));
+    }
+    assert(tfs_close_many(fds, results, FILES) == 0);
+    for (int i = 0; i < FILES; i++) {
+        assert(results[i] == 0);
+        check_file(paths[i], paths[i]);
+    }
+}
+
+int main() {
+    int fds[FILES + 4];
+    int results[FILES + 4];
+
+    assert(tfs_init() != -1);
+    assert(tfs_mkdir("/d") != -1);
+    assert(tfs_mkdir("/e") != -1);
+    create_files();
+
+    /* Existing files, new ones and invalid names, in one call */
+    paths[0] = "/d/f0";
+    paths[1] = "/new";
+    paths[2] = "invalid";
+    paths[3] = "/missing/f";
+    paths[4] = "/d/f0";
+    assert(tfs_open_many(paths, TFS_O_CREAT | TFS_O_APPEND, fds, 5) == 3);
+    assert(fds[0] != -1 && fds[1] != -1 && fds[4] != -1 && fds[0] != fds[4]);
+    assert(fds[2] == -1 && fds[3] == -1);
+    assert(tfs_get_file_size(fds[0]) == strlen("/d/f0"));
+    assert(tfs_lookup("/new") != -1);
+
+    /* Handles that are not open fail alone */
+    fds[2] = fds[0];
+    assert(tfs_close_many(fds, results, 5) == -1);
+    assert(results[0] == 0 && results[1] == 0 && results[4] == 0);
+    assert(results[2] == -1 && results[3] == -1);
+    assert(tfs_close_many(fds, NULL, 2) == -1);
+
+    /* Without TFS_O_CREAT, new names fail */
+    paths[1] = "/other";
+    assert(tfs_open_many(paths, 0, fds, 2) == 1);
+    assert(fds[1] == -1 && tfs_close(fds[0]) != -1);
+
+    /* A mixed sequence of operations */
+    tfs_batch_op_t ops[] = {
+        {.op = TFS_BATCH_MKDIR, .name = "/b"},
+        {.op = TFS_BATCH_OPEN, .name = "/b/x", .flags = TFS_O_CREAT},
+        {.op = TFS_BATCH_OPEN, .name = "/b/y", .flags = TFS_O_CREAT},
+        {.op = TFS_BATCH_LOOKUP, .name = "/b/x"},
+        {.op = TFS_BATCH_UNLINK, .name = "/b/y"},
+        {.op = TFS_BATCH_LOOKUP, .name = "/b/y"},
+    };
+    assert(tfs_batch(ops, sizeof(ops) / sizeof(ops[0])) == -1);
+    assert(ops[0].ret == 0 && ops[1].ret != -1 && ops[2].ret != -1);
+    assert(ops[3].ret == tfs_lookup("/b/x") && ops[4].ret == 0 && ops[5].ret == -1);
+    tfs_batch_op_t closes[] = {
+        {.op = TFS_BATCH_CLOSE, .fhandle = ops[1].ret},
+        {.op = TFS_BATCH_CLOSE, .fhandle = ops[2].ret},
+    };
+    assert(tfs_batch(closes, 2) == 0);
+    assert(closes[0].ret == 0 && closes[1].ret == 0);
+    assert(tfs_destroy() != -1);
+
+    /* The same, over several shards */
+    assert(tfs_init_sharded(4) != -1);
+    assert(tfs_mkdir("/d") != -1);
+    assert(tfs_mkdir("/e") != -1);
+    for (int i = 0; i < 4; i++) {
+        sprintf(names[FILES + i], "/r%d", i);
+    }
+    create_files();
+    for (int i = 0; i < 4; i++) {
+        paths[FILES + i] = names[FILES + i];
+    }
+    assert(tfs_open_many(paths, TFS_O_CREAT, fds, FILES + 4) == FILES + 4);
+    for (int i = 0; i < FILES + 4; i++) {
+        assert(tfs_get_file_size(fds[i]) == (i < FILES ? strlen(paths[i]) : 0));
+    }
+    assert(tfs_close_many(fds, NULL, FILES + 4) == 0);
+    assert(tfs_lookup("/r3") != -1);
+    assert(tfs_destroy() != -1);
+
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+#define SIZE 3000
+
+/**
+   This test writes a file with checksums being verified on read, checks
+   that it can be read back, then corrupts one of its data blocks directly
+   and checks that reading it fails
+ */
+
+int main() {
+
+    char *path = "/f1";
+    char input[SIZE];
+    memset(input, 'A', SIZE);
+
+    char output[SIZE];
+
+    assert(tfs_init() != -1);
+    assert(tfs_set_checksum_mode(CHECKSUM_VERIFY) != -1);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, input, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, SIZE) == SIZE);
+    assert(memcmp(input, output, SIZE) == 0);
+    assert(tfs_close(fd) != -1);
+
+    /* Corrupt the second data block behind the file system's back */
+    inode_t *inode = inode_get(tfs_default(), tfs_lookup(path));
+    assert(inode != NULL);
+    char *block = data_block_get(tfs_default(), inode->i_data_block[1]);
+    assert(block != NULL);
+    block[10] = 'B';
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, SIZE) == -1);
+    assert(tfs_close(fd) != -1);
+
+    /* Without verification, the (corrupted) contents are returned */
+    assert(tfs_set_checksum_mode(CHECKSUM_UPDATE) != -1);
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, SIZE) == SIZE);
+    assert(output[BLOCK_SIZE + 10] == 'B');
+    assert(tfs_close(fd) != -1);
+
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include "client/tfs_client.h"
+#include "fs/protocol.h"
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define THREADS (8)
+#define PROCESSES (4)
+#define COUNT (50)
+#define LARGE (64 * 1024)
+#define CHUNK (12 * 1024)
+#define WORKERS (4)
+#define STALLED_READS (64)
+
+/**
+   This test starts a server, and then uses its volume through several
+   connections: from one client, from threads pipelining requests over a
+   shared connection, and from several client processes at the same time.
+   Large reads and writes, which go through the memory the client shares
+   with the server, are checked from threads sharing a connection too, and
+   clients that stop reading their answers must not hold up the others.
+   Finally, it stops the server, which must exit cleanly.
+ */
+
+static char socket_path[64];
+static tfs_client_t *shared;
+
+static void write_file(tfs_client_t *client, char const *path, char const *contents) {
+    int fd = tfs_client_open(client, path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(fd != -1);
+    assert(tfs_client_write(client, fd, contents, strlen(contents)) == strlen(contents));
+    assert(tfs_client_close(client, fd) != -1);
+}
+
+static void check_file(tfs_client_t *client, char const *path, char const *contents) {
+    char buffer[64];
+    int fd = tfs_client_open(client, path, 0);
+    assert(fd != -1);
+    assert(tfs_client_get_file_size(client, fd) == strlen(contents));
+    assert(tfs_client_read(client, fd, buffer, sizeof(buffer)) == strlen(contents));
+    assert(memcmp(buffer, contents, strlen(contents)) == 0);
+    assert(tfs_client_close(client, fd) != -1);
+}
+
+static void *pipelined_client(void *arg) {
+    char path[MAX_PATH_NAME];
+    sprintf(path, "/t%d", *(int *) arg);
+
+    for (int i = 0; i < COUNT; i++) {
+        write_file(shared, path, path);
+        check_file(shared, path, path);
+    }
+    assert(tfs_client_unlink(shared, path) != -1);
+    return NULL;
+}
+
+/* Writes and reads back a large file, in chunks that do not divide the
+ * shared region evenly (so that they wrap around it) */
+static void *large_transfers(void *arg) {
+    static char data[THREADS][LARGE];
+    static char buffer[THREADS][LARGE];
+    int id = *(int *) arg;
+    char path[MAX_PATH_NAME];
+    sprintf(path, "/large%d", id);
+
+    for (size_t i = 0; i < LARGE; i++) {
+        data[id][i] = (char) ('a' + (i * 7 + (size_t) id) % 26);
+    }
+    for (int round = 0; round < 4; round++) {
+        int fd = tfs_client_open(shared, path, TFS_O_CREAT | TFS_O_TRUNC);
+        assert(fd != -1);
+        for (size_t done = 0; done < LARGE; done += CHUNK) {
+            size_t len = LARGE - done < CHUNK ? LARGE - done : CHUNK;
+            assert(tfs_client_write(shared, fd, data[id] + done, len) == len);
+        }
+        assert(tfs_client_close(shared, fd) != -1);
+
+        fd = tfs_client_open(shared, path, 0);
+        assert(fd != -1);
+        assert(tfs_client_read(shared, fd, buffer[id], LARGE) == LARGE);
+        assert(memcmp(buffer[id], data[id], LARGE) == 0);
+        assert(tfs_client_close(shared, fd) != -1);
+    }
+    assert(tfs_client_unlink(shared, path) != -1);
+    return NULL;
+}
+
+/* Opens a connection that asks for far more than the socket can hold, and
+ * then never reads the answers */
+static int stalled_connection() {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, socket_path);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(sock != -1 && connect(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+
+    protocol_request_t reads[STALLED_READS];
+    for (int i = 0; i < STALLED_READS; i++) {
+        protocol_request_t open = {.op = PROTOCOL_OPEN, .length = sizeof("/big")};
+        protocol_response_t response;
+        assert(write(sock, &open, sizeof(open)) == sizeof(open));
+        assert(write(sock, "/big", sizeof("/big")) == sizeof("/big"));
+        assert(read(sock, &response, sizeof(response)) == sizeof(response));
+        assert(response.ret != -1);
+        reads[i] = (protocol_request_t){
+            .op = PROTOCOL_READ, .arg = (int32_t) response.ret, .length = LARGE};
+    }
+    assert(write(sock, reads, sizeof(reads)) == sizeof(reads));
+    return sock;
+}
+
+static tfs_client_t *connect_to_server() {
+    struct timespec delay = {.tv_sec = 0, .tv_nsec = 10000000};
+    for (int i = 0; i < 500; i++) {
+        tfs_client_t *client = tfs_connect(socket_path);
+        if (client != NULL) {
+            return client;
+        }
+        nanosleep(&delay, NULL);
+    }
+    return NULL;
+}
+
+int main() {
+    char path[MAX_PATH_NAME];
+    pthread_t tid[THREADS];
+    int ids[THREADS];
+    int status;
+
+    sprintf(socket_path, "/tmp/tfs_server_%d.sock", getpid());
+    pid_t server = fork();
+    assert(server != -1);
+    if (server == 0) {
+        char workers[16];
+        sprintf(workers, "%d", WORKERS);
+        execl("../fs/tfs_server", "tfs_server", socket_path, workers, "2", (char *) NULL);
+        _exit(1);
+    }
+
+    tfs_client_t *client = connect_to_server();
+    assert(client != NULL);
+
+    /* The usual operations, through the server */
+    assert(tfs_client_lookup(client, "/f") == -1);
+    write_file(client, "/f", "contents");
+    check_file(client, "/f", "contents");
+    assert(tfs_client_lookup(client, "/f") != -1);
+    assert(tfs_client_mkdir(client, "/d") != -1);
+    assert(tfs_client_clone(client, "/f", "/d/f") != -1);
+    check_file(client, "/d/f", "contents");
+    assert(tfs_client_open(client, "invalid", TFS_O_CREAT) == -1);
+
+    /* Handles belong to their connection */
+    shared = tfs_connect(socket_path);
+    assert(shared != NULL);
+    int fd = tfs_client_open(client, "/f", 0);
+    assert(fd != -1);
+    assert(tfs_client_get_file_size(shared, fd) == -1);
+    assert(tfs_client_close(shared, fd) == -1);
+    assert(tfs_client_close(client, fd) != -1);
+    assert(tfs_client_close(client, fd) == -1);
+
+    /* As many clients as workers stop reading: the others are still served
+     * (or the alarm ends the test) */
+    static char big[LARGE];
+    memset(big, 'b', sizeof(big));
+    fd = tfs_client_open(client, "/big", TFS_O_CREAT);
+    assert(fd != -1);
+    for (size_t done = 0; done < LARGE; done += CHUNK) {
+        size_t len = LARGE - done < CHUNK ? LARGE - done : CHUNK;
+        assert(tfs_client_write(client, fd, big + done, len) == len);
+    }
+    assert(tfs_client_close(client, fd) != -1);
+    int stalled[WORKERS];
+    for (int i = 0; i < WORKERS; i++) {
+        stalled[i] = stalled_connection();
+    }
+    alarm(30);
+    check_file(client, "/f", "contents");
+    alarm(0);
+    for (int i = 0; i < WORKERS; i++) {
+        close(stalled[i]);
+    }
+    assert(tfs_client_unlink(client, "/big") != -1);
+
+    /* Threads sharing a connection */
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, pipelined_client, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+    for (int i = 0; i < THREADS / 2; i++) {
+        assert(pthread_create(&tid[i], NULL, large_transfers, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREADS / 2; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+    assert(tfs_disconnect(shared) != -1);
+
+    /* Client processes, each with its own connection */
+    for (int i = 0; i < PROCESSES; i++) {
+        pid_t pid = fork();
+        assert(pid != -1);
+        if (pid == 0) {
+            tfs_client_t *child = tfs_connect(socket_path);
+            assert(child != NULL);
+            sprintf(path, "/d/p%d", i);
+            for (int j = 0; j < COUNT; j++) {
+                write_file(child, path, path);
+            }
+            /* Left open on purpose: the server closes it */
+            assert(tfs_client_open(child, path, 0) != -1);
+            assert(tfs_disconnect(child) != -1);
+            _exit(0);
+        }
+    }
+    for (int i = 0; i < PROCESSES; i++) {
+        assert(wait(&status) != -1);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    for (int i = 0; i < PROCESSES; i++) {
+        sprintf(path, "/d/p%d", i);
+        check_file(client, path, path);
+        assert(tfs_client_unlink(client, path) != -1);
+    }
+    assert(tfs_disconnect(client) != -1);
+
+    assert(kill(server, SIGTERM) == 0);
+    assert(waitpid(server, &status, 0) == server);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(access(socket_path, F_OK) == -1);
+
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SIZE (30 * BLOCK_SIZE)
+
+/**
+   This test clones a file and checks that the clone shares its blocks
+   until either file is modified, then takes a snapshot and checks that it
+   keeps returning the old contents while the files are overwritten, in the
+   root directory and in nested ones. Last, it truncates a clone on a full
+   volume, which frees no block, and checks that the clone keeps its i-node
+ */
+
+static char input[SIZE];
+static char patch[SIZE];
+static char output[SIZE];
+
+static void check_contents(char const *path, char const *expected, size_t size) {
+    int fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, SIZE) == size);
+    assert(memcmp(expected, output, size) == 0);
+    assert(tfs_close(fd) != -1);
+}
+
+int main() {
+
+    for (size_t i = 0; i < SIZE; i++) {
+        input[i] = (char) ('a' + i % 26);
+        patch[i] = (char) ('A' + i % 26);
+    }
+
+    assert(tfs_init() != -1);
+
+    int fd = tfs_open("/f1", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, input, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    fd = tfs_open("/c1", TFS_O_CREAT | TFS_O_COMPRESS);
+    assert(fd != -1);
+    assert(tfs_write(fd, input, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    /* Clones only take a new block of indexes (if the source has one) */
+    int free_before = get_free_memory(tfs_default());
+    assert(tfs_clone("/f1", "/f2") != -1);
+    assert(tfs_clone("/c1", "/c2") != -1);
+    assert(free_before - get_free_memory(tfs_default()) <= 2 * BLOCK_SIZE);
+    assert(tfs_clone("/f1", "/f2") == -1);
+    assert(tfs_clone("/none", "/f3") == -1);
+
+    check_contents("/f2", input, SIZE);
+    check_contents("/c2", input, SIZE);
+
+    /* Modifying the clones leaves the sources untouched */
+    fd = tfs_open("/f2", 0);
+    assert(fd != -1);
+    assert(tfs_write(fd, patch, 2 * BLOCK_SIZE + 10) == 2 * BLOCK_SIZE + 10);
+    assert(tfs_close(fd) != -1);
+    fd = tfs_open("/c2", 0);
+    assert(fd != -1);
+    assert(tfs_write(fd, patch, 10) == 10);
+    assert(tfs_close(fd) != -1);
+
+    check_contents("/f1", input, SIZE);
+    check_contents("/c1", input, SIZE);
+    memcpy(output, patch, 2 * BLOCK_SIZE + 10);
+
+    assert(tfs_mkdir("/d") != -1);
+    assert(tfs_mkdir("/d/e") != -1);
+    assert(tfs_clone("/f1", "/d/e/f") != -1);
+
+    /* Snapshot, then overwrite and truncate the files */
+    snapshot_t *snapshot = tfs_snapshot();
+    assert(snapshot != NULL);
+    assert(tfs_unlink("/d/e/f") != -1);
+
+    fd = tfs_open("/f1", 0);
+    assert(fd != -1);
+    assert(tfs_write(fd, patch, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+    fd = tfs_open("/c1", TFS_O_TRUNC);
+    assert(fd != -1);
+    assert(tfs_close(fd) != -1);
+    check_contents("/f1", patch, SIZE);
+
+    assert(tfs_snapshot_read(snapshot, "/f1", 0, output, SIZE) == SIZE);
+    assert(memcmp(input, output, SIZE) == 0);
+    assert(tfs_snapshot_read(snapshot, "/c1", 0, output, SIZE) == SIZE);
+    assert(memcmp(input, output, SIZE) == 0);
+    assert(tfs_snapshot_read(snapshot, "/c1", SIZE - 5, output, SIZE) == 5);
+    assert(tfs_snapshot_read(snapshot, "/none", 0, output, SIZE) == -1);
+    assert(tfs_snapshot_read(snapshot, "/d/e/f", 0, output, SIZE) == SIZE);
+    assert(memcmp(input, output, SIZE) == 0);
+    assert(tfs_snapshot_read(snapshot, "/d/e", 0, output, SIZE) == -1);
+    assert(tfs_snapshot_read(snapshot, "/d/f", 0, output, SIZE) == -1);
+
+    /* Releasing the snapshot gives back the blocks only it referenced */
+    int free_with_snapshot = get_free_memory(tfs_default());
+    assert(tfs_snapshot_release(snapshot) != -1);
+    assert(get_free_memory(tfs_default()) > free_with_snapshot);
+
+    /* Fill the volume, with a clone whose blocks are all shared (without a
+     * block of indexes of its own) */
+    fd = tfs_open("/small", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, input, 2 * BLOCK_SIZE) == 2 * BLOCK_SIZE);
+    assert(tfs_close(fd) != -1);
+    assert(tfs_clone("/small", "/full") != -1);
+    volume_stats_t before, stats;
+    assert(tfs_stats_in(tfs_default(), &before) != -1); /* reclaims /d/e/f */
+    char name[16];
+    for (int i = 0; get_free_memory(tfs_default()) > 0; i++) {
+        sprintf(name, "/fill%d", i);
+        fd = tfs_open(name, TFS_O_CREAT);
+        assert(fd != -1);
+        while (tfs_get_file_size(fd) < (MAX_FILE_BLOCKS - 1) * BLOCK_SIZE &&
+               tfs_write(fd, input, BLOCK_SIZE) == BLOCK_SIZE) {
+        }
+        assert(tfs_close(fd) != -1);
+    }
+
+    /* Truncating the clone cannot get it a new block, but it stays linked */
+    assert(tfs_stats_in(tfs_default(), &before) != -1);
+    int full = tfs_lookup("/full");
+    assert(full != -1);
+    assert(tfs_open("/full", TFS_O_TRUNC) == -1);
+    assert(tfs_lookup("/full") == full);
+    assert(tfs_stats_in(tfs_default(), &stats) != -1);
+    assert(stats.files == before.files);
+    assert(tfs_unlink("/fill0") != -1);
+    assert(tfs_stats_in(tfs_default(), &stats) != -1); /* reclaims /fill0 */
+    fd = tfs_open("/new", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_close(fd) != -1);
+    assert(tfs_lookup("/new") != full);
+    fd = tfs_open("/full", TFS_O_TRUNC);
+    assert(fd != -1);
+    assert(tfs_get_file_size(fd) == 0);
+    assert(tfs_close(fd) != -1);
+
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+
+    return 0;
+}
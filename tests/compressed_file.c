@@ -0,0 +1,94 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+#define SIZE (100 * 1024)
+
+/**
+   This test writes a highly compressible file (log lines) with compression
+   enabled, checks that it takes fewer blocks than its size, then
+   overwrites part of it, appends to it and checks its contents; it also
+   writes an incompressible file and checks that it reads back correctly
+ */
+
+static char input[SIZE];
+static char output[SIZE];
+
+int main() {
+
+    char *path = "/log";
+    char *path2 = "/random";
+    char const *line = "2021-12-01 12:00:00 INFO request served in 3 ms\n";
+
+    for (size_t i = 0; i < SIZE; i++) {
+        input[i] = line[i % strlen(line)];
+    }
+
+    assert(tfs_init() != -1);
+    int free_before = get_free_memory(tfs_default());
+
+    int fd = tfs_open(path, TFS_O_CREAT | TFS_O_COMPRESS);
+    assert(fd != -1);
+    assert(tfs_write(fd, input, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    /* The file takes much less than SIZE bytes of storage */
+    assert(free_before - get_free_memory(tfs_default()) < SIZE / 4);
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, SIZE) == SIZE);
+    assert(memcmp(input, output, SIZE) == 0);
+    assert(tfs_close(fd) != -1);
+
+    /* Overwrite a range that spans two groups, then append */
+    memset(input + 8000, 'X', 500);
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, 8000) == 8000);
+    assert(tfs_write(fd, input + 8000, 500) == 500);
+    assert(tfs_close(fd) != -1);
+
+    fd = tfs_open(path, TFS_O_APPEND);
+    assert(fd != -1);
+    assert(tfs_write(fd, "tail", 4) == 4);
+    assert(tfs_close(fd) != -1);
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, SIZE) == SIZE);
+    assert(memcmp(input, output, SIZE) == 0);
+    assert(tfs_read(fd, output, SIZE) == 4);
+    assert(memcmp(output, "tail", 4) == 0);
+    assert(tfs_close(fd) != -1);
+
+    /* Incompressible data is stored as is */
+    unsigned int seed = 42;
+    for (size_t i = 0; i < SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        input[i] = (char) (seed >> 16);
+    }
+    assert(tfs_set_compression(1) != -1);
+    fd = tfs_open(path2, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, input, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    fd = tfs_open(path2, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, SIZE) == SIZE);
+    assert(memcmp(input, output, SIZE) == 0);
+    assert(tfs_close(fd) != -1);
+
+    /* Truncating releases the compressed groups */
+    fd = tfs_open(path, TFS_O_TRUNC);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, SIZE) == 0);
+    assert(tfs_close(fd) != -1);
+
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+
+    return 0;
+}
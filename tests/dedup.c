@@ -0,0 +1,79 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+#define COUNT 20
+#define SIZE BLOCK_SIZE
+
+/**
+   This test writes several files made of identical blocks with
+   deduplication enabled, checks that they share their blocks, then modifies
+   one of them and checks that the others are left unchanged
+ */
+
+static void check_contents(char const *path, char fill, int modified_block, char modified_fill) {
+    char output[SIZE];
+    char expected[SIZE];
+
+    int fd = tfs_open(path, 0);
+    assert(fd != -1);
+    for (int i = 0; i < COUNT; i++) {
+        memset(expected, i == modified_block ? modified_fill : fill, SIZE);
+        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(memcmp(expected, output, SIZE) == 0);
+    }
+    assert(tfs_close(fd) != -1);
+}
+
+int main() {
+
+    char *paths[] = {"/f1", "/f2", "/f3"};
+    char input[SIZE];
+    memset(input, 'A', SIZE);
+
+    assert(tfs_init() != -1);
+    assert(tfs_set_dedup(1) != -1);
+    int free_before = get_free_memory(tfs_default());
+
+    for (int f = 0; f < 3; f++) {
+        int fd = tfs_open(paths[f], TFS_O_CREAT);
+        assert(fd != -1);
+        for (int i = 0; i < COUNT; i++) {
+            assert(tfs_write(fd, input, SIZE) == SIZE);
+        }
+        assert(tfs_close(fd) != -1);
+    }
+
+    /* 3 files of 20 identical blocks: one shared data block, plus one
+     * block of indexes per file (and the spare first blocks freed on dedup) */
+    assert(free_before - get_free_memory(tfs_default()) <= 4 * BLOCK_SIZE);
+
+    /* Modify block 12 of /f2 (copy-on-write) */
+    char patch[SIZE];
+    memset(patch, 'B', SIZE);
+    int fd = tfs_open(paths[1], 0);
+    assert(fd != -1);
+    for (int i = 0; i < 12; i++) {
+        assert(tfs_read(fd, input, SIZE) == SIZE);
+    }
+    assert(tfs_write(fd, patch, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    check_contents(paths[0], 'A', -1, 'A');
+    check_contents(paths[1], 'A', 12, 'B');
+    check_contents(paths[2], 'A', -1, 'A');
+
+    /* Truncating the files only frees the shared block once nobody uses it */
+    for (int f = 0; f < 2; f++) {
+        fd = tfs_open(paths[f], TFS_O_TRUNC);
+        assert(fd != -1);
+        assert(tfs_close(fd) != -1);
+    }
+    check_contents(paths[2], 'A', -1, 'A');
+
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS (8)
+
+/**
+   This test creates nested directories and files in them, checks path
+   name resolution (including names that did not exist when first looked
+   up, and so were cached as missing), and then creates and looks up files
+   in several directories at the same time
+ */
+
+static void write_file(char const *path, char const *contents) {
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, contents, strlen(contents)) == strlen(contents));
+    assert(tfs_close(fd) != -1);
+}
+
+static void check_file(char const *path, char const *contents) {
+    char buffer[64];
+    int fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == strlen(contents));
+    assert(memcmp(buffer, contents, strlen(contents)) == 0);
+    assert(tfs_close(fd) != -1);
+}
+
+static void *work_in_dir(void *arg) {
+    int id = *(int *) arg;
+    char dir[MAX_PATH_NAME], path[MAX_PATH_NAME];
+
+    sprintf(dir, "/a/t%d", id);
+    sprintf(path, "/a/t%d/file", id);
+    assert(tfs_lookup(path) == -1);
+    assert(tfs_mkdir(dir) != -1);
+    write_file(path, dir);
+
+    for (int i = 0; i < 100; i++) {
+        int other = (id + i) % THREADS;
+        sprintf(path, "/a/t%d/file", other);
+        int inum = tfs_lookup(path);
+        if (other == id) {
+            assert(inum != -1);
+        }
+    }
+    return NULL;
+}
+
+int main() {
+    pthread_t tid[THREADS];
+    int ids[THREADS];
+
+    assert(tfs_init() != -1);
+
+    assert(tfs_mkdir("/a") != -1);
+    assert(tfs_mkdir("/a") == -1);
+    assert(tfs_mkdir("/a/b") != -1);
+    assert(tfs_mkdir("/missing/b") == -1);
+
+    /* Looked up (and cached as missing) before being created */
+    assert(tfs_lookup("/a/b/f") == -1);
+    assert(tfs_lookup("/a/b/c/f") == -1);
+    write_file("/a/b/f", "nested");
+    write_file("/f", "top");
+    assert(tfs_lookup("/a/b/f") != -1);
+    assert(tfs_lookup("/a/b/f") != tfs_lookup("/f"));
+    check_file("/a/b/f", "nested");
+    check_file("/f", "top");
+
+    /* Files are not directories, and directories cannot be opened */
+    assert(tfs_mkdir("/f/d") == -1);
+    assert(tfs_open("/f/g", TFS_O_CREAT) == -1);
+    assert(tfs_open("/a/b", 0) == -1);
+
+    assert(tfs_lookup("/a//b") == -1);
+    assert(tfs_lookup("/a/b/") == -1);
+    assert(tfs_lookup("/a/0123456789012345678901234567890123456789") == -1);
+
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, work_in_dir, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        char dir[MAX_PATH_NAME], path[MAX_PATH_NAME];
+        sprintf(dir, "/a/t%d", i);
+        sprintf(path, "/a/t%d/file", i);
+        check_file(path, dir);
+    }
+
+    /* A new file system does not remember the old one's paths */
+    assert(tfs_destroy() != -1);
+    assert(tfs_init() != -1);
+    assert(tfs_lookup("/a") == -1);
+    assert(tfs_lookup("/a/b/f") == -1);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test\n");
+
+    return 0;
+}
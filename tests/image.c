@@ -0,0 +1,228 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define LARGE (40 * BLOCK_SIZE + 100)
+
+/**
+   This test builds a directory tree in the external file system, turns it
+   into a volume image with mkfs.tfs and mounts it, checking every file.
+   It then changes the volume (clones, compressed files, removals), saves
+   and loads it again, and checks that the statistics match. tfs-inspect
+   must read the images, and cut or corrupted images must be rejected.
+ */
+
+static char root[64];
+static char image[64];
+static char large[LARGE];
+
+/* Where the tables, the blocks and the first i-node record (the root
+ * directory's) lie in an image */
+#define IMAGE_FREE_BLOCKS (24)
+#define IMAGE_REFCOUNT (IMAGE_FREE_BLOCKS + DATA_BLOCKS)
+#define IMAGE_DATA (IMAGE_REFCOUNT + 8 * DATA_BLOCKS)
+#define IMAGE_ROOT (IMAGE_DATA + DATA_BLOCKS * BLOCK_SIZE)
+#define IMAGE_ROOT_INDIRECT (IMAGE_ROOT + 32)
+#define IMAGE_ROOT_BLOCK (IMAGE_ROOT + 48)
+/* An i-node record, followed by the compressed size of each group, and
+ * where its fields lie in it */
+#define RECORD_SIZE (88)
+#define RECORD_TYPE (4)
+#define RECORD_INDIRECTION (8)
+#define RECORD_SIZE_BYTES (16)
+#define RECORD_BLOCKS (24)
+#define RECORD_INDIRECT (32)
+#define RECORD_GROUPS (40)
+
+static void host_path(char *path, char const *name) { sprintf(path, "%s/%s", root, name); }
+
+static void host_write(char const *name, char const *contents, size_t len) {
+    char path[128];
+    host_path(path, name);
+    FILE *file = fopen(path, "w");
+    assert(file != NULL);
+    assert(fwrite(contents, 1, len, file) == len);
+    assert(fclose(file) == 0);
+}
+
+static void check_file(tfs_t *fs, char const *path, char const *contents, size_t len) {
+    static char buffer[LARGE + 1];
+    int fd = tfs_open_in(fs, path, 0);
+    assert(fd != -1);
+    assert(tfs_read_in(fs, fd, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, contents, len) == 0);
+    assert(tfs_close_in(fs, fd) != -1);
+}
+
+/* Writes a copy of an image with some bytes changed, and checks that it
+ * cannot be loaded */
+static void check_corrupted(char const *contents, size_t size, size_t offset, void const *bytes,
+                            size_t len) {
+    static char copy[IMAGE_ROOT + 4096];
+    char path[128];
+    assert(size <= sizeof(copy));
+    memcpy(copy, contents, size);
+    memcpy(copy + offset, bytes, len);
+    sprintf(path, "%s.bad", image);
+    FILE *file = fopen(path, "w");
+    assert(file != NULL);
+    assert(fwrite(copy, 1, size, file) == size);
+    assert(fclose(file) == 0);
+    assert(tfs_load(path) == NULL);
+    unlink(path);
+}
+
+/* Runs one of the tools, returning its exit status */
+static int run(char const *tool, char const *arg1, char const *arg2) {
+    int status;
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        execl(tool, tool, arg1, arg2, (char *) NULL);
+        _exit(127);
+    }
+    assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status));
+    return WEXITSTATUS(status);
+}
+
+int main() {
+    char path[128];
+    volume_stats_t stats;
+
+    for (size_t i = 0; i < LARGE; i++) {
+        large[i] = (char) ('a' + i % 23);
+    }
+    sprintf(root, "/tmp/tfs_image_%d", getpid());
+    sprintf(image, "/tmp/tfs_image_%d.img", getpid());
+    assert(mkdir(root, 0700) == 0);
+    host_path(path, "d");
+    assert(mkdir(path, 0700) == 0);
+    host_write("small", "small file", 10);
+    host_write("large", large, LARGE);
+    host_write("empty", "", 0);
+    host_write("d/nested", "nested file", 11);
+
+    assert(run("../fs/mkfs.tfs", image, root) == 0);
+    assert(run("../fs/tfs-inspect", image, NULL) == 0);
+
+    tfs_t *fs = tfs_load(image);
+    assert(fs != NULL);
+    check_file(fs, "/small", "small file", 10);
+    check_file(fs, "/large", large, LARGE);
+    check_file(fs, "/empty", "", 0);
+    check_file(fs, "/d/nested", "nested file", 11);
+    assert(tfs_lookup_in(fs, "/d/missing") == -1);
+    assert(tfs_stats_in(fs, &stats) != -1);
+    assert(stats.files == 4 && stats.directories == 2 && stats.inodes == 6);
+    assert(stats.bytes_stored == 21 + LARGE);
+    assert(stats.blocks_used + stats.blocks_free == DATA_BLOCKS);
+    assert(stats.extents >= stats.files - 1 && stats.blocks_shared == 0);
+
+    /* The loaded volume works like any other, and saves all of it */
+    assert(tfs_clone_in(fs, "/large", "/d/copy") != -1);
+    assert(tfs_unlink_in(fs, "/small") != -1);
+    int fd = tfs_open_in(fs, "/compressed", TFS_O_CREAT | TFS_O_COMPRESS);
+    assert(fd != -1);
+    assert(tfs_write_in(fs, fd, large, LARGE) == LARGE);
+    assert(tfs_close_in(fs, fd) != -1);
+    volume_stats_t before;
+    assert(tfs_stats_in(fs, &before) != -1);
+    assert(before.blocks_shared > 0 && before.files == 5);
+    assert(tfs_save_in(fs, image) != -1);
+    assert(tfs_unmount(fs) != -1);
+
+    fs = tfs_load(image);
+    assert(fs != NULL);
+    assert(tfs_stats_in(fs, &stats) != -1);
+    assert(memcmp(&stats, &before, sizeof(stats)) == 0);
+    assert(tfs_lookup_in(fs, "/small") == -1);
+    check_file(fs, "/d/copy", large, LARGE);
+    check_file(fs, "/compressed", large, LARGE);
+    check_file(fs, "/d/nested", "nested file", 11);
+    assert(tfs_unmount(fs) != -1);
+
+    /* Images whose i-nodes and tables disagree are rejected */
+    static char contents[IMAGE_ROOT + 4096];
+    FILE *file = fopen(image, "r");
+    assert(file != NULL);
+    size_t size = fread(contents, 1, sizeof(contents), file);
+    assert(fclose(file) == 0 && size > IMAGE_ROOT && size < sizeof(contents));
+    int32_t root_block;
+    memcpy(&root_block, contents + IMAGE_ROOT_BLOCK, sizeof(root_block));
+    assert(root_block >= 0 && root_block < DATA_BLOCKS);
+
+    uint64_t indirect_blocks = 1; /* without a block of indexes */
+    check_corrupted(contents, size, IMAGE_ROOT_INDIRECT, &indirect_blocks, sizeof(indirect_blocks));
+    char free_block = FREE; /* still mapped by the root directory */
+    check_corrupted(contents, size, IMAGE_FREE_BLOCKS + (size_t) root_block, &free_block, 1);
+    unsigned int refcount = 0; /* of a block in use */
+    check_corrupted(contents, size, IMAGE_REFCOUNT + sizeof(refcount) * (size_t) root_block,
+                    &refcount, sizeof(refcount));
+    dir_entry_t entry = {.d_name = "ghost", .d_inumber = INODE_TABLE_SIZE - 1}; /* a free i-node */
+    check_corrupted(contents, size, IMAGE_DATA + (size_t) root_block * BLOCK_SIZE, &entry,
+                    sizeof(entry));
+
+    /* Indirect blocks are only valid once every direct slot is used: an
+     * empty file given a block of indexes (in blocks marked in use) is
+     * rejected */
+    size_t record = IMAGE_ROOT;
+    for (;;) {
+        assert(record + RECORD_SIZE <= size);
+        uint32_t type;
+        uint64_t bytes, blocks, groups;
+        memcpy(&type, contents + record + RECORD_TYPE, sizeof(type));
+        memcpy(&bytes, contents + record + RECORD_SIZE_BYTES, sizeof(bytes));
+        memcpy(&blocks, contents + record + RECORD_BLOCKS, sizeof(blocks));
+        memcpy(&groups, contents + record + RECORD_GROUPS, sizeof(groups));
+        if (type == T_FILE && bytes == 0 && blocks == 1 && groups == 0) {
+            break;
+        }
+        record += RECORD_SIZE + groups * sizeof(uint64_t);
+    }
+    static char crafted[IMAGE_ROOT + 4096];
+    memcpy(crafted, contents, size);
+    int32_t indexes[2] = {DATA_BLOCKS - 1, DATA_BLOCKS - 2};
+    unsigned int one = 1;
+    char taken = TAKEN;
+    for (int i = 0; i < 2; i++) {
+        assert(crafted[IMAGE_FREE_BLOCKS + indexes[i]] == FREE);
+        crafted[IMAGE_FREE_BLOCKS + indexes[i]] = taken;
+        memcpy(crafted + IMAGE_REFCOUNT + sizeof(one) * (size_t) indexes[i], &one, sizeof(one));
+    }
+    /* The block of indexes maps the other block */
+    memcpy(crafted + IMAGE_DATA + (size_t) indexes[0] * BLOCK_SIZE, &indexes[1], sizeof(int32_t));
+    memcpy(crafted + record + RECORD_INDIRECTION, &indexes[0], sizeof(int32_t));
+    check_corrupted(crafted, size, record + RECORD_INDIRECT, &indirect_blocks,
+                    sizeof(indirect_blocks));
+
+    fs = tfs_load(image);
+    assert(fs != NULL);
+    assert(tfs_unmount(fs) != -1);
+
+    /* Cut images are rejected */
+    assert(truncate(image, 1000) == 0);
+    assert(tfs_load(image) == NULL);
+    assert(run("../fs/tfs-inspect", image, NULL) != 0);
+
+    unlink(image);
+    host_path(path, "d/nested");
+    unlink(path);
+    host_path(path, "d");
+    rmdir(path);
+    char const *names[] = {"small", "large", "empty"};
+    for (int i = 0; i < 3; i++) {
+        host_path(path, names[i]);
+        unlink(path);
+    }
+    rmdir(root);
+
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include "../fs/operations.h"
+#include "../fs/journal.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define THREADS (10)
+#define SIZE (12 * BLOCK_SIZE)
+#define JOURNAL_PATH "journal_test.log"
+#define IMAGE_PATH "journal_test.img"
+
+/**
+   This test journals the metadata updates of several threads creating and
+   writing files at the same time, then reads the journal back and checks
+   that every update is there, in order, in whole transactions, and that
+   flushes were shared. Then it recovers a volume from an image and the
+   journal started after it, also once the journal is cut in the middle of
+   its last flush, and once its writer was killed while a transaction was
+   open, after another one that may depend on it committed.
+ */
+
+typedef struct {
+    size_t count[JOURNAL_TX_COMMIT + 1];
+    uint64_t last_lsn;
+    int files_found;
+} journal_summary_t;
+
+static char input[SIZE];
+
+static void *create_file(void *arg) {
+    char path[MAX_FILE_NAME];
+    sprintf(path, "/f%d", *(int *) arg);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, input, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    /* Truncating it is journaled too */
+    fd = tfs_open(path, TFS_O_TRUNC);
+    assert(fd != -1);
+    assert(tfs_close(fd) != -1);
+    return NULL;
+}
+
+static int summarize(journal_record_t const *record, void *arg) {
+    journal_summary_t *summary = arg;
+    assert(record->lsn > summary->last_lsn);
+    assert(record->type >= JOURNAL_INODE_CREATE && record->type <= JOURNAL_TX_COMMIT);
+    summary->last_lsn = record->lsn;
+    summary->count[record->type]++;
+    if (record->type == JOURNAL_DIR_ADD && record->name[0] == 'f') {
+        summary->files_found++;
+    }
+    return 0;
+}
+
+static void write_file_in(tfs_t *fs, char const *path, size_t size) {
+    int fd = tfs_open_in(fs, path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write_in(fs, fd, input, size) == size);
+    assert(tfs_close_in(fs, fd) != -1);
+}
+
+static void check_size_in(tfs_t *fs, char const *path, size_t size) {
+    static char buffer[SIZE + 1];
+    int fd = tfs_open_in(fs, path, 0);
+    assert(fd != -1);
+    assert(tfs_get_file_size_in(fs, fd) == size);
+    /* Contents are not journaled */
+    assert(tfs_read_in(fs, fd, buffer, sizeof(buffer)) == size);
+    for (size_t i = 0; i < size; i++) {
+        assert(buffer[i] == 0);
+    }
+    assert(tfs_close_in(fs, fd) != -1);
+}
+
+static void *write_other_file(void *arg) {
+    /* Does not return: the transaction it waits for is never committed */
+    write_file_in((tfs_t *) arg, "/b", BLOCK_SIZE);
+    return NULL;
+}
+
+/* Recovers the volume, checking the files every operation but the last
+ * one left (and, if it was recovered, the directory the last one made) */
+static void check_recovered(volume_stats_t const *stats, bool last) {
+    tfs_t *fs = tfs_recover(IMAGE_PATH, JOURNAL_PATH);
+    assert(fs != NULL);
+    check_size_in(fs, "/d/a", SIZE);
+    check_size_in(fs, "/c", SIZE);
+    assert(tfs_lookup_in(fs, "/b") == -1);
+    assert((tfs_lookup_in(fs, "/last") != -1) == last);
+    volume_stats_t recovered;
+    assert(tfs_stats_in(fs, &recovered) != -1);
+    if (last) {
+        assert(memcmp(&recovered, stats, sizeof(recovered)) == 0);
+    } else {
+        assert(recovered.directories == stats->directories - 1);
+    }
+    assert(tfs_unmount(fs) != -1);
+}
+
+int main() {
+    pthread_t tid[THREADS];
+    int ids[THREADS];
+    memset(input, 'J', SIZE);
+
+    unlink(JOURNAL_PATH);
+    assert(tfs_init() != -1);
+    assert(tfs_journal_open(JOURNAL_PATH, 2000) != -1);
+    assert(tfs_journal_open(JOURNAL_PATH, 2000) == -1);
+
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, create_file, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    uint64_t records, flushes;
+    journal_stats(tfs_default()->journal, &records, &flushes);
+    assert(tfs_journal_close() != -1);
+    assert(flushes > 0 && flushes < records);
+
+    journal_summary_t summary;
+    memset(&summary, 0, sizeof(summary));
+    assert(journal_read(JOURNAL_PATH, summarize, &summary) == (int) records);
+    assert(summary.count[JOURNAL_INODE_CREATE] == THREADS);
+    assert(summary.count[JOURNAL_DIR_ADD] == THREADS);
+    assert(summary.files_found == THREADS);
+    assert(summary.count[JOURNAL_INDIRECTION] == THREADS);
+    assert(summary.count[JOURNAL_TRUNCATE] == THREADS);
+    /* Each file's 12 blocks, and the first block again after truncating */
+    assert(summary.count[JOURNAL_BLOCK_MAP] == THREADS * 13);
+    assert(summary.count[JOURNAL_SIZE] == THREADS);
+    /* Each creation, write and truncation is a transaction of its own */
+    assert(summary.count[JOURNAL_TX_BEGIN] == THREADS * 3);
+    assert(summary.count[JOURNAL_TX_COMMIT] == THREADS * 3);
+
+    /* A torn record at the end of the journal is ignored */
+    FILE *file = fopen(JOURNAL_PATH, "a");
+    assert(file != NULL);
+    assert(fwrite(input, 1, sizeof(journal_record_t) / 2, file) == sizeof(journal_record_t) / 2);
+    assert(fclose(file) == 0);
+    memset(&summary, 0, sizeof(summary));
+    assert(journal_read(JOURNAL_PATH, summarize, &summary) == (int) records);
+
+    assert(tfs_destroy() != -1);
+
+    /* Operations journaled after an image is saved */
+    tfs_t *fs = tfs_mount();
+    assert(fs != NULL);
+    assert(tfs_mkdir_in(fs, "/d") != -1);
+    assert(tfs_save_in(fs, IMAGE_PATH) != -1);
+    unlink(JOURNAL_PATH);
+    assert(tfs_journal_open_in(fs, JOURNAL_PATH, 0) != -1);
+    write_file_in(fs, "/d/a", SIZE);
+    write_file_in(fs, "/b", 100);
+    assert(tfs_clone_in(fs, "/d/a", "/c") != -1);
+    assert(tfs_unlink_in(fs, "/b") != -1);
+    volume_stats_t stats;
+    assert(tfs_stats_in(fs, &stats) != -1); /* reclaims /b's i-node */
+    assert(tfs_mkdir_in(fs, "/last") != -1);
+    assert(tfs_journal_close_in(fs) != -1);
+    assert(tfs_stats_in(fs, &stats) != -1);
+    assert(tfs_unmount(fs) != -1);
+    check_recovered(&stats, true);
+
+    /* The last flush (of the last transaction), cut before its flush
+     * record, is left out */
+    file = fopen(JOURNAL_PATH, "r");
+    assert(file != NULL);
+    assert(fseek(file, -2 * (long) sizeof(journal_record_t), SEEK_END) == 0);
+    journal_record_t record[2];
+    assert(fread(record, sizeof(record[0]), 2, file) == 2);
+    long cut = ftell(file) - (long) sizeof(journal_record_t);
+    assert(fclose(file) == 0);
+    assert(record[0].type == JOURNAL_TX_COMMIT && record[1].type == JOURNAL_FLUSH);
+    assert(truncate(JOURNAL_PATH, cut) == 0);
+    check_recovered(&stats, false);
+    /* And so it is, cut in the middle of a record */
+    assert(truncate(JOURNAL_PATH, cut - (long) sizeof(journal_record_t) / 2) == 0);
+    check_recovered(&stats, false);
+
+    /* A writer killed while a transaction that freed blocks was open, after
+     * another one (which may have taken them) committed */
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        fs = tfs_mount();
+        assert(fs != NULL);
+        write_file_in(fs, "/a", 2 * BLOCK_SIZE);
+        assert(tfs_save_in(fs, IMAGE_PATH) != -1);
+        unlink(JOURNAL_PATH);
+        assert(tfs_journal_open_in(fs, JOURNAL_PATH, 0) != -1);
+        journal_begin(fs->journal);
+        int fd = tfs_open_in(fs, "/a", TFS_O_TRUNC);
+        assert(fd != -1);
+        assert(pthread_create(&tid[0], NULL, write_other_file, fs) == 0);
+        struct timespec delay = {.tv_sec = 0, .tv_nsec = 200000000};
+        nanosleep(&delay, NULL);
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    /* Neither of them is recovered */
+    fs = tfs_recover(IMAGE_PATH, JOURNAL_PATH);
+    assert(fs != NULL);
+    int fd = tfs_open_in(fs, "/a", 0);
+    assert(fd != -1 && tfs_get_file_size_in(fs, fd) == 2 * BLOCK_SIZE);
+    assert(tfs_close_in(fs, fd) != -1);
+    assert(tfs_lookup_in(fs, "/b") == -1);
+    assert(tfs_unmount(fs) != -1);
+
+    unlink(IMAGE_PATH);
+    unlink(JOURNAL_PATH);
+
+    printf("Successful test\n");
+
+    return 0;
+}
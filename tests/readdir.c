@@ -0,0 +1,123 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILES (8)
+
+/**
+   This test lists directories: names, i-node numbers, types and sizes all
+   come from the listing, a few entries at a time, and stay as they were
+   when the directory was opened while files change meanwhile. Then it
+   lists the root directory of a sharded file system, which spans every
+   shard.
+ */
+
+static void write_file(char const *path, size_t size) {
+    char buffer[BLOCK_SIZE];
+    memset(buffer, 'x', sizeof(buffer));
+    int fd = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(fd != -1);
+    assert(tfs_write(fd, buffer, size) == size);
+    assert(tfs_close(fd) != -1);
+}
+
+/* Reads a whole listing, three entries at a time, checking every entry
+ * against the directory's path name
+ * Returns the number of entries */
+static size_t check_listing(dir_listing_t *listing, char const *dir) {
+    dir_listing_entry_t entries[3];
+    char path[MAX_PATH_NAME];
+    size_t count = 0;
+    ssize_t n;
+
+    while ((n = tfs_readdir_plus(listing, entries, 3)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            sprintf(path, "%s/%s", dir, entries[i].name);
+            assert(tfs_lookup(path) == entries[i].inumber);
+            if (entries[i].type == T_FILE) {
+                /* Files are named after their size */
+                size_t size;
+                assert(sscanf(entries[i].name, "f%zu", &size) == 1);
+                assert(entries[i].size == size);
+            }
+            count++;
+        }
+    }
+    assert(n == 0);
+    assert(tfs_readdir_plus(listing, entries, 3) == 0);
+    return count;
+}
+
+int main() {
+    char path[MAX_PATH_NAME];
+    dir_listing_entry_t entries[FILES];
+
+    assert(tfs_init() != -1);
+    assert(tfs_opendir("/missing") == NULL);
+    assert(tfs_opendir("invalid") == NULL);
+    assert(tfs_readdir_plus(NULL, entries, 1) == -1);
+    assert(tfs_closedir(NULL) == -1);
+
+    dir_listing_t *listing = tfs_opendir("/");
+    assert(listing != NULL);
+    assert(tfs_readdir_plus(listing, entries, FILES) == 0);
+    assert(tfs_closedir(listing) != -1);
+
+    assert(tfs_mkdir("/d") != -1);
+    for (size_t i = 0; i < FILES; i++) {
+        sprintf(path, "/d/f%zu", i * 100);
+        write_file(path, i * 100);
+    }
+    write_file("/f3", 3);
+    assert(tfs_opendir("/f3") == NULL);
+
+    listing = tfs_opendir("/");
+    assert(listing != NULL);
+    assert(tfs_readdir_plus(listing, entries, FILES) == 2);
+    assert(tfs_closedir(listing) != -1);
+
+    /* Changes made after the directory is opened do not show */
+    listing = tfs_opendir("/d");
+    assert(listing != NULL);
+    assert(tfs_unlink("/d/f100") != -1);
+    write_file("/d/f200", 1);
+    write_file("/d/f2", 2);
+    assert(tfs_readdir_plus(listing, entries, 1) == 1);
+    assert(strcmp(entries[0].name, "f0") == 0 && entries[0].type == T_FILE);
+    assert(tfs_readdir_plus(listing, entries, FILES) == FILES - 1);
+    assert(strcmp(entries[0].name, "f100") == 0 && strcmp(entries[1].name, "f200") == 0);
+    assert(entries[1].size == 200);
+    assert(tfs_closedir(listing) != -1);
+    assert(tfs_unlink("/d/f200") != -1);
+
+    listing = tfs_opendir("/d");
+    assert(listing != NULL);
+    assert(check_listing(listing, "/d") == FILES - 1);
+    assert(tfs_closedir(listing) != -1);
+    assert(tfs_destroy() != -1);
+
+    /* The root directory of a sharded file system */
+    assert(tfs_init_sharded(4) != -1);
+    for (size_t i = 0; i < FILES; i++) {
+        sprintf(path, "/f%zu", i * 10);
+        write_file(path, i * 10);
+    }
+    assert(tfs_mkdir("/d") != -1);
+    write_file("/d/f5", 5);
+    listing = tfs_opendir("/");
+    assert(listing != NULL);
+    assert(check_listing(listing, "") == FILES + 1);
+    assert(tfs_closedir(listing) != -1);
+    listing = tfs_opendir("/d");
+    assert(listing != NULL);
+    assert(check_listing(listing, "/d") == 1);
+    assert(tfs_closedir(listing) != -1);
+    assert(tfs_destroy() != -1);
+
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS (8)
+#define FILES (6)
+#define OPEN (40)
+
+/**
+   This test spreads files over several shards: more files than a single
+   root directory can hold are created from several threads at the same
+   time, and then read, held open together, cloned (within and across
+   shards), captured in a snapshot and unlinked through the usual API
+ */
+
+static void write_file(char const *path, char const *contents) {
+    int fd = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(fd != -1);
+    assert(tfs_write(fd, contents, strlen(contents)) == strlen(contents));
+    assert(tfs_close(fd) != -1);
+}
+
+static void check_file(char const *path, char const *contents) {
+    char buffer[64];
+    int fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == strlen(contents));
+    assert(memcmp(buffer, contents, strlen(contents)) == 0);
+    assert(tfs_close(fd) != -1);
+}
+
+static void *create_files(void *arg) {
+    int id = *(int *) arg;
+    char path[MAX_PATH_NAME];
+
+    for (int i = 0; i < FILES; i++) {
+        sprintf(path, "/t%d_f%d", id, i);
+        write_file(path, path);
+    }
+    return NULL;
+}
+
+int main() {
+    char path[MAX_PATH_NAME];
+    char other[MAX_PATH_NAME];
+    pthread_t tid[THREADS];
+    int ids[THREADS];
+    int fds[OPEN];
+
+    assert(tfs_init_sharded(0) == -1);
+    assert(tfs_init_sharded(MAX_SHARDS + 1) == -1);
+    assert(tfs_init_sharded(4) != -1);
+    assert(tfs_init() == -1);
+
+    /* More files than fit in the root directory of a single volume */
+    assert(THREADS * FILES > MAX_DIR_ENTRIES);
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, create_files, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+    for (int i = 0; i < THREADS * FILES; i++) {
+        sprintf(path, "/t%d_f%d", i / FILES, i % FILES);
+        check_file(path, path);
+    }
+
+    /* Many files open at once, over every shard */
+    for (int i = 0; i < OPEN; i++) {
+        sprintf(path, "/t%d_f%d", i / FILES, i % FILES);
+        fds[i] = tfs_open(path, 0);
+        assert(fds[i] != -1);
+        for (int j = 0; j < i; j++) {
+            assert(fds[j] != fds[i]);
+        }
+    }
+    for (int i = 0; i < OPEN; i++) {
+        char buffer[64];
+        sprintf(path, "/t%d_f%d", i / FILES, i % FILES);
+        assert(tfs_get_file_size(fds[i]) == strlen(path));
+        assert(tfs_read(fds[i], buffer, sizeof(buffer)) == strlen(path));
+        assert(memcmp(buffer, path, strlen(path)) == 0);
+        assert(tfs_close(fds[i]) != -1);
+    }
+
+    /* Everything under a directory lives in its shard */
+    assert(tfs_mkdir("/d") != -1);
+    for (int i = 0; i < FILES; i++) {
+        sprintf(path, "/d/f%d", i);
+        write_file(path, path);
+        check_file(path, path);
+        assert(tfs_lookup(path) != tfs_lookup("/d"));
+    }
+
+    /* Clones, some of which cross shards */
+    for (int i = 0; i < FILES; i++) {
+        sprintf(path, "/t0_f%d", i);
+        sprintf(other, "/c%d", i);
+        assert(tfs_clone(path, other) != -1);
+        assert(tfs_clone(path, other) == -1);
+        check_file(other, path);
+    }
+
+    /* A snapshot covers every shard */
+    snapshot_t *snapshot = tfs_snapshot();
+    assert(snapshot != NULL);
+    for (int i = 0; i < FILES; i++) {
+        sprintf(path, "/c%d", i);
+        write_file(path, "new");
+    }
+    for (int i = 0; i < FILES; i++) {
+        char buffer[64];
+        sprintf(path, "/c%d", i);
+        sprintf(other, "/t0_f%d", i);
+        assert(tfs_snapshot_read(snapshot, path, 0, buffer, sizeof(buffer)) == strlen(other));
+        assert(memcmp(buffer, other, strlen(other)) == 0);
+        check_file(path, "new");
+    }
+    assert(tfs_snapshot_release(snapshot) != -1);
+
+    for (int i = 0; i < THREADS * FILES; i++) {
+        sprintf(path, "/t%d_f%d", i / FILES, i % FILES);
+        assert(tfs_unlink(path) != -1);
+        assert(tfs_lookup(path) == -1);
+    }
+    assert(tfs_destroy() != -1);
+
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+
+    return 0;
+}
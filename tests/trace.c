@@ -0,0 +1,143 @@
+#include "../fs/operations.h"
+#include "../fs/trace.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define THREADS (4)
+#define ROUNDS (20)
+#define SIZE (3 * BLOCK_SIZE + 10)
+
+/**
+   This test traces calls made by several threads (and a few that fail),
+   checks that the trace holds every one of them and nothing made after it
+   was closed, and then replays it with tfs-replay, as fast as possible and
+   at the original pace: every call must return what it did when traced.
+ */
+
+static char trace_path[64];
+
+static void *thread_calls(void *arg) {
+    char path[MAX_PATH_NAME];
+    char buffer[SIZE];
+    int id = *(int *) arg;
+    sprintf(path, "/d/t%d", id);
+    memset(buffer, 'a' + id, sizeof(buffer));
+
+    for (int i = 0; i < ROUNDS; i++) {
+        int fd = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+        assert(fd != -1);
+        assert(tfs_write(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(tfs_close(fd) != -1);
+        fd = tfs_open(path, 0);
+        assert(fd != -1);
+        assert(tfs_read(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(tfs_get_file_size(fd) == sizeof(buffer));
+        assert(tfs_close(fd) != -1);
+    }
+    return NULL;
+}
+
+/* Runs tfs-replay, returning its exit status */
+static int replay(char const *option) {
+    int status;
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        if (option == NULL) {
+            execl("../fs/tfs-replay", "tfs-replay", trace_path, (char *) NULL);
+        } else {
+            execl("../fs/tfs-replay", "tfs-replay", option, trace_path, (char *) NULL);
+        }
+        _exit(127);
+    }
+    assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status));
+    return WEXITSTATUS(status);
+}
+
+int main() {
+    pthread_t tid[THREADS];
+    int ids[THREADS];
+
+    sprintf(trace_path, "/tmp/tfs_trace_%d", getpid());
+    assert(tfs_trace_open(trace_path) == -1); /* Nothing to trace yet */
+    assert(tfs_init() != -1);
+    assert(tfs_trace_open(trace_path) != -1);
+    assert(tfs_trace_open(trace_path) == -1);
+
+    /* 7 calls, 2 of them failing */
+    assert(tfs_set_compression(0) != -1);
+    assert(tfs_mkdir("/d") != -1);
+    assert(tfs_open("/d/missing", 0) == -1);
+    assert(tfs_close(12345) == -1);
+    int fd = tfs_open("/f", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, "contents", 8) == 8);
+    assert(tfs_close(fd) != -1);
+
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, thread_calls, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    /* 10 more, through snapshots and listings too */
+    assert(tfs_clone("/f", "/g") != -1);
+    assert(tfs_set_huge_pages(1) != -1);
+    snapshot_t *snapshot = tfs_snapshot();
+    assert(snapshot != NULL);
+    char contents[8];
+    assert(tfs_snapshot_read(snapshot, "/g", 0, contents, sizeof(contents)) == 8);
+    assert(tfs_snapshot_release(snapshot) != -1);
+    dir_listing_t *listing = tfs_opendir("/");
+    dir_listing_entry_t entries[4];
+    assert(listing != NULL && tfs_readdir_plus(listing, entries, 4) == 3);
+    assert(tfs_closedir(listing) != -1);
+    assert(tfs_unlink("/f") != -1);
+    assert(tfs_lookup("/f") == -1);
+    assert(tfs_trace_close() != -1);
+    assert(tfs_lookup("/g") != -1);
+    assert(tfs_destroy() != -1);
+
+    /* Every call is in the trace, once */
+    FILE *in = fopen(trace_path, "r");
+    assert(in != NULL);
+    trace_header_t header;
+    trace_record_t record;
+    char names[2 * MAX_PATH_NAME];
+    size_t count = 0, writes = 0, objects = 0;
+    bool seen[7 + THREADS * ROUNDS * 7 + 10] = {false};
+    assert(fread(&header, sizeof(header), 1, in) == 1 && header.shards == 1);
+    while (fread(&record, sizeof(record), 1, in) == 1) {
+        assert(record.seq < sizeof(seen) && !seen[record.seq]);
+        seen[record.seq] = true;
+        assert(fread(names, 1, record.names_len, in) == record.names_len);
+        if (record.op == TRACE_WRITE) {
+            assert(record.offset == 0 && (record.size == 8 || record.size == SIZE));
+            writes++;
+        }
+        if (record.op == TRACE_SNAPSHOT_READ || record.op == TRACE_SNAPSHOT_RELEASE ||
+            record.op == TRACE_READDIR_PLUS || record.op == TRACE_CLOSEDIR) {
+            assert(record.object != -1);
+            objects++;
+        }
+        count++;
+    }
+    fclose(in);
+    assert(count == sizeof(seen) && writes == 1 + THREADS * ROUNDS && objects == 4);
+
+    assert(replay(NULL) == 0);
+    assert(replay("-r") == 0);
+    unlink(trace_path);
+
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+
+    return 0;
+}
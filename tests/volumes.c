@@ -0,0 +1,109 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define VOLUMES (4)
+#define FILES (10)
+#define SIZE (3 * BLOCK_SIZE)
+
+/**
+   This test mounts several volumes next to the default one, and checks
+   that they share nothing: the same path names hold different contents in
+   each, settings and free space are per volume, and unmounting one leaves
+   the others untouched. Then, one thread per volume fills it at the same
+   time as the others.
+ */
+
+static void write_file(tfs_t *fs, char const *path, char c) {
+    char buffer[SIZE];
+    memset(buffer, c, sizeof(buffer));
+    int fd = tfs_open_in(fs, path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write_in(fs, fd, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(tfs_close_in(fs, fd) != -1);
+}
+
+static void check_file(tfs_t *fs, char const *path, char c) {
+    char buffer[SIZE + 1];
+    int fd = tfs_open_in(fs, path, 0);
+    assert(fd != -1);
+    assert(tfs_read_in(fs, fd, buffer, sizeof(buffer)) == SIZE);
+    for (size_t i = 0; i < SIZE; i++) {
+        assert(buffer[i] == c);
+    }
+    assert(tfs_close_in(fs, fd) != -1);
+}
+
+static void *fill_volume(void *arg) {
+    tfs_t *fs = (tfs_t *) arg;
+    char path[MAX_PATH_NAME];
+
+    assert(tfs_mkdir_in(fs, "/d") != -1);
+    for (int i = 0; i < FILES; i++) {
+        sprintf(path, "/d/f%d", i);
+        write_file(fs, path, (char) ('a' + i));
+    }
+    for (int i = 0; i < FILES; i++) {
+        sprintf(path, "/d/f%d", i);
+        check_file(fs, path, (char) ('a' + i));
+        assert(tfs_unlink_in(fs, path) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_t *volumes[VOLUMES];
+    pthread_t tid[VOLUMES];
+
+    assert(tfs_init() != -1);
+    tfs_t *first = tfs_mount();
+    tfs_t *second = tfs_mount();
+    assert(first != NULL && second != NULL && first != second);
+    assert(first != tfs_default() && second != tfs_default());
+
+    /* The same path name, in three volumes */
+    write_file(tfs_default(), "/f", 'A');
+    write_file(first, "/f", 'B');
+    assert(tfs_lookup_in(second, "/f") == -1);
+    check_file(tfs_default(), "/f", 'A');
+    check_file(first, "/f", 'B');
+    assert(get_free_memory(second) - get_free_memory(first) == SIZE);
+
+    /* Settings only apply to their own volume */
+    assert(tfs_set_compression_in(second, 1) != -1);
+    write_file(second, "/f", 'C');
+    assert(get_free_memory(second) > get_free_memory(first));
+    check_file(second, "/f", 'C');
+
+    /* Handles belong to the volume they were opened in */
+    int fd = tfs_open_in(first, "/f", 0);
+    assert(fd != -1);
+    assert(tfs_unmount(second) != -1);
+    check_file(first, "/f", 'B');
+    check_file(tfs_default(), "/f", 'A');
+    assert(tfs_get_file_size_in(first, fd) == SIZE);
+    assert(tfs_close_in(first, fd) != -1);
+    assert(tfs_unmount(first) != -1);
+
+    for (int i = 0; i < VOLUMES; i++) {
+        volumes[i] = tfs_mount();
+        assert(volumes[i] != NULL);
+        assert(pthread_create(&tid[i], NULL, fill_volume, volumes[i]) == 0);
+    }
+    for (int i = 0; i < VOLUMES; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+        assert(tfs_lookup_in(volumes[i], "/d") != -1);
+        assert(tfs_unmount(volumes[i]) != -1);
+    }
+
+    check_file(tfs_default(), "/f", 'A');
+    assert(tfs_destroy() != -1);
+
+    printf("\033[0;32m");
+    printf("Successful test\n");
+    printf("\033[0m");
+
+    return 0;
+}